@@ -0,0 +1,965 @@
+/*
+ * Headless benchmarks of the document code paths
+ *
+ * Generates synthetic corpora and times the work the editor does on them
+ * off the main loop: opening (the loader's worker, file_reader.c: encoding
+ * detection, character indexing, the parallel line table build and the
+ * word count), saving (the saver's worker, file_writer.c: the snapshot
+ * written to a temporary file, fsync, rename and the new file mapped back
+ * in), searching the document for a string and for
+ * every match of a regular expression, looking up lines and counting
+ * words (with the vectorized, threaded scanner and, for comparison, the
+ * way the Word Count dialog did before it: the whole text copied out,
+ * measured with g_utf8_strlen() and split with g_strsplit_set()), and
+ * evicting an edited document from memory and bringing it back, as the
+ * tabs do, checking that its text survives.
+ * None of this needs GTK, so no display is required.
+ *
+ * With --editor, the editor itself is also timed from start to the first
+ * page of a 100 MiB file on screen (see startup.h), which has to stay
+ * within the --first-paint-budget, to that whole file inserted into its
+ * buffer by the loader's idle callback, and, with an editor running, how
+ * long a second one takes to hand it the file and exit (--forward-budget).
+ * These cases need a display: without one the benchmark runs an Xvfb
+ * server for them, and fails if it can't.
+ *
+ * Each operation runs in a child process of its own, so the peak RSS it
+ * reports belongs to that operation and corpus alone. Results are printed
+ * as JSON:
+ *
+ *   make bench
+ *   ./text_editor_bench --max-size 64M --output results.json
+ *   ./text_editor_bench --max-size 0 --editor ./text_editor
+ */
+
+#include "piece_table.h"
+#include "line_table.h"
+#include "text_scan.h"
+#include "encoding.h"
+#include "regex_search.h"
+#include "file_reader.h"
+#include "file_writer.h"
+#include "compression.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define BENCH_MIN_TIME   (G_USEC_PER_SEC / 2)  // Keep repeating small cases this long
+#define BENCH_MAX_RUNS   200
+#define BENCH_SEED       20240601              // Corpora are the same on every machine
+#define BENCH_NEEDLE     "needle-missing-from-the-corpus"
+#define BENCH_REGEX      "\\berror (\\w+) (?:value|index)\\b"  // Typical of a log search
+#define BENCH_LOOKUPS    100000                // Line lookups per run of "lines"
+#define BENCH_EDIT       "A line typed in before the tab is evicted\n"
+#define BENCH_SPLIT_MAX_SIZE (128 << 20)       // Larger corpora split into too many strings
+#define BENCH_STARTUP_SIZE (100 << 20)         // File opened by the first-paint case
+#define BENCH_STARTUP_RUNS 5
+#define BENCH_LOAD_RUNS    1                   // Inserting all of it takes a while
+
+typedef enum {
+    CORPUS_ASCII,
+    CORPUS_UTF8,
+    CORPUS_LONG_LINES,
+    CORPUS_SHORT_LINES
+} CorpusKind;
+
+static const gchar *corpus_names[] = {
+    [CORPUS_ASCII]       = "ascii",
+    [CORPUS_UTF8]        = "utf8-heavy",
+    [CORPUS_LONG_LINES]  = "long-lines",
+    [CORPUS_SHORT_LINES] = "short-lines",
+};
+
+static const gsize corpus_sizes[] = {
+    1 << 20, 16 << 20, 128 << 20, 1 << 30
+};
+
+typedef enum {
+    OPERATION_OPEN,
+    OPERATION_SAVE,
+    OPERATION_FIND,
+    OPERATION_REGEX,
+    OPERATION_LINES,
+    OPERATION_WORDS,
+    OPERATION_WORDS_SPLIT,
+    OPERATION_EVICT
+} Operation;
+
+static const gchar *operation_names[] = {
+    [OPERATION_OPEN]  = "open",
+    [OPERATION_SAVE]  = "save",
+    [OPERATION_FIND]  = "find",
+    [OPERATION_REGEX] = "regex",
+    [OPERATION_LINES] = "lines",
+    [OPERATION_WORDS] = "words",
+    [OPERATION_WORDS_SPLIT] = "words-split",
+    [OPERATION_EVICT] = "evict",
+};
+
+typedef struct {
+    PieceTable *table;
+    LineTable *lines;
+    Encoding encoding;
+} BenchDocument;
+
+static gchar *bench_dir = NULL;
+static gchar *max_size_option = NULL;
+static gchar *output_filename = NULL;
+static gint min_runs = 5;
+static gchar *editor_path = NULL;
+static gint first_paint_budget = 500;
+static gint forward_budget = 100;
+
+static GOptionEntry options[] = {
+    { "dir", 'd', 0, G_OPTION_ARG_FILENAME, &bench_dir,
+      "Where corpora are generated (kept for later runs)", "DIR" },
+    { "max-size", 's', 0, G_OPTION_ARG_STRING, &max_size_option,
+      "Largest corpus, e.g. 64M (default 1G)", "SIZE" },
+    { "min-runs", 'r', 0, G_OPTION_ARG_INT, &min_runs,
+      "Runs per case at least (default 5)", "N" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_filename,
+      "Write the JSON here instead of standard output", "FILE" },
+    { "editor", 'e', 0, G_OPTION_ARG_FILENAME, &editor_path,
+      "Also time the first paint of this editor binary", "PATH" },
+    { "first-paint-budget", 'b', 0, G_OPTION_ARG_INT, &first_paint_budget,
+      "Milliseconds the first paint may take (default 500)", "MS" },
+    { "forward-budget", 0, 0, G_OPTION_ARG_INT, &forward_budget,
+      "Milliseconds handing a file to the running editor may take (default 100)", "MS" },
+    { NULL }
+};
+
+// Parse sizes like 512K, 64M or 1G
+static gsize parse_size(const gchar *text) {
+    gchar *end;
+    guint64 value = g_ascii_strtoull(text, &end, 10);
+
+    switch (g_ascii_toupper(*end)) {
+    case 'G':
+        value <<= 10;
+        /* fall through */
+    case 'M':
+        value <<= 10;
+        /* fall through */
+    case 'K':
+        value <<= 10;
+        break;
+    default:
+        break;
+    }
+    return (gsize)value;
+}
+
+// Append a word of the corpus kind to line
+static void corpus_add_word(GString *line, CorpusKind kind, GRand *rand) {
+    static const gchar *ascii_words[] = {
+        "the", "editor", "buffer", "line", "error", "request", "value", "index",
+        "piece", "table", "thread", "status", "x", "configuration", "at", "of"
+    };
+    static const gchar *utf8_words[] = {
+        "naïve", "café", "Größe", "тест", "данные", "日本語", "文字列", "ελληνικά",
+        "العربية", "😀", "ключ", "señal", "crème", "中文", "한국어", "ok"
+    };
+    const gchar **words = kind == CORPUS_UTF8 ? utf8_words : ascii_words;
+
+    g_string_append(line, words[g_rand_int_range(rand, 0, 16)]);
+}
+
+// Length in bytes of the next line of the corpus kind
+static gsize corpus_line_length(CorpusKind kind, GRand *rand) {
+    switch (kind) {
+    case CORPUS_LONG_LINES:
+        return g_rand_int_range(rand, 16 * 1024, 128 * 1024);
+    case CORPUS_SHORT_LINES:
+        return g_rand_int_range(rand, 0, 9);
+    default:
+        return g_rand_int_range(rand, 20, 120);
+    }
+}
+
+// Write size bytes of the corpus kind to filename, unless already there
+static gboolean corpus_generate(const gchar *filename, CorpusKind kind, gsize size,
+                                GError **error) {
+    GRand *rand;
+    GString *line;
+    FILE *file;
+    gsize written = 0;
+    struct stat st;
+
+    if (g_stat(filename, &st) == 0 && (gsize)st.st_size == size) {
+        return TRUE;
+    }
+
+    file = g_fopen(filename, "wb");
+    if (!file) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "Cannot create %s: %s", filename, g_strerror(errno));
+        return FALSE;
+    }
+
+    rand = g_rand_new_with_seed(BENCH_SEED + kind);
+    line = g_string_new(NULL);
+
+    while (written < size) {
+        gsize length = corpus_line_length(kind, rand);
+
+        g_string_truncate(line, 0);
+        while (line->len < length) {
+            if (line->len > 0) {
+                g_string_append_c(line, ' ');
+            }
+            corpus_add_word(line, kind, rand);
+        }
+        g_string_append_c(line, '\n');
+
+        // The corpus ends exactly at size, on a character boundary
+        if (written + line->len > size) {
+            gsize cut = size - written;
+
+            while (cut > 0 && ((guchar)line->str[cut] & 0xC0) == 0x80) {
+                cut--;
+            }
+            memset(line->str + cut, ' ', size - written - cut);
+            g_string_truncate(line, size - written);
+        }
+
+        fwrite(line->str, 1, line->len, file);
+        written += line->len;
+    }
+
+    g_string_free(line, TRUE);
+    g_rand_free(rand);
+
+    if (fclose(file) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "Cannot write %s: %s", filename, g_strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void document_close(BenchDocument *document) {
+    piece_table_free(document->table);
+    line_table_free(document->lines);
+    memset(document, 0, sizeof(*document));
+}
+
+// Open filename with the loader's worker, without a buffer to insert into
+static gboolean document_open(BenchDocument *document, const gchar *filename) {
+    GMappedFile *mapping = g_mapped_file_new(filename, FALSE, NULL);
+    FileReader reader = { 0 };
+    GError *error = NULL;
+    gboolean ok;
+
+    if (!mapping) {
+        return FALSE;
+    }
+    reader.source = g_mapped_file_get_bytes(mapping);
+    g_mapped_file_unref(mapping);
+
+    ok = file_reader_run(&reader, &error);
+    if (ok) {
+        document->table = g_steal_pointer(&reader.table);
+        document->lines = g_steal_pointer(&reader.lines);
+        document->encoding = reader.encoding;
+    } else {
+        fprintf(stderr, "Cannot read %s: %s\n", filename, error->message);
+        g_error_free(error);
+    }
+
+    file_reader_clear(&reader);
+    return ok;
+}
+
+// Save the document to filename with the saver's worker
+static gboolean document_save(BenchDocument *document, const gchar *filename) {
+    FileWriter writer = { 0 };
+    PieceTable *rebased;
+    GError *error = NULL;
+    gboolean ok;
+
+    writer.filename = filename;
+    writer.snapshot = piece_table_snapshot(document->table);
+    writer.encoding = document->encoding;
+    writer.compression = COMPRESSION_NONE;
+    writer.create_mode = 0600;
+
+    ok = file_writer_run(&writer, &rebased, &error);
+    if (ok) {
+        piece_table_free(rebased);
+    } else {
+        fprintf(stderr, "Cannot save %s: %s\n", filename, error->message);
+        g_error_free(error);
+    }
+
+    piece_snapshot_unref(writer.snapshot);
+    return ok;
+}
+
+// Search the whole document for a string it doesn't contain
+static gboolean document_find(BenchDocument *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document->table);
+    gssize found = piece_snapshot_find(snapshot, BENCH_NEEDLE, strlen(BENCH_NEEDLE), 0);
+
+    piece_snapshot_unref(snapshot);
+    return found < 0;
+}
+
+static gboolean count_matches(const RegexMatch *matches, guint n_matches,
+                              const gssize *groups, gpointer data) {
+    *(gsize *)data += n_matches;
+    return TRUE;
+}
+
+// Find every match of a regular expression, with its capture groups
+static gboolean document_regex(BenchDocument *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document->table);
+    GRegex *regex = regex_search_compile(BENCH_REGEX, 0, NULL);
+    gsize count = 0;
+    gboolean ok;
+
+    ok = regex_search_run(snapshot, regex, TRUE, NULL, count_matches, &count, NULL);
+
+    g_regex_unref(regex);
+    piece_snapshot_unref(snapshot);
+    return ok;
+}
+
+// Look up random lines and positions, as Go to Line and the cursor
+// position in the status bar do
+static gboolean document_lines(BenchDocument *document, GRand *rand) {
+    gsize count = line_table_get_line_count(document->lines);
+    gsize chars = line_table_get_char_count(document->lines);
+    gsize sum = 0;
+
+    for (guint i = 0; i < BENCH_LOOKUPS; i++) {
+        gsize line, column;
+
+        sum += line_table_get_line_start(document->lines, g_rand_int_range(rand, 0, count));
+        line_table_get_position(document->lines,
+                                (gsize)(g_rand_double(rand) * chars), &line, &column);
+        sum += line + column;
+    }
+
+    return sum > 0 || chars == 0;
+}
+
+// Count the words of the document, as the loader does once the text is read
+static gboolean document_words(BenchDocument *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document->table);
+    const Piece *pieces;
+    guint n_pieces;
+    gboolean in_word = FALSE;
+    gsize count = 0;
+
+    pieces = piece_snapshot_get_pieces(snapshot, &n_pieces);
+    for (guint i = 0; i < n_pieces; i++) {
+        count += text_scan_count_words(pieces[i].data, pieces[i].bytes, &in_word);
+    }
+
+    piece_snapshot_unref(snapshot);
+    return count > 0 || piece_table_get_length(document->table) == 0;
+}
+
+// The same as the Word Count dialog used to, but for getting the text from
+// the buffer: a copy of all of it, its characters counted, and split on
+// separators into strings, each of which is a word unless empty
+static gboolean document_words_split(BenchDocument *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document->table);
+    gsize length = piece_snapshot_get_length(snapshot);
+    gchar *text = g_malloc(length + 1);
+    gchar **words;
+    glong chars;
+    gsize count = 0;
+
+    piece_snapshot_copy(snapshot, 0, length, text);
+    text[length] = '\0';
+
+    chars = g_utf8_strlen(text, -1);
+
+    words = g_strsplit_set(text, " \t\n\r", -1);
+    for (guint i = 0; words[i] != NULL; i++) {
+        if (g_utf8_strlen(words[i], -1) > 0) {
+            count++;
+        }
+    }
+    g_strfreev(words);
+    g_free(text);
+
+    piece_snapshot_unref(snapshot);
+    return (count > 0 && chars > 0) || length == 0;
+}
+
+// Edit the document, then evict it and bring it back as the tabs do: the
+// text not in the file mapping taken, compressed and given back. Fails if
+// the text isn't the same afterwards.
+static gboolean document_evict(BenchDocument *document, GRand *rand) {
+    gsize chars = piece_table_get_char_count(document->table);
+    PieceSnapshot *before, *after;
+    const Piece *old_pieces, *new_pieces;
+    guint n_old, n_new;
+    GBytes *packed;
+    gchar *taken;
+    gsize length;
+    gboolean same;
+
+    piece_table_insert(document->table, (gsize)(g_rand_double(rand) * chars),
+                       BENCH_EDIT, strlen(BENCH_EDIT));
+
+    // Keeps the text as it was, since it holds on to the storage
+    before = piece_table_snapshot(document->table);
+
+    taken = piece_table_take_text(document->table, &length);
+    packed = compression_pack(taken, length, NULL);
+    g_free(taken);
+    if (!packed) {
+        piece_snapshot_unref(before);
+        return FALSE;
+    }
+
+    taken = g_malloc(MAX(length, 1));
+    if (!compression_unpack(packed, taken, length, NULL)) {
+        g_free(taken);
+        g_bytes_unref(packed);
+        piece_snapshot_unref(before);
+        return FALSE;
+    }
+    g_bytes_unref(packed);
+    piece_table_restore_text(document->table, taken, length);
+
+    after = piece_table_snapshot(document->table);
+    old_pieces = piece_snapshot_get_pieces(before, &n_old);
+    new_pieces = piece_snapshot_get_pieces(after, &n_new);
+
+    // Pieces of a mapped original point into the same mapping as before
+    same = n_old == n_new;
+    for (guint i = 0; same && i < n_new; i++) {
+        same = old_pieces[i].bytes == new_pieces[i].bytes &&
+               (old_pieces[i].data == new_pieces[i].data ||
+                memcmp(old_pieces[i].data, new_pieces[i].data, new_pieces[i].bytes) == 0);
+    }
+
+    piece_snapshot_unref(after);
+    piece_snapshot_unref(before);
+    return same;
+}
+
+static int compare_times(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted times
+static gint64 percentile(GArray *times, guint percent) {
+    guint rank = (times->len * percent + 99) / 100;
+
+    return g_array_index(times, gint64, MAX(rank, 1) - 1);
+}
+
+// Child process: run operation on the corpus and print one JSON object
+static int bench_run(Operation operation, const gchar *corpus, const gchar *kind, gsize size) {
+    GArray *times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GRand *rand = g_rand_new_with_seed(BENCH_SEED);
+    gchar *save_filename = g_build_filename(bench_dir, "save.out", NULL);
+    BenchDocument document = { 0 };
+    struct rusage usage;
+    gint64 total = 0, p50, p99;
+    gdouble seconds, mb_per_second;
+
+    if (operation != OPERATION_OPEN && !document_open(&document, corpus)) {
+        return 1;
+    }
+
+    while (times->len < (guint)min_runs ||
+           (total < BENCH_MIN_TIME && times->len < BENCH_MAX_RUNS)) {
+        gint64 start = g_get_monotonic_time(), elapsed;
+        gboolean ok;
+
+        switch (operation) {
+        case OPERATION_OPEN:
+            ok = document_open(&document, corpus);
+            break;
+        case OPERATION_SAVE:
+            ok = document_save(&document, save_filename);
+            break;
+        case OPERATION_FIND:
+            ok = document_find(&document);
+            break;
+        case OPERATION_REGEX:
+            ok = document_regex(&document);
+            break;
+        case OPERATION_WORDS:
+            ok = document_words(&document);
+            break;
+        case OPERATION_WORDS_SPLIT:
+            ok = document_words_split(&document);
+            break;
+        case OPERATION_EVICT:
+            ok = document_evict(&document, rand);
+            break;
+        default:
+            ok = document_lines(&document, rand);
+            break;
+        }
+
+        elapsed = g_get_monotonic_time() - start;
+        if (!ok) {
+            return 1;
+        }
+        if (operation == OPERATION_OPEN) {
+            document_close(&document);
+        }
+
+        g_array_append_val(times, elapsed);
+        total += elapsed;
+    }
+
+    g_array_sort(times, compare_times);
+    p50 = percentile(times, 50);
+    p99 = percentile(times, 99);
+    getrusage(RUSAGE_SELF, &usage);
+
+    // Line lookups don't depend on the size in bytes, so their rate is
+    // given in lookups per second instead
+    seconds = MAX(p50, 1) / (gdouble)G_USEC_PER_SEC;
+    mb_per_second = operation == OPERATION_LINES ? BENCH_LOOKUPS / seconds
+                                                 : size / seconds / (1024.0 * 1024.0);
+
+    printf("{\"operation\": \"%s\", \"corpus\": \"%s\", \"size\": %" G_GSIZE_FORMAT ", "
+           "\"runs\": %u, \"%s\": %.1f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+           "\"peak_rss_kb\": %ld}",
+           operation_names[operation], kind, size, times->len,
+           operation == OPERATION_LINES ? "lookups_per_s" : "throughput_mb_s", mb_per_second,
+           p50 / 1000.0, p99 / 1000.0, usage.ru_maxrss);
+    fflush(stdout);
+
+    g_unlink(save_filename);
+    return 0;
+}
+
+// Run one case in a child process, appending its JSON to results
+static gboolean bench_case(Operation operation, const gchar *corpus, const gchar *kind,
+                           gsize size, GString *results) {
+    int fds[2], status;
+    gchar buffer[1024];
+    gssize n;
+    pid_t pid;
+
+    if (pipe(fds) != 0) {
+        return FALSE;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return FALSE;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        _exit(bench_run(operation, corpus, kind, size));
+    }
+
+    close(fds[1]);
+    if (results->len > 0 && results->str[results->len - 1] == '}') {
+        g_string_append(results, ",\n    ");
+    }
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            g_string_append_len(results, buffer, n);
+        }
+    }
+    close(fds[0]);
+
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Total milliseconds of phase in the editor's --startup-profile output, or
+// -1 if it isn't there
+static gdouble parse_phase(const gchar *profile, const gchar *phase) {
+    gchar **lines = g_strsplit(profile, "\n", -1);
+    gsize length = strlen(phase);
+    gdouble ms = -1;
+
+    for (guint i = 0; lines[i]; i++) {
+        // Name, then the phase and total times, padded with spaces
+        if (strncmp(lines[i], phase, length) == 0 && lines[i][length] == ' ') {
+            gchar *end;
+
+            g_ascii_strtod(lines[i] + length, &end);
+            ms = g_ascii_strtod(end, NULL);
+            break;
+        }
+    }
+
+    g_strfreev(lines);
+    return ms;
+}
+
+// Append the times of operation on the startup corpus to results. Returns
+// FALSE if the median is over budget ms (0 for none).
+static gboolean bench_report(const gchar *operation, GArray *times, gint budget,
+                             GString *results) {
+    gint64 p50, p99;
+
+    g_array_sort(times, compare_times);
+    p50 = percentile(times, 50);
+    p99 = percentile(times, 99);
+
+    if (results->len > 0 && results->str[results->len - 1] == '}') {
+        g_string_append(results, ",\n    ");
+    }
+    g_string_append_printf(results, "{\"operation\": \"%s\", \"corpus\": \"%s\", "
+                           "\"size\": %d, \"runs\": %u, \"p50_ms\": %.3f, \"p99_ms\": %.3f",
+                           operation, corpus_names[CORPUS_ASCII], BENCH_STARTUP_SIZE, times->len,
+                           p50 / 1000.0, p99 / 1000.0);
+    if (budget > 0) {
+        g_string_append_printf(results, ", \"budget_ms\": %d", budget);
+    }
+    g_string_append(results, "}");
+
+    if (budget > 0 && p50 > (gint64)budget * 1000) {
+        fprintf(stderr, "%s took %.1f ms, over the budget of %d ms\n",
+                operation, p50 / 1000.0, budget);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Environment of the editors started: without a session to restore, which
+// would change what they show first, and without writing one
+static gchar **bench_editor_environ(void) {
+    return g_environ_setenv(g_get_environ(), "TEXT_EDITOR_SESSION", "0", TRUE);
+}
+
+// Start the editor on the corpus runs times, quitting with quit_option, and
+// report how long after its start it got to phase as operation. Fails if
+// the median is over budget ms (0 for none).
+static gboolean bench_editor_phase(const gchar *corpus, const gchar *quit_option,
+                                   const gchar *phase, guint runs, const gchar *operation,
+                                   gint budget, GString *results) {
+    gchar *argv[] = { editor_path, "--startup-profile", (gchar *)quit_option,
+                      (gchar *)corpus, NULL };
+    gchar **envp = bench_editor_environ();
+    GArray *times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gboolean ok = TRUE;
+
+    for (guint run = 0; run < runs && ok; run++) {
+        gchar *profile = NULL;
+        GError *error = NULL;
+        gint status;
+        gdouble ms;
+
+        if (!g_spawn_sync(NULL, argv, envp, G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL,
+                          NULL, &profile, &status, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            g_error_free(error);
+            ok = FALSE;
+            break;
+        }
+
+        ms = parse_phase(profile, phase);
+        if (ms < 0) {
+            // Also what happens when an editor already running takes the file
+            fprintf(stderr, "%s printed no %s time:\n%s", editor_path, phase, profile);
+            ok = FALSE;
+        } else {
+            gint64 usec = (gint64)(ms * 1000);
+
+            g_array_append_val(times, usec);
+        }
+        g_free(profile);
+    }
+    g_strfreev(envp);
+
+    if (!ok) {
+        g_array_unref(times);
+        return FALSE;
+    }
+
+    ok = bench_report(operation, times, budget, results);
+    g_array_unref(times);
+    return ok;
+}
+
+// Start the editor with no file and wait for its first frame: it is then
+// registered on the session bus. Returns its stderr to keep open.
+static gint bench_start_primary(GPid *pid) {
+    gchar *argv[] = { editor_path, "--startup-profile", NULL };
+    gchar **envp = bench_editor_environ();
+    GString *profile = g_string_new(NULL);
+    GError *error = NULL;
+    gchar buffer[256];
+    gboolean started;
+    gssize n;
+    gint fd;
+
+    started = g_spawn_async_with_pipes(NULL, argv, envp,
+                                       G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL,
+                                       NULL, NULL, pid, NULL, NULL, &fd, &error);
+    g_strfreev(envp);
+    if (!started) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_string_free(profile, TRUE);
+        return -1;
+    }
+
+    while (!strstr(profile->str, "first-frame ") &&
+           ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))) {
+        if (n > 0) {
+            g_string_append_len(profile, buffer, n);
+        }
+    }
+
+    // It forwarded to an editor running already, or failed
+    if (!strstr(profile->str, "first-frame ")) {
+        fprintf(stderr, "%s didn't start as the primary instance:\n%s", editor_path,
+                profile->str);
+        close(fd);
+        waitpid(*pid, NULL, 0);
+        g_spawn_close_pid(*pid);
+        fd = -1;
+    }
+
+    g_string_free(profile, TRUE);
+    return fd;
+}
+
+// With the editor running, time a second one handing it the corpus, from
+// the command to its exit, and fail if the median is over the budget
+static gboolean bench_forwarded(const gchar *corpus, GString *results) {
+    gchar *argv[] = { editor_path, "--startup-profile", (gchar *)corpus, NULL };
+    gchar **envp;
+    GArray *times;
+    gboolean ok = TRUE;
+    GPid pid;
+    gint fd;
+
+    fd = bench_start_primary(&pid);
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    envp = bench_editor_environ();
+    times = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    for (guint run = 0; run < BENCH_STARTUP_RUNS && ok; run++) {
+        gint64 start = g_get_monotonic_time(), elapsed;
+        gchar *profile = NULL;
+        GError *error = NULL;
+        gint status;
+
+        if (!g_spawn_sync(NULL, argv, envp, G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL,
+                          NULL, &profile, &status, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            g_error_free(error);
+            ok = FALSE;
+            break;
+        }
+        elapsed = g_get_monotonic_time() - start;
+
+        if (parse_phase(profile, "forwarded") < 0) {
+            fprintf(stderr, "%s didn't forward the file:\n%s", editor_path, profile);
+            ok = FALSE;
+        } else {
+            g_array_append_val(times, elapsed);
+        }
+        g_free(profile);
+    }
+
+    g_strfreev(envp);
+
+    // The primary has no changes to ask about
+    kill(pid, SIGTERM);
+    close(fd);
+    waitpid(pid, NULL, 0);
+    g_spawn_close_pid(pid);
+
+    if (ok) {
+        ok = bench_report("open-forwarded", times, forward_budget, results);
+    }
+    g_array_unref(times);
+    return ok;
+}
+
+// Start an Xvfb server on a free display and point DISPLAY at it, for the
+// editors started when there is no display. Returns its pid, or 0.
+static GPid bench_start_xvfb(void) {
+    gchar *xvfb = g_find_program_in_path("Xvfb");
+    gchar *argv[] = { xvfb, "-displayfd", "1", "-screen", "0", "1280x1024x24",
+                      "-nolisten", "tcp", NULL };
+    GError *error = NULL;
+    gchar buffer[32], *display;
+    gsize length = 0;
+    gssize n;
+    GPid pid;
+    gint fd;
+
+    if (!xvfb) {
+        fprintf(stderr, "No display, and no Xvfb to run one\n");
+        return 0;
+    }
+
+    if (!g_spawn_async_with_pipes(NULL, argv, NULL,
+                                  G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDERR_TO_DEV_NULL,
+                                  NULL, NULL, &pid, NULL, &fd, NULL, &error)) {
+        fprintf(stderr, "Cannot start %s: %s\n", xvfb, error->message);
+        g_error_free(error);
+        g_free(xvfb);
+        return 0;
+    }
+    g_free(xvfb);
+
+    // With -displayfd it writes the number of the display once it is ready
+    while (length < sizeof(buffer) - 1 && !memchr(buffer, '\n', length) &&
+           ((n = read(fd, buffer + length, sizeof(buffer) - 1 - length)) > 0 ||
+            (n < 0 && errno == EINTR))) {
+        length += MAX(n, 0);
+    }
+    close(fd);
+    buffer[length] = '\0';
+
+    if (!memchr(buffer, '\n', length)) {
+        fprintf(stderr, "Xvfb didn't start\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        g_spawn_close_pid(pid);
+        return 0;
+    }
+
+    display = g_strdup_printf(":%d", atoi(buffer));
+    g_setenv("DISPLAY", display, TRUE);
+    fprintf(stderr, "No display, running Xvfb on %s\n", display);
+    g_free(display);
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    GOptionContext *context;
+    GError *error = NULL;
+    GString *results;
+    gsize max_size = 1 << 30;
+    gboolean ok = TRUE;
+    FILE *output = stdout;
+
+    context = g_option_context_new("- benchmark opening, saving and searching documents");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (max_size_option) {
+        max_size = parse_size(max_size_option);
+    }
+    if (!bench_dir) {
+        bench_dir = g_build_filename(g_get_tmp_dir(), "text_editor_bench", NULL);
+    }
+    if (g_mkdir_with_parents(bench_dir, 0700) != 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", bench_dir, g_strerror(errno));
+        return 1;
+    }
+
+    results = g_string_new("    ");
+
+    for (guint s = 0; s < G_N_ELEMENTS(corpus_sizes) && corpus_sizes[s] <= max_size; s++) {
+        for (guint k = 0; k < G_N_ELEMENTS(corpus_names); k++) {
+            gchar *name = g_strdup_printf("%s-%" G_GSIZE_FORMAT ".txt", corpus_names[k],
+                                          corpus_sizes[s]);
+            gchar *corpus = g_build_filename(bench_dir, name, NULL);
+
+            gchar *size = g_format_size(corpus_sizes[s]);
+
+            fprintf(stderr, "%s, %s\n", corpus_names[k], size);
+            g_free(size);
+
+            if (!corpus_generate(corpus, k, corpus_sizes[s], &error)) {
+                fprintf(stderr, "%s\n", error->message);
+                g_clear_error(&error);
+                ok = FALSE;
+            } else {
+                for (guint o = 0; o < G_N_ELEMENTS(operation_names); o++) {
+                    if (o == OPERATION_WORDS_SPLIT && corpus_sizes[s] > BENCH_SPLIT_MAX_SIZE) {
+                        continue;
+                    }
+                    if (!bench_case(o, corpus, corpus_names[k], corpus_sizes[s], results)) {
+                        fprintf(stderr, "%s failed on %s\n", operation_names[o], name);
+                        ok = FALSE;
+                    }
+                }
+            }
+
+            g_free(corpus);
+            g_free(name);
+        }
+    }
+
+    // The editor opens its file on the first run, cold or not
+    if (editor_path) {
+        gchar *name = g_strdup_printf("%s-%d.txt", corpus_names[CORPUS_ASCII],
+                                      BENCH_STARTUP_SIZE);
+        gchar *corpus = g_build_filename(bench_dir, name, NULL);
+        GPid xvfb = 0;
+
+        if (!g_getenv("DISPLAY") && !g_getenv("WAYLAND_DISPLAY") &&
+            (xvfb = bench_start_xvfb()) == 0) {
+            fprintf(stderr, "first-paint, open-insert and open-forwarded can't run\n");
+            ok = FALSE;
+        } else if (!corpus_generate(corpus, CORPUS_ASCII, BENCH_STARTUP_SIZE, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            g_clear_error(&error);
+            ok = FALSE;
+        } else {
+            fprintf(stderr, "first-paint, %s\n", name);
+            ok = bench_editor_phase(corpus, "--quit-after-startup", "first-page",
+                                    BENCH_STARTUP_RUNS, "first-paint", first_paint_budget,
+                                    results) && ok;
+
+            // The real idle insertion into the buffer, which the headless
+            // open case leaves out
+            fprintf(stderr, "open-insert, %s\n", name);
+            ok = bench_editor_phase(corpus, "--quit-after-load", "loaded", BENCH_LOAD_RUNS,
+                                    "open-insert", 0, results) && ok;
+            fprintf(stderr, "open-forwarded, %s\n", name);
+            ok = bench_forwarded(corpus, results) && ok;
+        }
+
+        if (xvfb) {
+            kill(xvfb, SIGTERM);
+            waitpid(xvfb, NULL, 0);
+            g_spawn_close_pid(xvfb);
+        }
+        g_free(corpus);
+        g_free(name);
+    }
+
+    if (output_filename) {
+        output = g_fopen(output_filename, "w");
+        if (!output) {
+            fprintf(stderr, "Cannot create %s: %s\n", output_filename, g_strerror(errno));
+            return 1;
+        }
+    }
+
+    fprintf(output, "{\n  \"kernel\": \"%s\",\n  \"processors\": %u,\n  \"results\": [\n%s\n  ]\n}\n",
+            text_scan_get_kernel(), g_get_num_processors(), results->str);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    g_string_free(results, TRUE);
+    return ok ? 0 : 1;
+}
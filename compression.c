@@ -0,0 +1,301 @@
+/*
+ * Compressed file support
+ *
+ * A Compressor wraps either a GIO zlib converter (gzip) or a zstd stream
+ * behind one streaming call, so the loader and saver don't care which
+ * format they are dealing with.
+ */
+
+#include "compression.h"
+
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define GZIP_DEFAULT_LEVEL 6
+#define ZSTD_DEFAULT_LEVEL 3
+#define PACK_LEVEL         1              // Fastest: packing is done while the user waits
+#define PACK_OUTPUT_SIZE   (256 * 1024)   // Output produced per call when packing
+
+struct _Compressor {
+    CompressionType type;
+    gboolean compress;
+    GConverter *converter;      // gzip
+#ifdef HAVE_ZSTD
+    ZSTD_CStream *cstream;      // zstd compression
+    ZSTD_DStream *dstream;      // zstd decompression
+#endif
+};
+
+CompressionType compression_detect(const gchar *data, gsize length) {
+    if (length >= 2 && memcmp(data, "\x1F\x8B", 2) == 0) {
+        return COMPRESSION_GZIP;
+    }
+    if (length >= 4 && memcmp(data, "\x28\xB5\x2F\xFD", 4) == 0) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+CompressionType compression_detect_file(const gchar *filename) {
+    gchar magic[4];
+    gsize length;
+    FILE *file = fopen(filename, "rb");
+
+    if (!file) {
+        return COMPRESSION_NONE;
+    }
+
+    length = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return compression_detect(magic, length);
+}
+
+CompressionType compression_for_filename(const gchar *filename) {
+    if (g_str_has_suffix(filename, ".gz")) {
+        return COMPRESSION_GZIP;
+    }
+    if (g_str_has_suffix(filename, ".zst")) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+const gchar *compression_get_name(CompressionType type) {
+    switch (type) {
+    case COMPRESSION_GZIP:
+        return "gzip";
+    case COMPRESSION_ZSTD:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+gint compression_get_level(CompressionType type) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_COMPRESSION_LEVEL");
+    gint level = type == COMPRESSION_ZSTD ? ZSTD_DEFAULT_LEVEL : GZIP_DEFAULT_LEVEL;
+
+    if (setting && *setting) {
+        level = (gint)g_ascii_strtoll(setting, NULL, 10);
+    }
+
+    // gzip only has levels 1-9
+    if (type == COMPRESSION_GZIP) {
+        level = CLAMP(level, 1, 9);
+    }
+    return level;
+}
+
+Compressor *compressor_new(CompressionType type, gboolean compress, gint level, GError **error) {
+    Compressor *compressor = g_new0(Compressor, 1);
+
+    compressor->type = type;
+    compressor->compress = compress;
+
+    switch (type) {
+    case COMPRESSION_GZIP:
+        if (compress) {
+            compressor->converter = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, level));
+        } else {
+            compressor->converter = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+        }
+        return compressor;
+
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        if (compress) {
+            compressor->cstream = ZSTD_createCStream();
+            ZSTD_CCtx_setParameter(compressor->cstream, ZSTD_c_compressionLevel, level);
+        } else {
+            compressor->dstream = ZSTD_createDStream();
+        }
+        return compressor;
+#endif
+
+    default:
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "This build has no %s support", compression_get_name(type));
+        g_free(compressor);
+        return NULL;
+    }
+}
+
+void compressor_free(Compressor *compressor) {
+    if (!compressor) {
+        return;
+    }
+
+    if (compressor->converter) {
+        g_object_unref(compressor->converter);
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeCStream(compressor->cstream);
+    ZSTD_freeDStream(compressor->dstream);
+#endif
+    g_free(compressor);
+}
+
+static CompressorResult compressor_process_gzip(Compressor *compressor, const gchar *input,
+                                                gsize input_size, gchar *output,
+                                                gsize output_size, gboolean finish,
+                                                gsize *bytes_read, gsize *bytes_written,
+                                                GError **error) {
+    GConverterFlags flags = finish ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+    GError *local_error = NULL;
+    GConverterResult result;
+
+    result = g_converter_convert(compressor->converter, input, input_size, output, output_size,
+                                 flags, bytes_read, bytes_written, &local_error);
+
+    switch (result) {
+    case G_CONVERTER_ERROR:
+        *bytes_read = 0;
+        *bytes_written = 0;
+        if (!finish && g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT)) {
+            g_error_free(local_error);
+            return COMPRESSOR_CONTINUE;
+        }
+        g_propagate_prefixed_error(error, local_error, "gzip: ");
+        return COMPRESSOR_ERROR;
+
+    case G_CONVERTER_FINISHED:
+        // Another member may follow, as written by pigz or cat a.gz b.gz
+        if (!compressor->compress && *bytes_read < input_size) {
+            g_converter_reset(compressor->converter);
+            return COMPRESSOR_CONTINUE;
+        }
+        return finish ? COMPRESSOR_DONE : COMPRESSOR_CONTINUE;
+
+    default:
+        return COMPRESSOR_CONTINUE;
+    }
+}
+
+#ifdef HAVE_ZSTD
+static CompressorResult compressor_process_zstd(Compressor *compressor, const gchar *input,
+                                                gsize input_size, gchar *output,
+                                                gsize output_size, gboolean finish,
+                                                gsize *bytes_read, gsize *bytes_written,
+                                                GError **error) {
+    ZSTD_inBuffer in = { input, input_size, 0 };
+    ZSTD_outBuffer out = { output, output_size, 0 };
+    gsize result;
+
+    if (compressor->compress) {
+        result = ZSTD_compressStream2(compressor->cstream, &out, &in,
+                                      finish ? ZSTD_e_end : ZSTD_e_continue);
+    } else {
+        result = ZSTD_decompressStream(compressor->dstream, &out, &in);
+    }
+
+    *bytes_read = in.pos;
+    *bytes_written = out.pos;
+
+    if (ZSTD_isError(result)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "zstd: %s",
+                    ZSTD_getErrorName(result));
+        return COMPRESSOR_ERROR;
+    }
+
+    if (!finish || in.pos < in.size) {
+        return COMPRESSOR_CONTINUE;
+    }
+
+    // All input is in: done once nothing is left to flush (or to decode)
+    if (result == 0) {
+        return COMPRESSOR_DONE;
+    }
+    if (!compressor->compress && out.pos < out.size) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "zstd: Truncated input");
+        return COMPRESSOR_ERROR;
+    }
+    return COMPRESSOR_CONTINUE;
+}
+#endif
+
+CompressorResult compressor_process(Compressor *compressor, const gchar *input, gsize input_size,
+                                    gchar *output, gsize output_size, gboolean finish,
+                                    gsize *bytes_read, gsize *bytes_written, GError **error) {
+#ifdef HAVE_ZSTD
+    if (compressor->type == COMPRESSION_ZSTD) {
+        return compressor_process_zstd(compressor, input, input_size, output, output_size,
+                                       finish, bytes_read, bytes_written, error);
+    }
+#endif
+
+    return compressor_process_gzip(compressor, input, input_size, output, output_size,
+                                   finish, bytes_read, bytes_written, error);
+}
+
+// The best format this build has
+static CompressionType compression_get_pack_type(void) {
+#ifdef HAVE_ZSTD
+    return COMPRESSION_ZSTD;
+#else
+    return COMPRESSION_GZIP;
+#endif
+}
+
+GBytes *compression_pack(const gchar *data, gsize length, GError **error) {
+    Compressor *compressor = compressor_new(compression_get_pack_type(), TRUE, PACK_LEVEL, error);
+    GByteArray *packed;
+    CompressorResult result = COMPRESSOR_CONTINUE;
+
+    if (!compressor) {
+        return NULL;
+    }
+
+    packed = g_byte_array_sized_new(PACK_OUTPUT_SIZE);
+    while (result == COMPRESSOR_CONTINUE) {
+        gsize read, written, used = packed->len;
+
+        g_byte_array_set_size(packed, used + PACK_OUTPUT_SIZE);
+        result = compressor_process(compressor, data, length, (gchar *)packed->data + used,
+                                    PACK_OUTPUT_SIZE, TRUE, &read, &written, error);
+        g_byte_array_set_size(packed, used + written);
+        data += read;
+        length -= read;
+    }
+    compressor_free(compressor);
+
+    if (result == COMPRESSOR_ERROR) {
+        g_byte_array_unref(packed);
+        return NULL;
+    }
+    return g_bytes_new(packed->data, packed->len);
+}
+
+gboolean compression_unpack(GBytes *packed, gchar *output, gsize length, GError **error) {
+    Compressor *compressor = compressor_new(compression_get_pack_type(), FALSE, 0, error);
+    gsize input_left;
+    const gchar *input = g_bytes_get_data(packed, &input_left);
+    CompressorResult result = COMPRESSOR_CONTINUE;
+
+    if (!compressor) {
+        return FALSE;
+    }
+
+    while (result == COMPRESSOR_CONTINUE) {
+        gsize read, written;
+
+        result = compressor_process(compressor, input, input_left, output, length, TRUE,
+                                    &read, &written, error);
+        if (result == COMPRESSOR_CONTINUE && read == 0 && written == 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Packed data doesn't match its length");
+            result = COMPRESSOR_ERROR;
+        }
+        input += read;
+        input_left -= read;
+        output += written;
+        length -= written;
+    }
+    compressor_free(compressor);
+
+    return result == COMPRESSOR_DONE && length == 0;
+}
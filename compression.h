@@ -0,0 +1,67 @@
+/*
+ * Compressed file support
+ *
+ * gzip and zstd files are recognised by their magic bytes and streamed
+ * through a Compressor when loading and saving, so they are never
+ * decompressed to disk. gzip uses the zlib converters of GIO; zstd needs
+ * libzstd and is only available when built with HAVE_ZSTD.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <glib.h>
+
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+} CompressionType;
+
+typedef enum {
+    COMPRESSOR_ERROR,
+    COMPRESSOR_CONTINUE,    // More input or output space is needed
+    COMPRESSOR_DONE         // The stream is complete
+} CompressorResult;
+
+typedef struct _Compressor Compressor;
+
+// Compression format of data, from its first bytes
+CompressionType compression_detect(const gchar *data, gsize length);
+
+// Same for the start of a file (COMPRESSION_NONE if it can't be read)
+CompressionType compression_detect_file(const gchar *filename);
+
+// Format implied by the extension of filename (.gz, .zst)
+CompressionType compression_for_filename(const gchar *filename);
+
+// Name shown to the user ("gzip", "zstd")
+const gchar *compression_get_name(CompressionType type);
+
+// Level to compress with: TEXT_EDITOR_COMPRESSION_LEVEL if set, otherwise
+// the format's usual default
+gint compression_get_level(CompressionType type);
+
+// Create a streaming compressor, or a decompressor if compress is FALSE
+// (level is then ignored). Returns NULL with error set if the format isn't
+// supported by this build.
+Compressor *compressor_new(CompressionType type, gboolean compress, gint level, GError **error);
+void compressor_free(Compressor *compressor);
+
+// Consume input and produce up to output_size bytes of output; *bytes_read
+// and *bytes_written receive the amounts used. finish tells that input holds
+// everything that is left, so the end of the stream can be written (or, when
+// decompressing, that a truncated stream is an error). A decompressor reads
+// concatenated streams as one.
+CompressorResult compressor_process(Compressor *compressor, const gchar *input, gsize input_size,
+                                    gchar *output, gsize output_size, gboolean finish,
+                                    gsize *bytes_read, gsize *bytes_written, GError **error);
+
+// Compress data kept in memory in one go, quickly, with the best format of
+// this build. Returns NULL with error set if that fails.
+GBytes *compression_pack(const gchar *data, gsize length, GError **error);
+
+// Decompress what compression_pack() made of length bytes into output
+gboolean compression_unpack(GBytes *packed, gchar *output, gsize length, GError **error);
+
+#endif // COMPRESSION_H
@@ -0,0 +1,118 @@
+/*
+ * Shared editor state for the Advanced Text Editor
+ *
+ * The TextEditor structure is used by the main UI in text_editor.c and by
+ * the helper modules (file loading and saving, edit journal, large-file
+ * viewport, ...) that operate on the open document.
+ */
+
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <gtk/gtk.h>
+
+#include "piece_table.h"
+#include "line_table.h"
+#include "encoding.h"
+#include "compression.h"
+
+typedef struct _FileLoader FileLoader;
+typedef struct _FileSaver FileSaver;
+typedef struct _Journal Journal;
+typedef struct _Viewport Viewport;
+typedef struct _Follow Follow;
+typedef struct _Search Search;
+typedef struct _FindFiles FindFiles;
+typedef struct _StatusFields StatusFields;
+typedef struct _Undo Undo;
+typedef struct _Highlight Highlight;
+typedef struct _Tabs Tabs;
+typedef struct _Timings Timings;
+typedef struct _Session Session;
+typedef struct _Gutter Gutter;
+
+// Global application structure
+typedef struct {
+    GtkWidget *window;
+    GtkWidget *text_view;
+    GtkTextBuffer *text_buffer;     // View of document
+    PieceTable *document;
+    LineTable *lines;               // Line lengths of document
+    GtkWidget *scrolled_window;
+    GtkWidget *menu_bar;            // Menus filled in after the first frame
+    GtkAccelGroup *accel_group;
+    GtkWidget *viewport_scrollbar;  // Whole-file scrollbar of the large-file mode
+    gchar *current_filename;
+    gsize pending_line;             // Line + 1 to go to once the file is read, 0 for none
+    gsize pending_column;           // Column on that line
+    gsize pending_top;              // Line + 1 to scroll to the top of the view, 0 for none
+    GBytes *pending_edits;          // Unsaved edits of the last session to put back (session.c)
+    Encoding encoding;              // Encoding of the file on disk, restored on save
+    CompressionType compression;    // Likewise for gzip/zstd compression
+    guint64 follow_dropped;         // File bytes before the text, dropped while following
+    gsize follow_dropped_lines;     // Lines in them
+    gboolean modified;
+    gsize n_words;                  // Words in document, kept up to date with each edit
+    guint64 edit_generation;        // Bumped on every edit to the document
+    GtkCssProvider *css_provider;
+
+    // Status bar with load/save progress
+    GtkWidget *status_bar;
+    guint status_context_id;
+    GtkWidget *progress_bar;
+    GtkWidget *cancel_button;
+    StatusFields *status_fields;    // Position, counts, file details (status.c)
+
+    // Background file loader/saver, NULL when not running
+    FileLoader *loader;
+    FileSaver *saver;
+
+    // Write-ahead journal of edits, NULL if journaling is unavailable
+    Journal *journal;
+
+    // Read-only large-file mode, NULL when the buffer holds the document
+    Viewport *viewport;
+
+    // Follow mode for growing files, NULL when not following
+    Follow *follow;
+    GtkWidget *follow_item;
+
+    // Undo history, and the Edit menu items for it
+    Undo *undo;
+    GtkWidget *undo_item;
+    GtkWidget *redo_item;
+
+    // Syntax highlighting of the buffer
+    Highlight *highlight;
+
+    // Line numbers and markers beside the text (gutter.c)
+    Gutter *gutter;
+
+    // Open documents. The per-document fields above, from text_buffer to
+    // highlight, describe the tab in view; tabs.c keeps those of the others.
+    Tabs *tabs;
+
+    // Incremental search bar
+    Search *search;
+
+    // Find in Files window, NULL until first opened
+    FindFiles *find_files;
+
+    // Trace timings window and frame tracing (timings.c)
+    Timings *timings;
+
+    // Open documents saved for the next start, NULL if sessions are off
+    Session *session;
+} TextEditor;
+
+// Helpers shared between modules (text_editor.c)
+void editor_update_title(TextEditor *editor);
+void editor_set_status(TextEditor *editor, const gchar *message);
+void editor_show_error(TextEditor *editor, const gchar *format, ...) G_GNUC_PRINTF(2, 3);
+gboolean editor_prompt_save_changes(TextEditor *editor);
+void editor_open_file(TextEditor *editor, const gchar *filename, gsize line);
+void editor_goto_line(TextEditor *editor, gsize line);
+void editor_goto_pending(TextEditor *editor);
+void editor_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer);
+
+#endif // EDITOR_H
@@ -0,0 +1,287 @@
+/*
+ * Text encoding detection and conversion
+ *
+ * UTF-8 validation skips runs of plain ASCII with the vectorized scanner,
+ * which covers nearly all of a typical log or source file, and only hands
+ * the non-ASCII runs in between to g_utf8_validate(). An ASCII byte always
+ * starts a character, so each run can be validated on its own.
+ */
+
+#include "encoding.h"
+#include "text_scan.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define ENCODING_RUN_MAX    4096         // Longest non-ASCII run validated in one call
+#define ENCODING_SNIFF_SIZE (64 * 1024)  // Bytes examined for UTF-16 without a BOM
+#define ENCODING_REPAIR_RATIO 4          // Valid non-ASCII bytes per invalid one to stay UTF-8
+
+#define IS_CONTINUATION(c) (((guchar)(c) & 0xC0) == 0x80)
+
+typedef struct {
+    const gchar *charset;
+    const gchar *bom;
+    gsize bom_length;
+} EncodingInfo;
+
+static const EncodingInfo encodings[] = {
+    [ENCODING_UTF8]    = { "UTF-8",      "\xEF\xBB\xBF",     3 },
+    [ENCODING_UTF16LE] = { "UTF-16LE",   "\xFF\xFE",         2 },
+    [ENCODING_UTF16BE] = { "UTF-16BE",   "\xFE\xFF",         2 },
+    [ENCODING_UTF32LE] = { "UTF-32LE",   "\xFF\xFE\x00\x00", 4 },
+    [ENCODING_UTF32BE] = { "UTF-32BE",   "\x00\x00\xFE\xFF", 4 },
+    [ENCODING_LATIN1]  = { "ISO-8859-1", NULL,               0 },
+};
+
+gsize encoding_validate_utf8(const gchar *data, gsize length) {
+    gsize position = 0;
+
+    while (position < length) {
+        const gchar *invalid;
+        gsize end;
+
+        position += text_scan_ascii_length(data + position, length - position);
+        if (position == length || data[position] == '\0') {
+            break;
+        }
+
+        // The run ends at the next ASCII byte, or is cut before a lead byte
+        end = position + 1;
+        while (end < length && end - position < ENCODING_RUN_MAX && (guchar)data[end] >= 0x80) {
+            end++;
+        }
+        if (end < length && (guchar)data[end] >= 0x80) {
+            gsize cut = end;
+
+            while (cut > position && IS_CONTINUATION(data[cut])) {
+                cut--;
+            }
+            if (cut > position) {
+                end = cut;
+            }
+        }
+
+        if (!g_utf8_validate(data + position, end - position, &invalid)) {
+            return invalid - data;
+        }
+        position = end;
+    }
+
+    return position;
+}
+
+gsize encoding_utf8_complete_length(const gchar *buffer, gsize length) {
+    gsize i = length;
+    gsize back = 0;
+
+    while (i > 0 && back < 4) {
+        guchar c = (guchar)buffer[i - 1];
+        gsize needed;
+
+        i--;
+        back++;
+
+        if ((c & 0xC0) == 0x80) {
+            continue; // Continuation byte, keep looking for the lead byte
+        }
+
+        if (c < 0x80) {
+            needed = 1;
+        } else if ((c & 0xE0) == 0xC0) {
+            needed = 2;
+        } else if ((c & 0xF0) == 0xE0) {
+            needed = 3;
+        } else {
+            needed = 4;
+        }
+
+        return (back < needed) ? i : length;
+    }
+
+    return length;
+}
+
+gsize encoding_repair_utf8(const gchar *data, gsize length, gchar *output) {
+    static const gchar replacement[] = "\xEF\xBF\xBD";
+    gsize position = 0, written = 0;
+
+    while (position < length) {
+        gsize valid = encoding_validate_utf8(data + position, length - position);
+
+        if (output) {
+            memcpy(output + written, data + position, valid);
+        }
+        position += valid;
+        written += valid;
+
+        if (position < length) {
+            if (output) {
+                memcpy(output + written, replacement, 3);
+            }
+            position++;
+            written += 3;
+        }
+    }
+
+    return written;
+}
+
+// Count the bytes that aren't part of valid UTF-8 characters, and in
+// *valid the non-ASCII bytes that are
+static gsize encoding_count_invalid_utf8(const gchar *data, gsize length, gsize *valid) {
+    gsize position = 0, invalid = 0;
+
+    *valid = 0;
+    while (position < length) {
+        gsize end = position + encoding_validate_utf8(data + position, length - position);
+
+        while (position < end) {
+            position += text_scan_ascii_length(data + position, end - position);
+            while (position < end && (guchar)data[position] >= 0x80) {
+                (*valid)++;
+                position++;
+            }
+        }
+
+        if (position < length) {
+            invalid++;
+            position++;
+        }
+    }
+
+    return invalid;
+}
+
+// Guess UTF-16 without a BOM from zero high bytes of ASCII characters
+static gboolean encoding_sniff_utf16(const gchar *data, gsize length, EncodingType *type) {
+    gsize even = 0, odd = 0, pairs;
+
+    length = MIN(length, ENCODING_SNIFF_SIZE) & ~(gsize)1;
+    pairs = length / 2;
+    if (pairs < 2) {
+        return FALSE;
+    }
+
+    for (gsize i = 0; i < length; i += 2) {
+        even += data[i] == 0;
+        odd += data[i + 1] == 0;
+    }
+
+    if (odd > pairs * 4 / 10 && even <= pairs / 20) {
+        *type = ENCODING_UTF16LE;
+        return TRUE;
+    }
+    if (even > pairs * 4 / 10 && odd <= pairs / 20) {
+        *type = ENCODING_UTF16BE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+Encoding encoding_detect(const gchar *data, gsize length, gsize *bom_length) {
+    Encoding encoding = { ENCODING_UTF8, FALSE, FALSE };
+    gsize valid, invalid;
+    // UTF-32LE before UTF-16LE, whose BOM is a prefix of it
+    static const EncodingType with_bom[] = {
+        ENCODING_UTF8, ENCODING_UTF32LE, ENCODING_UTF32BE, ENCODING_UTF16LE, ENCODING_UTF16BE
+    };
+
+    *bom_length = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS(with_bom); i++) {
+        const EncodingInfo *info = &encodings[with_bom[i]];
+
+        if (length >= info->bom_length && memcmp(data, info->bom, info->bom_length) == 0) {
+            encoding.type = with_bom[i];
+            encoding.bom = TRUE;
+            *bom_length = info->bom_length;
+            // The mark says UTF-8, so stray bytes in it can only be replaced
+            if (encoding.type == ENCODING_UTF8) {
+                encoding.repaired = encoding_validate_utf8(data + info->bom_length,
+                                                           length - info->bom_length) !=
+                                    length - info->bom_length;
+            }
+            return encoding;
+        }
+    }
+
+    if (encoding_validate_utf8(data, length) == length) {
+        return encoding;
+    }
+
+    if (encoding_sniff_utf16(data, length, &encoding.type)) {
+        return encoding;
+    }
+
+    // A few stray bytes in UTF-8 text are replaced. Without UTF-8 characters
+    // to go by, ISO-8859-1 reads any byte and saves it back unchanged.
+    invalid = encoding_count_invalid_utf8(data, length, &valid);
+    if (valid > 0 && invalid * ENCODING_REPAIR_RATIO <= valid) {
+        encoding.repaired = TRUE;
+    } else {
+        encoding.type = ENCODING_LATIN1;
+    }
+    return encoding;
+}
+
+gboolean encoding_is_utf8(Encoding encoding) {
+    return encoding.type == ENCODING_UTF8;
+}
+
+const gchar *encoding_get_charset(Encoding encoding) {
+    return encodings[encoding.type].charset;
+}
+
+const gchar *encoding_get_bom(Encoding encoding, gsize *length) {
+    if (!encoding.bom) {
+        *length = 0;
+        return NULL;
+    }
+
+    *length = encodings[encoding.type].bom_length;
+    return encodings[encoding.type].bom;
+}
+
+gsize encoding_get_max_utf8_length(Encoding encoding, gsize length) {
+    if (encoding.repaired) {
+        return length * 3;          // Each invalid byte becomes U+FFFD
+    }
+
+    switch (encoding.type) {
+    case ENCODING_LATIN1:
+        return length * 2;          // 0x80-0xFF take two bytes
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16BE:
+        return length / 2 * 3 + 3;  // BMP characters take up to three
+    default:
+        return length;
+    }
+}
+
+gboolean encoding_convert(GIConv converter, const gchar **input, gsize *input_left,
+                          gchar **output, gsize *output_left, GError **error) {
+    while (*input_left > 0) {
+        gsize result = g_iconv(converter, (gchar **)input, input_left, output, output_left);
+
+        if (result != (gsize)-1) {
+            continue;
+        }
+
+        switch (errno) {
+        case EINVAL:    // Incomplete character at the end of the input
+        case E2BIG:     // Output full
+            return TRUE;
+        case EILSEQ:
+            g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE,
+                        "Invalid byte sequence in conversion input");
+            return FALSE;
+        default:
+            g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_FAILED,
+                        "Conversion failed: %s", g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
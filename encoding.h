@@ -0,0 +1,68 @@
+/*
+ * Text encoding detection and conversion
+ *
+ * Files are detected as UTF-8 (the common case, used as is), UTF-16 or
+ * UTF-32 (from a byte order mark, or the pattern of zero bytes for UTF-16
+ * without one) or, failing all that, ISO-8859-1. A file that is mostly
+ * valid UTF-8 stays UTF-8 and only its stray invalid bytes are replaced
+ * with U+FFFD, rather than turning every other non-ASCII character into
+ * mojibake. Other encodings are converted to UTF-8 for editing and back
+ * when saving, and a byte order mark is written back if the file had one.
+ */
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <glib.h>
+
+typedef enum {
+    ENCODING_UTF8,
+    ENCODING_UTF16LE,
+    ENCODING_UTF16BE,
+    ENCODING_UTF32LE,
+    ENCODING_UTF32BE,
+    ENCODING_LATIN1
+} EncodingType;
+
+typedef struct {
+    EncodingType type;
+    gboolean bom;       // The file starts with a byte order mark
+    gboolean repaired;  // UTF-8 with invalid bytes, replaced with U+FFFD
+} Encoding;
+
+// Length of the valid UTF-8 prefix of data (length if it is all valid).
+// NUL bytes are treated as invalid since the text buffer can't hold them.
+gsize encoding_validate_utf8(const gchar *data, gsize length);
+
+// Length of the longest prefix of buffer that doesn't end in the middle of a
+// multi-byte UTF-8 sequence. The remainder is carried into the next chunk.
+gsize encoding_utf8_complete_length(const gchar *buffer, gsize length);
+
+// Copy data to output with each byte that isn't part of a valid UTF-8
+// character (NULs included) replaced with U+FFFD, as g_utf8_make_valid()
+// does. Returns the length of the result; with output NULL, only that.
+gsize encoding_repair_utf8(const gchar *data, gsize length, gchar *output);
+
+// Detect the encoding of a whole file. *bom_length receives the size of the
+// byte order mark to skip.
+Encoding encoding_detect(const gchar *data, gsize length, gsize *bom_length);
+
+// Whether text in this encoding can be used without conversion
+gboolean encoding_is_utf8(Encoding encoding);
+
+// Charset name for g_iconv_open()
+const gchar *encoding_get_charset(Encoding encoding);
+
+// Byte order mark to write when saving (NULL/0 if none)
+const gchar *encoding_get_bom(Encoding encoding, gsize *length);
+
+// Upper bound of the UTF-8 size of length bytes in this encoding
+gsize encoding_get_max_utf8_length(Encoding encoding, gsize length);
+
+// Convert as much of *input as possible into *output, advancing both. An
+// incomplete character at the end of the input is left for the next call.
+// Returns FALSE with error set on input that can't be converted.
+gboolean encoding_convert(GIConv converter, const gchar **input, gsize *input_left,
+                          gchar **output, gsize *output_left, GError **error);
+
+#endif // ENCODING_H
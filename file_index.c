@@ -0,0 +1,1051 @@
+/*
+ * Persistent trigram index of a directory tree
+ *
+ * Files get increasing ids, and each trigram maps to a posting list of the
+ * ids of the files that contain it, stored as varint deltas. A file that
+ * changes is not edited in place: its id is marked dead and it is indexed
+ * again under a new id, so posting lists only ever grow at the end. Once
+ * dead ids make up a quarter of the index it is compacted.
+ *
+ * Only the refresh thread modifies the index, under the write side of
+ * lock; queries take the read side. Watch events arrive on the main thread
+ * and only touch the changes, under changes_lock. Files too large to index
+ * are listed with a flag and always searched; binary files never are.
+ */
+
+#include "file_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+
+#define FILE_INDEX_MAGIC         "TEFIDX01"
+#define FILE_INDEX_MAX_FILE_SIZE (16 * 1024 * 1024)  // Larger files are searched, not indexed
+#define FILE_INDEX_BINARY_PROBE  8192                // Bytes looked at for a NUL
+#define FILE_INDEX_BATCH         256                 // Files indexed per write lock
+#define FILE_INDEX_REFRESH_DELAY 2000                // Milliseconds after a change
+#define FILE_INDEX_WATCH_MASK    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | \
+                                  IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+enum {
+    FILE_INDEX_DEAD      = 1 << 0,  // Removed, or indexed again under another id
+    FILE_INDEX_UNINDEXED = 1 << 1,  // Too large to index, always a candidate
+    FILE_INDEX_BINARY    = 1 << 2   // Never a candidate
+};
+
+typedef struct {
+    gchar *path;            // Relative to the root
+    gint64 mtime;           // Microseconds
+    guint64 size;
+    guint32 flags;
+} IndexedFile;
+
+typedef struct {
+    GByteArray *ids;        // Varint deltas of increasing file ids
+    guint32 last;           // Last id added
+} Posting;
+
+// A file to index, read off the lock
+typedef struct {
+    gchar *path;
+    gint64 mtime;
+    guint64 size;
+    guint32 flags;
+    GArray *trigrams;       // guint32, distinct
+} IndexUpdate;
+
+struct _FileIndex {
+    gchar *root;
+    gchar *cache_path;
+
+    // Modified by the refresh thread only, under the write lock
+    GRWLock lock;
+    GArray *files;          // IndexedFile by id
+    GHashTable *by_path;    // Relative path -> id + 1, for live files
+    GHashTable *postings;   // Trigram + 1 -> Posting
+    guint n_dead;
+    gint ready;             // Atomic: up to date and watched
+
+    // Protected by changes_lock
+    GMutex changes_lock;
+    GHashTable *changed;    // Relative paths changed since they were indexed
+    GHashTable *refreshing; // Those being indexed again right now
+    GHashTable *watches;    // inotify watch -> relative directory
+    gboolean full_refresh;  // Walk the whole tree on the next refresh
+    gboolean watch_failed;  // Out of inotify watches: the index can't be trusted
+    guint done_id;
+
+    int inotify_fd;
+    guint inotify_id;
+    GThread *thread;        // Running refresh
+    gint cancelled;         // Atomic
+    gboolean refresh_again; // Changes came in while refreshing
+    guint refresh_id;
+    guint64 *seen;          // Trigram bitmap of the refresh thread
+};
+
+typedef void (*FileIndexWalkFunc)(const gchar *relative, const gchar *path,
+                                  const struct stat *st, gpointer data);
+
+static void file_index_schedule_refresh(FileIndex *index);
+
+static void indexed_file_clear(gpointer data) {
+    g_free(((IndexedFile *)data)->path);
+}
+
+static void posting_free(gpointer data) {
+    Posting *posting = (Posting *)data;
+
+    g_byte_array_free(posting->ids, TRUE);
+    g_free(posting);
+}
+
+static GHashTable *file_index_new_postings(void) {
+    return g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, posting_free);
+}
+
+static GArray *file_index_new_files(void) {
+    GArray *files = g_array_new(FALSE, FALSE, sizeof(IndexedFile));
+
+    g_array_set_clear_func(files, indexed_file_clear);
+    return files;
+}
+
+static gint64 file_index_mtime(const struct stat *st) {
+    return (gint64)st->st_mtim.tv_sec * G_USEC_PER_SEC + st->st_mtim.tv_nsec / 1000;
+}
+
+gboolean file_index_is_binary(const gchar *data, gsize length) {
+    return memchr(data, '\0', MIN(length, FILE_INDEX_BINARY_PROBE)) != NULL;
+}
+
+// Visit the directories and regular files under root, breadth first.
+// dir_func (optional) sees each directory before its entries are read.
+static void file_index_walk(const gchar *root, const gint *cancelled, FileIndexWalkFunc file_func,
+                            FileIndexWalkFunc dir_func, gpointer data) {
+    GQueue pending = G_QUEUE_INIT;
+    gchar *relative;
+
+    g_queue_push_tail(&pending, g_strdup(""));
+
+    while ((relative = g_queue_pop_head(&pending))) {
+        gchar *dir_path = g_build_filename(root, relative, NULL);
+        const gchar *name;
+        GDir *dir;
+
+        if (dir_func) {
+            dir_func(relative, dir_path, NULL, data);
+        }
+
+        dir = g_dir_open(dir_path, 0, NULL);
+        while (dir && (name = g_dir_read_name(dir)) &&
+               !(cancelled && g_atomic_int_get(cancelled))) {
+            gchar *child, *path;
+            struct stat st;
+
+            if (name[0] == '.') {
+                continue;
+            }
+
+            child = *relative ? g_build_filename(relative, name, NULL) : g_strdup(name);
+            path = g_build_filename(root, child, NULL);
+
+            if (lstat(path, &st) != 0) {
+                // Gone since the directory was read
+            } else if (S_ISDIR(st.st_mode)) {
+                g_queue_push_tail(&pending, child);
+                child = NULL;
+            } else if (S_ISREG(st.st_mode)) {
+                file_func(child, path, &st, data);
+            }
+
+            g_free(path);
+            g_free(child);
+        }
+
+        if (dir) {
+            g_dir_close(dir);
+        }
+        g_free(dir_path);
+        g_free(relative);
+    }
+
+    g_queue_clear_full(&pending, g_free);
+}
+
+static void file_index_collect_path(const gchar *relative, const gchar *path,
+                                    const struct stat *st, gpointer data) {
+    g_ptr_array_add((GPtrArray *)data, g_strdup(path));
+}
+
+GPtrArray *file_index_list_files(const gchar *root, const gint *cancelled) {
+    GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+
+    file_index_walk(root, cancelled, file_index_collect_path, NULL, files);
+    return files;
+}
+
+// ============================================
+// Posting lists
+// ============================================
+
+static void posting_append(Posting *posting, guint32 id) {
+    guint32 delta = id - posting->last;
+    guint8 bytes[5];
+    guint n = 0;
+
+    while (delta >= 0x80) {
+        bytes[n++] = (guint8)(delta | 0x80);
+        delta >>= 7;
+    }
+    bytes[n++] = (guint8)delta;
+
+    g_byte_array_append(posting->ids, bytes, n);
+    posting->last = id;
+}
+
+// Decode the next id of a posting list, returning FALSE at its end
+static gboolean posting_next(const guint8 **p, const guint8 *end, guint32 *id) {
+    guint32 delta = 0;
+    guint shift = 0;
+
+    while (*p < end) {
+        guint8 byte = *(*p)++;
+
+        delta |= (guint32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *id += delta;
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+// Keep only the ids, sorted, that are also in posting
+static void posting_intersect(GArray *ids, const Posting *posting) {
+    const guint8 *p = posting->ids->data, *end = p + posting->ids->len;
+    guint32 *values = (guint32 *)(void *)ids->data;
+    guint32 id = 0;
+    guint kept = 0, i = 0;
+    gboolean more = posting_next(&p, end, &id);
+
+    while (more && i < ids->len) {
+        if (values[i] < id) {
+            i++;
+        } else if (values[i] > id) {
+            more = posting_next(&p, end, &id);
+        } else {
+            values[kept++] = values[i++];
+            more = posting_next(&p, end, &id);
+        }
+    }
+    g_array_set_size(ids, kept);
+}
+
+// Add a file under the next id (write lock held)
+static void file_index_add_locked(FileIndex *index, IndexUpdate *update) {
+    guint32 id = index->files->len;
+    IndexedFile file = { update->path, update->mtime, update->size, update->flags };
+    gpointer old;
+
+    if (g_hash_table_lookup_extended(index->by_path, update->path, NULL, &old)) {
+        g_array_index(index->files, IndexedFile, GPOINTER_TO_UINT(old) - 1).flags |= FILE_INDEX_DEAD;
+        index->n_dead++;
+    }
+
+    g_array_append_val(index->files, file);
+    g_hash_table_replace(index->by_path, update->path, GUINT_TO_POINTER(id + 1));
+    update->path = NULL;
+
+    for (guint i = 0; update->trigrams && i < update->trigrams->len; i++) {
+        guint32 trigram = g_array_index(update->trigrams, guint32, i);
+        Posting *posting = g_hash_table_lookup(index->postings, GUINT_TO_POINTER(trigram + 1));
+
+        if (!posting) {
+            posting = g_new0(Posting, 1);
+            posting->ids = g_byte_array_new();
+            g_hash_table_insert(index->postings, GUINT_TO_POINTER(trigram + 1), posting);
+        }
+        posting_append(posting, id);
+    }
+}
+
+// Mark a file as gone (write lock held)
+static void file_index_remove_locked(FileIndex *index, const gchar *path) {
+    gpointer id;
+
+    if (g_hash_table_lookup_extended(index->by_path, path, NULL, &id)) {
+        g_array_index(index->files, IndexedFile, GPOINTER_TO_UINT(id) - 1).flags |= FILE_INDEX_DEAD;
+        g_hash_table_remove(index->by_path, path);
+        index->n_dead++;
+    }
+}
+
+// ============================================
+// Refreshing
+// ============================================
+
+// Read a file's trigrams, or flag why it has none
+static void file_index_read(FileIndex *index, const gchar *path, IndexUpdate *update) {
+    GMappedFile *mapping;
+    const guchar *data;
+    gsize length;
+
+    if (update->size > FILE_INDEX_MAX_FILE_SIZE) {
+        update->flags = FILE_INDEX_UNINDEXED;
+        return;
+    }
+
+    mapping = g_mapped_file_new(path, FALSE, NULL);
+    if (!mapping) {
+        update->flags = FILE_INDEX_UNINDEXED;
+        return;
+    }
+
+    data = (const guchar *)g_mapped_file_get_contents(mapping);
+    length = g_mapped_file_get_length(mapping);
+
+    if (length > 0 && file_index_is_binary((const gchar *)data, length)) {
+        update->flags = FILE_INDEX_BINARY;
+    } else if (length >= 3) {
+        guint32 trigram = (data[0] << 8) | data[1];
+
+        // Distinct trigrams through a bitmap, cleared again afterwards
+        update->trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+        for (gsize i = 2; i < length; i++) {
+            trigram = ((trigram << 8) | data[i]) & 0xFFFFFF;
+            if (!(index->seen[trigram >> 6] & (G_GUINT64_CONSTANT(1) << (trigram & 63)))) {
+                index->seen[trigram >> 6] |= G_GUINT64_CONSTANT(1) << (trigram & 63);
+                g_array_append_val(update->trigrams, trigram);
+            }
+        }
+        for (guint i = 0; i < update->trigrams->len; i++) {
+            trigram = g_array_index(update->trigrams, guint32, i);
+            index->seen[trigram >> 6] = 0;
+        }
+    }
+
+    g_mapped_file_unref(mapping);
+}
+
+// Read the files in updates and add them to the index a batch at a time
+static gboolean file_index_apply(FileIndex *index, GArray *updates) {
+    for (guint start = 0; start < updates->len; start += FILE_INDEX_BATCH) {
+        guint end = MIN(updates->len, start + FILE_INDEX_BATCH);
+
+        for (guint i = start; i < end; i++) {
+            IndexUpdate *update = &g_array_index(updates, IndexUpdate, i);
+            gchar *path = g_build_filename(index->root, update->path, NULL);
+
+            file_index_read(index, path, update);
+            g_free(path);
+        }
+
+        if (g_atomic_int_get(&index->cancelled)) {
+            return FALSE;
+        }
+
+        g_rw_lock_writer_lock(&index->lock);
+        for (guint i = start; i < end; i++) {
+            file_index_add_locked(index, &g_array_index(updates, IndexUpdate, i));
+        }
+        g_rw_lock_writer_unlock(&index->lock);
+    }
+    return TRUE;
+}
+
+static void index_update_clear(gpointer data) {
+    IndexUpdate *update = (IndexUpdate *)data;
+
+    g_free(update->path);
+    if (update->trigrams) {
+        g_array_free(update->trigrams, TRUE);
+    }
+}
+
+// Whether the file at relative path needs indexing, judging by st
+static gboolean file_index_is_stale(FileIndex *index, const gchar *relative, const struct stat *st) {
+    gpointer id;
+    const IndexedFile *file;
+
+    if (!g_hash_table_lookup_extended(index->by_path, relative, NULL, &id)) {
+        return TRUE;
+    }
+    file = &g_array_index(index->files, IndexedFile, GPOINTER_TO_UINT(id) - 1);
+    return file->size != (guint64)st->st_size || file->mtime != file_index_mtime(st);
+}
+
+typedef struct {
+    FileIndex *index;
+    GArray *updates;        // IndexUpdate
+    GHashTable *present;    // Relative paths found by the walk
+} FileIndexScan;
+
+static void file_index_scan_file(const gchar *relative, const gchar *path,
+                                 const struct stat *st, gpointer data) {
+    FileIndexScan *scan = (FileIndexScan *)data;
+
+    g_hash_table_add(scan->present, g_strdup(relative));
+
+    if (file_index_is_stale(scan->index, relative, st)) {
+        IndexUpdate update = { g_strdup(relative), file_index_mtime(st), st->st_size, 0, NULL };
+
+        g_array_append_val(scan->updates, update);
+    }
+}
+
+// Watch each directory before it is read, so no change is missed
+static void file_index_scan_dir(const gchar *relative, const gchar *path,
+                                const struct stat *st, gpointer data) {
+    FileIndex *index = ((FileIndexScan *)data)->index;
+    int wd;
+
+    if (index->inotify_fd < 0) {
+        return;
+    }
+
+    wd = inotify_add_watch(index->inotify_fd, path, FILE_INDEX_WATCH_MASK);
+
+    g_mutex_lock(&index->changes_lock);
+    if (wd < 0) {
+        index->watch_failed = TRUE;
+    } else {
+        g_hash_table_replace(index->watches, GINT_TO_POINTER(wd), g_strdup(relative));
+    }
+    g_mutex_unlock(&index->changes_lock);
+}
+
+// Walk the whole tree, indexing new and changed files and dropping the
+// ones that are gone
+static gboolean file_index_refresh_all(FileIndex *index, gboolean *modified) {
+    FileIndexScan scan;
+    GPtrArray *gone = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer path;
+    gboolean ok;
+
+    scan.index = index;
+    scan.updates = g_array_new(FALSE, FALSE, sizeof(IndexUpdate));
+    g_array_set_clear_func(scan.updates, index_update_clear);
+    scan.present = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    file_index_walk(index->root, &index->cancelled, file_index_scan_file, file_index_scan_dir,
+                    &scan);
+
+    ok = !g_atomic_int_get(&index->cancelled);
+    if (ok) {
+        g_hash_table_iter_init(&iter, index->by_path);
+        while (g_hash_table_iter_next(&iter, &path, NULL)) {
+            if (!g_hash_table_contains(scan.present, path)) {
+                g_ptr_array_add(gone, path);
+            }
+        }
+
+        g_rw_lock_writer_lock(&index->lock);
+        for (guint i = 0; i < gone->len; i++) {
+            file_index_remove_locked(index, gone->pdata[i]);
+        }
+        g_rw_lock_writer_unlock(&index->lock);
+
+        ok = file_index_apply(index, scan.updates);
+        *modified = gone->len > 0 || scan.updates->len > 0;
+    }
+
+    g_ptr_array_free(gone, TRUE);
+    g_array_free(scan.updates, TRUE);
+    g_hash_table_unref(scan.present);
+    return ok;
+}
+
+// Check only the files reported as changed
+static gboolean file_index_refresh_changed(FileIndex *index, GHashTable *changed,
+                                           gboolean *modified) {
+    GArray *updates = g_array_new(FALSE, FALSE, sizeof(IndexUpdate));
+    GHashTableIter iter;
+    gpointer relative;
+    gboolean ok;
+
+    g_array_set_clear_func(updates, index_update_clear);
+
+    g_hash_table_iter_init(&iter, changed);
+    while (g_hash_table_iter_next(&iter, &relative, NULL)) {
+        gchar *path = g_build_filename(index->root, (const gchar *)relative, NULL);
+        struct stat st;
+
+        if (lstat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (file_index_is_stale(index, relative, &st)) {
+                IndexUpdate update = { g_strdup(relative), file_index_mtime(&st), st.st_size, 0, NULL };
+
+                g_array_append_val(updates, update);
+            }
+        } else if (g_hash_table_contains(index->by_path, relative)) {
+            g_rw_lock_writer_lock(&index->lock);
+            file_index_remove_locked(index, relative);
+            g_rw_lock_writer_unlock(&index->lock);
+            *modified = TRUE;
+        }
+        g_free(path);
+    }
+
+    ok = file_index_apply(index, updates);
+    *modified = *modified || updates->len > 0;
+    g_array_free(updates, TRUE);
+    return ok;
+}
+
+// Drop the dead files, renumbering the others
+static void file_index_compact(FileIndex *index) {
+    GArray *files = file_index_new_files();
+    GHashTable *by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *postings = file_index_new_postings();
+    guint32 *renumber = g_new(guint32, index->files->len);
+    GHashTableIter iter;
+    gpointer key, value;
+    GArray *old_files;
+    GHashTable *old_by_path, *old_postings;
+
+    for (guint i = 0; i < index->files->len; i++) {
+        IndexedFile *file = &g_array_index(index->files, IndexedFile, i);
+
+        if (file->flags & FILE_INDEX_DEAD) {
+            renumber[i] = G_MAXUINT32;
+            continue;
+        }
+
+        renumber[i] = files->len;
+        g_array_append_val(files, *file);
+        g_hash_table_insert(by_path, file->path, GUINT_TO_POINTER(files->len));
+        file->path = NULL;
+    }
+
+    g_hash_table_iter_init(&iter, index->postings);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const Posting *old = (const Posting *)value;
+        const guint8 *p = old->ids->data, *end = p + old->ids->len;
+        Posting *posting = NULL;
+        guint32 id = 0;
+
+        while (posting_next(&p, end, &id)) {
+            if (renumber[id] == G_MAXUINT32) {
+                continue;
+            }
+            if (!posting) {
+                posting = g_new0(Posting, 1);
+                posting->ids = g_byte_array_new();
+                g_hash_table_insert(postings, key, posting);
+            }
+            posting_append(posting, renumber[id]);
+        }
+    }
+
+    g_rw_lock_writer_lock(&index->lock);
+    old_files = index->files;
+    old_by_path = index->by_path;
+    old_postings = index->postings;
+    index->files = files;
+    index->by_path = by_path;
+    index->postings = postings;
+    index->n_dead = 0;
+    g_rw_lock_writer_unlock(&index->lock);
+
+    g_array_free(old_files, TRUE);
+    g_hash_table_unref(old_by_path);
+    g_hash_table_unref(old_postings);
+    g_free(renumber);
+}
+
+// ============================================
+// Saving and loading
+// ============================================
+
+static gchar *file_index_cache_path(const gchar *root) {
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, root, -1);
+    gchar *name = g_strconcat(hash, ".index", NULL);
+    gchar *path = g_build_filename(g_get_user_cache_dir(), "text_editor", "index", name, NULL);
+
+    g_free(name);
+    g_free(hash);
+    return path;
+}
+
+// Write the index to the cache, replacing the old copy only once complete
+static void file_index_save(FileIndex *index) {
+    gchar *dir = g_path_get_dirname(index->cache_path);
+    gchar *temp_path = g_strconcat(index->cache_path, ".tmp", NULL);
+    guint32 n_files = index->files->len, n_postings = g_hash_table_size(index->postings);
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean ok;
+    FILE *out;
+
+    g_mkdir_with_parents(dir, 0700);
+    out = g_fopen(temp_path, "wb");
+    if (!out) {
+        g_free(temp_path);
+        g_free(dir);
+        return;
+    }
+
+    ok = fwrite(FILE_INDEX_MAGIC, 8, 1, out) == 1 &&
+         fwrite(&n_files, sizeof(n_files), 1, out) == 1;
+
+    for (guint i = 0; ok && i < n_files; i++) {
+        const IndexedFile *file = &g_array_index(index->files, IndexedFile, i);
+        guint32 length = file->path ? strlen(file->path) : 0;
+
+        ok = fwrite(&length, sizeof(length), 1, out) == 1 &&
+             fwrite(file->path ? file->path : "", 1, length, out) == length &&
+             fwrite(&file->mtime, sizeof(file->mtime), 1, out) == 1 &&
+             fwrite(&file->size, sizeof(file->size), 1, out) == 1 &&
+             fwrite(&file->flags, sizeof(file->flags), 1, out) == 1;
+    }
+
+    ok = ok && fwrite(&n_postings, sizeof(n_postings), 1, out) == 1;
+
+    g_hash_table_iter_init(&iter, index->postings);
+    while (ok && g_hash_table_iter_next(&iter, &key, &value)) {
+        const Posting *posting = (const Posting *)value;
+        guint32 trigram = GPOINTER_TO_UINT(key) - 1, length = posting->ids->len;
+
+        ok = fwrite(&trigram, sizeof(trigram), 1, out) == 1 &&
+             fwrite(&posting->last, sizeof(posting->last), 1, out) == 1 &&
+             fwrite(&length, sizeof(length), 1, out) == 1 &&
+             fwrite(posting->ids->data, 1, length, out) == length;
+    }
+
+    ok = fclose(out) == 0 && ok;
+    if (!ok || g_rename(temp_path, index->cache_path) != 0) {
+        g_unlink(temp_path);
+    }
+
+    g_free(temp_path);
+    g_free(dir);
+}
+
+typedef struct {
+    const gchar *p;
+    const gchar *end;
+    gboolean ok;
+} IndexReader;
+
+static const gchar *index_reader_take(IndexReader *reader, gsize length) {
+    const gchar *start = reader->p;
+
+    if (!reader->ok || (gsize)(reader->end - reader->p) < length) {
+        reader->ok = FALSE;
+        return NULL;
+    }
+    reader->p += length;
+    return start;
+}
+
+static void index_reader_read(IndexReader *reader, gpointer dest, gsize length) {
+    const gchar *data = index_reader_take(reader, length);
+
+    if (data) {
+        memcpy(dest, data, length);
+    }
+}
+
+// Load the saved index. Whatever doesn't match the format is discarded,
+// and the refresh then starts from scratch.
+static void file_index_load(FileIndex *index) {
+    GMappedFile *mapping = g_mapped_file_new(index->cache_path, FALSE, NULL);
+    IndexReader reader;
+    guint32 n_files = 0, n_postings = 0;
+
+    if (!mapping) {
+        return;
+    }
+
+    reader.p = g_mapped_file_get_contents(mapping);
+    reader.end = reader.p + g_mapped_file_get_length(mapping);
+    reader.ok = reader.p && g_mapped_file_get_length(mapping) >= 8 &&
+                memcmp(reader.p, FILE_INDEX_MAGIC, 8) == 0;
+    index_reader_take(&reader, 8);
+    index_reader_read(&reader, &n_files, sizeof(n_files));
+
+    for (guint32 i = 0; reader.ok && i < n_files; i++) {
+        IndexedFile file;
+        guint32 length = 0;
+        const gchar *path;
+
+        index_reader_read(&reader, &length, sizeof(length));
+        path = index_reader_take(&reader, length);
+        index_reader_read(&reader, &file.mtime, sizeof(file.mtime));
+        index_reader_read(&reader, &file.size, sizeof(file.size));
+        index_reader_read(&reader, &file.flags, sizeof(file.flags));
+        if (!reader.ok) {
+            break;
+        }
+
+        file.path = (file.flags & FILE_INDEX_DEAD) ? NULL : g_strndup(path, length);
+        g_array_append_val(index->files, file);
+        if (file.path) {
+            g_hash_table_replace(index->by_path, file.path, GUINT_TO_POINTER(i + 1));
+        } else {
+            index->n_dead++;
+        }
+    }
+
+    index_reader_read(&reader, &n_postings, sizeof(n_postings));
+    for (guint32 i = 0; reader.ok && i < n_postings; i++) {
+        guint32 trigram = 0, last = 0, length = 0;
+        const gchar *ids;
+        Posting *posting;
+
+        index_reader_read(&reader, &trigram, sizeof(trigram));
+        index_reader_read(&reader, &last, sizeof(last));
+        index_reader_read(&reader, &length, sizeof(length));
+        ids = index_reader_take(&reader, length);
+        if (!reader.ok || trigram > 0xFFFFFF || last >= n_files) {
+            reader.ok = FALSE;
+            break;
+        }
+
+        posting = g_new0(Posting, 1);
+        posting->ids = g_byte_array_sized_new(length);
+        g_byte_array_append(posting->ids, (const guint8 *)ids, length);
+        posting->last = last;
+        g_hash_table_replace(index->postings, GUINT_TO_POINTER(trigram + 1), posting);
+    }
+
+    if (!reader.ok) {
+        g_hash_table_remove_all(index->by_path);
+        g_hash_table_remove_all(index->postings);
+        g_array_set_size(index->files, 0);
+        index->n_dead = 0;
+    }
+
+    g_mapped_file_unref(mapping);
+}
+
+// ============================================
+// Refresh thread and watching
+// ============================================
+
+// Idle callback: the refresh thread has finished
+static gboolean file_index_refresh_done(gpointer data) {
+    FileIndex *index = (FileIndex *)data;
+    gboolean again;
+
+    g_mutex_lock(&index->changes_lock);
+    index->done_id = 0;
+    again = index->refresh_again || index->full_refresh || g_hash_table_size(index->changed) > 0;
+    g_mutex_unlock(&index->changes_lock);
+
+    g_thread_join(index->thread);
+    index->thread = NULL;
+    index->refresh_again = FALSE;
+
+    if (again) {
+        file_index_schedule_refresh(index);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer file_index_refresh_worker(gpointer data) {
+    FileIndex *index = (FileIndex *)data;
+    gboolean full, modified = FALSE, ok;
+
+    // What changed from here on is left for the next refresh
+    g_mutex_lock(&index->changes_lock);
+    full = index->full_refresh;
+    index->full_refresh = FALSE;
+    index->refreshing = index->changed;
+    index->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_unlock(&index->changes_lock);
+
+    index->seen = g_new0(guint64, (1 << 24) / 64);
+    if (full) {
+        ok = file_index_refresh_all(index, &modified);
+    } else {
+        ok = file_index_refresh_changed(index, index->refreshing, &modified);
+    }
+    g_free(index->seen);
+    index->seen = NULL;
+
+    if (ok && index->n_dead > 1024 && index->n_dead > index->files->len / 4) {
+        file_index_compact(index);
+    }
+    if (ok && modified) {
+        file_index_save(index);
+    }
+
+    g_mutex_lock(&index->changes_lock);
+    if (ok && full && !index->watch_failed && index->inotify_fd >= 0) {
+        g_atomic_int_set(&index->ready, 1);
+    }
+    g_hash_table_unref(index->refreshing);
+    index->refreshing = NULL;
+    index->done_id = g_idle_add(file_index_refresh_done, index);
+    g_mutex_unlock(&index->changes_lock);
+
+    return NULL;
+}
+
+static gboolean file_index_refresh_timeout(gpointer data) {
+    FileIndex *index = (FileIndex *)data;
+
+    index->refresh_id = 0;
+    if (index->thread) {
+        index->refresh_again = TRUE;
+    } else {
+        index->thread = g_thread_new("file-index", file_index_refresh_worker, index);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void file_index_schedule_refresh(FileIndex *index) {
+    if (index->refresh_id == 0) {
+        index->refresh_id = g_timeout_add(FILE_INDEX_REFRESH_DELAY, file_index_refresh_timeout,
+                                          index);
+    }
+}
+
+// inotify callback: remember what changed, and index it again shortly
+static gboolean on_file_index_event(gint fd, GIOCondition condition, gpointer data) {
+    FileIndex *index = (FileIndex *)data;
+    gchar buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    gboolean full = FALSE;
+    gssize length = read(fd, buffer, sizeof(buffer));
+
+    if (length <= 0) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_mutex_lock(&index->changes_lock);
+    for (gchar *p = buffer; p < buffer + length;
+         p += sizeof(struct inotify_event) + ((struct inotify_event *)(void *)p)->len) {
+        const struct inotify_event *event = (const struct inotify_event *)(void *)p;
+        const gchar *dir = g_hash_table_lookup(index->watches, GINT_TO_POINTER(event->wd));
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            full = TRUE;
+        } else if (event->mask & IN_IGNORED) {
+            g_hash_table_remove(index->watches, GINT_TO_POINTER(event->wd));
+        } else if (dir && event->len > 0 && event->name[0] != '.') {
+            // A directory coming or going changes which files there are
+            if (event->mask & IN_ISDIR) {
+                full = full || (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO));
+            } else {
+                g_hash_table_add(index->changed, *dir ? g_build_filename(dir, event->name, NULL)
+                                                      : g_strdup(event->name));
+            }
+        }
+    }
+    if (full) {
+        index->full_refresh = TRUE;
+        g_atomic_int_set(&index->ready, 0);
+    }
+    g_mutex_unlock(&index->changes_lock);
+
+    file_index_schedule_refresh(index);
+    return G_SOURCE_CONTINUE;
+}
+
+FileIndex *file_index_open(const gchar *root) {
+    FileIndex *index = g_new0(FileIndex, 1);
+
+    index->root = g_strdup(root);
+    index->cache_path = file_index_cache_path(root);
+    g_rw_lock_init(&index->lock);
+    index->files = file_index_new_files();
+    index->by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    index->postings = file_index_new_postings();
+
+    g_mutex_init(&index->changes_lock);
+    index->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index->watches = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    index->full_refresh = TRUE;
+
+    index->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (index->inotify_fd >= 0) {
+        index->inotify_id = g_unix_fd_add(index->inotify_fd, G_IO_IN, on_file_index_event, index);
+    }
+
+    file_index_load(index);
+    index->thread = g_thread_new("file-index", file_index_refresh_worker, index);
+    return index;
+}
+
+void file_index_free(FileIndex *index) {
+    if (!index) {
+        return;
+    }
+
+    if (index->thread) {
+        g_atomic_int_set(&index->cancelled, 1);
+        g_thread_join(index->thread);
+    }
+    if (index->done_id) {
+        g_source_remove(index->done_id);
+    }
+    if (index->refresh_id) {
+        g_source_remove(index->refresh_id);
+    }
+    if (index->inotify_fd >= 0) {
+        g_source_remove(index->inotify_id);
+        close(index->inotify_fd);
+    }
+
+    g_hash_table_unref(index->postings);
+    g_hash_table_unref(index->by_path);
+    g_array_free(index->files, TRUE);
+    g_rw_lock_clear(&index->lock);
+    g_hash_table_unref(index->changed);
+    g_hash_table_unref(index->watches);
+    g_mutex_clear(&index->changes_lock);
+    g_free(index->cache_path);
+    g_free(index->root);
+    g_free(index);
+}
+
+const gchar *file_index_get_root(FileIndex *index) {
+    return index->root;
+}
+
+gboolean file_index_is_ready(FileIndex *index) {
+    return g_atomic_int_get(&index->ready);
+}
+
+// ============================================
+// Queries
+// ============================================
+
+static gint compare_postings(gconstpointer a, gconstpointer b) {
+    const Posting *x = *(const Posting * const *)a, *y = *(const Posting * const *)b;
+
+    return (x->ids->len > y->ids->len) - (x->ids->len < y->ids->len);
+}
+
+static gboolean ids_contain(GArray *ids, guint32 id) {
+    guint lo = 0, hi = ids->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index(ids, guint32, mid) < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < ids->len && g_array_index(ids, guint32, lo) == id;
+}
+
+// Add the changed files the index doesn't already list (read lock held)
+static void file_index_add_changed(FileIndex *index, GHashTable *changed, GArray *ids,
+                                   GPtrArray *result) {
+    GHashTableIter iter;
+    gpointer relative, id;
+
+    if (!changed) {
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, changed);
+    while (g_hash_table_iter_next(&iter, &relative, NULL)) {
+        if (ids && g_hash_table_lookup_extended(index->by_path, relative, NULL, &id) &&
+            ids_contain(ids, GPOINTER_TO_UINT(id) - 1)) {
+            continue;
+        }
+        g_ptr_array_add(result, g_build_filename(index->root, (const gchar *)relative, NULL));
+    }
+}
+
+GPtrArray *file_index_query(FileIndex *index, const gchar * const *literals) {
+    GHashTable *trigrams = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GPtrArray *postings = g_ptr_array_new();
+    GPtrArray *result = NULL;
+    GArray *ids = NULL;
+    GHashTableIter iter;
+    gpointer key;
+
+    for (guint i = 0; literals && literals[i]; i++) {
+        const guchar *s = (const guchar *)literals[i];
+        gsize length = strlen(literals[i]);
+
+        for (gsize j = 2; j < length; j++) {
+            guint32 trigram = (s[j - 2] << 16) | (s[j - 1] << 8) | s[j];
+            g_hash_table_add(trigrams, GUINT_TO_POINTER(trigram + 1));
+        }
+    }
+
+    g_rw_lock_reader_lock(&index->lock);
+
+    if (!file_index_is_ready(index)) {
+        g_rw_lock_reader_unlock(&index->lock);
+        g_hash_table_unref(trigrams);
+        g_ptr_array_free(postings, TRUE);
+        return NULL;
+    }
+
+    // Intersect the posting lists, shortest first
+    if (g_hash_table_size(trigrams) > 0) {
+        gboolean missing = FALSE;
+
+        g_hash_table_iter_init(&iter, trigrams);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            Posting *posting = g_hash_table_lookup(index->postings, key);
+
+            if (!posting) {
+                missing = TRUE;
+                break;
+            }
+            g_ptr_array_add(postings, posting);
+        }
+
+        ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+        if (!missing) {
+            const Posting *first;
+            const guint8 *p, *end;
+            guint32 id = 0;
+
+            g_ptr_array_sort(postings, compare_postings);
+            first = postings->pdata[0];
+            p = first->ids->data;
+            end = p + first->ids->len;
+            while (posting_next(&p, end, &id)) {
+                g_array_append_val(ids, id);
+            }
+            for (guint i = 1; i < postings->len && ids->len > 0; i++) {
+                posting_intersect(ids, postings->pdata[i]);
+            }
+        }
+    }
+
+    result = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < index->files->len; i++) {
+        const IndexedFile *file = &g_array_index(index->files, IndexedFile, i);
+
+        if (file->flags & (FILE_INDEX_DEAD | FILE_INDEX_BINARY)) {
+            continue;
+        }
+        if (!ids || (file->flags & FILE_INDEX_UNINDEXED) || ids_contain(ids, i)) {
+            g_ptr_array_add(result, g_build_filename(index->root, file->path, NULL));
+        }
+    }
+
+    // Files changed since they were indexed might match now
+    g_mutex_lock(&index->changes_lock);
+    file_index_add_changed(index, index->changed, ids, result);
+    file_index_add_changed(index, index->refreshing, ids, result);
+    g_mutex_unlock(&index->changes_lock);
+
+    g_rw_lock_reader_unlock(&index->lock);
+
+    if (ids) {
+        g_array_free(ids, TRUE);
+    }
+    g_ptr_array_free(postings, TRUE);
+    g_hash_table_unref(trigrams);
+    return result;
+}
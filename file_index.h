@@ -0,0 +1,46 @@
+/*
+ * Persistent trigram index of a directory tree
+ *
+ * For every text file under a folder the index records which three-byte
+ * sequences (trigrams) it contains, so a search only has to read the files
+ * that contain all the trigrams of the strings a match must include. The
+ * index is saved in the user's cache directory and brought up to date on a
+ * worker thread when it is opened, re-reading only the files whose size or
+ * modification time changed. While it is open the tree is watched with
+ * inotify, and files that change are searched directly until they have
+ * been indexed again a moment later.
+ */
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <glib.h>
+
+typedef struct _FileIndex FileIndex;
+
+// Open the index of the tree under root, loading it from the cache and
+// refreshing it in the background. Main thread only.
+FileIndex *file_index_open(const gchar *root);
+
+// Stop watching and refreshing, and free the index. Main thread only.
+void file_index_free(FileIndex *index);
+
+const gchar *file_index_get_root(FileIndex *index);
+
+// Whether the index is up to date with the tree and can answer queries
+gboolean file_index_is_ready(FileIndex *index);
+
+// Absolute paths of the files that may contain every one of literals
+// (NULL-terminated), or NULL if the index isn't ready. Literals shorter
+// than three bytes don't narrow the result. Thread-safe.
+GPtrArray *file_index_query(FileIndex *index, const gchar * const *literals);
+
+// Absolute paths of the regular files under root, leaving out hidden files
+// and directories and not following symbolic links. Stops early once
+// *cancelled (optional) is non-zero. Thread-safe.
+GPtrArray *file_index_list_files(const gchar *root, const gint *cancelled);
+
+// Whether data looks like a binary file, which searches skip
+gboolean file_index_is_binary(const gchar *data, gsize length);
+
+#endif // FILE_INDEX_H
@@ -0,0 +1,381 @@
+/*
+ * Reading a file into a document
+ *
+ * See file_reader.h. UTF-8 text, by far the common case, becomes the
+ * original text of a new PieceTable as it is: the mapping is walked in
+ * READER_CHUNK_SIZE slices, split on character boundaries, indexed and
+ * handed over without copying. Other encodings are converted to UTF-8 one
+ * slice at a time into a single buffer, which becomes the original text
+ * instead, and the converted slices are handed over as they are produced.
+ * gzip and zstd files are decompressed a block at a time straight from the
+ * mapping; each block of text is appended to the document as a piece of
+ * its own, so nothing touches the disk but the compressed file. A UTF-8
+ * file's first slice is only READER_FIRST_CHUNK bytes, so the loader can
+ * paint the first page before the rest is read.
+ */
+
+#include "file_reader.h"
+#include "text_scan.h"
+#include "trace.h"
+
+#include <string.h>
+
+#define READER_CHUNK_SIZE  (1024 * 1024)  // File bytes handled per iteration
+#define READER_FIRST_CHUNK (64 * 1024)    // Smaller, so the first page shows sooner
+
+// Hand a chunk of the document to the caller. Returns FALSE if the read
+// was cancelled.
+static gboolean reader_push_chunk(FileReader *reader, const gchar *data, gsize length,
+                                  gsize source_length) {
+    if (g_atomic_int_get(&reader->cancelled)) {
+        return FALSE;
+    }
+    return !reader->func || reader->func(data, length, source_length, reader->user_data);
+}
+
+// Use UTF-8 text in place: the original text is the mapping after the BOM.
+// If it has invalid bytes, it is instead a copy made slice by slice with
+// each of them replaced.
+static gboolean reader_stream_utf8(FileReader *reader, gsize bom_length, GError **error) {
+    const gchar *source = (const gchar *)g_bytes_get_data(reader->source, NULL) + bom_length;
+    gsize source_length = reader->length - bom_length;
+    gchar *output = NULL;
+    gsize length, offset = 0;
+    GBytes *text;
+
+    if (reader->encoding.repaired) {
+        length = encoding_repair_utf8(source, source_length, NULL);
+        output = g_try_malloc(length);
+        if (!output) {
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                        "Not enough memory to read the file");
+            return FALSE;
+        }
+        reader->replaced = (length - source_length) / 2;
+        text = g_bytes_new_take(output, length);
+    } else {
+        text = g_bytes_new_from_bytes(reader->source, bom_length, source_length);
+    }
+
+    reader->table = output ? piece_table_new_from_bytes(text)
+                           : piece_table_new_from_mapping(text);
+    g_bytes_unref(text);
+
+    // Unrepaired, the slices of the mapping are the original text itself
+    while (offset < source_length && !g_atomic_int_get(&reader->cancelled)) {
+        const gchar *chunk = source + offset;
+        gsize size = MIN(offset == 0 ? READER_FIRST_CHUNK : READER_CHUNK_SIZE,
+                         source_length - offset);
+        gsize chunk_length;
+        gint64 index_start;
+
+        if (offset + size < source_length) {
+            size = encoding_utf8_complete_length(chunk, size);
+        }
+
+        // A slice ends on a character boundary, so it is repaired on its own
+        // just as it would be as part of the whole file
+        if (output) {
+            chunk_length = encoding_repair_utf8(chunk, size, output);
+            chunk = output;
+            output += chunk_length;
+        } else {
+            chunk_length = size;
+        }
+
+        index_start = trace_begin();
+        piece_table_index_original(reader->table, chunk, chunk_length);
+        trace_end("open.index", index_start);
+
+        if (!reader_push_chunk(reader, chunk, chunk_length,
+                               offset == 0 ? bom_length + size : size)) {
+            break;
+        }
+        offset += size;
+    }
+
+    return TRUE;
+}
+
+// Convert the file to UTF-8 slice by slice. The output goes into one buffer
+// allocated for the worst case, so queued chunks can point into it while the
+// rest is converted.
+static gboolean reader_stream_converted(FileReader *reader, gsize bom_length, GError **error) {
+    const gchar *charset = encoding_get_charset(reader->encoding);
+    const gchar *input = (const gchar *)g_bytes_get_data(reader->source, NULL) + bom_length;
+    gsize input_left = reader->length - bom_length;
+    gsize capacity = encoding_get_max_utf8_length(reader->encoding, input_left);
+    gchar *buffer, *output;
+    gsize output_left = capacity;
+    gboolean ok = TRUE;
+    GIConv converter;
+    GBytes *text;
+
+    converter = g_iconv_open("UTF-8", charset);
+    if (converter == (GIConv)-1) {
+        g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_NO_CONVERSION,
+                    "Conversion from %s is not supported", charset);
+        return FALSE;
+    }
+
+    buffer = g_try_malloc(MAX(capacity, 1));
+    if (!buffer) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                    "Not enough memory to convert the file from %s", charset);
+        g_iconv_close(converter);
+        return FALSE;
+    }
+    output = buffer;
+
+    while (input_left > 0 && !g_atomic_int_get(&reader->cancelled)) {
+        const gchar *chunk = output;
+        gsize slice = MIN(READER_CHUNK_SIZE, input_left);
+        gsize slice_left = slice;
+
+        // A character cut at the end of the slice is left for the next one
+        ok = encoding_convert(converter, &input, &slice_left, &output, &output_left, error);
+        if (!ok) {
+            g_prefix_error(error, "The file is not valid %s text: ", charset);
+            break;
+        }
+        if (slice_left == slice) {
+            g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_PARTIAL_INPUT,
+                        "The file ends in the middle of a %s character", charset);
+            ok = FALSE;
+            break;
+        }
+        if (memchr(chunk, '\0', output - chunk)) {
+            g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_EMBEDDED_NUL,
+                        "The file contains NUL characters");
+            ok = FALSE;
+            break;
+        }
+
+        input_left -= slice - slice_left;
+        if (!reader_push_chunk(reader, chunk, output - chunk, slice - slice_left)) {
+            break;
+        }
+    }
+
+    g_iconv_close(converter);
+
+    // The queued chunks keep pointing into the buffer, now owned by the table
+    text = g_bytes_new_take(buffer, output - buffer);
+    reader->table = piece_table_new_from_bytes(text);
+    g_bytes_unref(text);
+
+    if (ok && output > buffer) {
+        piece_table_index_original(reader->table, buffer, output - buffer);
+    }
+
+    return ok;
+}
+
+// Converter from the detected encoding to UTF-8, or (GIConv)-1 for UTF-8
+// or with error set if the encoding isn't supported
+static GIConv reader_open_converter(FileReader *reader, GError **error) {
+    const gchar *charset = encoding_get_charset(reader->encoding);
+    GIConv converter;
+
+    if (encoding_is_utf8(reader->encoding)) {
+        return (GIConv)-1;
+    }
+
+    converter = g_iconv_open("UTF-8", charset);
+    if (converter == (GIConv)-1) {
+        g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_NO_CONVERSION,
+                    "Conversion from %s is not supported", charset);
+    }
+    return converter;
+}
+
+// Decompress the file block by block; the encoding is detected from the
+// first block. Invalid UTF-8 in a later block is handled as in a plain file:
+// its bytes are replaced, or if all the text before it was ASCII, the rest
+// is read as ISO-8859-1. Each block of text is indexed and becomes a piece
+// of the document as soon as it is decoded, so it is only written once.
+static gboolean reader_stream_compressed(FileReader *reader, GError **error) {
+    const gchar *input = g_bytes_get_data(reader->source, NULL);
+    gsize input_left = reader->length;
+    GIConv converter = (GIConv)-1;
+    Compressor *decompressor;
+    gchar carry[4];             // Start of a character cut at the end of a block
+    gsize carried = 0;
+    gboolean first = TRUE, done = FALSE, ok = TRUE;
+    gboolean ascii_only = TRUE;  // All the text so far is ASCII
+
+    decompressor = compressor_new(reader->compression, FALSE, 0, error);
+    if (!decompressor) {
+        return FALSE;
+    }
+
+    reader->table = piece_table_new();
+    reader->lines = line_table_new();
+
+    while (ok && !done && !g_atomic_int_get(&reader->cancelled)) {
+        gchar *block = g_malloc(READER_CHUNK_SIZE);
+        gsize read, written, length, text_length = 0, bom_length = 0;
+        CompressorResult result;
+
+        memcpy(block, carry, carried);
+        result = compressor_process(decompressor, input, input_left, block + carried,
+                                    READER_CHUNK_SIZE - carried, TRUE, &read, &written, error);
+        input += read;
+        input_left -= read;
+        length = carried + written;
+        done = result == COMPRESSOR_DONE;
+        ok = result != COMPRESSOR_ERROR;
+
+        if (ok && !done && read == 0 && written == 0) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                        "The compressed data is truncated");
+            ok = FALSE;
+        }
+
+        if (ok && first && (length > 0 || done)) {
+            gsize sample = done ? length : encoding_utf8_complete_length(block, length);
+
+            reader->encoding = encoding_detect(block, sample, &bom_length);
+            converter = reader_open_converter(reader, error);
+            ok = encoding_is_utf8(reader->encoding) || converter != (GIConv)-1;
+            first = FALSE;
+        }
+
+        if (ok && encoding_is_utf8(reader->encoding)) {
+            gsize complete = done ? length : encoding_utf8_complete_length(block, length);
+
+            text_length = complete - bom_length;
+            if (encoding_validate_utf8(block + bom_length, text_length) != text_length) {
+                gsize ignored;
+
+                // As for a plain file: with no UTF-8 so far to go by, the
+                // ASCII text already read reads the same as ISO-8859-1 and
+                // the rest is taken as that. Otherwise the bytes are replaced.
+                if (ascii_only && !reader->encoding.bom &&
+                    encoding_detect(block, complete, &ignored).type == ENCODING_LATIN1) {
+                    reader->encoding = (Encoding){ ENCODING_LATIN1, FALSE, FALSE };
+                    converter = reader_open_converter(reader, error);
+                    ok = converter != (GIConv)-1;
+                } else {
+                    gsize repaired_length = encoding_repair_utf8(block + bom_length, text_length,
+                                                                 NULL);
+                    gchar *text = g_malloc(repaired_length);
+
+                    encoding_repair_utf8(block + bom_length, text_length, text);
+                    reader->replaced += (repaired_length - text_length) / 2;
+                    reader->encoding.repaired = TRUE;
+
+                    carried = length - complete;
+                    g_assert(carried <= sizeof carry);
+                    memcpy(carry, block + complete, carried);
+                    text_length = repaired_length;
+                    g_free(block);
+                    block = text;
+                }
+            } else {
+                carried = length - complete;
+                g_assert(carried <= sizeof carry);
+                memcpy(carry, block + complete, carried);
+                memmove(block, block + bom_length, text_length);
+            }
+        }
+
+        if (ok && !encoding_is_utf8(reader->encoding)) {
+            const gchar *in = block + bom_length;
+            gsize in_left = length - bom_length;
+            gsize capacity = encoding_get_max_utf8_length(reader->encoding, in_left);
+            gchar *text = g_malloc(MAX(capacity, 1));
+            gchar *out = text;
+
+            ok = encoding_convert(converter, &in, &in_left, &out, &capacity, error);
+            if (ok && memchr(text, '\0', out - text)) {
+                g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_EMBEDDED_NUL,
+                            "The file contains NUL characters");
+                ok = FALSE;
+            }
+            // On failure in_left is the rest of the block, not a cut character
+            if (ok) {
+                carried = in_left;
+                g_assert(carried <= sizeof carry);
+                memcpy(carry, in, carried);
+            }
+            text_length = out - text;
+            g_free(block);
+            block = text;
+        }
+
+        if (ok && done && carried > 0) {
+            g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_PARTIAL_INPUT,
+                        "The file ends in the middle of a character");
+            ok = FALSE;
+        }
+
+        if (!ok || text_length == 0) {
+            g_free(block);
+            continue;
+        }
+
+        ascii_only = ascii_only && text_scan_ascii_length(block, text_length) == text_length;
+        line_table_insert(reader->lines, line_table_get_char_count(reader->lines),
+                          block, text_length);
+        reader->words += text_scan_count_words(block, text_length, &reader->in_word);
+        piece_table_append_block(reader->table, block, text_length);
+        if (!reader_push_chunk(reader, block, text_length, read)) {
+            break;
+        }
+    }
+
+    if (converter != (GIConv)-1) {
+        g_iconv_close(converter);
+    }
+    compressor_free(decompressor);
+    return ok;
+}
+
+gboolean file_reader_run(FileReader *reader, GError **error) {
+    const gchar *source = g_bytes_get_data(reader->source, &reader->length);
+    gsize bom_length;
+    gboolean ok;
+
+    reader->compression = compression_detect(source, reader->length);
+
+    if (reader->compression != COMPRESSION_NONE) {
+        ok = reader_stream_compressed(reader, error);
+    } else {
+        gint64 detect_start = trace_begin();
+
+        reader->encoding = encoding_detect(source, reader->length, &bom_length);
+        trace_end("open.detect", detect_start);
+
+        if (encoding_is_utf8(reader->encoding)) {
+            ok = reader_stream_utf8(reader, bom_length, error);
+        } else {
+            ok = reader_stream_converted(reader, bom_length, error);
+        }
+    }
+
+    // Line starts are indexed in one parallel pass once the whole text is
+    // known, while the loader is still inserting chunks
+    if (ok && !g_atomic_int_get(&reader->cancelled) && !reader->lines) {
+        gsize length;
+        const gchar *contents = piece_table_get_original(reader->table, &length);
+        gint64 lines_start = trace_begin(), words_start;
+
+        reader->lines = line_table_new_from_text(contents, length);
+        trace_end("open.lines", lines_start);
+
+        words_start = trace_begin();
+        reader->words = text_scan_count_words(contents, length, &reader->in_word);
+        trace_end("stats.count_words", words_start);
+    }
+
+    return ok;
+}
+
+void file_reader_clear(FileReader *reader) {
+    piece_table_free(reader->table);
+    reader->table = NULL;
+    line_table_free(reader->lines);
+    reader->lines = NULL;
+    g_clear_pointer(&reader->source, g_bytes_unref);
+}
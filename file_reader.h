@@ -0,0 +1,50 @@
+/*
+ * Reading a file into a document
+ *
+ * The part of opening a file that runs on the loader's worker thread (see
+ * loader.h), free of GTK so the benchmarks time exactly this code. The
+ * compression and encoding of the mapped file are detected and its text
+ * becomes a PieceTable, with its line table and word count. Each chunk of
+ * text is handed to a callback as soon as it is in the document.
+ */
+
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include "piece_table.h"
+#include "line_table.h"
+#include "encoding.h"
+#include "compression.h"
+
+// A chunk of length bytes of text, read from source_length bytes of the
+// file, is in the document; data stays valid as long as the document.
+// Runs on the reading thread. Returns FALSE to stop reading.
+typedef gboolean (*FileReaderFunc)(const gchar *data, gsize length, gsize source_length,
+                                   gpointer user_data);
+
+typedef struct {
+    // Set by the caller
+    GBytes *source;             // The mapped file, released by file_reader_clear()
+    FileReaderFunc func;        // NULL if the chunks aren't wanted
+    gpointer user_data;
+    gint cancelled;             // Atomic: set to stop reading
+
+    // Results
+    gsize length;               // Of the source
+    Encoding encoding;
+    CompressionType compression;
+    PieceTable *table;          // The document
+    LineTable *lines;           // Its line table, NULL if the read was stopped
+    gsize words;                // Words in the text
+    gboolean in_word;           // Whether the text ends inside a word
+    gsize replaced;             // Invalid UTF-8 bytes replaced with U+FFFD
+} FileReader;
+
+// Read reader->source into a document. Returns FALSE with error set if it
+// can't be read as text.
+gboolean file_reader_run(FileReader *reader, GError **error);
+
+// Free the source and the results still held
+void file_reader_clear(FileReader *reader);
+
+#endif // FILE_READER_H
@@ -0,0 +1,283 @@
+/*
+ * Writing a document to a file
+ *
+ * See file_writer.h. The snapshot's pieces are written straight from the
+ * mapping and add buffer, at most WRITER_CHUNK_SIZE bytes per write(), into
+ * a temporary file created next to the target. Once everything is written
+ * the file is fsync'd, renamed over the target and the directory is
+ * synced, so a crash leaves either the old or the new file, never a
+ * truncated one. Documents read from another encoding are converted back
+ * to it on the way, one WRITER_CHUNK_SIZE buffer at a time, behind the
+ * byte order mark if the file had one, and gzip/zstd files are compressed
+ * again on the fly.
+ */
+
+#include "file_writer.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define WRITER_CHUNK_SIZE (1024 * 1024)  // Largest single write()
+
+static void set_error_from_errno(GError **error, const gchar *what, int saved_errno) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                "%s: %s", what, g_strerror(saved_errno));
+}
+
+// Write a buffer completely, in chunks
+static gboolean writer_write_all(FileWriter *writer, int fd, const gchar *data, gsize length,
+                                 GError **error) {
+    while (length > 0) {
+        gssize n;
+
+        if (g_atomic_int_get(&writer->cancelled)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Save cancelled");
+            return FALSE;
+        }
+
+        n = write(fd, data, MIN(length, WRITER_CHUNK_SIZE));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_error_from_errno(error, "Write failed", errno);
+            return FALSE;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return TRUE;
+}
+
+// Write data to the file, through the compressor for compressed files. With
+// finish set, the end of the compressed stream is written after it.
+static gboolean writer_output(FileWriter *writer, int fd, const gchar *data, gsize length,
+                              gboolean finish, GError **error) {
+    if (!writer->compressor) {
+        return writer_write_all(writer, fd, data, length, error);
+    }
+    if (length == 0 && !finish) {
+        return TRUE;
+    }
+
+    for (;;) {
+        gsize read, written;
+        CompressorResult result;
+
+        result = compressor_process(writer->compressor, data, length, writer->compressed,
+                                    WRITER_CHUNK_SIZE, finish, &read, &written, error);
+        if (result == COMPRESSOR_ERROR ||
+            !writer_write_all(writer, fd, writer->compressed, written, error)) {
+            return FALSE;
+        }
+
+        data += read;
+        length -= read;
+        if (result == COMPRESSOR_DONE || (!finish && length == 0)) {
+            return TRUE;
+        }
+    }
+}
+
+// Count bytes of the snapshot as written
+static void writer_add_progress(FileWriter *writer, gsize length) {
+    if (writer->func) {
+        writer->func(length, writer->user_data);
+    }
+}
+
+// Write the pieces as they are
+static gboolean writer_write_pieces(FileWriter *writer, int fd, GError **error) {
+    const Piece *pieces;
+    guint n_pieces, i;
+
+    pieces = piece_snapshot_get_pieces(writer->snapshot, &n_pieces);
+    for (i = 0; i < n_pieces; i++) {
+        gsize offset;
+
+        for (offset = 0; offset < pieces[i].bytes; offset += WRITER_CHUNK_SIZE) {
+            gsize length = MIN(WRITER_CHUNK_SIZE, pieces[i].bytes - offset);
+
+            if (!writer_output(writer, fd, pieces[i].data + offset, length, FALSE, error)) {
+                return FALSE;
+            }
+            writer_add_progress(writer, length);
+        }
+    }
+
+    return TRUE;
+}
+
+// Write the pieces converted from UTF-8 to the file's encoding
+static gboolean writer_write_converted(FileWriter *writer, int fd, GError **error) {
+    const gchar *charset = encoding_get_charset(writer->encoding);
+    const Piece *pieces;
+    guint n_pieces, i;
+    gchar *buffer;
+    gboolean ok = TRUE;
+    GIConv converter;
+
+    converter = g_iconv_open(charset, "UTF-8");
+    if (converter == (GIConv)-1) {
+        g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_NO_CONVERSION,
+                    "Conversion to %s is not supported", charset);
+        return FALSE;
+    }
+
+    buffer = g_malloc(WRITER_CHUNK_SIZE);
+    pieces = piece_snapshot_get_pieces(writer->snapshot, &n_pieces);
+
+    // Pieces always hold whole characters, so each converts on its own
+    for (i = 0; i < n_pieces && ok; i++) {
+        const gchar *input = pieces[i].data;
+        gsize input_left = pieces[i].bytes;
+
+        while (input_left > 0 && ok) {
+            gchar *output = buffer;
+            gsize output_left = WRITER_CHUNK_SIZE;
+            gsize before = input_left;
+
+            ok = encoding_convert(converter, &input, &input_left, &output, &output_left, error);
+            if (!ok) {
+                g_clear_error(error);
+                g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE,
+                            "The text contains characters that can't be saved as %s. "
+                            "Use Save As to save a copy in UTF-8 instead.", charset);
+            } else if (input_left == before) {
+                g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_PARTIAL_INPUT,
+                            "Incomplete character in the document");
+                ok = FALSE;
+            } else {
+                ok = writer_output(writer, fd, buffer, output - buffer, FALSE, error);
+                writer_add_progress(writer, before - input_left);
+            }
+        }
+    }
+
+    g_free(buffer);
+    g_iconv_close(converter);
+    return ok;
+}
+
+// Make the rename durable
+static void sync_directory(const gchar *filename) {
+    gchar *dirname = g_path_get_dirname(filename);
+    int fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    g_free(dirname);
+}
+
+// Write the snapshot to a temporary file and rename it over the target
+static gboolean writer_write_file(FileWriter *writer, GError **error) {
+    TRACE_SCOPE("save.write");
+    const gchar *bom;
+    gsize bom_length;
+    gchar *temp_filename;
+    struct stat st;
+    gint64 sync_start;
+    gboolean ok;
+    int fd;
+
+    temp_filename = g_strdup_printf("%s.XXXXXX", writer->filename);
+    fd = g_mkstemp(temp_filename);
+    if (fd < 0) {
+        set_error_from_errno(error, "Cannot create temporary file", errno);
+        g_free(temp_filename);
+        return FALSE;
+    }
+
+    // Keep the permissions of the file being replaced
+    if (stat(writer->filename, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+    } else {
+        fchmod(fd, writer->create_mode);
+    }
+
+    if (writer->compression != COMPRESSION_NONE) {
+        writer->compressor = compressor_new(writer->compression, TRUE,
+                                            writer->compression_level, error);
+        writer->compressed = g_malloc(WRITER_CHUNK_SIZE);
+    }
+
+    bom = encoding_get_bom(writer->encoding, &bom_length);
+    ok = (writer->compression == COMPRESSION_NONE || writer->compressor) &&
+         writer_output(writer, fd, bom, bom_length, FALSE, error);
+
+    if (ok && encoding_is_utf8(writer->encoding)) {
+        ok = writer_write_pieces(writer, fd, error);
+    } else if (ok) {
+        ok = writer_write_converted(writer, fd, error);
+    }
+
+    ok = ok && writer_output(writer, fd, NULL, 0, TRUE, error);
+
+    compressor_free(writer->compressor);
+    writer->compressor = NULL;
+    g_free(writer->compressed);
+    writer->compressed = NULL;
+
+    sync_start = trace_begin();
+    if (ok && fsync(fd) != 0) {
+        set_error_from_errno(error, "Sync failed", errno);
+        ok = FALSE;
+    }
+    trace_end("save.fsync", sync_start);
+
+    if (close(fd) != 0 && ok) {
+        set_error_from_errno(error, "Close failed", errno);
+        ok = FALSE;
+    }
+
+    if (ok && g_rename(temp_filename, writer->filename) != 0) {
+        set_error_from_errno(error, "Rename failed", errno);
+        ok = FALSE;
+    }
+
+    if (ok) {
+        sync_start = trace_begin();
+        sync_directory(writer->filename);
+        trace_end("save.fsync_dir", sync_start);
+    } else {
+        g_unlink(temp_filename);
+    }
+
+    g_free(temp_filename);
+    return ok;
+}
+
+gboolean file_writer_run(FileWriter *writer, PieceTable **rebased, GError **error) {
+    *rebased = NULL;
+
+    if (!writer_write_file(writer, error)) {
+        return FALSE;
+    }
+
+    // The new file can only stand in for the document if it holds the text
+    // as it is
+    if (writer->compression == COMPRESSION_NONE && encoding_is_utf8(writer->encoding) &&
+        !writer->encoding.bom) {
+        TRACE_SCOPE("save.rebase");
+
+        *rebased = piece_table_new_from_file(writer->filename, NULL);
+        if (*rebased) {
+            gsize length;
+            const gchar *contents = piece_table_get_original(*rebased, &length);
+
+            if (length > 0) {
+                piece_table_index_original(*rebased, contents, length);
+            }
+        }
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,46 @@
+/*
+ * Writing a document to a file
+ *
+ * The part of saving that runs on the saver's worker thread (see saver.h),
+ * free of GTK so the benchmarks time exactly this code: a snapshot of the
+ * document is written to a temporary file that replaces the target once
+ * complete, in the file's encoding and compression, and the new file is
+ * then mapped into a fresh piece table if it holds the text as it is.
+ */
+
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include "piece_table.h"
+#include "encoding.h"
+#include "compression.h"
+
+#include <sys/types.h>
+
+// length more bytes of the snapshot have been written. Runs on the
+// writing thread.
+typedef void (*FileWriterFunc)(gsize length, gpointer user_data);
+
+typedef struct {
+    // Set by the caller
+    const gchar *filename;
+    PieceSnapshot *snapshot;
+    Encoding encoding;
+    CompressionType compression;
+    gint compression_level;
+    mode_t create_mode;         // Permissions if the file doesn't exist yet
+    FileWriterFunc func;        // NULL if progress isn't wanted
+    gpointer user_data;
+    gint cancelled;             // Atomic: set to stop writing, leaving the target as it was
+
+    // While writing a compressed file
+    Compressor *compressor;
+    gchar *compressed;          // Its output buffer
+} FileWriter;
+
+// Write writer->snapshot to writer->filename. On success *rebased is the
+// document read back from the new file, or NULL if it can't stand in for
+// the one saved (see saver.c). Returns FALSE with error set on failure.
+gboolean file_writer_run(FileWriter *writer, PieceTable **rebased, GError **error);
+
+#endif // FILE_WRITER_H
@@ -0,0 +1,733 @@
+/*
+ * Find in Files
+ *
+ * A search lists its files first, from the index when it is ready or else
+ * by walking the folder, then hands them to one worker per processor. The
+ * list is split into a contiguous range per worker; a worker that runs out
+ * takes the back half of the range of the one with the most left, so a few
+ * large files don't leave the other threads idle. Files are mapped rather
+ * than read, and binary files are skipped.
+ *
+ * Each line is reported once, however many matches it has, with its line
+ * number counted on the way through the file. Results are handed over in
+ * batches under the job's lock and added to the list by a timeout on the
+ * main thread, as in the search bar.
+ *
+ * A regular expression narrows the files to search through the literal
+ * strings every match must contain. Only the plain runs of characters
+ * outside groups and classes are taken, and none at all from a pattern
+ * with alternatives or inline options, so the index never leaves out a
+ * file that could match.
+ */
+
+#include "find_files.h"
+#include "file_index.h"
+#include "regex_search.h"
+#include "text_scan.h"
+#include "tabs.h"
+
+#include <string.h>
+
+#define FIND_FILES_MAX_RESULTS   10000  // Matching lines listed at most
+#define FIND_FILES_PREVIEW       200    // Bytes of a matching line shown
+#define FIND_FILES_BATCH         64     // Results handed over at once
+#define FIND_FILES_POLL_INTERVAL 100    // Milliseconds between result pickups
+
+enum {
+    COLUMN_PATH,            // Absolute path
+    COLUMN_NAME,            // Path relative to the folder
+    COLUMN_LINE,            // From 1
+    COLUMN_TEXT,
+    N_COLUMNS
+};
+
+typedef struct {
+    gchar *path;
+    guint line;
+    gchar *text;
+} FindResult;
+
+// The files of job->files left to one worker
+typedef struct {
+    GMutex lock;
+    guint head;
+    guint tail;
+} FindQueue;
+
+typedef struct {
+    gint ref_count;
+    gchar *root;
+    gchar *needle;
+    gsize needle_length;
+    GRegex *regex;          // Compiled needle in regex mode, else NULL
+    GPtrArray *files;       // Absolute paths, listed by the job if NULL at the start
+    FindQueue *queues;      // One per worker
+    guint n_workers;
+    gint cancelled;         // Atomic
+    gint n_results;         // Atomic
+    gint n_searched;        // Atomic, files read
+
+    // Protected by lock
+    GMutex lock;
+    GArray *found;          // FindResult, not picked up yet
+    gboolean done;
+} FindJob;
+
+typedef struct {
+    FindJob *job;
+    guint index;
+} FindWorker;
+
+struct _FindFiles {
+    TextEditor *editor;
+    GtkWidget *window;
+    GtkWidget *folder_button;
+    GtkWidget *entry;
+    GtkWidget *regex_button;
+    GtkWidget *index_button;
+    GtkWidget *status_label;
+    GtkListStore *store;
+
+    FileIndex *index;       // Index of the folder, NULL when not used
+    FindJob *job;           // Running search, NULL when none
+    gboolean from_index;    // The job's files came from the index
+    gint64 started;         // Monotonic time the job started
+    guint poll_id;
+};
+
+static FindJob *find_job_ref(FindJob *job) {
+    g_atomic_int_inc(&job->ref_count);
+    return job;
+}
+
+static void find_result_clear(gpointer data) {
+    FindResult *result = (FindResult *)data;
+
+    g_free(result->path);
+    g_free(result->text);
+}
+
+static void find_job_unref(FindJob *job) {
+    if (!g_atomic_int_dec_and_test(&job->ref_count)) {
+        return;
+    }
+
+    if (job->regex) {
+        g_regex_unref(job->regex);
+    }
+    if (job->files) {
+        g_ptr_array_free(job->files, TRUE);
+    }
+    for (guint i = 0; i < job->n_workers; i++) {
+        g_mutex_clear(&job->queues[i].lock);
+    }
+    g_free(job->queues);
+    g_array_free(job->found, TRUE);
+    g_mutex_clear(&job->lock);
+    g_free(job->needle);
+    g_free(job->root);
+    g_free(job);
+}
+
+// Hand the worker's batch of results over to the main thread
+static void find_job_flush(FindJob *job, GArray *batch) {
+    if (batch->len == 0) {
+        return;
+    }
+
+    g_mutex_lock(&job->lock);
+    g_array_append_vals(job->found, batch->data, batch->len);
+    g_mutex_unlock(&job->lock);
+    g_array_set_size(batch, 0);
+}
+
+// Record a matching line, returning FALSE once no more are wanted
+static gboolean find_job_add(FindJob *job, GArray *batch, const gchar *path, gsize line,
+                             const gchar *text, gsize length) {
+    FindResult result;
+    gsize end = length;
+
+    if (g_atomic_int_add(&job->n_results, 1) >= FIND_FILES_MAX_RESULTS) {
+        return FALSE;
+    }
+
+    // Cut long lines at a character boundary, and without a CR
+    if (end > FIND_FILES_PREVIEW) {
+        end = FIND_FILES_PREVIEW;
+        while (end > 0 && ((guchar)text[end] & 0xC0) == 0x80) {
+            end--;
+        }
+    } else if (end > 0 && text[end - 1] == '\r') {
+        end--;
+    }
+
+    result.path = g_strdup(path);
+    result.line = (guint)MIN(line, G_MAXUINT);
+    result.text = g_strstrip(g_utf8_make_valid(text, (gssize)end));
+    g_array_append_val(batch, result);
+
+    if (batch->len >= FIND_FILES_BATCH) {
+        find_job_flush(job, batch);
+    }
+    return TRUE;
+}
+
+// Byte offset of the first match at or after position, or length if none
+static gsize find_job_match(FindJob *job, const gchar *data, gsize length, gsize position) {
+    GMatchInfo *info = NULL;
+    gint start = (gint)length;
+
+    if (!job->regex) {
+        return position + text_scan_find(data + position, length - position,
+                                         job->needle, job->needle_length);
+    }
+
+    if (g_regex_match_full(job->regex, data, (gssize)length, (gint)position, 0, &info, NULL)) {
+        g_match_info_fetch_pos(info, 0, &start, NULL);
+    }
+    g_match_info_free(info);
+    return (gsize)start;
+}
+
+// Report each line of the file at path with a match in it
+static gboolean find_job_search_file(FindJob *job, const gchar *path, GArray *batch) {
+    GMappedFile *mapping = g_mapped_file_new(path, FALSE, NULL);
+    const gchar *data;
+    gsize length, position = 0, counted = 0, line = 0;
+    gboolean more = TRUE;
+
+    if (!mapping) {
+        return TRUE;
+    }
+
+    data = g_mapped_file_get_contents(mapping);
+    length = g_mapped_file_get_length(mapping);
+
+    // PCRE takes offsets as int
+    if (length == 0 || file_index_is_binary(data, length) || (job->regex && length > G_MAXINT)) {
+        g_mapped_file_unref(mapping);
+        return TRUE;
+    }
+    g_atomic_int_inc(&job->n_searched);
+
+    while (more && position < length && !g_atomic_int_get(&job->cancelled)) {
+        gsize hit = find_job_match(job, data, length, position);
+        gsize line_start = hit, line_end;
+        const gchar *newline;
+
+        if (hit >= length) {
+            break;
+        }
+
+        line += text_scan_count_newlines(data + counted, hit - counted);
+        counted = hit;
+
+        while (line_start > position && data[line_start - 1] != '\n') {
+            line_start--;
+        }
+        newline = memchr(data + hit, '\n', length - hit);
+        line_end = newline ? (gsize)(newline - data) : length;
+
+        more = find_job_add(job, batch, path, line + 1, data + line_start, line_end - line_start);
+
+        // Further matches on the same line add nothing
+        position = line_end + 1;
+    }
+
+    g_mapped_file_unref(mapping);
+    return more;
+}
+
+// Take the next file to search, stealing from another worker if the
+// worker's own range is used up
+static gboolean find_job_next(FindJob *job, guint self, guint *file) {
+    FindQueue *own = &job->queues[self];
+
+    g_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *file = own->head++;
+        g_mutex_unlock(&own->lock);
+        return TRUE;
+    }
+    g_mutex_unlock(&own->lock);
+
+    for (;;) {
+        FindQueue *victim = NULL;
+        guint most = 0, taken, start;
+
+        for (guint i = 0; i < job->n_workers; i++) {
+            FindQueue *queue = &job->queues[i];
+            guint left;
+
+            if (i == self) {
+                continue;
+            }
+            g_mutex_lock(&queue->lock);
+            left = queue->tail - queue->head;
+            g_mutex_unlock(&queue->lock);
+
+            if (left > most) {
+                most = left;
+                victim = queue;
+            }
+        }
+
+        if (!victim) {
+            return FALSE;
+        }
+
+        // It may have shrunk since it was looked at
+        g_mutex_lock(&victim->lock);
+        taken = (victim->tail - victim->head + 1) / 2;
+        victim->tail -= taken;
+        start = victim->tail;
+        g_mutex_unlock(&victim->lock);
+
+        if (taken > 0) {
+            g_mutex_lock(&own->lock);
+            *file = start;
+            own->head = start + 1;
+            own->tail = start + taken;
+            g_mutex_unlock(&own->lock);
+            return TRUE;
+        }
+    }
+}
+
+static void find_job_work(FindJob *job, guint self) {
+    GArray *batch = g_array_new(FALSE, FALSE, sizeof(FindResult));
+    guint file;
+
+    while (!g_atomic_int_get(&job->cancelled) && find_job_next(job, self, &file)) {
+        if (!find_job_search_file(job, job->files->pdata[file], batch)) {
+            break;
+        }
+    }
+
+    find_job_flush(job, batch);
+    g_array_free(batch, TRUE);
+}
+
+static gpointer find_job_worker(gpointer data) {
+    FindWorker *worker = (FindWorker *)data;
+
+    find_job_work(worker->job, worker->index);
+    g_free(worker);
+    return NULL;
+}
+
+// Job thread: list the files if needed, then search them with the help of
+// a worker per extra processor
+static gpointer find_job_run(gpointer data) {
+    FindJob *job = (FindJob *)data;
+    GThread **threads;
+    guint n_files;
+
+    if (!job->files) {
+        job->files = file_index_list_files(job->root, &job->cancelled);
+    }
+
+    n_files = job->files->len;
+    job->n_workers = CLAMP(g_get_num_processors(), 1, MAX(n_files, 1));
+    job->queues = g_new0(FindQueue, job->n_workers);
+    for (guint i = 0; i < job->n_workers; i++) {
+        g_mutex_init(&job->queues[i].lock);
+        job->queues[i].head = (guint)((guint64)n_files * i / job->n_workers);
+        job->queues[i].tail = (guint)((guint64)n_files * (i + 1) / job->n_workers);
+    }
+
+    threads = g_new0(GThread *, job->n_workers);
+    for (guint i = 1; i < job->n_workers; i++) {
+        FindWorker *worker = g_new(FindWorker, 1);
+
+        worker->job = job;
+        worker->index = i;
+        threads[i] = g_thread_new("find-files", find_job_worker, worker);
+    }
+
+    find_job_work(job, 0);
+
+    for (guint i = 1; i < job->n_workers; i++) {
+        g_thread_join(threads[i]);
+    }
+    g_free(threads);
+
+    g_mutex_lock(&job->lock);
+    job->done = TRUE;
+    g_mutex_unlock(&job->lock);
+
+    find_job_unref(job);
+    return NULL;
+}
+
+// Literal strings every match of pattern contains, or NULL if that can't
+// be told
+static gchar **find_files_regex_literals(const gchar *pattern) {
+    GPtrArray *literals = g_ptr_array_new();
+    GString *current = g_string_new(NULL);
+    const gchar *p = pattern;
+    gint depth = 0;
+
+    // Alternatives make every literal optional, and options such as (?i)
+    // change what they match
+    if (strchr(pattern, '|') || strstr(pattern, "(?")) {
+        g_ptr_array_free(literals, TRUE);
+        g_string_free(current, TRUE);
+        return NULL;
+    }
+
+    while (*p) {
+        const gchar *next;
+        gboolean literal = FALSE;
+
+        if (*p == '\\' && p[1]) {
+            // Escaped punctuation is the character itself; classes and
+            // anchors end the literal. Other escapes are refused.
+            if (g_ascii_ispunct(p[1])) {
+                literal = TRUE;
+            } else if (!strchr("dDwWsSbBntr", p[1])) {
+                g_ptr_array_free(literals, TRUE);
+                g_string_free(current, TRUE);
+                return NULL;
+            }
+            p++;
+        } else if (*p == '[') {
+            // Skip the class, where ] first is a member
+            p++;
+            if (*p == '^') {
+                p++;
+            }
+            if (*p == ']') {
+                p++;
+            }
+            while (*p && *p != ']') {
+                p += (*p == '\\' && p[1]) ? 2 : 1;
+            }
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            depth = MAX(depth - 1, 0);
+        } else if (*p == '{') {
+            while (*p && *p != '}') {
+                p++;
+            }
+        } else if (*p && !strchr(".^$*+?", *p)) {
+            literal = TRUE;
+        }
+
+        next = *p ? g_utf8_next_char(p) : p;
+
+        // Groups may be optional, and so is a character followed by *, ?
+        // or {0,...}; one followed by + is there at least once
+        if (literal && depth == 0 && !(*next && strchr("*?{", *next))) {
+            g_string_append_len(current, p, next - p);
+            literal = *next != '+';
+        } else {
+            literal = FALSE;
+        }
+
+        if (!literal && current->len > 0) {
+            g_ptr_array_add(literals, g_string_free(current, FALSE));
+            current = g_string_new(NULL);
+        }
+        p = next;
+    }
+
+    if (current->len > 0) {
+        g_ptr_array_add(literals, g_string_free(current, FALSE));
+    } else {
+        g_string_free(current, TRUE);
+    }
+    g_ptr_array_add(literals, NULL);
+    return (gchar **)g_ptr_array_free(literals, FALSE);
+}
+
+// Show the number of results, and where the files came from once done
+static void find_files_update_label(FindFiles *find, guint n_files) {
+    gint n_rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(find->store), NULL);
+    gchar *text;
+
+    if (find->job) {
+        text = g_strdup_printf("%d results…", n_rows);
+    } else {
+        gint64 elapsed = (g_get_monotonic_time() - find->started) / 1000;
+
+        text = g_strdup_printf("%d%s results in %u files searched, %" G_GINT64_FORMAT " ms%s",
+                               n_rows, n_rows >= FIND_FILES_MAX_RESULTS ? "+" : "", n_files,
+                               elapsed, find->from_index ? " (indexed)" : "");
+    }
+
+    gtk_label_set_text(GTK_LABEL(find->status_label), text);
+    g_free(text);
+}
+
+// Stop the running search, keeping the results found so far
+static void find_files_stop(FindFiles *find) {
+    if (find->poll_id) {
+        g_source_remove(find->poll_id);
+        find->poll_id = 0;
+    }
+    if (find->job) {
+        g_atomic_int_set(&find->job->cancelled, 1);
+        find_job_unref(find->job);
+        find->job = NULL;
+    }
+}
+
+// Timeout callback: add the results found since the last call
+static gboolean find_files_poll(gpointer data) {
+    FindFiles *find = (FindFiles *)data;
+    FindJob *job = find->job;
+    gsize root_length = strlen(job->root);
+    GArray *found;
+    gboolean done;
+
+    g_mutex_lock(&job->lock);
+    found = job->found;
+    job->found = g_array_new(FALSE, FALSE, sizeof(FindResult));
+    g_array_set_clear_func(job->found, find_result_clear);
+    done = job->done;
+    g_mutex_unlock(&job->lock);
+
+    for (guint i = 0; i < found->len; i++) {
+        const FindResult *result = &g_array_index(found, FindResult, i);
+        const gchar *name = result->path + root_length;
+
+        while (G_IS_DIR_SEPARATOR(*name)) {
+            name++;
+        }
+        gtk_list_store_insert_with_values(find->store, NULL, -1,
+                                          COLUMN_PATH, result->path,
+                                          COLUMN_NAME, name,
+                                          COLUMN_LINE, result->line,
+                                          COLUMN_TEXT, result->text,
+                                          -1);
+    }
+    g_array_free(found, TRUE);
+
+    if (done) {
+        guint n_searched = (guint)g_atomic_int_get(&job->n_searched);
+
+        find_job_unref(job);
+        find->job = NULL;
+        find->poll_id = 0;
+        find_files_update_label(find, n_searched);
+    } else {
+        find_files_update_label(find, 0);
+    }
+
+    return done ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+// Search the folder for the entry's text, replacing any running search
+static void find_files_start(FindFiles *find) {
+    const gchar *needle = gtk_entry_get_text(GTK_ENTRY(find->entry));
+    gchar *root = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(find->folder_button));
+    GRegex *regex = NULL;
+    GError *error = NULL;
+    FindJob *job;
+
+    find_files_stop(find);
+    gtk_list_store_clear(find->store);
+    gtk_widget_set_tooltip_text(find->status_label, NULL);
+    gtk_label_set_text(GTK_LABEL(find->status_label), "");
+
+    if (*needle == '\0' || !root) {
+        g_free(root);
+        return;
+    }
+
+    // Raw, so files that aren't valid UTF-8 are still searched
+    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(find->regex_button))) {
+        regex = regex_search_compile(needle, G_REGEX_RAW, &error);
+        if (!regex) {
+            gtk_label_set_text(GTK_LABEL(find->status_label), "Invalid pattern");
+            gtk_widget_set_tooltip_text(find->status_label, error->message);
+            g_error_free(error);
+            g_free(root);
+            return;
+        }
+    }
+
+    job = g_new0(FindJob, 1);
+    job->ref_count = 1;
+    job->root = root;
+    job->needle = g_strdup(needle);
+    job->needle_length = strlen(needle);
+    job->regex = regex;
+    job->found = g_array_new(FALSE, FALSE, sizeof(FindResult));
+    g_array_set_clear_func(job->found, find_result_clear);
+    g_mutex_init(&job->lock);
+
+    // The index is kept open, and watching the folder, between searches
+    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(find->index_button))) {
+        if (find->index && strcmp(file_index_get_root(find->index), root) != 0) {
+            file_index_free(find->index);
+            find->index = NULL;
+        }
+        if (!find->index) {
+            find->index = file_index_open(root);
+        }
+
+        if (regex) {
+            gchar **literals = find_files_regex_literals(needle);
+
+            job->files = file_index_query(find->index, (const gchar * const *)literals);
+            g_strfreev(literals);
+        } else {
+            const gchar *literals[] = { needle, NULL };
+
+            job->files = file_index_query(find->index, literals);
+        }
+    }
+
+    find->job = job;
+    find->from_index = job->files != NULL;
+    find->started = g_get_monotonic_time();
+    g_thread_unref(g_thread_new("find-files", find_job_run, find_job_ref(job)));
+    find->poll_id = g_timeout_add(FIND_FILES_POLL_INTERVAL, find_files_poll, find);
+    find_files_update_label(find, 0);
+}
+
+static void on_find_files_activate(GtkWidget *widget, gpointer data) {
+    find_files_start((FindFiles *)data);
+}
+
+// Use index toggled: stop watching the folder when it is turned off
+static void on_find_files_index_toggled(GtkToggleButton *button, gpointer data) {
+    FindFiles *find = (FindFiles *)data;
+
+    if (!gtk_toggle_button_get_active(button) && find->index) {
+        file_index_free(find->index);
+        find->index = NULL;
+    }
+}
+
+// Result activated: open its file at the matching line
+static void on_find_files_row_activated(GtkTreeView *view, GtkTreePath *path,
+                                        GtkTreeViewColumn *column, gpointer data) {
+    FindFiles *find = (FindFiles *)data;
+    TextEditor *editor = find->editor;
+    GtkTreeModel *model = gtk_tree_view_get_model(view);
+    GtkTreeIter iter;
+    gchar *filename;
+    guint line;
+
+    if (!gtk_tree_model_get_iter(model, &iter, path)) {
+        return;
+    }
+    gtk_tree_model_get(model, &iter, COLUMN_PATH, &filename, COLUMN_LINE, &line, -1);
+
+    // A file already open only needs its tab shown and the cursor moved
+    tabs_open_file(editor, filename, line - 1);
+
+    gtk_window_present(GTK_WINDOW(editor->window));
+    g_free(filename);
+}
+
+// Create the window, hidden
+static FindFiles *find_files_new(TextEditor *editor) {
+    FindFiles *find = g_new0(FindFiles, 1);
+    GtkWidget *vbox, *folder_box, *query_box, *find_button, *scrolled_window, *view;
+    gchar *folder;
+
+    find->editor = editor;
+
+    find->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(find->window), "Find in Files");
+    gtk_window_set_transient_for(GTK_WINDOW(find->window), GTK_WINDOW(editor->window));
+    gtk_window_set_default_size(GTK_WINDOW(find->window), 700, 450);
+    g_signal_connect(find->window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+    // Start in the folder of the open file
+    find->folder_button = gtk_file_chooser_button_new("Select a Folder",
+                                                      GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+    folder = editor->current_filename ? g_path_get_dirname(editor->current_filename)
+                                      : g_get_current_dir();
+    gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(find->folder_button), folder);
+    g_free(folder);
+
+    find->index_button = gtk_check_button_new_with_mnemonic("Use _index");
+    gtk_widget_set_tooltip_text(find->index_button,
+                                "Keep an index of the folder so that searches only read "
+                                "the files that may match");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(find->index_button), TRUE);
+    g_signal_connect(find->index_button, "toggled", G_CALLBACK(on_find_files_index_toggled), find);
+
+    folder_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(folder_box), find->folder_button, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(folder_box), find->index_button, FALSE, FALSE, 0);
+
+    find->entry = gtk_search_entry_new();
+    g_signal_connect(find->entry, "activate", G_CALLBACK(on_find_files_activate), find);
+
+    find->regex_button = gtk_toggle_button_new_with_label(".*");
+    gtk_widget_set_tooltip_text(find->regex_button, "Regular expression");
+
+    find_button = gtk_button_new_with_mnemonic("_Find");
+    g_signal_connect(find_button, "clicked", G_CALLBACK(on_find_files_activate), find);
+
+    query_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(query_box), find->entry, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(query_box), find->regex_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(query_box), find_button, FALSE, FALSE, 0);
+
+    find->status_label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(find->status_label), 0.0);
+
+    find->store = gtk_list_store_new(N_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT,
+                                      G_TYPE_STRING);
+    view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(find->store));
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "File",
+                                                gtk_cell_renderer_text_new(),
+                                                "text", COLUMN_NAME, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Line",
+                                                gtk_cell_renderer_text_new(),
+                                                "text", COLUMN_LINE, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Text",
+                                                gtk_cell_renderer_text_new(),
+                                                "text", COLUMN_TEXT, NULL);
+    gtk_tree_view_column_set_resizable(gtk_tree_view_get_column(GTK_TREE_VIEW(view), 0), TRUE);
+    g_signal_connect(view, "row-activated", G_CALLBACK(on_find_files_row_activated), find);
+
+    scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scrolled_window), view);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox), 10);
+    gtk_box_pack_start(GTK_BOX(vbox), folder_box, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), query_box, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), find->status_label, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), scrolled_window, TRUE, TRUE, 0);
+    gtk_container_add(GTK_CONTAINER(find->window), vbox);
+
+    return find;
+}
+
+void find_files_show(TextEditor *editor) {
+    FindFiles *find = editor->find_files;
+
+    if (!find) {
+        find = editor->find_files = find_files_new(editor);
+    }
+
+    gtk_widget_show_all(find->window);
+    gtk_window_present(GTK_WINDOW(find->window));
+    gtk_widget_grab_focus(find->entry);
+    gtk_editable_select_region(GTK_EDITABLE(find->entry), 0, -1);
+}
+
+void find_files_cleanup(TextEditor *editor) {
+    FindFiles *find = editor->find_files;
+
+    if (!find) {
+        return;
+    }
+
+    find_files_stop(find);
+    file_index_free(find->index);
+    gtk_widget_destroy(find->window);
+    g_object_unref(find->store);
+    g_free(find);
+    editor->find_files = NULL;
+}
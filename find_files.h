@@ -0,0 +1,24 @@
+/*
+ * Find in Files
+ *
+ * A separate, non-modal window that searches every text file under a
+ * folder, as plain text or as a regular expression. Files are searched
+ * mapped into memory by a pool of threads that steal work from each other,
+ * and each matching line is added to the list as soon as it is found.
+ * Activating a result opens the file at that line. With "Use index", the
+ * files to search come from a trigram index of the folder (see
+ * file_index.h), which leaves out the ones that can't contain a match.
+ */
+
+#ifndef FIND_FILES_H
+#define FIND_FILES_H
+
+#include "editor.h"
+
+// Show the Find in Files window, creating it on first use
+void find_files_show(TextEditor *editor);
+
+// Stop the running search, close the index and destroy the window
+void find_files_cleanup(TextEditor *editor);
+
+#endif // FIND_FILES_H
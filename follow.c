@@ -0,0 +1,342 @@
+/*
+ * Follow mode for growing log files
+ *
+ * The file is kept open and read with pread() from the last offset, at most
+ * FOLLOW_BATCH_SIZE bytes per idle run, so each update costs in proportion
+ * to what was appended. A file that shrinks was truncated in place: the
+ * buffer no longer matches it and its mapping may reach past the new end,
+ * so following stops and the file is opened again. When the name refers to
+ * a new file (rename and create rotation) the old one is read to its end
+ * before switching.
+ */
+
+#include "follow.h"
+#include "journal.h"
+#include "status.h"
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FOLLOW_BATCH_SIZE (256 * 1024)  // Bytes read and inserted per idle run
+#define FOLLOW_RATE_LIMIT 100           // Milliseconds between change notifications
+
+struct _Follow {
+    TextEditor *editor;
+    gchar *filename;
+    GFileMonitor *monitor;
+    int fd;                 // The file being read, kept open across a rotation
+    dev_t dev;
+    ino_t ino;
+    guint64 offset;         // Bytes of it already in the buffer
+    gchar carry[4];         // Start of a character cut at the end of the last read
+    gsize carried;
+    gsize max_lines;
+    GtkTextMark *end_mark;
+    guint idle_id;
+};
+
+// Scrollback limit in lines, 0 for none
+static gsize follow_get_max_lines(void) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_FOLLOW_MAX_LINES");
+
+    if (setting && *setting) {
+        return g_ascii_strtoull(setting, NULL, 10);
+    }
+    return FOLLOW_DEFAULT_MAX_LINES;
+}
+
+// Open the file at follow->filename, replacing the one being read
+static gboolean follow_open_file(Follow *follow, GError **error) {
+    struct stat st;
+    int fd = open(follow->filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        int saved_errno = errno;
+
+        if (fd >= 0) {
+            close(fd);
+        }
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                    "%s", g_strerror(saved_errno));
+        return FALSE;
+    }
+
+    if (follow->fd >= 0) {
+        close(follow->fd);
+    }
+    follow->fd = fd;
+    follow->dev = st.st_dev;
+    follow->ino = st.st_ino;
+    follow->offset = 0;
+    follow->carried = 0;
+    return TRUE;
+}
+
+// Whether the view shows the end of the buffer
+static gboolean follow_at_end(Follow *follow) {
+    GtkAdjustment *adjustment = gtk_scrolled_window_get_vadjustment(
+        GTK_SCROLLED_WINDOW(follow->editor->scrolled_window));
+
+    return gtk_adjustment_get_value(adjustment) + gtk_adjustment_get_page_size(adjustment) >=
+           gtk_adjustment_get_upper(adjustment) - 1.0;
+}
+
+// Drop the oldest lines beyond the scrollback limit. They go an eighth of
+// the limit at a time, so the cost is spread over many appends. What was
+// dropped is counted, as the buffer no longer holds the whole file.
+static void follow_trim(Follow *follow) {
+    TextEditor *editor = follow->editor;
+    gsize lines = line_table_get_line_count(editor->lines);
+    gsize length = piece_table_get_length(editor->document);
+    GtkTextIter start, cut;
+
+    if (follow->max_lines == 0 || lines <= follow->max_lines + follow->max_lines / 8) {
+        return;
+    }
+
+    gtk_text_buffer_get_start_iter(editor->text_buffer, &start);
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &cut,
+        (gint)line_table_get_line_start(editor->lines, lines - follow->max_lines));
+    gtk_text_buffer_delete(editor->text_buffer, &start, &cut);
+    editor->follow_dropped += length - piece_table_get_length(editor->document);
+    editor->follow_dropped_lines += lines - follow->max_lines;
+
+    // The dropped text would otherwise stay in the piece table's add buffer
+    piece_table_compact(editor->document);
+}
+
+// Add text at the end of the buffer, keeping the end in view if it was
+static void follow_append(Follow *follow, const gchar *text, gsize length) {
+    TextEditor *editor = follow->editor;
+    gboolean at_end = follow_at_end(follow);
+    gchar *valid = NULL;
+    GtkTextIter end;
+
+    // A stray invalid byte in a log shouldn't stop it from being followed
+    if (encoding_validate_utf8(text, length) != length) {
+        valid = g_utf8_make_valid(text, length);
+        text = valid;
+        length = strlen(valid);
+    }
+
+    gtk_text_buffer_get_end_iter(editor->text_buffer, &end);
+    gtk_text_buffer_insert(editor->text_buffer, &end, text, length);
+    follow_trim(follow);
+    status_update(editor, STATUS_FILE);
+
+    if (at_end) {
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view), follow->end_mark,
+                                     0.0, TRUE, 0.0, 1.0);
+    }
+
+    g_free(valid);
+}
+
+// Read the next batch of new bytes into the buffer. Returns TRUE while
+// there is more to read before reaching size.
+static gboolean follow_read(Follow *follow, guint64 size) {
+    gsize wanted = (gsize)MIN((guint64)FOLLOW_BATCH_SIZE, size - follow->offset);
+    gchar *buffer = g_malloc(follow->carried + wanted);
+    gsize length, complete;
+    gssize n;
+
+    memcpy(buffer, follow->carry, follow->carried);
+    n = pread(follow->fd, buffer + follow->carried, wanted, (off_t)follow->offset);
+    if (n <= 0) {
+        g_free(buffer);
+        return FALSE;
+    }
+
+    follow->offset += n;
+    length = follow->carried + n;
+    complete = encoding_utf8_complete_length(buffer, length);
+    follow->carried = length - complete;
+    memcpy(follow->carry, buffer + complete, follow->carried);
+
+    if (complete > 0) {
+        follow_append(follow, buffer, complete);
+    }
+
+    g_free(buffer);
+    return follow->offset < size;
+}
+
+// Idle callback: catch up with the file a batch at a time
+static gboolean follow_idle(gpointer data) {
+    Follow *follow = (Follow *)data;
+    TextEditor *editor = follow->editor;
+    struct stat st;
+
+    if (fstat(follow->fd, &st) != 0) {
+        follow->idle_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    // Shorter than what was read: truncated in place, as by copytruncate.
+    // The document may still map the old end of the file, which can't be
+    // touched any more, so it is replaced by the file read again.
+    if ((guint64)st.st_size < follow->offset) {
+        gchar *filename = g_strdup(follow->filename);
+
+        follow->idle_id = 0;
+        follow_stop(editor);
+        editor_open_file(editor, filename, 0);
+        editor_set_status(editor, "File truncated and opened again, no longer following it");
+        g_free(filename);
+        return G_SOURCE_REMOVE;
+    }
+
+    if ((guint64)st.st_size > follow->offset && follow_read(follow, st.st_size)) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    // Caught up. If the name now refers to another file the log was rotated,
+    // and the new file is read from its start.
+    if (stat(follow->filename, &st) == 0 &&
+        (st.st_dev != follow->dev || st.st_ino != follow->ino) &&
+        follow_open_file(follow, NULL)) {
+        editor_set_status(editor, "File rotated, following the new file");
+        return G_SOURCE_CONTINUE;
+    }
+
+    follow->idle_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// Monitor callback: anything happening to the file may mean new data
+static void on_followed_file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                     GFileMonitorEvent event, gpointer data) {
+    Follow *follow = (Follow *)data;
+
+    if (follow->idle_id == 0) {
+        follow->idle_id = g_idle_add(follow_idle, follow);
+    }
+}
+
+gboolean follow_start(TextEditor *editor, GError **error) {
+    Follow *follow;
+    GFile *file;
+    GtkTextIter end;
+    gsize bom_length;
+    gchar *basename, *status;
+
+    if (editor->follow) {
+        return TRUE;
+    }
+
+    if (editor->loader || editor->saver) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                    "Wait until the file has finished loading or saving");
+        return FALSE;
+    }
+    if (editor->viewport) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Files opened in large-file mode can't be followed");
+        return FALSE;
+    }
+    if (!editor->current_filename) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "There is no file to follow");
+        return FALSE;
+    }
+    if (editor->modified) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Save or discard the changes before following the file");
+        return FALSE;
+    }
+    if (!encoding_is_utf8(editor->encoding) || editor->compression != COMPRESSION_NONE) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Only uncompressed UTF-8 files can be followed");
+        return FALSE;
+    }
+    // Invalid bytes were replaced, so the text is no longer as long as the
+    // file and where to read from can't be told from it
+    if (editor->encoding.repaired) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Save the file first: its invalid UTF-8 was replaced");
+        return FALSE;
+    }
+
+    follow = g_new0(Follow, 1);
+    follow->editor = editor;
+    follow->filename = g_strdup(editor->current_filename);
+    follow->fd = -1;
+
+    if (!follow_open_file(follow, error)) {
+        g_free(follow->filename);
+        g_free(follow);
+        return FALSE;
+    }
+
+    file = g_file_new_for_path(follow->filename);
+    follow->monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, error);
+    g_object_unref(file);
+    if (!follow->monitor) {
+        close(follow->fd);
+        g_free(follow->filename);
+        g_free(follow);
+        return FALSE;
+    }
+    g_file_monitor_set_rate_limit(follow->monitor, FOLLOW_RATE_LIMIT);
+    g_signal_connect(follow->monitor, "changed", G_CALLBACK(on_followed_file_changed), follow);
+
+    // The buffer holds the file as it was opened or last saved, or what was
+    // left of it when following last stopped
+    encoding_get_bom(editor->encoding, &bom_length);
+    follow->offset = bom_length + editor->follow_dropped +
+                     piece_table_get_length(editor->document);
+    follow->max_lines = follow_get_max_lines();
+
+    gtk_text_buffer_get_end_iter(editor->text_buffer, &end);
+    follow->end_mark = gtk_text_buffer_create_mark(editor->text_buffer, NULL, &end, FALSE);
+
+    // What gets appended is already on disk, so there is nothing to journal
+    // or undo
+    journal_close(editor, TRUE);
+    undo_clear(editor);
+    editor->follow = follow;
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+
+    basename = g_path_get_basename(follow->filename);
+    status = g_strdup_printf("Following %s", basename);
+    editor_set_status(editor, status);
+    g_free(status);
+    g_free(basename);
+
+    // Catch up with anything written since the file was read
+    follow->idle_id = g_idle_add(follow_idle, follow);
+    return TRUE;
+}
+
+void follow_stop(TextEditor *editor) {
+    Follow *follow = editor->follow;
+
+    if (!follow) {
+        return;
+    }
+
+    editor->follow = NULL;
+
+    if (follow->idle_id) {
+        g_source_remove(follow->idle_id);
+    }
+    g_file_monitor_cancel(follow->monitor);
+    g_object_unref(follow->monitor);
+    close(follow->fd);
+
+    gtk_text_buffer_delete_mark(editor->text_buffer, follow->end_mark);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), TRUE);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(editor->follow_item), FALSE);
+
+    g_free(follow->filename);
+    g_free(follow);
+
+    // Edits from here on are the user's again. A journal of edits to the
+    // end of the file alone couldn't be replayed onto the file.
+    if (editor->follow_dropped == 0) {
+        journal_start(editor);
+    }
+}
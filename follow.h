@@ -0,0 +1,32 @@
+/*
+ * Follow mode for growing log files
+ *
+ * While following, the current file is watched with a GFileMonitor and
+ * whatever is appended to it is read (only the new bytes) and added at the
+ * end of the buffer, like tail -F. Rotation is followed to the new file, a
+ * truncated file is opened again (and no longer followed), and the oldest
+ * lines are dropped once the buffer holds more than the scrollback limit.
+ * The document is read-only while following.
+ */
+
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include "editor.h"
+
+// Lines kept while following. Can be overridden with the
+// TEXT_EDITOR_FOLLOW_MAX_LINES environment variable (0 for no limit).
+#define FOLLOW_DEFAULT_MAX_LINES 200000
+
+// Start following the current file. Fails if there is none, or if it
+// isn't shown as is (unsaved changes, large-file mode, another encoding or
+// compression, invalid UTF-8 replaced).
+gboolean follow_start(TextEditor *editor, GError **error);
+
+// Stop following, leaving the buffer as it is and editable again. If old
+// lines were dropped, the buffer holds only the end of the file, as
+// editor->follow_dropped tells; it isn't journaled then and can't be saved
+// over the file. Following again carries on from where it stopped.
+void follow_stop(TextEditor *editor);
+
+#endif // FOLLOW_H
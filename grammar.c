@@ -0,0 +1,443 @@
+/*
+ * Syntax highlighting grammars
+ *
+ * Hand-written tokenizers for C (and C++), JSON and log files. They look
+ * at each byte once and allocate nothing but spans, so re-lexing the few
+ * lines around an edit costs next to nothing. Word lists are sorted (by
+ * strcmp) and binary searched.
+ */
+
+#include "grammar.h"
+
+#include <string.h>
+
+// ---- Helpers ----
+
+static void grammar_add(GArray *spans, gsize start, gsize end, GrammarStyle style) {
+    GrammarSpan span = { (guint)start, (guint)end, style };
+
+    if (end > start) {
+        g_array_append_val(spans, span);
+    }
+}
+
+static gboolean grammar_is_word_start(gchar c) {
+    return g_ascii_isalpha(c) || c == '_';
+}
+
+static gboolean grammar_is_word(gchar c) {
+    return g_ascii_isalnum(c) || c == '_';
+}
+
+static gboolean grammar_is_blank(gchar c) {
+    return c == ' ' || c == '\t';
+}
+
+// Whether the length bytes at word are one of the n sorted words
+static gboolean grammar_is_one_of(const gchar *word, gsize length,
+                                  const gchar *const *words, gsize n) {
+    gsize low = 0, high = n;
+
+    while (low < high) {
+        gsize middle = (low + high) / 2;
+        gint cmp = strncmp(words[middle], word, length);
+
+        if (cmp == 0 && words[middle][length] != '\0') {
+            cmp = 1;
+        }
+        if (cmp == 0) {
+            return TRUE;
+        }
+        if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return FALSE;
+}
+
+// End of the string or character literal whose body starts at i, just past
+// the closing quote, or length if it isn't closed on this line. *continued
+// is set when the line ends in a backslash inside it.
+static gsize grammar_scan_string(const gchar *text, gsize length, gsize i, gchar quote,
+                                 gboolean *continued) {
+    *continued = FALSE;
+
+    while (i < length) {
+        if (text[i] == '\\') {
+            if (i + 1 == length) {
+                *continued = TRUE;
+                return length;
+            }
+            i += 2;
+        } else if (text[i++] == quote) {
+            return i;
+        }
+    }
+    return length;
+}
+
+// Offset just past the "*/" at or after i, or 0 if there is none
+static gsize grammar_find_comment_end(const gchar *text, gsize length, gsize i) {
+    for (; i + 1 < length; i++) {
+        if (text[i] == '*' && text[i + 1] == '/') {
+            return i + 2;
+        }
+    }
+    return 0;
+}
+
+// ---- C ----
+
+enum {
+    C_NORMAL,
+    C_COMMENT,                  // Inside /* */
+    C_STRING                    // Inside a string continued with a backslash
+};
+
+static const gchar *const c_keywords[] = {
+    "_Alignas", "_Alignof", "_Atomic", "_Generic", "_Noreturn", "_Static_assert",
+    "_Thread_local", "alignas", "alignof", "asm", "auto", "break", "case", "catch",
+    "class", "const", "const_cast", "constexpr", "continue", "default", "delete", "do",
+    "dynamic_cast", "else", "enum", "explicit", "export", "extern", "for", "friend",
+    "goto", "if", "inline", "mutable", "namespace", "new", "noexcept", "operator",
+    "override", "private", "protected", "public", "register", "reinterpret_cast",
+    "restrict", "return", "sizeof", "static", "static_assert", "static_cast", "struct",
+    "switch", "template", "this", "throw", "try", "typedef", "typeid", "typename",
+    "union", "using", "virtual", "volatile", "while"
+};
+
+static const gchar *const c_types[] = {
+    "FILE", "_Bool", "_Complex", "bool", "char", "char16_t", "char32_t", "double",
+    "float", "gboolean", "gchar", "gconstpointer", "gdouble", "gint", "gint32",
+    "gint64", "goffset", "gpointer", "gsize", "gssize", "guint", "guint32", "guint64",
+    "guint8", "int", "int16_t", "int32_t", "int64_t", "int8_t", "intptr_t", "long",
+    "ptrdiff_t", "short", "signed", "size_t", "ssize_t", "uint16_t", "uint32_t",
+    "uint64_t", "uint8_t", "uintptr_t", "unsigned", "void", "wchar_t"
+};
+
+static const gchar *const c_constants[] = {
+    "EOF", "FALSE", "NULL", "TRUE", "false", "nullptr", "true"
+};
+
+// End of the number starting before i: a preprocessing number, so digits,
+// letters (hex digits, suffixes), '.', digit separators and the sign of an
+// exponent
+static gsize grammar_scan_c_number(const gchar *text, gsize length, gsize i) {
+    while (i < length) {
+        gchar c = text[i];
+        gchar previous = text[i - 1] | 0x20;
+
+        if (g_ascii_isalnum(c) || c == '.' || c == '_' || c == '\'' ||
+            ((c == '+' || c == '-') && (previous == 'e' || previous == 'p'))) {
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static guint grammar_lex_c(const gchar *text, gsize length, guint state, GArray *spans) {
+    gboolean directive_allowed = state != C_STRING;    // Nothing but blanks yet
+    gboolean include = FALSE;                          // In an #include line
+    gboolean continued;
+    gsize i = 0;
+
+    if (state == C_COMMENT) {
+        i = grammar_find_comment_end(text, length, 0);
+        if (i == 0) {
+            grammar_add(spans, 0, length, GRAMMAR_STYLE_COMMENT);
+            return C_COMMENT;
+        }
+        grammar_add(spans, 0, i, GRAMMAR_STYLE_COMMENT);
+    } else if (state == C_STRING) {
+        i = grammar_scan_string(text, length, 0, '"', &continued);
+        grammar_add(spans, 0, i, GRAMMAR_STYLE_STRING);
+        if (continued) {
+            return C_STRING;
+        }
+    }
+
+    while (i < length) {
+        gchar c = text[i];
+        gsize start = i;
+
+        if (grammar_is_blank(c)) {
+            i++;
+            continue;
+        }
+
+        if (c == '#' && directive_allowed) {
+            gsize name;
+
+            for (i++; i < length && grammar_is_blank(text[i]); i++);
+            for (name = i; i < length && grammar_is_word(text[i]); i++);
+            grammar_add(spans, start, i, GRAMMAR_STYLE_PREPROCESSOR);
+            include = (i - name == 7 && strncmp(text + name, "include", 7) == 0) ||
+                      (i - name == 6 && strncmp(text + name, "import", 6) == 0);
+            directive_allowed = FALSE;
+            continue;
+        }
+        directive_allowed = FALSE;
+
+        if (c == '/' && i + 1 < length && text[i + 1] == '/') {
+            grammar_add(spans, i, length, GRAMMAR_STYLE_COMMENT);
+            return C_NORMAL;
+        }
+
+        if (c == '/' && i + 1 < length && text[i + 1] == '*') {
+            i = grammar_find_comment_end(text, length, i + 2);
+            if (i == 0) {
+                grammar_add(spans, start, length, GRAMMAR_STYLE_COMMENT);
+                return C_COMMENT;
+            }
+            grammar_add(spans, start, i, GRAMMAR_STYLE_COMMENT);
+            continue;
+        }
+
+        if (c == '"' || c == '\'') {
+            i = grammar_scan_string(text, length, i + 1, c, &continued);
+            grammar_add(spans, start, i, GRAMMAR_STYLE_STRING);
+            if (continued && c == '"') {
+                return C_STRING;
+            }
+            continue;
+        }
+
+        // The header name of an #include
+        if (c == '<' && include) {
+            const gchar *close = memchr(text + i, '>', length - i);
+
+            i = close ? (gsize)(close - text) + 1 : length;
+            grammar_add(spans, start, i, GRAMMAR_STYLE_STRING);
+            continue;
+        }
+
+        if (g_ascii_isdigit(c) || (c == '.' && i + 1 < length && g_ascii_isdigit(text[i + 1]))) {
+            i = grammar_scan_c_number(text, length, i + 1);
+            grammar_add(spans, start, i, GRAMMAR_STYLE_NUMBER);
+            continue;
+        }
+
+        if (grammar_is_word_start(c)) {
+            for (i++; i < length && grammar_is_word(text[i]); i++);
+
+            if (grammar_is_one_of(text + start, i - start, c_keywords, G_N_ELEMENTS(c_keywords))) {
+                grammar_add(spans, start, i, GRAMMAR_STYLE_KEYWORD);
+            } else if (grammar_is_one_of(text + start, i - start, c_types, G_N_ELEMENTS(c_types))) {
+                grammar_add(spans, start, i, GRAMMAR_STYLE_TYPE);
+            } else if (grammar_is_one_of(text + start, i - start, c_constants,
+                                         G_N_ELEMENTS(c_constants))) {
+                grammar_add(spans, start, i, GRAMMAR_STYLE_CONSTANT);
+            }
+            continue;
+        }
+
+        i++;
+    }
+
+    return C_NORMAL;
+}
+
+// ---- JSON ----
+
+// Strings can't span lines in JSON, so every line starts in the same state
+static guint grammar_lex_json(const gchar *text, gsize length, guint state, GArray *spans) {
+    gboolean continued;
+    gsize i = 0;
+
+    while (i < length) {
+        gchar c = text[i];
+        gsize start = i;
+
+        if (c == '"') {
+            gsize next;
+
+            // A string followed by a colon names a member
+            i = grammar_scan_string(text, length, i + 1, '"', &continued);
+            for (next = i; next < length && grammar_is_blank(text[next]); next++);
+            grammar_add(spans, start, i, next < length && text[next] == ':' ?
+                        GRAMMAR_STYLE_KEY : GRAMMAR_STYLE_STRING);
+        } else if (c == '-' || g_ascii_isdigit(c)) {
+            for (i++; i < length && (g_ascii_isalnum(text[i]) || text[i] == '.' ||
+                                     text[i] == '+' || text[i] == '-'); i++);
+            grammar_add(spans, start, i, GRAMMAR_STYLE_NUMBER);
+        } else if (g_ascii_isalpha(c)) {
+            for (i++; i < length && g_ascii_isalpha(text[i]); i++);
+            if ((i - start == 4 && (strncmp(text + start, "true", 4) == 0 ||
+                                    strncmp(text + start, "null", 4) == 0)) ||
+                (i - start == 5 && strncmp(text + start, "false", 5) == 0)) {
+                grammar_add(spans, start, i, GRAMMAR_STYLE_CONSTANT);
+            }
+        } else {
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+// ---- Log files ----
+
+static const struct {
+    const gchar *name;
+    GrammarStyle style;
+} log_levels[] = {
+    { "CRIT",     GRAMMAR_STYLE_ERROR },
+    { "CRITICAL", GRAMMAR_STYLE_ERROR },
+    { "DEBUG",    GRAMMAR_STYLE_DEBUG },
+    { "ERR",      GRAMMAR_STYLE_ERROR },
+    { "ERROR",    GRAMMAR_STYLE_ERROR },
+    { "FATAL",    GRAMMAR_STYLE_ERROR },
+    { "FINE",     GRAMMAR_STYLE_DEBUG },
+    { "INFO",     GRAMMAR_STYLE_INFO },
+    { "NOTICE",   GRAMMAR_STYLE_INFO },
+    { "PANIC",    GRAMMAR_STYLE_ERROR },
+    { "SEVERE",   GRAMMAR_STYLE_ERROR },
+    { "TRACE",    GRAMMAR_STYLE_DEBUG },
+    { "WARN",     GRAMMAR_STYLE_WARNING },
+    { "WARNING",  GRAMMAR_STYLE_WARNING }
+};
+
+static const gchar *const log_months[] = {
+    "Apr", "Aug", "Dec", "Feb", "Jan", "Jul", "Jun", "Mar", "May", "Nov", "Oct", "Sep"
+};
+
+// Style of the log level named by the word at start, or -1. Lower case
+// names only count where they are marked out as a level ("[info]",
+// "level=warn", "error:"), not in the middle of a message.
+static gint grammar_log_level(const gchar *text, gsize length, gsize start, gsize end) {
+    gchar upper[16];
+    gboolean marked = (start > 0 && (text[start - 1] == '[' || text[start - 1] == '=')) ||
+                      (end < length && (text[end] == ']' || text[end] == ':'));
+
+    if (end - start >= sizeof(upper)) {
+        return -1;
+    }
+
+    for (gsize i = start; i < end; i++) {
+        if (!g_ascii_isupper(text[i]) && !marked) {
+            return -1;
+        }
+        upper[i - start] = g_ascii_toupper(text[i]);
+    }
+    upper[end - start] = '\0';
+
+    for (guint i = 0; i < G_N_ELEMENTS(log_levels); i++) {
+        if (strcmp(log_levels[i].name, upper) == 0) {
+            return log_levels[i].style;
+        }
+    }
+    return -1;
+}
+
+// End of a timestamp at the start of the line, or 0 if there is none. A
+// timestamp is a run of digits and date and time punctuation, with single
+// spaces between its parts ("2024-05-01 12:00:00,123"), possibly after a
+// syslog month ("May  1 12:00:00") or inside brackets.
+static gsize grammar_scan_timestamp(const gchar *text, gsize length) {
+    gsize i = 0, start, separators = 0;
+
+    if (length > 0 && text[0] == '[') {
+        i = 1;
+    }
+    if (i + 4 <= length && text[i + 3] == ' ' &&
+        grammar_is_one_of(text + i, 3, log_months, G_N_ELEMENTS(log_months))) {
+        for (i += 4; i < length && text[i] == ' '; i++);
+        separators++;
+    }
+
+    for (start = i; i < length; i++) {
+        gchar c = text[i];
+
+        if (c == '-' || c == ':' || c == '/') {
+            separators++;
+        } else if (!g_ascii_isdigit(c) && !(c && strchr(".,+TZ", c)) &&
+                   !(c == ' ' && i > start && i + 1 < length && g_ascii_isdigit(text[i + 1]))) {
+            break;
+        }
+    }
+
+    if (separators < 2 || i == start) {
+        return 0;
+    }
+    if (text[0] == '[' && i < length && text[i] == ']') {
+        i++;
+    }
+    return i;
+}
+
+static guint grammar_lex_log(const gchar *text, gsize length, guint state, GArray *spans) {
+    gboolean level_found = FALSE;
+    gboolean continued;
+    gsize i = grammar_scan_timestamp(text, length);
+
+    grammar_add(spans, 0, i, GRAMMAR_STYLE_TIMESTAMP);
+
+    while (i < length) {
+        gchar c = text[i];
+        gsize start = i;
+
+        if (c == '"') {
+            i = grammar_scan_string(text, length, i + 1, '"', &continued);
+            grammar_add(spans, start, i, GRAMMAR_STYLE_STRING);
+        } else if (g_ascii_isalpha(c)) {
+            gint style;
+
+            for (i++; i < length && g_ascii_isalpha(text[i]); i++);
+
+            // Only the first level named counts, the rest is the message
+            if (!level_found && (style = grammar_log_level(text, length, start, i)) >= 0) {
+                grammar_add(spans, start, i, style);
+                level_found = TRUE;
+            }
+        } else {
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+// ---- Table ----
+
+static const gchar *const c_patterns[] = {
+    "*.c", "*.h", "*.cc", "*.cpp", "*.cxx", "*.hh", "*.hpp", "*.hxx", "*.ino", NULL
+};
+static const gchar *const json_patterns[] = {
+    "*.json", "*.jsonl", "*.ndjson", "*.geojson", NULL
+};
+static const gchar *const log_patterns[] = {
+    "*.log", "*.log.*", "*.err", "syslog", "syslog.*", "messages", NULL
+};
+
+static const Grammar grammars[] = {
+    { "C",    c_patterns,    grammar_lex_c },
+    { "JSON", json_patterns, grammar_lex_json },
+    { "Log",  log_patterns,  grammar_lex_log }
+};
+
+const Grammar *grammar_for_file(const gchar *filename) {
+    const Grammar *found = NULL;
+    gchar *basename, *name;
+
+    if (!filename) {
+        return NULL;
+    }
+
+    basename = g_path_get_basename(filename);
+    name = g_ascii_strdown(basename, -1);
+    for (guint i = 0; !found && i < G_N_ELEMENTS(grammars); i++) {
+        for (const gchar *const *pattern = grammars[i].patterns; *pattern; pattern++) {
+            if (g_pattern_match_simple(*pattern, name)) {
+                found = &grammars[i];
+                break;
+            }
+        }
+    }
+    g_free(name);
+    g_free(basename);
+    return found;
+}
@@ -0,0 +1,58 @@
+/*
+ * Syntax highlighting grammars
+ *
+ * A grammar is a line tokenizer: given one line of text, without its line
+ * terminator, and the state the previous line ended in, it appends a span
+ * for each token worth highlighting and returns the state the line ends in
+ * (inside a block comment, say). A file starts in state 0, and states are
+ * below GRAMMAR_MAX_STATES so the highlighter can keep one per line in a
+ * few bits. Grammars only name the style of a token; how a style looks is
+ * up to the highlighter, so all grammars share the same tags.
+ *
+ * A new language is a lex_line function and an entry in the table that
+ * grammar_for_file() looks through, in grammar.c.
+ */
+
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <glib.h>
+
+#define GRAMMAR_MAX_STATES 32
+
+typedef enum {
+    GRAMMAR_STYLE_COMMENT,
+    GRAMMAR_STYLE_STRING,
+    GRAMMAR_STYLE_NUMBER,
+    GRAMMAR_STYLE_KEYWORD,
+    GRAMMAR_STYLE_TYPE,
+    GRAMMAR_STYLE_CONSTANT,
+    GRAMMAR_STYLE_PREPROCESSOR,
+    GRAMMAR_STYLE_KEY,          // Member names of JSON objects
+    GRAMMAR_STYLE_TIMESTAMP,
+    GRAMMAR_STYLE_ERROR,        // Log levels
+    GRAMMAR_STYLE_WARNING,
+    GRAMMAR_STYLE_INFO,
+    GRAMMAR_STYLE_DEBUG,
+    GRAMMAR_N_STYLES
+} GrammarStyle;
+
+typedef struct {
+    guint start;                // Byte offsets in the line
+    guint end;
+    GrammarStyle style;
+} GrammarSpan;
+
+typedef struct {
+    const gchar *name;
+    const gchar *const *patterns;   // Glob patterns of the file names it is for
+
+    // Tokenize length bytes of text starting in state, appending GrammarSpan
+    // to spans in order. Returns the state the next line starts in.
+    guint (*lex_line)(const gchar *text, gsize length, guint state, GArray *spans);
+} Grammar;
+
+// Grammar for a file, going by its name, or NULL for plain text
+const Grammar *grammar_for_file(const gchar *filename);
+
+#endif // GRAMMAR_H
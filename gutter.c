@@ -0,0 +1,371 @@
+/*
+ * Line-number gutter
+ *
+ * The lines in view are walked with the text view's own line geometry,
+ * starting from the one at the top of the area being drawn, so a frame
+ * costs the same for any length of document. Numbers are drawn digit by
+ * digit from ten layouts made once per font: nothing is laid out while
+ * scrolling, and the gutter is as wide as the widest digit times the
+ * number of digits. Numbers start from the window's first line in
+ * large-file mode, where the buffer holds only the lines around the view.
+ *
+ * Changed lines carry a tag with no looks of its own, applied to inserted
+ * text and to the character after a deletion; search matches are found by
+ * the tag the search bar puts on the matches in view. A line is marked if
+ * the tag is on any of its characters, which takes a toggle search in the
+ * buffer's tree rather than a walk over the line.
+ */
+
+#include "gutter.h"
+#include "search.h"
+#include "trace.h"
+#include "viewport.h"
+
+#define GUTTER_CHANGE_TAG   "gutter-changed"
+#define GUTTER_MIN_DIGITS   2
+#define GUTTER_PADDING      4           // Pixels on each side of the numbers
+#define GUTTER_MARKER_WIDTH 3           // Pixels of each marker strip
+#define GUTTER_CHANGE_COLOR "#f57900"
+#define GUTTER_MATCH_COLOR  "#c4a000"
+#define GUTTER_DIM_ALPHA    0.45        // Numbers other than the cursor's line
+
+struct _Gutter {
+    TextEditor *editor;
+    guint shown;                // Mask of GutterPart
+    PangoLayout *digits[10];    // NULL until first drawn with the current font
+    gint digit_width;
+    guint n_digits;             // The width is set for, 0 to set it again
+    GdkRGBA change_color;
+    GdkRGBA match_color;
+};
+
+// Make the digit layouts with the view's font
+static void gutter_make_digits(Gutter *gutter) {
+    GtkWidget *view = gutter->editor->text_view;
+
+    gutter->digit_width = 0;
+    for (guint d = 0; d < 10; d++) {
+        gchar text[2] = { (gchar)('0' + d), '\0' };
+        gint width;
+
+        gutter->digits[d] = gtk_widget_create_pango_layout(view, text);
+        pango_layout_get_pixel_size(gutter->digits[d], &width, NULL);
+        gutter->digit_width = MAX(gutter->digit_width, width);
+    }
+}
+
+static void gutter_free_digits(Gutter *gutter) {
+    for (guint d = 0; d < 10; d++) {
+        g_clear_object(&gutter->digits[d]);
+    }
+}
+
+static guint gutter_count_digits(gsize n) {
+    guint digits = 1;
+
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return MAX(digits, GUTTER_MIN_DIGITS);
+}
+
+static gint gutter_get_numbers_width(Gutter *gutter) {
+    if (!(gutter->shown & GUTTER_LINE_NUMBERS)) {
+        return 0;
+    }
+    return (gint)gutter->n_digits * gutter->digit_width + 2 * GUTTER_PADDING;
+}
+
+// Fit the width to the digits of the line count, if they changed
+static void gutter_update_width(Gutter *gutter) {
+    TextEditor *editor = gutter->editor;
+    gsize n_lines;
+    guint n_digits;
+    gint width = 0;
+
+    n_lines = editor->viewport ? viewport_get_line_count(editor)
+                               : (gsize)gtk_text_buffer_get_line_count(editor->text_buffer);
+    n_digits = gutter_count_digits(n_lines);
+    if (n_digits == gutter->n_digits) {
+        return;
+    }
+    gutter->n_digits = n_digits;
+
+    if (!gutter->digits[0]) {
+        gutter_make_digits(gutter);
+    }
+    width = gutter_get_numbers_width(gutter);
+    if (gutter->shown & (GUTTER_CHANGES | GUTTER_MATCHES)) {
+        width += 2 * GUTTER_MARKER_WIDTH;
+    }
+    gtk_text_view_set_border_window_size(GTK_TEXT_VIEW(editor->text_view),
+                                         GTK_TEXT_WINDOW_LEFT, width);
+}
+
+// Redraw the gutter only
+static void gutter_queue_draw(Gutter *gutter) {
+    GdkWindow *window = gtk_text_view_get_window(GTK_TEXT_VIEW(gutter->editor->text_view),
+                                                 GTK_TEXT_WINDOW_LEFT);
+
+    if (window) {
+        gdk_window_invalidate_rect(window, NULL, FALSE);
+    }
+}
+
+// Whether tag is on any character from start up to end
+static gboolean gutter_has_tag(const GtkTextIter *start, const GtkTextIter *end, GtkTextTag *tag) {
+    GtkTextIter iter = *start;
+
+    if (!tag) {
+        return FALSE;
+    }
+    if (gtk_text_iter_has_tag(&iter, tag)) {
+        return TRUE;
+    }
+    return gtk_text_iter_forward_to_tag_toggle(&iter, tag) &&
+           gtk_text_iter_compare(&iter, end) < 0;
+}
+
+// Draw number right-aligned against x
+static void gutter_draw_number(Gutter *gutter, cairo_t *cr, gsize number, gint x, gint y) {
+    do {
+        x -= gutter->digit_width;
+        cairo_move_to(cr, x, y);
+        pango_cairo_show_layout(cr, gutter->digits[number % 10]);
+        number /= 10;
+    } while (number > 0);
+}
+
+static void gutter_draw_marker(cairo_t *cr, const GdkRGBA *color, gint x, gint y, gint height) {
+    gdk_cairo_set_source_rgba(cr, color);
+    cairo_rectangle(cr, x, y, GUTTER_MARKER_WIDTH, height);
+    cairo_fill(cr);
+}
+
+// Draw the lines in the area to be painted
+static void gutter_draw(Gutter *gutter, cairo_t *cr) {
+    TRACE_SCOPE("gutter.draw");
+    TextEditor *editor = gutter->editor;
+    GtkTextView *view = GTK_TEXT_VIEW(editor->text_view);
+    GtkTextTagTable *tags = gtk_text_buffer_get_tag_table(editor->text_buffer);
+    GtkTextTag *change_tag = NULL, *match_tag = NULL;
+    GtkStyleContext *style = gtk_widget_get_style_context(editor->text_view);
+    GdkRectangle area;
+    GtkTextIter iter, next, cursor;
+    GdkRGBA color;
+    gint numbers_width = gutter_get_numbers_width(gutter);
+    gint top, bottom, cursor_line;
+    gsize first;
+
+    if (!gdk_cairo_get_clip_rectangle(cr, &area)) {
+        return;
+    }
+    if ((gutter->shown & GUTTER_LINE_NUMBERS) && !gutter->digits[0]) {
+        gutter_make_digits(gutter);
+    }
+    if (gutter->shown & GUTTER_CHANGES) {
+        change_tag = gtk_text_tag_table_lookup(tags, GUTTER_CHANGE_TAG);
+    }
+    if (gutter->shown & GUTTER_MATCHES) {
+        match_tag = gtk_text_tag_table_lookup(tags, SEARCH_MATCH_TAG);
+    }
+
+    gtk_style_context_get_color(style, gtk_style_context_get_state(style), &color);
+    gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &cursor,
+                                     gtk_text_buffer_get_insert(editor->text_buffer));
+    cursor_line = gtk_text_iter_get_line(&cursor);
+    first = editor->viewport ? viewport_get_first_line(editor) : 0;
+
+    gtk_text_view_window_to_buffer_coords(view, GTK_TEXT_WINDOW_LEFT, 0, area.y, NULL, &top);
+    bottom = top + area.height;
+    gtk_text_view_get_line_at_y(view, &iter, top, NULL);
+
+    while (TRUE) {
+        gint line = gtk_text_iter_get_line(&iter);
+        gint y, height, window_y;
+        gboolean last;
+
+        gtk_text_view_get_line_yrange(view, &iter, &y, &height);
+        if (y >= bottom) {
+            break;
+        }
+        gtk_text_view_buffer_to_window_coords(view, GTK_TEXT_WINDOW_LEFT, 0, y, NULL, &window_y);
+
+        next = iter;
+        last = !gtk_text_iter_forward_line(&next);
+
+        if (gutter->shown & GUTTER_LINE_NUMBERS) {
+            color.alpha = line == cursor_line ? 1.0 : GUTTER_DIM_ALPHA;
+            gdk_cairo_set_source_rgba(cr, &color);
+            gutter_draw_number(gutter, cr, first + line + 1, numbers_width - GUTTER_PADDING,
+                               window_y);
+        }
+        if (gutter_has_tag(&iter, &next, match_tag)) {
+            gutter_draw_marker(cr, &gutter->match_color, numbers_width, window_y, height);
+        }
+        if (gutter_has_tag(&iter, &next, change_tag)) {
+            gutter_draw_marker(cr, &gutter->change_color, numbers_width + GUTTER_MARKER_WIDTH,
+                               window_y, height);
+        }
+
+        if (last) {
+            break;
+        }
+        iter = next;
+    }
+}
+
+// Text view draw callback, after the view has painted the border window's
+// background
+static gboolean on_gutter_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+    Gutter *gutter = (Gutter *)data;
+    GdkWindow *window = gtk_text_view_get_window(GTK_TEXT_VIEW(widget), GTK_TEXT_WINDOW_LEFT);
+
+    if (!window || !gtk_cairo_should_draw_window(cr, window)) {
+        return FALSE;
+    }
+
+    cairo_save(cr);
+    gtk_cairo_transform_to_window(cr, widget, window);
+    gutter_draw(gutter, cr);
+    cairo_restore(cr);
+    return FALSE;
+}
+
+// The font may have changed: lay the digits out again
+static void on_gutter_style_updated(GtkWidget *widget, gpointer data) {
+    Gutter *gutter = (Gutter *)data;
+
+    gutter_free_digits(gutter);
+    gutter->n_digits = 0;
+    gutter_update_width(gutter);
+}
+
+// Another document is shown
+static void on_gutter_buffer_set(GObject *view, GParamSpec *pspec, gpointer data) {
+    gutter_update_width((Gutter *)data);
+}
+
+// Buffer changed callback: the line count may have another digit
+static void on_gutter_buffer_changed(GtkTextBuffer *buffer, gpointer data) {
+    Gutter *gutter = (Gutter *)data;
+
+    if (buffer == gutter->editor->text_buffer) {
+        gutter_update_width(gutter);
+    }
+}
+
+// Whether edits of the buffer in view are the user's (see on_text_changed)
+static gboolean gutter_is_user_edit(Gutter *gutter, GtkTextBuffer *buffer) {
+    TextEditor *editor = gutter->editor;
+
+    return buffer == editor->text_buffer && !editor->loader && !editor->viewport &&
+           !editor->follow;
+}
+
+// Insert callback, after the default handler: mark the inserted text
+static void on_gutter_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
+                                  const gchar *text, gint length, gpointer data) {
+    GtkTextIter start = *location;
+
+    if (!gutter_is_user_edit((Gutter *)data, buffer)) {
+        return;
+    }
+
+    gtk_text_iter_backward_chars(&start, (gint)g_utf8_strlen(text, length));
+    gtk_text_buffer_apply_tag_by_name(buffer, GUTTER_CHANGE_TAG, &start, location);
+}
+
+// Delete callback, after the default handler: mark the line it happened on
+// by the character after it (its newline at the end of a line)
+static void on_gutter_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end,
+                                   gpointer data) {
+    GtkTextIter from = *start, to = *start;
+
+    if (!gutter_is_user_edit((Gutter *)data, buffer)) {
+        return;
+    }
+
+    if (!gtk_text_iter_forward_char(&to) && !gtk_text_iter_backward_char(&from)) {
+        return;
+    }
+    gtk_text_buffer_apply_tag_by_name(buffer, GUTTER_CHANGE_TAG, &from, &to);
+}
+
+// Cursor moved: the number of its line is drawn brighter
+static void on_gutter_mark_set(GtkTextBuffer *buffer, GtkTextIter *location, GtkTextMark *mark,
+                               gpointer data) {
+    Gutter *gutter = (Gutter *)data;
+
+    if (mark == gtk_text_buffer_get_insert(buffer) && buffer == gutter->editor->text_buffer &&
+        (gutter->shown & GUTTER_LINE_NUMBERS)) {
+        gutter_queue_draw(gutter);
+    }
+}
+
+void gutter_init(TextEditor *editor) {
+    Gutter *gutter = g_new0(Gutter, 1);
+
+    gutter->editor = editor;
+    gutter->shown = GUTTER_LINE_NUMBERS | GUTTER_CHANGES | GUTTER_MATCHES;
+    gdk_rgba_parse(&gutter->change_color, GUTTER_CHANGE_COLOR);
+    gdk_rgba_parse(&gutter->match_color, GUTTER_MATCH_COLOR);
+    editor->gutter = gutter;
+
+    g_signal_connect_after(editor->text_view, "draw", G_CALLBACK(on_gutter_draw), gutter);
+    g_signal_connect(editor->text_view, "style-updated", G_CALLBACK(on_gutter_style_updated),
+                     gutter);
+    g_signal_connect(editor->text_view, "notify::buffer", G_CALLBACK(on_gutter_buffer_set),
+                     gutter);
+    gutter_update_width(gutter);
+}
+
+void gutter_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer) {
+    Gutter *gutter = editor->gutter;
+
+    gtk_text_buffer_create_tag(buffer, GUTTER_CHANGE_TAG, NULL);
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_gutter_buffer_changed), gutter);
+    g_signal_connect_after(buffer, "insert-text", G_CALLBACK(on_gutter_insert_text), gutter);
+    g_signal_connect_after(buffer, "delete-range", G_CALLBACK(on_gutter_delete_range), gutter);
+    g_signal_connect(buffer, "mark-set", G_CALLBACK(on_gutter_mark_set), gutter);
+}
+
+void gutter_set_shown(TextEditor *editor, GutterPart part, gboolean shown) {
+    Gutter *gutter = editor->gutter;
+
+    if (shown) {
+        gutter->shown |= part;
+    } else {
+        gutter->shown &= ~part;
+    }
+
+    gutter->n_digits = 0;
+    gutter_update_width(gutter);
+    gutter_queue_draw(gutter);
+}
+
+gboolean gutter_get_shown(TextEditor *editor, GutterPart part) {
+    return (editor->gutter->shown & part) != 0;
+}
+
+void gutter_clear_changes(TextEditor *editor) {
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_bounds(editor->text_buffer, &start, &end);
+    gtk_text_buffer_remove_tag_by_name(editor->text_buffer, GUTTER_CHANGE_TAG, &start, &end);
+}
+
+void gutter_cleanup(TextEditor *editor) {
+    Gutter *gutter = editor->gutter;
+
+    if (!gutter) {
+        return;
+    }
+
+    g_signal_handlers_disconnect_by_data(editor->text_view, gutter);
+    g_signal_handlers_disconnect_by_data(editor->text_buffer, gutter);
+    gutter_free_digits(gutter);
+    g_free(gutter);
+    editor->gutter = NULL;
+}
@@ -0,0 +1,38 @@
+/*
+ * Line-number gutter
+ *
+ * GTK 3's text view has no line numbers of its own, so they are drawn in
+ * its left border window, for the lines in view only. Beside them, markers
+ * can show the lines changed since the file was read or saved and the
+ * lines with search matches in view. Its width fits the number of digits
+ * of the line count (of the whole file in large-file mode) and only
+ * changes with it.
+ */
+
+#ifndef GUTTER_H
+#define GUTTER_H
+
+#include "editor.h"
+
+typedef enum {
+    GUTTER_LINE_NUMBERS = 1 << 0,
+    GUTTER_CHANGES      = 1 << 1,   // Marker on the lines changed
+    GUTTER_MATCHES      = 1 << 2    // Marker on the lines with search matches
+} GutterPart;
+
+// Set up the gutter of editor->text_view, with all its parts shown
+void gutter_init(TextEditor *editor);
+
+// Mark the lines edited in buffer. Called once for every document buffer.
+void gutter_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer);
+
+// Show or hide part (a GutterPart)
+void gutter_set_shown(TextEditor *editor, GutterPart part, gboolean shown);
+gboolean gutter_get_shown(TextEditor *editor, GutterPart part);
+
+// The document in view now matches its file: forget the changed lines
+void gutter_clear_changes(TextEditor *editor);
+
+void gutter_cleanup(TextEditor *editor);
+
+#endif // GUTTER_H
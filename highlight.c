@@ -0,0 +1,488 @@
+/*
+ * Syntax highlighting
+ *
+ * Every line of the buffer has a byte in highlight->lines: the lexer state
+ * it starts in and the LINE_* flags. Lines before clean_to are highlighted
+ * and the state of line clean_to is right, so lexing always carries on
+ * from there. Lexing a line gives the state of the next one; if that line
+ * isn't dirty and already starts in that state, it and the clean lines
+ * after it were lexed from the right state, and clean_to skips to the next
+ * dirty line. Lines are only inserted into and removed from the array as
+ * the buffer gains and loses them, so an edit costs a memmove of a byte
+ * per line, not a pass over the document.
+ *
+ * Dirty lines in view that clean_to hasn't reached yet are lexed from the
+ * state they have (which is right unless something above changed it) so
+ * they are coloured straight away. They stay dirty and are lexed again
+ * once clean_to gets there.
+ */
+
+#include "highlight.h"
+#include "grammar.h"
+#include "trace.h"
+
+#include <string.h>
+
+#define LINE_STATE   0x1f           // Lexer state the line starts in
+#define LINE_TAGGED  0x20           // May have highlight tags on it
+#define LINE_GUESSED 0x40           // Lexed from a state that may be wrong
+#define LINE_DIRTY   0x80           // Changed, or not lexed from the right state yet
+
+#define HIGHLIGHT_MAX_LINE     (64 * 1024)  // Bytes; longer lines are left plain
+#define HIGHLIGHT_FRAME_BUDGET 8000         // Microseconds for the lines in view
+#define HIGHLIGHT_SLICE        4000         // Microseconds per idle slice
+#define HIGHLIGHT_CHECK_EVERY  32           // Lines lexed between looks at the clock
+
+G_STATIC_ASSERT(GRAMMAR_MAX_STATES <= LINE_STATE + 1);
+
+static const struct {
+    const gchar *name;
+    const gchar *foreground;
+    PangoWeight weight;
+    PangoStyle style;
+} highlight_styles[GRAMMAR_N_STYLES] = {
+    [GRAMMAR_STYLE_COMMENT]      = { "highlight-comment",      "#888a85", PANGO_WEIGHT_NORMAL, PANGO_STYLE_ITALIC },
+    [GRAMMAR_STYLE_STRING]       = { "highlight-string",       "#4e9a06", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_NUMBER]       = { "highlight-number",       "#75507b", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_KEYWORD]      = { "highlight-keyword",      "#204a87", PANGO_WEIGHT_BOLD,   PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_TYPE]         = { "highlight-type",         "#3465a4", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_CONSTANT]     = { "highlight-constant",     "#5c3566", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_PREPROCESSOR] = { "highlight-preprocessor", "#ce5c00", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_KEY]          = { "highlight-key",          "#204a87", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_TIMESTAMP]    = { "highlight-timestamp",    "#888a85", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_ERROR]        = { "highlight-error",        "#cc0000", PANGO_WEIGHT_BOLD,   PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_WARNING]      = { "highlight-warning",      "#c4a000", PANGO_WEIGHT_BOLD,   PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_INFO]         = { "highlight-info",         "#3465a4", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL },
+    [GRAMMAR_STYLE_DEBUG]        = { "highlight-debug",        "#888a85", PANGO_WEIGHT_NORMAL, PANGO_STYLE_NORMAL }
+};
+
+struct _Highlight {
+    TextEditor *editor;
+    GtkTextBuffer *buffer;      // Of the document; not the one in view while its tab is inactive
+    const Grammar *grammar;     // NULL when not highlighting
+    GArray *lines;              // guint8 per line of the buffer; empty to start over
+    gsize clean_to;             // First line that may need lexing
+    gsize n_dirty;              // Lines with LINE_DIRTY
+    GArray *spans;              // GrammarSpan, reused for every line
+    GtkTextTag *tags[GRAMMAR_N_STYLES];     // Created on first use
+
+    guint visible_id;           // Lexing the lines in view before the next frame
+    guint idle_id;              // Lexing the rest in idle time
+};
+
+// Tag for style, shared by every line and every grammar
+static GtkTextTag *highlight_get_tag(Highlight *highlight, GrammarStyle style) {
+    if (!highlight->tags[style]) {
+        highlight->tags[style] = gtk_text_buffer_create_tag(
+            highlight->buffer, highlight_styles[style].name,
+            "foreground", highlight_styles[style].foreground,
+            "weight", highlight_styles[style].weight,
+            "style", highlight_styles[style].style, NULL);
+    }
+    return highlight->tags[style];
+}
+
+static void highlight_remove_tags(Highlight *highlight, const GtkTextIter *start,
+                                  const GtkTextIter *end) {
+    for (guint i = 0; i < GRAMMAR_N_STYLES; i++) {
+        if (highlight->tags[i]) {
+            gtk_text_buffer_remove_tag(highlight->buffer, highlight->tags[i], start, end);
+        }
+    }
+}
+
+static guint8 *highlight_line_flags(Highlight *highlight, gsize line) {
+    return &g_array_index(highlight->lines, guint8, line);
+}
+
+static void highlight_mark_dirty(Highlight *highlight, gsize line) {
+    guint8 *flags = highlight_line_flags(highlight, line);
+
+    if (!(*flags & LINE_DIRTY)) {
+        *flags |= LINE_DIRTY;
+        highlight->n_dirty++;
+    }
+    *flags &= ~LINE_GUESSED;
+}
+
+// First dirty line from line on, or the number of lines if there is none
+static gsize highlight_next_dirty(Highlight *highlight, gsize line) {
+    gsize n_lines = highlight->lines->len;
+
+    if (highlight->n_dirty == 0) {
+        return n_lines;
+    }
+    while (line < n_lines && !(*highlight_line_flags(highlight, line) & LINE_DIRTY)) {
+        line++;
+    }
+    return line;
+}
+
+// Tokenize line from state and tag it, returning the state of the next line
+static guint highlight_lex(Highlight *highlight, gsize line, guint state) {
+    GtkTextBuffer *buffer = highlight->buffer;
+    guint8 *flags = highlight_line_flags(highlight, line);
+    GtkTextIter start, end;
+    gsize length;
+    gchar *text;
+    guint next;
+
+    gtk_text_buffer_get_iter_at_line(buffer, &start, (gint)line);
+    end = start;
+    if (!gtk_text_iter_ends_line(&end)) {
+        gtk_text_iter_forward_to_line_end(&end);
+    }
+
+    if (*flags & LINE_TAGGED) {
+        highlight_remove_tags(highlight, &start, &end);
+        *flags &= ~LINE_TAGGED;
+    }
+
+    // Too long to lex between two frames (a minified file, say)
+    length = gtk_text_iter_get_line_index(&end);
+    if (length > HIGHLIGHT_MAX_LINE) {
+        return state;
+    }
+
+    text = gtk_text_iter_get_slice(&start, &end);
+    g_array_set_size(highlight->spans, 0);
+    next = highlight->grammar->lex_line(text, length, state, highlight->spans) & LINE_STATE;
+    g_free(text);
+
+    for (guint i = 0; i < highlight->spans->len; i++) {
+        const GrammarSpan *span = &g_array_index(highlight->spans, GrammarSpan, i);
+        GtkTextIter span_start = start, span_end = start;
+
+        gtk_text_iter_set_line_index(&span_start, span->start);
+        gtk_text_iter_set_line_index(&span_end, span->end);
+        gtk_text_buffer_apply_tag(buffer, highlight_get_tag(highlight, span->style),
+                                  &span_start, &span_end);
+    }
+    if (highlight->spans->len > 0) {
+        *flags |= LINE_TAGGED;
+    }
+
+    return next;
+}
+
+// Lex line clean_to and move clean_to on
+static void highlight_step(Highlight *highlight) {
+    gsize line = highlight->clean_to;
+    guint8 *flags = highlight_line_flags(highlight, line);
+    guint next = highlight_lex(highlight, line, *flags & LINE_STATE);
+
+    if (*flags & LINE_DIRTY) {
+        highlight->n_dirty--;
+    }
+    *flags &= ~(LINE_DIRTY | LINE_GUESSED);
+
+    if (++line < highlight->lines->len) {
+        flags = highlight_line_flags(highlight, line);
+
+        if (!(*flags & LINE_DIRTY) && (*flags & LINE_STATE) == next) {
+            // Converged: the following lines were lexed from the same state
+            line = highlight_next_dirty(highlight, line);
+        } else {
+            highlight_mark_dirty(highlight, line);
+            *flags = (*flags & ~LINE_STATE) | next;
+        }
+    }
+    highlight->clean_to = line;
+}
+
+// Lex from clean_to up to and including line until, or until deadline
+static void highlight_run(Highlight *highlight, gsize until, gint64 deadline) {
+    TRACE_SCOPE("highlight.run");
+
+    for (guint n = 1; highlight->clean_to < highlight->lines->len && highlight->clean_to <= until;
+         n++) {
+        highlight_step(highlight);
+        if (n % HIGHLIGHT_CHECK_EVERY == 0 && g_get_monotonic_time() >= deadline) {
+            break;
+        }
+    }
+}
+
+// Colour the dirty lines from first to last from the state they have, for
+// now
+static void highlight_guess(Highlight *highlight, gsize first, gsize last) {
+    gsize n_lines = highlight->lines->len;
+
+    for (gsize line = MAX(first, highlight->clean_to); line <= last && line < n_lines; line++) {
+        guint8 *flags = highlight_line_flags(highlight, line);
+        guint next;
+
+        if ((*flags & (LINE_DIRTY | LINE_GUESSED)) != LINE_DIRTY) {
+            continue;
+        }
+
+        next = highlight_lex(highlight, line, *flags & LINE_STATE);
+        *flags |= LINE_GUESSED;
+        if (line + 1 < n_lines) {
+            flags = highlight_line_flags(highlight, line + 1);
+            if (*flags & LINE_DIRTY) {
+                *flags = (*flags & ~LINE_STATE) | next;
+            }
+        }
+    }
+}
+
+// Drop all tags and lex every line again, from the top
+static void highlight_restart(Highlight *highlight) {
+    GtkTextBuffer *buffer = highlight->buffer;
+    gsize n_lines = gtk_text_buffer_get_line_count(buffer);
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    highlight_remove_tags(highlight, &start, &end);
+
+    // Every grammar starts a file in state 0
+    g_array_set_size(highlight->lines, n_lines);
+    memset(highlight->lines->data, LINE_DIRTY, n_lines);
+    highlight->n_dirty = n_lines;
+    highlight->clean_to = 0;
+}
+
+// Whether the buffer holds the document, so it can be highlighted. Only
+// the document in view can be loading or in large-file mode.
+static gboolean highlight_is_possible(Highlight *highlight) {
+    TextEditor *editor = highlight->editor;
+
+    return editor->highlight != highlight || (!editor->loader && !editor->viewport);
+}
+
+// Check there is something to do and the line array still matches the
+// buffer (the buffer can split lines at "\r" or U+2028 too)
+static gboolean highlight_sync(Highlight *highlight) {
+    if (!highlight->grammar || !highlight_is_possible(highlight)) {
+        return FALSE;
+    }
+    if (highlight->lines->len != (guint)gtk_text_buffer_get_line_count(highlight->buffer)) {
+        highlight_restart(highlight);
+    }
+    return TRUE;
+}
+
+static gboolean highlight_idle(gpointer data) {
+    Highlight *highlight = (Highlight *)data;
+
+    if (highlight_sync(highlight)) {
+        highlight_run(highlight, G_MAXSIZE, g_get_monotonic_time() + HIGHLIGHT_SLICE);
+        if (highlight->clean_to < highlight->lines->len) {
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    highlight->idle_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// Runs ahead of the redraw: bring the lines in view up to date, or as far
+// as the frame budget goes and guess the rest, then leave the remainder to
+// idle time
+static gboolean highlight_visible_idle(gpointer data) {
+    Highlight *highlight = (Highlight *)data;
+    GtkTextView *view = GTK_TEXT_VIEW(highlight->editor->text_view);
+    GdkRectangle visible;
+    GtkTextIter iter;
+    gsize first, last;
+
+    highlight->visible_id = 0;
+
+    if (highlight->editor->highlight != highlight || !highlight_sync(highlight)) {
+        return G_SOURCE_REMOVE;
+    }
+
+    gtk_text_view_get_visible_rect(view, &visible);
+    gtk_text_view_get_line_at_y(view, &iter, visible.y, NULL);
+    first = gtk_text_iter_get_line(&iter);
+    gtk_text_view_get_line_at_y(view, &iter, visible.y + visible.height, NULL);
+    last = gtk_text_iter_get_line(&iter);
+
+    highlight_run(highlight, last, g_get_monotonic_time() + HIGHLIGHT_FRAME_BUDGET);
+    highlight_guess(highlight, first, last);
+
+    if (highlight->clean_to < highlight->lines->len && highlight->idle_id == 0) {
+        highlight->idle_id = g_idle_add_full(G_PRIORITY_LOW, highlight_idle, highlight, NULL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Only the document in view has lines in view; the others carry on in
+// idle time
+static void highlight_schedule(Highlight *highlight) {
+    if (highlight->grammar && highlight->visible_id == 0 &&
+        highlight->editor->highlight == highlight) {
+        highlight->visible_id = g_idle_add_full(GDK_PRIORITY_REDRAW - 10, highlight_visible_idle,
+                                                highlight, NULL);
+    }
+}
+
+// Scrolled or resized: there may be new lines in view
+static void on_highlight_view_moved(gpointer object, gpointer data) {
+    highlight_schedule((Highlight *)data);
+}
+
+static void highlight_stop(Highlight *highlight) {
+    if (highlight->visible_id) {
+        g_source_remove(highlight->visible_id);
+        highlight->visible_id = 0;
+    }
+    if (highlight->idle_id) {
+        g_source_remove(highlight->idle_id);
+        highlight->idle_id = 0;
+    }
+}
+
+void highlight_init(TextEditor *editor) {
+    Highlight *highlight = g_new0(Highlight, 1);
+    GtkAdjustment *adjustment;
+
+    highlight->editor = editor;
+    highlight->buffer = editor->text_buffer;
+    highlight->lines = g_array_new(FALSE, FALSE, sizeof(guint8));
+    highlight->spans = g_array_new(FALSE, FALSE, sizeof(GrammarSpan));
+    editor->highlight = highlight;
+
+    g_signal_connect(editor->text_view, "size-allocate",
+                     G_CALLBACK(on_highlight_view_moved), highlight);
+    adjustment = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(editor->scrolled_window));
+    g_signal_connect(adjustment, "value-changed", G_CALLBACK(on_highlight_view_moved), highlight);
+}
+
+void highlight_record_insert(TextEditor *editor, const GtkTextIter *location,
+                             const gchar *text, gsize length) {
+    Highlight *highlight = editor->highlight;
+    gsize line, n_lines, added = 0;
+    guint8 *data;
+
+    if (!highlight || !highlight->grammar || highlight->lines->len == 0) {
+        return;
+    }
+
+    line = gtk_text_iter_get_line(location);
+    n_lines = highlight->lines->len;
+    if (line >= n_lines) {
+        g_array_set_size(highlight->lines, 0);
+        highlight_schedule(highlight);
+        return;
+    }
+
+    // Lines the text adds, ended by "\n", "\r\n" or "\r"
+    for (gsize i = 0; i < length; i++) {
+        if (text[i] == '\n' || (text[i] == '\r' && (i + 1 == length || text[i + 1] != '\n'))) {
+            added++;
+        }
+    }
+
+    highlight_mark_dirty(highlight, line);
+    if (added > 0) {
+        // The new lines carry on with the text, and the tags, of line
+        guint8 flags = LINE_DIRTY | (*highlight_line_flags(highlight, line) & LINE_TAGGED);
+
+        g_array_set_size(highlight->lines, n_lines + added);
+        data = (guint8 *)highlight->lines->data;
+        memmove(data + line + 1 + added, data + line + 1, n_lines - line - 1);
+        memset(data + line + 1, flags, added);
+        highlight->n_dirty += added;
+    }
+
+    highlight->clean_to = MIN(highlight->clean_to, line);
+    highlight_schedule(highlight);
+}
+
+void highlight_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end) {
+    Highlight *highlight = editor->highlight;
+    gsize first, last;
+    guint8 tagged = 0;
+
+    if (!highlight || !highlight->grammar || highlight->lines->len == 0) {
+        return;
+    }
+
+    first = gtk_text_iter_get_line(start);
+    last = gtk_text_iter_get_line(end);
+    if (last >= highlight->lines->len) {
+        g_array_set_size(highlight->lines, 0);
+        highlight_schedule(highlight);
+        return;
+    }
+
+    // The lines after first are joined onto it
+    for (gsize line = first + 1; line <= last; line++) {
+        guint8 flags = *highlight_line_flags(highlight, line);
+
+        if (flags & LINE_DIRTY) {
+            highlight->n_dirty--;
+        }
+        tagged |= flags & LINE_TAGGED;
+    }
+    if (last > first) {
+        g_array_remove_range(highlight->lines, first + 1, last - first);
+    }
+
+    *highlight_line_flags(highlight, first) |= tagged;
+    highlight_mark_dirty(highlight, first);
+    highlight->clean_to = MIN(highlight->clean_to, first);
+    highlight_schedule(highlight);
+}
+
+void highlight_reset(TextEditor *editor) {
+    Highlight *highlight = editor->highlight;
+    GtkTextIter start, end;
+
+    if (!highlight) {
+        return;
+    }
+
+    highlight_stop(highlight);
+    highlight->grammar = highlight_is_possible(highlight) ?
+                         grammar_for_file(editor->current_filename) : NULL;
+
+    if (highlight->grammar) {
+        highlight_restart(highlight);
+        highlight_schedule(highlight);
+    } else {
+        gtk_text_buffer_get_bounds(editor->text_buffer, &start, &end);
+        highlight_remove_tags(highlight, &start, &end);
+        g_array_set_size(highlight->lines, 0);
+        highlight->n_dirty = 0;
+        highlight->clean_to = 0;
+    }
+}
+
+void highlight_show(TextEditor *editor) {
+    Highlight *highlight = editor->highlight;
+
+    if (highlight) {
+        highlight_schedule(highlight);
+    }
+}
+
+void highlight_update_grammar(TextEditor *editor) {
+    Highlight *highlight = editor->highlight;
+
+    if (highlight && highlight_is_possible(highlight) &&
+        grammar_for_file(editor->current_filename) != highlight->grammar) {
+        highlight_reset(editor);
+    }
+}
+
+void highlight_cleanup(TextEditor *editor) {
+    Highlight *highlight = editor->highlight;
+    GtkAdjustment *adjustment;
+
+    if (!highlight) {
+        return;
+    }
+
+    highlight_stop(highlight);
+    g_signal_handlers_disconnect_by_data(editor->text_view, highlight);
+    adjustment = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(editor->scrolled_window));
+    g_signal_handlers_disconnect_by_data(adjustment, highlight);
+
+    g_array_free(highlight->lines, TRUE);
+    g_array_free(highlight->spans, TRUE);
+    g_free(highlight);
+    editor->highlight = NULL;
+}
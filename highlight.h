@@ -0,0 +1,43 @@
+/*
+ * Syntax highlighting
+ *
+ * The document is tokenized line by line with the grammar picked from the
+ * file name (see grammar.h), keeping the lexer state each line starts in.
+ * An edit only marks the lines it touched; they are lexed again from the
+ * first of them, and lexing stops as soon as a line starts in the same
+ * state it did before, since everything after it is unchanged. Typing
+ * therefore re-lexes a line or two whatever the size of the file, while
+ * opening a comment re-lexes down to where it closes.
+ *
+ * The lines in view are done first, just before the next frame is drawn;
+ * the rest of a newly opened file is done in idle time, a few milliseconds
+ * at a time. Tags are created once per style and shared by every line and
+ * every grammar. There is no highlighting while a file loads or in the
+ * large-file mode.
+ */
+
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include "editor.h"
+
+void highlight_init(TextEditor *editor);
+
+// Record edits about to be made to the buffer, from the insert-text and
+// delete-range handlers
+void highlight_record_insert(TextEditor *editor, const GtkTextIter *location,
+                             const gchar *text, gsize length);
+void highlight_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end);
+
+// The buffer holds another document now: pick its grammar and start over
+void highlight_reset(TextEditor *editor);
+
+// The document's tab was brought to the front: do the lines now in view
+void highlight_show(TextEditor *editor);
+
+// The file name changed, which may call for another grammar
+void highlight_update_grammar(TextEditor *editor);
+
+void highlight_cleanup(TextEditor *editor);
+
+#endif // HIGHLIGHT_H
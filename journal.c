@@ -0,0 +1,643 @@
+/*
+ * Write-ahead edit journal
+ *
+ * Journals live in <user cache>/text_editor/journal, named after a hash of
+ * the document's path. Untitled documents each take the first of "untitled",
+ * "untitled-1", ... not in use, so every tab has a journal. A journal
+ * starts with a header identifying the file it applies to (path, size,
+ * mtime and inode, all zero for an untitled buffer), followed by one record
+ * per edit:
+ *
+ *   type ('i' or 'd'), char offset, length, [inserted bytes], checksum
+ *
+ * Records are collected in memory and handed to a writer thread every
+ * JOURNAL_FLUSH_INTERVAL ms, or sooner once JOURNAL_FLUSH_THRESHOLD bytes
+ * are pending; the thread appends and fdatasync's each batch. A record cut
+ * short by a crash fails its checksum and ends the replay.
+ *
+ * The journal is locked with flock() while open so a second instance
+ * doesn't mistake it for a leftover.
+ */
+
+#include "journal.h"
+#include "loader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define JOURNAL_MAGIC           "TEJ1"
+#define JOURNAL_MAGIC_SIZE      4
+#define JOURNAL_FLUSH_INTERVAL  500            // Milliseconds between batched writes
+#define JOURNAL_FLUSH_THRESHOLD (64 * 1024)    // Pending bytes that force a write
+#define JOURNAL_RECORD_SIZE     (1 + 8 + 8)    // Record fields before the payload
+#define JOURNAL_MAX_UNTITLED    256            // Untitled journals tried before giving up
+
+typedef struct {
+    guint64 size;
+    gint64 mtime;
+    guint64 inode;
+} JournalBase;
+
+struct _Journal {
+    gchar *path;
+    int fd;
+    gboolean replaying;     // Edits come from the journal itself
+    GString *pending;       // Records not yet handed to the writer
+    GString *since_save;    // Records since journal_begin_save, NULL if not saving
+    guint flush_id;
+    GThread *writer;
+    GAsyncQueue *batches;   // GBytes to append, an empty one stops the writer
+};
+
+// FNV-1a, enough to tell a torn record from a complete one
+static guint32 journal_checksum(const gchar *data, gsize length) {
+    guint32 hash = 2166136261u;
+
+    for (gsize i = 0; i < length; i++) {
+        hash ^= (guchar)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static gchar *journal_dir(void) {
+    return g_build_filename(g_get_user_cache_dir(), "text_editor", "journal", NULL);
+}
+
+static gchar *journal_path_for_key(const gchar *key) {
+    gchar *dir = journal_dir();
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    gchar *name = g_strconcat(hash, ".journal", NULL);
+    gchar *path = g_build_filename(dir, name, NULL);
+
+    g_free(name);
+    g_free(hash);
+    g_free(dir);
+    return path;
+}
+
+// Open and lock the journal of filename, or for an untitled document the
+// first untitled journal not locked by another tab or instance. Returns the
+// descriptor and sets *path, or returns -1 with errno set.
+static int journal_lock(const gchar *filename, int flags, gchar **path) {
+    for (guint i = 0; i < (filename ? 1 : JOURNAL_MAX_UNTITLED); i++) {
+        gchar *key = filename ? g_strdup(filename)
+                   : i == 0   ? g_strdup("untitled")
+                              : g_strdup_printf("untitled-%u", i);
+        int fd;
+
+        *path = journal_path_for_key(key);
+        g_free(key);
+
+        fd = open(*path, flags | O_CLOEXEC, 0600);
+        if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            return fd;
+        }
+
+        if (fd >= 0) {
+            int saved_errno = errno;
+
+            close(fd);
+            errno = saved_errno;
+        }
+        g_free(*path);
+        *path = NULL;
+        if (errno != EWOULDBLOCK) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Identify the file the journalled edits apply to
+static gboolean journal_get_base(const gchar *filename, JournalBase *base) {
+    struct stat st;
+
+    memset(base, 0, sizeof(*base));
+    if (!filename) {
+        return TRUE;
+    }
+    if (stat(filename, &st) != 0) {
+        return FALSE;
+    }
+
+    base->size = st.st_size;
+    base->mtime = st.st_mtime;
+    base->inode = st.st_ino;
+    return TRUE;
+}
+
+static gboolean journal_write_all(int fd, const gchar *data, gsize length) {
+    while (length > 0) {
+        gssize n = write(fd, data, length);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+static void journal_write_header(int fd, const gchar *filename, const JournalBase *base) {
+    GString *header = g_string_new(JOURNAL_MAGIC);
+    guint32 path_length = filename ? strlen(filename) : 0;
+
+    g_string_append_len(header, (const gchar *)&path_length, sizeof(path_length));
+    if (filename) {
+        g_string_append_len(header, filename, path_length);
+    }
+    g_string_append_len(header, (const gchar *)base, sizeof(*base));
+
+    if (!journal_write_all(fd, header->str, header->len) || fdatasync(fd) != 0) {
+        g_warning("Failed to write edit journal: %s", g_strerror(errno));
+    }
+    g_string_free(header, TRUE);
+}
+
+// Parse the header. Returns the offset of the first record, or 0 if invalid.
+static gsize journal_parse_header(const gchar *data, gsize length,
+                                  gchar **filename, JournalBase *base) {
+    guint32 path_length;
+    gsize pos = JOURNAL_MAGIC_SIZE;
+
+    if (length < pos + sizeof(path_length) || memcmp(data, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    memcpy(&path_length, data + pos, sizeof(path_length));
+    pos += sizeof(path_length);
+
+    if (length - pos < (gsize)path_length + sizeof(*base)) {
+        return 0;
+    }
+    *filename = path_length > 0 ? g_strndup(data + pos, path_length) : NULL;
+    pos += path_length;
+
+    memcpy(base, data + pos, sizeof(*base));
+    return pos + sizeof(*base);
+}
+
+// Decode the record at *pos. Returns FALSE at the end of the journal or at a
+// torn or corrupt record.
+static gboolean journal_next_record(const gchar *data, gsize length, gsize *pos, gchar *type,
+                                    guint64 *offset, guint64 *count, const gchar **payload) {
+    const gchar *record = data + *pos;
+    gsize available = length - *pos;
+    gsize payload_length;
+    guint32 checksum;
+
+    if (available < JOURNAL_RECORD_SIZE + sizeof(checksum)) {
+        return FALSE;
+    }
+
+    *type = record[0];
+    memcpy(offset, record + 1, sizeof(*offset));
+    memcpy(count, record + 9, sizeof(*count));
+
+    if (*type == 'i') {
+        payload_length = *count;
+    } else if (*type == 'd') {
+        payload_length = 0;
+    } else {
+        return FALSE;
+    }
+
+    if (available - JOURNAL_RECORD_SIZE - sizeof(checksum) < payload_length) {
+        return FALSE;
+    }
+    memcpy(&checksum, record + JOURNAL_RECORD_SIZE + payload_length, sizeof(checksum));
+    if (checksum != journal_checksum(record, JOURNAL_RECORD_SIZE + payload_length)) {
+        return FALSE;
+    }
+
+    *payload = record + JOURNAL_RECORD_SIZE;
+    *pos += JOURNAL_RECORD_SIZE + payload_length + sizeof(checksum);
+    return TRUE;
+}
+
+// Writer thread: append batches and sync them to disk
+static gpointer journal_writer(gpointer data) {
+    Journal *journal = (Journal *)data;
+
+    for (;;) {
+        GBytes *batch = g_async_queue_pop(journal->batches);
+        gsize length;
+        const gchar *bytes = g_bytes_get_data(batch, &length);
+
+        if (length == 0) {
+            g_bytes_unref(batch);
+            break;
+        }
+
+        if (!journal_write_all(journal->fd, bytes, length) || fdatasync(journal->fd) != 0) {
+            g_warning("Failed to write edit journal: %s", g_strerror(errno));
+        }
+        g_bytes_unref(batch);
+    }
+
+    return NULL;
+}
+
+// Hand the pending records to the writer thread
+static void journal_flush(Journal *journal) {
+    if (journal->pending->len == 0) {
+        return;
+    }
+
+    g_async_queue_push(journal->batches, g_bytes_new(journal->pending->str, journal->pending->len));
+    g_string_truncate(journal->pending, 0);
+}
+
+static gboolean journal_flush_timeout(gpointer data) {
+    Journal *journal = (Journal *)data;
+
+    journal->flush_id = 0;
+    journal_flush(journal);
+    return G_SOURCE_REMOVE;
+}
+
+static void journal_append(Journal *journal, const gchar *records, gsize length) {
+    g_string_append_len(journal->pending, records, length);
+    if (journal->since_save) {
+        g_string_append_len(journal->since_save, records, length);
+    }
+
+    if (journal->pending->len >= JOURNAL_FLUSH_THRESHOLD) {
+        journal_flush(journal);
+    } else if (journal->flush_id == 0) {
+        journal->flush_id = g_timeout_add(JOURNAL_FLUSH_INTERVAL, journal_flush_timeout, journal);
+    }
+}
+
+static void journal_add_record(Journal *journal, gchar type, guint64 offset, guint64 count,
+                               const gchar *payload, gsize payload_length) {
+    GString *record = g_string_sized_new(JOURNAL_RECORD_SIZE + payload_length + sizeof(guint32));
+    guint32 checksum;
+
+    g_string_append_c(record, type);
+    g_string_append_len(record, (const gchar *)&offset, sizeof(offset));
+    g_string_append_len(record, (const gchar *)&count, sizeof(count));
+    g_string_append_len(record, payload, payload_length);
+
+    checksum = journal_checksum(record->str, record->len);
+    g_string_append_len(record, (const gchar *)&checksum, sizeof(checksum));
+
+    journal_append(journal, record->str, record->len);
+    g_string_free(record, TRUE);
+}
+
+// Apply the journalled edits to the buffer. Returns the offset after the
+// last record applied.
+static gsize journal_replay(TextEditor *editor, const gchar *data, gsize length, gsize pos) {
+    gsize end = pos;
+    gchar type;
+    guint64 offset, count;
+    const gchar *payload;
+
+    while (journal_next_record(data, length, &pos, &type, &offset, &count, &payload)) {
+        gint n_chars = gtk_text_buffer_get_char_count(editor->text_buffer);
+        GtkTextIter start, stop;
+
+        if (offset > (guint64)n_chars) {
+            break;
+        }
+
+        gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &start, offset);
+        if (type == 'i') {
+            if (!g_utf8_validate(payload, count, NULL)) {
+                break;
+            }
+            gtk_text_buffer_insert(editor->text_buffer, &start, payload, count);
+        } else {
+            if (count > (guint64)n_chars - offset) {
+                break;
+            }
+            gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &stop, offset + count);
+            gtk_text_buffer_delete(editor->text_buffer, &start, &stop);
+        }
+        end = pos;
+    }
+
+    return end;
+}
+
+// Ask whether to replay a leftover journal
+static gboolean journal_ask_recover(TextEditor *editor) {
+    GtkWidget *dialog;
+    gchar *name;
+    gint response;
+
+    name = editor->current_filename ? g_path_get_basename(editor->current_filename)
+                                    : g_strdup("Untitled");
+    dialog = gtk_message_dialog_new(GTK_WINDOW(editor->window),
+                                    GTK_DIALOG_MODAL,
+                                    GTK_MESSAGE_QUESTION,
+                                    GTK_BUTTONS_NONE,
+                                    "Unsaved changes to %s from a previous session were found. Recover them?",
+                                    name);
+    gtk_dialog_add_buttons(GTK_DIALOG(dialog),
+                           "_Discard", GTK_RESPONSE_NO,
+                           "_Recover", GTK_RESPONSE_YES,
+                           NULL);
+
+    response = gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+    g_free(name);
+
+    return response == GTK_RESPONSE_YES;
+}
+
+// Replay a leftover journal for the current document if the user wants it.
+// Returns the length of the journal to keep, or 0 to start over.
+static gsize journal_try_recover(TextEditor *editor, Journal *journal, const JournalBase *base) {
+    gchar *contents = NULL, *filename = NULL;
+    gsize length, pos, probe, end = 0;
+    JournalBase recorded;
+    gchar type;
+    guint64 offset, count;
+    const gchar *payload;
+
+    if (!g_file_get_contents(journal->path, &contents, &length, NULL)) {
+        return 0;
+    }
+
+    pos = journal_parse_header(contents, length, &filename, &recorded);
+    probe = pos;
+    if (pos > 0 &&
+        g_strcmp0(filename, editor->current_filename) == 0 &&
+        memcmp(&recorded, base, sizeof(recorded)) == 0 &&
+        journal_next_record(contents, length, &probe, &type, &offset, &count, &payload) &&
+        journal_ask_recover(editor)) {
+        journal->replaying = TRUE;
+        end = journal_replay(editor, contents, length, pos);
+        journal->replaying = FALSE;
+
+        editor->modified = TRUE;
+        editor_set_status(editor, "Recovered unsaved changes");
+    }
+
+    g_free(filename);
+    g_free(contents);
+    return end;
+}
+
+// Open the journal for the current document
+static void journal_open(TextEditor *editor, gboolean recover) {
+    Journal *journal;
+    JournalBase base;
+    gchar *dir;
+    gsize keep = 0;
+    int fd;
+
+    dir = journal_dir();
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    journal = g_new0(Journal, 1);
+    fd = journal_lock(editor->current_filename, O_RDWR | O_CREAT, &journal->path);
+    if (fd < 0) {
+        // Unavailable, or in use by another tab or instance editing the same
+        // file. The user should know a crash would lose the changes.
+        editor_set_status(editor, errno == EWOULDBLOCK
+                          ? "The file is open elsewhere too, so changes here aren't journaled"
+                          : "Changes aren't journaled: the edit journal can't be created");
+        g_free(journal);
+        return;
+    }
+
+    journal->fd = fd;
+    journal->pending = g_string_new(NULL);
+    editor->journal = journal;
+
+    journal_get_base(editor->current_filename, &base);
+    if (recover) {
+        keep = journal_try_recover(editor, journal, &base);
+    }
+
+    if (keep > 0) {
+        // Drop a torn tail and continue after the replayed edits
+        if (ftruncate(fd, keep) != 0) {
+            g_warning("Failed to truncate edit journal: %s", g_strerror(errno));
+        }
+        lseek(fd, 0, SEEK_END);
+    } else {
+        if (ftruncate(fd, 0) != 0) {
+            g_warning("Failed to truncate edit journal: %s", g_strerror(errno));
+        }
+        lseek(fd, 0, SEEK_SET);
+        journal_write_header(fd, editor->current_filename, &base);
+    }
+
+    journal->batches = g_async_queue_new_full((GDestroyNotify)g_bytes_unref);
+    journal->writer = g_thread_new("edit-journal", journal_writer, journal);
+}
+
+void journal_start(TextEditor *editor) {
+    journal_close(editor, TRUE);
+    journal_open(editor, TRUE);
+}
+
+void journal_record_insert(TextEditor *editor, gsize char_offset, const gchar *text, gsize bytes) {
+    Journal *journal = editor->journal;
+
+    if (journal && !journal->replaying) {
+        journal_add_record(journal, 'i', char_offset, bytes, text, bytes);
+    }
+}
+
+void journal_record_delete(TextEditor *editor, gsize char_offset, gsize n_chars) {
+    Journal *journal = editor->journal;
+
+    if (journal && !journal->replaying && n_chars > 0) {
+        journal_add_record(journal, 'd', char_offset, n_chars, NULL, 0);
+    }
+}
+
+void journal_begin_save(TextEditor *editor) {
+    Journal *journal = editor->journal;
+
+    if (journal) {
+        if (journal->since_save) {
+            g_string_free(journal->since_save, TRUE);
+        }
+        journal->since_save = g_string_new(NULL);
+    }
+}
+
+void journal_end_save(TextEditor *editor, gboolean saved) {
+    Journal *journal = editor->journal;
+    GString *since_save;
+
+    if (!journal || !journal->since_save) {
+        return;
+    }
+
+    since_save = journal->since_save;
+    journal->since_save = NULL;
+
+    if (saved) {
+        // Edits up to the save are in the file now; keep the ones made
+        // while it was being written, against the new file
+        journal_close(editor, TRUE);
+        journal_open(editor, FALSE);
+        if (editor->journal && since_save->len > 0) {
+            journal_append(editor->journal, since_save->str, since_save->len);
+        }
+    }
+
+    g_string_free(since_save, TRUE);
+}
+
+void journal_close(TextEditor *editor, gboolean discard) {
+    Journal *journal = editor->journal;
+
+    if (!journal) {
+        return;
+    }
+
+    if (journal->flush_id) {
+        g_source_remove(journal->flush_id);
+    }
+    journal_flush(journal);
+
+    g_async_queue_push(journal->batches, g_bytes_new(NULL, 0));
+    g_thread_join(journal->writer);
+    g_async_queue_unref(journal->batches);
+
+    if (discard) {
+        g_unlink(journal->path);
+    }
+    close(journal->fd);
+
+    if (journal->since_save) {
+        g_string_free(journal->since_save, TRUE);
+    }
+    g_string_free(journal->pending, TRUE);
+    g_free(journal->path);
+    g_free(journal);
+    editor->journal = NULL;
+}
+
+// Check a journal found at startup. Returns TRUE if it holds edits that can
+// still be applied, setting *filename to the document it belongs to; stale
+// and empty journals are deleted.
+static gboolean journal_check_leftover(const gchar *path, gchar **filename) {
+    gchar *contents = NULL;
+    gsize length, pos;
+    JournalBase recorded, base;
+    gboolean usable = FALSE;
+    gchar type;
+    guint64 offset, count;
+    const gchar *payload;
+    int fd;
+
+    *filename = NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd); // Another instance is using it
+        return FALSE;
+    }
+
+    if (g_file_get_contents(path, &contents, &length, NULL)) {
+        pos = journal_parse_header(contents, length, filename, &recorded);
+        usable = pos > 0 &&
+                 journal_get_base(*filename, &base) &&
+                 memcmp(&recorded, &base, sizeof(base)) == 0 &&
+                 journal_next_record(contents, length, &pos, &type, &offset, &count, &payload);
+        g_free(contents);
+    }
+
+    if (!usable) {
+        g_free(*filename);
+        *filename = NULL;
+        g_unlink(path);
+    }
+
+    close(fd);
+    return usable;
+}
+
+gboolean journal_discard_older(const gchar *filename, gint64 time) {
+    gchar *path = NULL;
+    gboolean older = TRUE;
+    struct stat st;
+    int fd;
+
+    // For an untitled document, the journal journal_start() would take next
+    fd = journal_lock(filename, O_RDONLY, &path);
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        older = (gint64)st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000 <= time;
+        if (older) {
+            g_unlink(path);
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    g_free(path);
+    return older;
+}
+
+void journal_recover_session(TextEditor *editor) {
+    gchar *dir = journal_dir();
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    gchar *recover_filename = NULL;
+    gboolean found = FALSE;
+    time_t newest = 0;
+    const gchar *name;
+
+    while (handle && (name = g_dir_read_name(handle)) != NULL) {
+        gchar *path, *filename;
+        struct stat st;
+
+        if (!g_str_has_suffix(name, ".journal")) {
+            continue;
+        }
+
+        path = g_build_filename(dir, name, NULL);
+        if (journal_check_leftover(path, &filename) && stat(path, &st) == 0 &&
+            (!found || st.st_mtime > newest)) {
+            g_free(recover_filename);
+            recover_filename = filename;
+            newest = st.st_mtime;
+            found = TRUE;
+        } else {
+            g_free(filename);
+        }
+        g_free(path);
+    }
+
+    if (handle) {
+        g_dir_close(handle);
+    }
+    g_free(dir);
+
+    if (recover_filename) {
+        GError *error = NULL;
+
+        // The journal is offered for replay once the file has loaded
+        if (file_loader_start(editor, recover_filename, &error)) {
+            g_free(recover_filename);
+            return;
+        }
+        g_error_free(error);
+        g_free(recover_filename);
+    }
+
+    // An untitled journal is offered for replay right away
+    journal_start(editor);
+}
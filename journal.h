@@ -0,0 +1,46 @@
+/*
+ * Write-ahead edit journal
+ *
+ * Every insertion and deletion is appended to a small side file in the
+ * user's cache directory, in batches written and synced by a background
+ * thread. If the editor exits without the user deciding what to do with
+ * unsaved changes, the journal is replayed over the unchanged file on the
+ * next start. Its cost scales with the amount typed, not the document size.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "editor.h"
+
+// Start journaling the current document (editor->current_filename, or an
+// untitled buffer, each with a journal of its own), replacing the previous
+// journal. If a journal for the same unchanged file is left over from a
+// crash the user is offered to replay it into the buffer. If there can be
+// no journal, the status bar says so.
+void journal_start(TextEditor *editor);
+
+// Record edits, in characters like the GtkTextBuffer offsets
+void journal_record_insert(TextEditor *editor, gsize char_offset, const gchar *text, gsize bytes);
+void journal_record_delete(TextEditor *editor, gsize char_offset, gsize n_chars);
+
+// Mark the point a background save snapshots the document at. When the save
+// finishes successfully the journal is restarted against the new file,
+// keeping only the edits made after the mark.
+void journal_begin_save(TextEditor *editor);
+void journal_end_save(TextEditor *editor, gboolean saved);
+
+// Flush and close the journal. With discard the file is deleted, otherwise
+// it is left behind for recovery.
+void journal_close(TextEditor *editor, gboolean discard);
+
+// Delete the journal left over for filename (NULL for an untitled buffer)
+// unless it was written to after time (as from g_get_real_time()). Returns
+// FALSE if a newer journal is left. One in use is neither.
+gboolean journal_discard_older(const gchar *filename, gint64 time);
+
+// At startup: reopen the most recent file that has unsaved changes left in
+// a journal, or start an untitled journal
+void journal_recover_session(TextEditor *editor);
+
+#endif // JOURNAL_H
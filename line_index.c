@@ -0,0 +1,107 @@
+/*
+ * Sparse line index over a read-only text
+ *
+ * checkpoints[k] is the byte offset of line k * LINE_INDEX_STRIDE. Lines are
+ * skipped with the vectorized newline scanner in text_scan.c.
+ */
+
+#include "line_index.h"
+#include "text_scan.h"
+
+struct _LineIndex {
+    const gchar *data;
+    gsize length;
+    gsize scanned;          // Bytes indexed so far
+    gsize newlines;         // Newlines in the indexed bytes
+    GArray *checkpoints;    // gsize offsets of every LINE_INDEX_STRIDE-th line
+};
+
+LineIndex *line_index_new(const gchar *data, gsize length) {
+    LineIndex *index = g_new0(LineIndex, 1);
+    gsize first = 0;
+
+    index->data = data;
+    index->length = length;
+    index->checkpoints = g_array_new(FALSE, FALSE, sizeof(gsize));
+    g_array_append_val(index->checkpoints, first);
+
+    return index;
+}
+
+LineIndex *line_index_new_complete(const gchar *data, gsize length, const gsize *checkpoints,
+                                   gsize n_checkpoints, gsize n_lines) {
+    LineIndex *index;
+
+    if (n_lines == 0 || n_checkpoints != (n_lines - 1) / LINE_INDEX_STRIDE + 1 ||
+        checkpoints[0] != 0) {
+        return NULL;
+    }
+    for (gsize k = 1; k < n_checkpoints; k++) {
+        if (checkpoints[k] <= checkpoints[k - 1] || checkpoints[k] > length) {
+            return NULL;
+        }
+    }
+
+    index = g_new0(LineIndex, 1);
+    index->data = data;
+    index->length = length;
+    index->scanned = length;
+    index->newlines = n_lines - 1;
+    index->checkpoints = g_array_sized_new(FALSE, FALSE, sizeof(gsize), n_checkpoints);
+    g_array_append_vals(index->checkpoints, checkpoints, n_checkpoints);
+    return index;
+}
+
+void line_index_free(LineIndex *index) {
+    if (!index) {
+        return;
+    }
+
+    g_array_free(index->checkpoints, TRUE);
+    g_free(index);
+}
+
+gsize line_index_scan(LineIndex *index, gsize max_bytes) {
+    gsize end = index->scanned + MIN(max_bytes, index->length - index->scanned);
+
+    // Jump from one recorded line to the next with the newline scanner
+    while (index->scanned < end) {
+        gsize wanted = LINE_INDEX_STRIDE - index->newlines % LINE_INDEX_STRIDE;
+        gsize found;
+
+        index->scanned += text_scan_skip_newlines(index->data + index->scanned,
+                                                  end - index->scanned, wanted, &found);
+        index->newlines += found;
+
+        if (found == wanted) {
+            g_array_append_val(index->checkpoints, index->scanned);
+        }
+    }
+
+    return index->scanned;
+}
+
+gboolean line_index_is_complete(LineIndex *index) {
+    return index->scanned == index->length;
+}
+
+gsize line_index_get_line_count(LineIndex *index) {
+    return index->newlines + 1;
+}
+
+const gsize *line_index_get_checkpoints(LineIndex *index, gsize *n_checkpoints) {
+    *n_checkpoints = index->checkpoints->len;
+    return (const gsize *)(void *)index->checkpoints->data;
+}
+
+gsize line_index_get_line_offset(LineIndex *index, gsize line) {
+    gsize start;
+
+    if (line > index->newlines) {
+        return index->length;
+    }
+
+    start = g_array_index(index->checkpoints, gsize, line / LINE_INDEX_STRIDE);
+    return start + text_scan_skip_newlines(index->data + start, index->scanned - start,
+                                           line % LINE_INDEX_STRIDE, NULL);
+}
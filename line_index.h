@@ -0,0 +1,43 @@
+/*
+ * Sparse line index over a read-only text
+ *
+ * Records the byte offset of every LINE_INDEX_STRIDE-th line, so its size
+ * is a small fraction of the line count. Other lines are found by scanning
+ * forward from the nearest recorded line.
+ */
+
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <glib.h>
+
+#define LINE_INDEX_STRIDE 1024  // Lines between recorded offsets
+
+typedef struct _LineIndex LineIndex;
+
+// Create an index over data, which must stay valid while the index is used
+LineIndex *line_index_new(const gchar *data, gsize length);
+void line_index_free(LineIndex *index);
+
+// Create a complete index over data from the offsets recorded by an earlier
+// index of the same text (see line_index_get_checkpoints()) and its line
+// count. Returns NULL if they don't fit the text.
+LineIndex *line_index_new_complete(const gchar *data, gsize length, const gsize *checkpoints,
+                                   gsize n_checkpoints, gsize n_lines);
+
+// Index up to max_bytes more of the text. Returns the number of bytes
+// indexed so far; the index is complete once that equals the length.
+gsize line_index_scan(LineIndex *index, gsize max_bytes);
+gboolean line_index_is_complete(LineIndex *index);
+
+// Number of lines, counted like GtkTextBuffer: one more than the newlines
+gsize line_index_get_line_count(LineIndex *index);
+
+// The recorded offsets, to be kept with the text's identity and given back
+// to line_index_new_complete()
+const gsize *line_index_get_checkpoints(LineIndex *index, gsize *n_checkpoints);
+
+// Byte offset at which line starts (the length for lines past the end)
+gsize line_index_get_line_offset(LineIndex *index, gsize line);
+
+#endif // LINE_INDEX_H
@@ -0,0 +1,400 @@
+/*
+ * Line table of the editable document
+ *
+ * Line lengths (newline included, so they sum to the document length) are
+ * kept in blocks of up to LINE_BLOCK_MAX lines, each with its total number
+ * of characters. A lookup skips whole blocks by their totals and then walks
+ * one block, and an edit only shifts entries within the block it touches.
+ * Blocks are split when they grow past LINE_BLOCK_MAX and merged with a
+ * neighbour when deletions leave them small.
+ *
+ * Lines end at '\n'. GtkTextBuffer also breaks lines at a lone '\r' and
+ * at U+2029, which are rare enough not to be tracked.
+ *
+ * The initial build divides the text between up to LINE_TABLE_MAX_THREADS
+ * threads, each producing the line lengths of its slice with the
+ * vectorized scanner; the slices are joined by adding the unterminated
+ * tail of one slice to the first line of the next.
+ */
+
+#include "line_table.h"
+#include "text_scan.h"
+
+#include <string.h>
+
+#define LINE_BLOCK_MAX         4096                // Lines in a block before it is split
+#define LINE_BLOCK_FILL        2048                // Lines per block when building or splitting
+#define LINE_BLOCK_MERGE       (LINE_BLOCK_MAX / 8)  // Blocks smaller than this are merged
+#define LINE_TABLE_MAX_THREADS 16
+#define LINE_TABLE_MIN_SLICE   (4 * 1024 * 1024)   // Smallest slice worth a thread
+
+typedef struct {
+    GArray *lengths;    // gsize characters per line
+    gsize chars;
+} LineBlock;
+
+struct _LineTable {
+    GPtrArray *blocks;  // LineBlock, never empty, and no block is empty
+    gsize n_lines;
+    gsize n_chars;
+};
+
+typedef struct {
+    const gchar *data;
+    gsize length;
+    GArray *lengths;
+    gsize tail;
+} LineScanJob;
+
+static LineBlock *line_block_new(void) {
+    LineBlock *block = g_new0(LineBlock, 1);
+
+    block->lengths = g_array_sized_new(FALSE, FALSE, sizeof(gsize), LINE_BLOCK_FILL);
+    return block;
+}
+
+static void line_block_free(gpointer data) {
+    LineBlock *block = (LineBlock *)data;
+
+    g_array_free(block->lengths, TRUE);
+    g_free(block);
+}
+
+#define BLOCK(table, b) ((LineBlock *)g_ptr_array_index((table)->blocks, (b)))
+#define LENGTH(block, i) g_array_index((block)->lengths, gsize, (i))
+
+// Append lines at the end of the table while building it
+static void line_table_append_lines(LineTable *table, const gsize *lengths, gsize n) {
+    while (n > 0) {
+        LineBlock *block = table->blocks->len > 0 ? BLOCK(table, table->blocks->len - 1) : NULL;
+        gsize count, chars = 0;
+
+        if (!block || block->lengths->len >= LINE_BLOCK_FILL) {
+            block = line_block_new();
+            g_ptr_array_add(table->blocks, block);
+        }
+
+        count = MIN(n, LINE_BLOCK_FILL - block->lengths->len);
+        g_array_append_vals(block->lengths, lengths, count);
+        for (gsize i = 0; i < count; i++) {
+            chars += lengths[i];
+        }
+
+        block->chars += chars;
+        table->n_lines += count;
+        table->n_chars += chars;
+        lengths += count;
+        n -= count;
+    }
+}
+
+static void line_table_reset(LineTable *table) {
+    g_ptr_array_set_size(table->blocks, 0);
+    table->n_lines = 0;
+    table->n_chars = 0;
+}
+
+LineTable *line_table_new(void) {
+    LineTable *table = g_new0(LineTable, 1);
+
+    table->blocks = g_ptr_array_new_with_free_func(line_block_free);
+    line_table_clear(table);
+    return table;
+}
+
+static gpointer line_scan_job_run(gpointer data) {
+    LineScanJob *job = (LineScanJob *)data;
+
+    job->lengths = g_array_sized_new(FALSE, FALSE, sizeof(gsize), job->length / 64 + 1);
+    job->tail = text_scan_line_lengths(job->data, job->length, job->lengths);
+    return NULL;
+}
+
+LineTable *line_table_new_from_text(const gchar *data, gsize length) {
+    LineTable *table = line_table_new();
+    LineScanJob jobs[LINE_TABLE_MAX_THREADS];
+    GThread *threads[LINE_TABLE_MAX_THREADS];
+    guint n_jobs, i;
+    gsize slice, carry = 0;
+
+    n_jobs = CLAMP(g_get_num_processors(), 1, LINE_TABLE_MAX_THREADS);
+    n_jobs = MAX(1, MIN(n_jobs, length / LINE_TABLE_MIN_SLICE));
+    slice = length / n_jobs;
+
+    for (i = 0; i < n_jobs; i++) {
+        jobs[i].data = data + i * slice;
+        jobs[i].length = (i == n_jobs - 1) ? length - i * slice : slice;
+    }
+
+    // The calling thread takes the first slice
+    for (i = 1; i < n_jobs; i++) {
+        threads[i] = g_thread_new("line-scan", line_scan_job_run, &jobs[i]);
+    }
+    line_scan_job_run(&jobs[0]);
+    for (i = 1; i < n_jobs; i++) {
+        g_thread_join(threads[i]);
+    }
+
+    line_table_reset(table);
+    for (i = 0; i < n_jobs; i++) {
+        GArray *lengths = jobs[i].lengths;
+
+        if (lengths->len > 0) {
+            g_array_index(lengths, gsize, 0) += carry;
+            line_table_append_lines(table, (const gsize *)lengths->data, lengths->len);
+            carry = jobs[i].tail;
+        } else {
+            carry += jobs[i].tail;
+        }
+        g_array_free(lengths, TRUE);
+    }
+    line_table_append_lines(table, &carry, 1);
+
+    return table;
+}
+
+void line_table_free(LineTable *table) {
+    if (!table) {
+        return;
+    }
+
+    g_ptr_array_free(table->blocks, TRUE);
+    g_free(table);
+}
+
+void line_table_clear(LineTable *table) {
+    gsize empty = 0;
+
+    line_table_reset(table);
+    line_table_append_lines(table, &empty, 1);
+}
+
+// Find the block, entry, line and column of a character offset
+static void line_table_locate(LineTable *table, gsize offset, guint *block_index, guint *entry,
+                              gsize *line, gsize *column) {
+    gsize chars = 0, lines = 0;
+    LineBlock *block;
+    guint b, i;
+
+    offset = MIN(offset, table->n_chars);
+
+    for (b = 0; b + 1 < table->blocks->len; b++) {
+        block = BLOCK(table, b);
+        if (offset < chars + block->chars) {
+            break;
+        }
+        chars += block->chars;
+        lines += block->lengths->len;
+    }
+
+    block = BLOCK(table, b);
+    for (i = 0; i + 1 < block->lengths->len; i++) {
+        gsize length = LENGTH(block, i);
+
+        if (offset < chars + length) {
+            break;
+        }
+        chars += length;
+    }
+
+    *block_index = b;
+    *entry = i;
+    *line = lines + i;
+    *column = offset - chars;
+}
+
+// Split a block that grew past LINE_BLOCK_MAX into blocks of LINE_BLOCK_FILL
+static void line_table_split_block(LineTable *table, guint b) {
+    LineBlock *block = BLOCK(table, b);
+    guint n = block->lengths->len;
+    guint start, inserted = 0;
+
+    if (n <= LINE_BLOCK_MAX) {
+        return;
+    }
+
+    for (start = LINE_BLOCK_FILL; start < n; start += LINE_BLOCK_FILL) {
+        LineBlock *piece = line_block_new();
+        guint count = MIN(LINE_BLOCK_FILL, n - start);
+
+        g_array_append_vals(piece->lengths, &LENGTH(block, start), count);
+        for (guint i = 0; i < count; i++) {
+            piece->chars += LENGTH(piece, i);
+        }
+        block->chars -= piece->chars;
+        g_ptr_array_insert(table->blocks, b + 1 + inserted++, piece);
+    }
+
+    g_array_set_size(block->lengths, LINE_BLOCK_FILL);
+}
+
+// Merge a small block into its successor, or its predecessor at the end
+static void line_table_merge_block(LineTable *table, guint b) {
+    LineBlock *block, *into;
+
+    if (table->blocks->len < 2 || b >= table->blocks->len ||
+        BLOCK(table, b)->lengths->len >= LINE_BLOCK_MERGE) {
+        return;
+    }
+
+    if (b + 1 == table->blocks->len) {
+        b--;
+    }
+    into = BLOCK(table, b);
+    block = BLOCK(table, b + 1);
+
+    if (into->lengths->len + block->lengths->len > LINE_BLOCK_FILL) {
+        return;
+    }
+
+    g_array_append_vals(into->lengths, block->lengths->data, block->lengths->len);
+    into->chars += block->chars;
+    g_ptr_array_remove_index(table->blocks, b + 1);
+}
+
+void line_table_insert(LineTable *table, gsize char_offset, const gchar *text, gsize bytes) {
+    LineBlock *block;
+    GArray *lengths;
+    guint b, i;
+    gsize line, column, chars, length, tail;
+
+    if (bytes == 0) {
+        return;
+    }
+
+    line_table_locate(table, char_offset, &b, &i, &line, &column);
+    block = BLOCK(table, b);
+    chars = g_utf8_strlen(text, bytes);
+
+    if (!memchr(text, '\n', bytes)) {
+        LENGTH(block, i) += chars;
+        block->chars += chars;
+        table->n_chars += chars;
+        return;
+    }
+
+    // The line is split at the insertion point, and the new lines go in
+    // between its head and tail
+    length = LENGTH(block, i);
+    lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+    tail = text_scan_line_lengths(text, bytes, lengths);
+    g_array_index(lengths, gsize, 0) += column;
+    tail += length - column;
+    g_array_append_val(lengths, tail);
+
+    g_array_remove_index(block->lengths, i);
+    g_array_insert_vals(block->lengths, i, lengths->data, lengths->len);
+    block->chars += chars;
+    table->n_chars += chars;
+    table->n_lines += lengths->len - 1;
+    g_array_free(lengths, TRUE);
+
+    line_table_split_block(table, b);
+}
+
+// Remove count whole lines starting at first
+static void line_table_remove_lines(LineTable *table, gsize first, gsize count) {
+    gsize lines = 0;
+    guint b = 0;
+
+    table->n_lines -= count;
+
+    while (count > 0 && b < table->blocks->len) {
+        LineBlock *block = BLOCK(table, b);
+        gsize n = block->lengths->len;
+
+        if (first >= lines + n) {
+            lines += n;
+            b++;
+            continue;
+        }
+
+        gsize start = first - lines;
+        gsize remove = MIN(count, n - start);
+
+        for (gsize i = start; i < start + remove; i++) {
+            block->chars -= LENGTH(block, i);
+        }
+        g_array_remove_range(block->lengths, start, remove);
+        count -= remove;
+
+        if (block->lengths->len == 0) {
+            g_ptr_array_remove_index(table->blocks, b);
+        } else {
+            lines += block->lengths->len;
+            first = lines;
+            b++;
+        }
+    }
+}
+
+void line_table_delete(LineTable *table, gsize char_offset, gsize n_chars) {
+    guint b1, i1, b2, i2;
+    gsize line1, column1, line2, column2, length1, length2;
+
+    n_chars = MIN(n_chars, table->n_chars - MIN(char_offset, table->n_chars));
+    if (n_chars == 0) {
+        return;
+    }
+
+    line_table_locate(table, char_offset, &b1, &i1, &line1, &column1);
+    line_table_locate(table, char_offset + n_chars, &b2, &i2, &line2, &column2);
+
+    if (line1 == line2) {
+        LENGTH(BLOCK(table, b1), i1) -= n_chars;
+        BLOCK(table, b1)->chars -= n_chars;
+        table->n_chars -= n_chars;
+        return;
+    }
+
+    // The head of the first line joins the tail of the last one
+    length1 = LENGTH(BLOCK(table, b1), i1);
+    length2 = LENGTH(BLOCK(table, b2), i2);
+    LENGTH(BLOCK(table, b1), i1) = column1 + (length2 - column2);
+    BLOCK(table, b1)->chars += column1 + (length2 - column2);
+    BLOCK(table, b1)->chars -= length1;
+
+    line_table_remove_lines(table, line1 + 1, line2 - line1);
+    table->n_chars -= n_chars;
+
+    line_table_merge_block(table, b1 + 1);
+    line_table_merge_block(table, b1);
+}
+
+gsize line_table_get_line_count(LineTable *table) {
+    return table->n_lines;
+}
+
+gsize line_table_get_char_count(LineTable *table) {
+    return table->n_chars;
+}
+
+gsize line_table_get_line_start(LineTable *table, gsize line) {
+    gsize chars = 0, lines = 0;
+    LineBlock *block;
+    guint b;
+
+    line = MIN(line, table->n_lines - 1);
+
+    for (b = 0; b + 1 < table->blocks->len; b++) {
+        block = BLOCK(table, b);
+        if (line < lines + block->lengths->len) {
+            break;
+        }
+        chars += block->chars;
+        lines += block->lengths->len;
+    }
+
+    block = BLOCK(table, b);
+    for (guint i = 0; i < line - lines; i++) {
+        chars += LENGTH(block, i);
+    }
+
+    return chars;
+}
+
+void line_table_get_position(LineTable *table, gsize char_offset, gsize *line, gsize *column) {
+    guint b, i;
+
+    line_table_locate(table, char_offset, &b, &i, line, column);
+}
@@ -0,0 +1,41 @@
+/*
+ * Line table of the editable document
+ *
+ * Holds the length in characters of every line, so the start of a line and
+ * the line/column of an offset are found without walking the text. The
+ * table is built in parallel from the file at open time and kept up to
+ * date with each insertion and deletion. Offsets are in characters, like
+ * GtkTextBuffer and PieceTable offsets.
+ */
+
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include <glib.h>
+
+typedef struct _LineTable LineTable;
+
+// Create a table for an empty document (one empty line)
+LineTable *line_table_new(void);
+
+// Create a table for text, which must be valid UTF-8. The scan is split
+// across the available processors.
+LineTable *line_table_new_from_text(const gchar *data, gsize length);
+
+void line_table_free(LineTable *table);
+void line_table_clear(LineTable *table);
+
+// Apply an edit to the table
+void line_table_insert(LineTable *table, gsize char_offset, const gchar *text, gsize bytes);
+void line_table_delete(LineTable *table, gsize char_offset, gsize n_chars);
+
+gsize line_table_get_line_count(LineTable *table);
+gsize line_table_get_char_count(LineTable *table);
+
+// Offset of the first character of line (clamped to the last line)
+gsize line_table_get_line_start(LineTable *table, gsize line);
+
+// Line and column (both from 0) of char_offset
+void line_table_get_position(LineTable *table, gsize char_offset, gsize *line, gsize *column);
+
+#endif // LINE_TABLE_H
@@ -0,0 +1,451 @@
+/*
+ * Background file loading
+ *
+ * The file is memory-mapped and a worker thread reads it into a new
+ * PieceTable with a FileReader (see file_reader.c), which hands over the
+ * text chunk by chunk as it goes; the chunks are queued without copying.
+ * The main thread drains the queue from an idle callback, inserting for at
+ * most LOADER_FRAME_BUDGET per run so redraws and input keep flowing. The
+ * queue holds at most LOADER_MAX_PENDING chunks, which bounds how far the
+ * worker runs ahead of the buffer. The first chunk of a UTF-8 file is a
+ * small one, and the idle callback returns once it is in, so the first
+ * page is painted before the rest of the file is inserted.
+ * Likewise the view goes to the line it was asked to show as soon as that
+ * part of the file is in.
+ */
+
+#include "loader.h"
+#include "file_reader.h"
+#include "journal.h"
+#include "viewport.h"
+#include "status.h"
+#include "undo.h"
+#include "highlight.h"
+#include "trace.h"
+#include "session.h"
+#include "startup.h"
+
+#include <sys/mman.h>
+
+#define LOADER_MAX_PENDING  4              // Queued chunks before the worker waits
+#define LOADER_FRAME_BUDGET 8000           // Microseconds spent inserting per idle run
+#define LOADER_POSITION_MARGIN 200         // Lines wanted below the line to show before going there
+
+typedef struct {
+    const gchar *data;      // Points into the document's original text
+    gsize length;
+    gsize source_length;    // File bytes it was read from
+} LoadChunk;
+
+struct _FileLoader {
+    gint ref_count;
+    TextEditor *editor;      // Main thread only, NULL once detached
+    gchar *filename;
+    FileReader reader;       // Run by the worker; its document is handed to
+                             // the editor on success
+    gsize bytes_inserted;    // File bytes whose text is in the buffer, main thread only
+    gboolean positioned;     // The pending position was gone to, main thread only
+    gint64 trace_start;      // Start of the open.total span, main thread only
+
+    // Protected by lock
+    GMutex lock;
+    GCond space_available;
+    GQueue pending;
+    gboolean worker_done;
+    GError *error;
+    guint idle_id;
+};
+
+static FileLoader *loader_ref(FileLoader *loader) {
+    g_atomic_int_inc(&loader->ref_count);
+    return loader;
+}
+
+static void loader_unref(gpointer data) {
+    FileLoader *loader = (FileLoader *)data;
+    LoadChunk *chunk;
+
+    if (!g_atomic_int_dec_and_test(&loader->ref_count)) {
+        return;
+    }
+
+    while ((chunk = g_queue_pop_head(&loader->pending)) != NULL) {
+        g_free(chunk);
+    }
+
+    file_reader_clear(&loader->reader);
+    g_clear_error(&loader->error);
+    g_mutex_clear(&loader->lock);
+    g_cond_clear(&loader->space_available);
+    g_free(loader->filename);
+    g_free(loader);
+}
+
+static gboolean loader_idle(gpointer data);
+
+// Make sure an idle callback will drain the queue (lock must be held)
+static void loader_schedule_locked(FileLoader *loader) {
+    if (loader->idle_id == 0) {
+        loader->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, loader_idle,
+                                          loader_ref(loader), loader_unref);
+    }
+}
+
+// FileReaderFunc: queue a chunk for insertion, waiting while the queue is
+// full. Returns FALSE if the load was cancelled.
+static gboolean loader_push_chunk(const gchar *data, gsize length, gsize source_length,
+                                  gpointer user_data) {
+    FileLoader *loader = (FileLoader *)user_data;
+    LoadChunk *chunk;
+
+    g_mutex_lock(&loader->lock);
+
+    while (loader->pending.length >= LOADER_MAX_PENDING &&
+           !g_atomic_int_get(&loader->reader.cancelled)) {
+        g_cond_wait(&loader->space_available, &loader->lock);
+    }
+
+    if (g_atomic_int_get(&loader->reader.cancelled)) {
+        g_mutex_unlock(&loader->lock);
+        return FALSE;
+    }
+
+    chunk = g_new(LoadChunk, 1);
+    chunk->data = data;
+    chunk->length = length;
+    chunk->source_length = source_length;
+    g_queue_push_tail(&loader->pending, chunk);
+    loader_schedule_locked(loader);
+
+    g_mutex_unlock(&loader->lock);
+    return TRUE;
+}
+
+// Worker thread: read the file, handing its text over chunk by chunk
+static gpointer loader_worker(gpointer data) {
+    FileLoader *loader = (FileLoader *)data;
+    gint64 start = trace_begin();
+    GError *error = NULL;
+
+    file_reader_run(&loader->reader, &error);
+    trace_end("open.worker", start);
+
+    g_mutex_lock(&loader->lock);
+    loader->worker_done = TRUE;
+    loader->error = error;
+    loader_schedule_locked(loader);
+    g_mutex_unlock(&loader->lock);
+
+    loader_unref(loader);
+    return NULL;
+}
+
+// Reflect the number of inserted bytes in the progress bar
+static void loader_update_progress(FileLoader *loader) {
+    TextEditor *editor = loader->editor;
+    gchar *text;
+
+    if (loader->reader.length == 0) {
+        return;
+    }
+
+    gdouble fraction = (gdouble)loader->bytes_inserted / (gdouble)loader->reader.length;
+    fraction = CLAMP(fraction, 0.0, 1.0);
+
+    text = g_strdup_printf("%d%%", (gint)(fraction * 100.0));
+    status_set_progress(editor, fraction, text);
+    g_free(text);
+}
+
+// Disconnect the loader from the editor and restore the normal UI state
+static void loader_detach(FileLoader *loader) {
+    TextEditor *editor = loader->editor;
+
+    editor->loader = NULL;
+    loader->editor = NULL;
+
+    gtk_widget_hide(editor->progress_bar);
+    gtk_widget_hide(editor->cancel_button);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), TRUE);
+
+    // The buffer holds what was read (or nothing), so it can be highlighted
+    highlight_reset(editor);
+}
+
+// Called on the main thread once every chunk has been inserted
+static void loader_complete(FileLoader *loader, GError *error) {
+    TRACE_SCOPE("open.complete");
+    TextEditor *editor = loader->editor;
+    GtkTextIter start;
+
+    trace_end("open.total", loader->trace_start);
+    startup_loaded();
+
+    if (error) {
+        // Cleared while still attached so the change isn't mirrored
+        gtk_text_buffer_set_text(editor->text_buffer, "", -1);
+        loader_detach(loader);
+
+        g_free(editor->current_filename);
+        editor->current_filename = NULL;
+        editor->encoding = (Encoding){ ENCODING_UTF8, FALSE, FALSE };
+        editor->compression = COMPRESSION_NONE;
+        editor->follow_dropped = 0;
+        editor->follow_dropped_lines = 0;
+        editor->modified = FALSE;
+        editor->pending_line = 0;
+        editor->pending_column = 0;
+        editor->pending_top = 0;
+        g_clear_pointer(&editor->pending_edits, g_bytes_unref);
+        editor->n_words = 0;
+        status_update(editor, STATUS_COUNTS | STATUS_FILE);
+        editor_update_title(editor);
+        journal_start(editor);
+        editor_set_status(editor, "");
+        editor_show_error(editor, "Failed to open file: %s\n%s",
+                          loader->filename, error->message);
+        g_error_free(error);
+    } else {
+        gchar *basename = g_path_get_basename(loader->filename);
+        GString *details = g_string_new(NULL);
+        gchar *status;
+
+        // Mention the compression and the encoding unless it is plain UTF-8,
+        // with why it was chosen when the file wasn't all valid UTF-8
+        if (loader->reader.compression != COMPRESSION_NONE) {
+            g_string_append(details, compression_get_name(loader->reader.compression));
+        }
+        if (!encoding_is_utf8(loader->reader.encoding) || loader->reader.encoding.bom ||
+            loader->reader.encoding.repaired) {
+            g_string_append_printf(details, "%s%s%s", details->len ? ", " : "",
+                                   encoding_get_charset(loader->reader.encoding),
+                                   loader->reader.encoding.bom ? " with BOM" : "");
+        }
+        if (loader->reader.encoding.repaired) {
+            g_string_append_printf(details, ", %" G_GSIZE_FORMAT " invalid byte%s"
+                                   " replaced with U+FFFD", loader->reader.replaced,
+                                   loader->reader.replaced == 1 ? "" : "s");
+        } else if (loader->reader.encoding.type == ENCODING_LATIN1) {
+            g_string_append(details, ", as it isn't valid UTF-8");
+        }
+
+        if (details->len > 0) {
+            status = g_strdup_printf("Opened %s (%s)", basename, details->str);
+        } else {
+            status = g_strdup_printf("Opened %s", basename);
+        }
+        g_string_free(details, TRUE);
+
+        loader_detach(loader);
+
+        // The buffer now shows exactly the file's text
+        piece_table_free(editor->document);
+        editor->document = loader->reader.table;
+        loader->reader.table = NULL;
+        line_table_free(editor->lines);
+        editor->lines = loader->reader.lines;
+        loader->reader.lines = NULL;
+        editor->n_words = loader->reader.words;
+        status_update(editor, STATUS_COUNTS | STATUS_FILE);
+        editor->encoding = loader->reader.encoding;
+        editor->compression = loader->reader.compression;
+
+        if (!loader->positioned) {
+            gtk_text_buffer_get_start_iter(editor->text_buffer, &start);
+            gtk_text_buffer_place_cursor(editor->text_buffer, &start);
+        }
+        editor->modified = FALSE;
+        editor_set_status(editor, status);
+
+        // Puts back the unsaved edits of the last session, or offers to
+        // replay those a crash left in the journal, then goes to the line
+        // asked for unless that was done while loading
+        session_resume_document(editor);
+
+        g_free(status);
+        g_free(basename);
+    }
+
+    loader_unref(loader);
+}
+
+// Go to the pending position once the text around it is in, rather than
+// at the end. Not when edits from the last session, which may move it, are
+// still to be put back.
+static void loader_try_position(FileLoader *loader) {
+    TextEditor *editor = loader->editor;
+    gsize line = MAX(editor->pending_line, editor->pending_top);
+
+    if (loader->positioned || line == 0 || editor->pending_edits) {
+        return;
+    }
+
+    if ((gsize)gtk_text_buffer_get_line_count(editor->text_buffer) > line + LOADER_POSITION_MARGIN) {
+        editor_goto_pending(editor);
+        loader->positioned = TRUE;
+    }
+}
+
+// Idle callback: insert queued chunks until the frame budget runs out
+static gboolean loader_idle(gpointer data) {
+    FileLoader *loader = (FileLoader *)data;
+    gint64 deadline = g_get_monotonic_time() + LOADER_FRAME_BUDGET;
+    gboolean finished = FALSE;
+    GError *error = NULL;
+
+    if (!loader->editor) {
+        g_mutex_lock(&loader->lock);
+        loader->idle_id = 0;
+        g_mutex_unlock(&loader->lock);
+        return G_SOURCE_REMOVE;
+    }
+
+    for (;;) {
+        LoadChunk *chunk;
+        GtkTextIter end;
+        gint64 insert_start;
+        gboolean first;
+
+        g_mutex_lock(&loader->lock);
+        chunk = g_queue_pop_head(&loader->pending);
+        if (!chunk) {
+            finished = loader->worker_done;
+            if (finished) {
+                error = loader->error;
+                loader->error = NULL;
+            }
+            loader->idle_id = 0;
+            g_mutex_unlock(&loader->lock);
+            break;
+        }
+        g_cond_signal(&loader->space_available);
+        g_mutex_unlock(&loader->lock);
+
+        insert_start = trace_begin();
+        gtk_text_buffer_get_end_iter(loader->editor->text_buffer, &end);
+        gtk_text_buffer_insert(loader->editor->text_buffer, &end, chunk->data, chunk->length);
+        trace_end("open.insert", insert_start);
+        first = loader->bytes_inserted == 0;
+        loader->bytes_inserted += chunk->source_length;
+
+        g_free(chunk);
+
+        // Let a frame show the first page before going on
+        if (first || g_get_monotonic_time() >= deadline) {
+            loader_try_position(loader);
+            loader_update_progress(loader);
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    loader_try_position(loader);
+    loader_update_progress(loader);
+
+    if (finished) {
+        loader_complete(loader, error);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+gboolean file_loader_start(TextEditor *editor, const gchar *filename, GError **error) {
+    FileLoader *loader;
+    GMappedFile *mapping;
+    gchar *basename, *status;
+
+    mapping = g_mapped_file_new(filename, FALSE, error);
+    if (!mapping) {
+        return FALSE;
+    }
+
+    file_loader_cancel(editor);
+    viewport_close(editor);
+
+    loader = g_new0(FileLoader, 1);
+    loader->ref_count = 1;
+    loader->editor = editor;
+    loader->trace_start = trace_begin();
+    loader->filename = g_strdup(filename);
+    loader->reader.source = g_mapped_file_get_bytes(mapping);
+    loader->reader.length = g_mapped_file_get_length(mapping);
+    loader->reader.func = loader_push_chunk;
+    loader->reader.user_data = loader;
+    g_mapped_file_unref(mapping);
+
+    if (loader->reader.length > 0) {
+        posix_madvise((void *)g_bytes_get_data(loader->reader.source, NULL),
+                      loader->reader.length, POSIX_MADV_SEQUENTIAL);
+    }
+    g_mutex_init(&loader->lock);
+    g_cond_init(&loader->space_available);
+    g_queue_init(&loader->pending);
+
+    // Clear the old document before the loader is attached so the change
+    // isn't mistaken for chunk insertion
+    journal_close(editor, TRUE);
+    gtk_text_buffer_set_text(editor->text_buffer, "", -1);
+    piece_table_clear(editor->document);
+    line_table_clear(editor->lines);
+    undo_clear(editor);
+    editor->n_words = 0;
+    editor->loader = loader;
+    highlight_reset(editor);
+    status_update(editor, STATUS_POSITION | STATUS_COUNTS);
+
+    g_free(editor->current_filename);
+    editor->current_filename = g_strdup(filename);
+    editor->encoding = (Encoding){ ENCODING_UTF8, FALSE, FALSE };
+    editor->compression = COMPRESSION_NONE;
+    editor->follow_dropped = 0;
+    editor->follow_dropped_lines = 0;
+    editor->modified = FALSE;
+    editor_update_title(editor);
+
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+    status_set_progress(editor, 0.0, "0%");
+    gtk_widget_show(editor->progress_bar);
+    gtk_widget_show(editor->cancel_button);
+
+    basename = g_path_get_basename(filename);
+    status = g_strdup_printf("Loading %s...", basename);
+    editor_set_status(editor, status);
+    g_free(status);
+    g_free(basename);
+
+    g_thread_unref(g_thread_new("file-loader", loader_worker, loader_ref(loader)));
+
+    return TRUE;
+}
+
+void file_loader_cancel(TextEditor *editor) {
+    FileLoader *loader = editor->loader;
+
+    if (!loader) {
+        return;
+    }
+
+    g_atomic_int_set(&loader->reader.cancelled, TRUE);
+
+    g_mutex_lock(&loader->lock);
+    g_cond_signal(&loader->space_available);
+    if (loader->idle_id) {
+        g_source_remove(loader->idle_id);
+        loader->idle_id = 0;
+    }
+    g_mutex_unlock(&loader->lock);
+
+    // Cleared while still attached so the change isn't mirrored
+    gtk_text_buffer_set_text(editor->text_buffer, "", -1);
+    loader_detach(loader);
+
+    g_free(editor->current_filename);
+    editor->current_filename = NULL;
+    editor->encoding = (Encoding){ ENCODING_UTF8, FALSE, FALSE };
+    editor->compression = COMPRESSION_NONE;
+    editor->follow_dropped = 0;
+    editor->follow_dropped_lines = 0;
+    editor->modified = FALSE;
+    editor_update_title(editor);
+
+    loader_unref(loader);
+}
@@ -0,0 +1,21 @@
+/*
+ * Background file loading
+ *
+ * Files are read in fixed-size chunks on a worker thread and inserted into
+ * the editor's GtkTextBuffer from idle callbacks, so the window stays
+ * responsive while large files are opened.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "editor.h"
+
+// Start loading filename into the editor's buffer. Any running load is
+// cancelled first. Returns FALSE (and sets error) if the file can't be opened.
+gboolean file_loader_start(TextEditor *editor, const gchar *filename, GError **error);
+
+// Stop the running load, if any, and discard the partially loaded text.
+void file_loader_cancel(TextEditor *editor);
+
+#endif // LOADER_H
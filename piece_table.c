@@ -0,0 +1,810 @@
+/*
+ * Piece-table document model
+ *
+ * Pieces live in a GArray in document order. Inserted text is copied into
+ * add-buffer blocks that are never reallocated, so a Piece can point straight
+ * at its bytes and snapshots stay valid without copying any text. The
+ * original file is indexed with a character count every
+ * PIECE_CHECKPOINT_SPACING bytes so that character offsets inside a
+ * multi-gigabyte original piece can be resolved without walking it.
+ */
+
+#define _GNU_SOURCE
+
+#include "piece_table.h"
+#include "text_scan.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#define PIECE_ADD_BLOCK_SIZE     (64 * 1024)  // Minimum size of an add-buffer block
+#define PIECE_CHECKPOINT_SPACING (64 * 1024)  // Bytes between original-file checkpoints
+#define PIECE_COMPACT_MIN        (4 * 1024 * 1024)  // Add buffer size worth compacting
+
+#define IS_CONTINUATION(c) (((guchar)(c) & 0xC0) == 0x80)
+
+// Text shared between a table and its snapshots
+typedef struct {
+    gint ref_count;
+    GBytes *original_bytes; // Keeps the original text (usually a mapping) alive
+    const gchar *original;
+    gsize original_length;
+    gboolean original_mapped; // The original text is a file mapping, not a copy
+    GArray *checkpoints;    // gsize: characters before each checkpoint
+    gsize indexed_bytes;
+    gsize indexed_chars;
+    GPtrArray *blocks;      // Add-buffer blocks
+    gsize add_allocated;    // Their total size
+} PieceStorage;
+
+struct _PieceTable {
+    PieceStorage *storage;
+    GArray *pieces;
+    gchar *add_block;
+    gsize add_used;
+    gsize add_size;
+    gsize length;
+    gsize char_count;
+
+    // pieces[hint_index] starts at character hint_start, byte
+    // hint_byte_start; speeds up runs of edits and lookups at the same place
+    guint hint_index;
+    gsize hint_start;
+    gsize hint_byte_start;
+
+    GArray *taken;          // PieceTaken while the text is taken, otherwise NULL
+};
+
+// Piece whose text was taken by piece_table_take_text(), and where that
+// text is in what was taken
+typedef struct {
+    guint index;
+    gsize offset;
+} PieceTaken;
+
+struct _PieceSnapshot {
+    gint ref_count;
+    PieceStorage *storage;
+    Piece *pieces;
+    gsize *byte_starts;     // n_pieces + 1 entries
+    gsize *char_starts;     // n_pieces + 1 entries
+    guint n_pieces;
+};
+
+// ============================================
+// STORAGE
+// ============================================
+
+static PieceStorage *storage_new(void) {
+    PieceStorage *storage = g_new0(PieceStorage, 1);
+
+    storage->ref_count = 1;
+    storage->checkpoints = g_array_new(FALSE, FALSE, sizeof(gsize));
+    storage->blocks = g_ptr_array_new_with_free_func(g_free);
+    return storage;
+}
+
+static PieceStorage *storage_ref(PieceStorage *storage) {
+    g_atomic_int_inc(&storage->ref_count);
+    return storage;
+}
+
+static void storage_unref(PieceStorage *storage) {
+    if (!g_atomic_int_dec_and_test(&storage->ref_count)) {
+        return;
+    }
+
+    if (storage->original_bytes) {
+        g_bytes_unref(storage->original_bytes);
+    }
+    g_array_free(storage->checkpoints, TRUE);
+    g_ptr_array_free(storage->blocks, TRUE);
+    g_free(storage);
+}
+
+// Whether piece points into the original text
+static gboolean storage_is_original(PieceStorage *storage, const Piece *piece) {
+    return storage->original &&
+           piece->data >= storage->original &&
+           piece->data < storage->original + storage->original_length;
+}
+
+// Characters before a byte position in the original file
+static gsize original_byte_to_char(PieceStorage *storage, gsize byte) {
+    gsize k = byte / PIECE_CHECKPOINT_SPACING;
+
+    if (k >= storage->checkpoints->len) {
+        k = storage->checkpoints->len - 1;
+    }
+
+    return g_array_index(storage->checkpoints, gsize, k) +
+           text_scan_count_chars(storage->original + k * PIECE_CHECKPOINT_SPACING,
+                                 byte - k * PIECE_CHECKPOINT_SPACING);
+}
+
+// Byte position of a character in the original file
+static gsize original_char_to_byte(PieceStorage *storage, gsize chars) {
+    const gsize *checkpoints = (const gsize *)(void *)storage->checkpoints->data;
+    guint lo = 0, hi = storage->checkpoints->len;
+    gsize position, count;
+
+    // Last checkpoint at or before the character
+    while (hi - lo > 1) {
+        guint mid = (lo + hi) / 2;
+        if (checkpoints[mid] <= chars) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    position = (gsize)lo * PIECE_CHECKPOINT_SPACING;
+    count = checkpoints[lo];
+
+    while (position < storage->original_length) {
+        if (!IS_CONTINUATION(storage->original[position])) {
+            if (count == chars) {
+                break;
+            }
+            count++;
+        }
+        position++;
+    }
+
+    return position;
+}
+
+// Byte offset of the k-th character inside a piece
+static gsize piece_char_to_byte(PieceStorage *storage, const Piece *piece, gsize k) {
+    if (k == 0) {
+        return 0;
+    }
+    if (k >= piece->chars) {
+        return piece->bytes;
+    }
+
+    if (storage_is_original(storage, piece)) {
+        gsize base = piece->data - storage->original;
+        gsize first = original_byte_to_char(storage, base);
+        return original_char_to_byte(storage, first + k) - base;
+    }
+
+    return g_utf8_offset_to_pointer(piece->data, (glong)k) - piece->data;
+}
+
+// Characters before byte offset b inside a piece
+static gsize piece_byte_to_char(PieceStorage *storage, const Piece *piece, gsize b) {
+    if (b == 0) {
+        return 0;
+    }
+    if (b >= piece->bytes) {
+        return piece->chars;
+    }
+
+    if (storage_is_original(storage, piece)) {
+        gsize base = piece->data - storage->original;
+        return original_byte_to_char(storage, base + b) - original_byte_to_char(storage, base);
+    }
+
+    return text_scan_count_chars(piece->data, b);
+}
+
+// ============================================
+// TABLE
+// ============================================
+
+PieceTable *piece_table_new(void) {
+    PieceTable *table = g_new0(PieceTable, 1);
+
+    table->storage = storage_new();
+    table->pieces = g_array_new(FALSE, FALSE, sizeof(Piece));
+    return table;
+}
+
+PieceTable *piece_table_new_from_file(const gchar *filename, GError **error) {
+    GMappedFile *mapping;
+    GBytes *bytes;
+    PieceTable *table;
+
+    mapping = g_mapped_file_new(filename, FALSE, error);
+    if (!mapping) {
+        return NULL;
+    }
+
+    bytes = g_mapped_file_get_bytes(mapping);
+    g_mapped_file_unref(mapping);
+
+    table = piece_table_new_from_mapping(bytes);
+    g_bytes_unref(bytes);
+
+    if (table->storage->original) {
+        posix_madvise((void *)table->storage->original, table->storage->original_length,
+                      POSIX_MADV_SEQUENTIAL);
+    }
+
+    return table;
+}
+
+PieceTable *piece_table_new_from_bytes(GBytes *bytes) {
+    PieceTable *table = piece_table_new();
+    PieceStorage *storage = table->storage;
+
+    storage->original_bytes = g_bytes_ref(bytes);
+    storage->original = g_bytes_get_data(bytes, &storage->original_length);
+
+    if (storage->original_length > 0) {
+        Piece piece = { storage->original, storage->original_length, 0 };
+
+        g_array_append_val(table->pieces, piece);
+        table->length = storage->original_length;
+    } else {
+        storage->original = NULL;
+    }
+
+    return table;
+}
+
+PieceTable *piece_table_new_from_mapping(GBytes *bytes) {
+    PieceTable *table = piece_table_new_from_bytes(bytes);
+
+    table->storage->original_mapped = table->storage->original != NULL;
+    return table;
+}
+
+void piece_table_free(PieceTable *table) {
+    if (table) {
+        storage_unref(table->storage);
+        g_array_free(table->pieces, TRUE);
+        if (table->taken) {
+            g_array_free(table->taken, TRUE);
+        }
+        g_free(table);
+    }
+}
+
+const gchar *piece_table_get_original(PieceTable *table, gsize *length) {
+    *length = table->storage->original_length;
+    return table->storage->original;
+}
+
+void piece_table_index_original(PieceTable *table, const gchar *data, gsize length) {
+    PieceStorage *storage = table->storage;
+
+    g_return_if_fail(data == storage->original + storage->indexed_bytes);
+
+    while (length > 0) {
+        gsize within = storage->indexed_bytes % PIECE_CHECKPOINT_SPACING;
+        gsize span = MIN(length, PIECE_CHECKPOINT_SPACING - within);
+
+        if (within == 0) {
+            g_array_append_val(storage->checkpoints, storage->indexed_chars);
+        }
+
+        storage->indexed_chars += text_scan_count_chars(data, span);
+        storage->indexed_bytes += span;
+        data += span;
+        length -= span;
+    }
+
+    // Once the whole file is indexed the single original piece is complete
+    if (storage->indexed_bytes == storage->original_length && table->pieces->len == 1) {
+        g_array_index(table->pieces, Piece, 0).chars = storage->indexed_chars;
+        table->char_count = storage->indexed_chars;
+    }
+}
+
+void piece_table_append_block(PieceTable *table, gchar *block, gsize bytes) {
+    Piece piece = { block, bytes, text_scan_count_chars(block, bytes) };
+
+    g_ptr_array_add(table->storage->blocks, block);
+    table->storage->add_allocated += bytes;
+    g_array_append_val(table->pieces, piece);
+    table->length += bytes;
+    table->char_count += piece.chars;
+}
+
+void piece_table_clear(PieceTable *table) {
+    storage_unref(table->storage);
+    table->storage = storage_new();
+    g_array_set_size(table->pieces, 0);
+    table->add_block = NULL;
+    table->add_used = 0;
+    table->add_size = 0;
+    table->length = 0;
+    table->char_count = 0;
+    table->hint_index = 0;
+    table->hint_start = 0;
+    table->hint_byte_start = 0;
+}
+
+// Copy text to the add buffer and return its stable address
+static const gchar *piece_table_append_text(PieceTable *table, const gchar *text, gsize bytes) {
+    gchar *dest;
+
+    if (!table->add_block || table->add_size - table->add_used < bytes) {
+        gsize size = MAX(PIECE_ADD_BLOCK_SIZE, bytes);
+
+        table->add_block = g_malloc(size);
+        table->add_size = size;
+        table->add_used = 0;
+        g_ptr_array_add(table->storage->blocks, table->add_block);
+        table->storage->add_allocated += size;
+    }
+
+    dest = table->add_block + table->add_used;
+    memcpy(dest, text, bytes);
+    table->add_used += bytes;
+    return dest;
+}
+
+// Index of the piece containing char_offset (pieces->len at the end)
+static guint piece_table_locate(PieceTable *table, gsize char_offset, gsize *piece_start) {
+    guint i = 0;
+    gsize start = 0, byte_start = 0;
+
+    if (table->hint_index <= table->pieces->len && table->hint_start <= char_offset) {
+        i = table->hint_index;
+        start = table->hint_start;
+        byte_start = table->hint_byte_start;
+    }
+
+    while (i < table->pieces->len) {
+        const Piece *piece = &g_array_index(table->pieces, Piece, i);
+
+        if (char_offset < start + piece->chars) {
+            break;
+        }
+        start += piece->chars;
+        byte_start += piece->bytes;
+        i++;
+    }
+
+    table->hint_index = i;
+    table->hint_start = start;
+    table->hint_byte_start = byte_start;
+    *piece_start = start;
+    return i;
+}
+
+void piece_table_insert(PieceTable *table, gsize char_offset, const gchar *text, gsize bytes) {
+    Piece piece;
+    gsize start;
+    guint i;
+
+    if (bytes == 0) {
+        return;
+    }
+
+    char_offset = MIN(char_offset, table->char_count);
+    piece.data = piece_table_append_text(table, text, bytes);
+    piece.bytes = bytes;
+    piece.chars = g_utf8_strlen(text, bytes);
+
+    i = piece_table_locate(table, char_offset, &start);
+
+    if (char_offset == start) {
+        Piece *prev = (i > 0) ? &g_array_index(table->pieces, Piece, i - 1) : NULL;
+
+        // Extend the previous piece when typing continues where it left off
+        if (prev && prev->data >= table->add_block &&
+            prev->data + prev->bytes == piece.data) {
+            table->hint_index = i - 1;
+            table->hint_start = start - prev->chars;
+            table->hint_byte_start -= prev->bytes;
+            prev->bytes += piece.bytes;
+            prev->chars += piece.chars;
+        } else {
+            g_array_insert_val(table->pieces, i, piece);
+        }
+    } else {
+        Piece *target = &g_array_index(table->pieces, Piece, i);
+        gsize k = char_offset - start;
+        gsize split = piece_char_to_byte(table->storage, target, k);
+        Piece inserted[2];
+
+        inserted[0] = piece;
+        inserted[1].data = target->data + split;
+        inserted[1].bytes = target->bytes - split;
+        inserted[1].chars = target->chars - k;
+
+        target->bytes = split;
+        target->chars = k;
+        g_array_insert_vals(table->pieces, i + 1, inserted, 2);
+    }
+
+    table->length += piece.bytes;
+    table->char_count += piece.chars;
+}
+
+void piece_table_delete(PieceTable *table, gsize char_offset, gsize n_chars) {
+    if (char_offset >= table->char_count) {
+        return;
+    }
+    n_chars = MIN(n_chars, table->char_count - char_offset);
+
+    while (n_chars > 0) {
+        gsize start;
+        guint i = piece_table_locate(table, char_offset, &start);
+        Piece *piece = &g_array_index(table->pieces, Piece, i);
+        gsize k = char_offset - start;
+        gsize take = MIN(piece->chars - k, n_chars);
+        gsize removed_bytes;
+
+        if (k == 0 && take == piece->chars) {
+            // Whole piece
+            removed_bytes = piece->bytes;
+            g_array_remove_index(table->pieces, i);
+        } else if (k == 0) {
+            // Front of the piece
+            removed_bytes = piece_char_to_byte(table->storage, piece, take);
+            piece->data += removed_bytes;
+            piece->bytes -= removed_bytes;
+            piece->chars -= take;
+        } else if (k + take == piece->chars) {
+            // Tail of the piece
+            gsize keep = piece_char_to_byte(table->storage, piece, k);
+            removed_bytes = piece->bytes - keep;
+            piece->bytes = keep;
+            piece->chars = k;
+        } else {
+            // Middle of the piece: split around the hole
+            gsize from = piece_char_to_byte(table->storage, piece, k);
+            gsize to = piece_char_to_byte(table->storage, piece, k + take);
+            Piece right;
+
+            right.data = piece->data + to;
+            right.bytes = piece->bytes - to;
+            right.chars = piece->chars - k - take;
+            piece->bytes = from;
+            piece->chars = k;
+            removed_bytes = to - from;
+            g_array_insert_val(table->pieces, i + 1, right);
+        }
+
+        table->length -= removed_bytes;
+        table->char_count -= take;
+        n_chars -= take;
+    }
+}
+
+void piece_table_compact(PieceTable *table) {
+    PieceStorage *old = table->storage;
+    PieceStorage *storage;
+    gsize live = 0;
+    guint i;
+
+    for (i = 0; i < table->pieces->len; i++) {
+        const Piece *piece = &g_array_index(table->pieces, Piece, i);
+
+        if (!storage_is_original(old, piece)) {
+            live += piece->bytes;
+        }
+    }
+
+    // Copying is only worth it once most of the add buffer is deleted text
+    if (old->add_allocated < PIECE_COMPACT_MIN || live > old->add_allocated / 2) {
+        return;
+    }
+
+    // The original text is shared, the add buffer starts over; snapshots
+    // keep the old storage alive for as long as they need it
+    storage = storage_new();
+    if (old->original_bytes) {
+        storage->original_bytes = g_bytes_ref(old->original_bytes);
+    }
+    storage->original = old->original;
+    storage->original_length = old->original_length;
+    storage->original_mapped = old->original_mapped;
+    g_array_append_vals(storage->checkpoints, old->checkpoints->data, old->checkpoints->len);
+    storage->indexed_bytes = old->indexed_bytes;
+    storage->indexed_chars = old->indexed_chars;
+
+    table->storage = storage;
+    table->add_block = NULL;
+    table->add_used = 0;
+    table->add_size = 0;
+
+    for (i = 0; i < table->pieces->len; i++) {
+        Piece *piece = &g_array_index(table->pieces, Piece, i);
+
+        if (!storage_is_original(old, piece)) {
+            piece->data = piece_table_append_text(table, piece->data, piece->bytes);
+        }
+    }
+
+    storage_unref(old);
+}
+
+gchar *piece_table_take_text(PieceTable *table, gsize *length) {
+    PieceStorage *old = table->storage;
+    PieceStorage *storage;
+    gboolean mapped = old->original_mapped;
+    gsize size, position;
+    gchar *text;
+    guint i;
+
+    g_return_val_if_fail(!table->taken, NULL);
+
+    // A copy of the original text goes first, whole, so it can be given
+    // back as the original along with its index
+    size = mapped ? 0 : old->original_length;
+    for (i = 0; i < table->pieces->len; i++) {
+        const Piece *piece = &g_array_index(table->pieces, Piece, i);
+
+        if (!storage_is_original(old, piece)) {
+            size += piece->bytes;
+        }
+    }
+
+    text = g_malloc(MAX(size, 1));
+    position = mapped ? 0 : old->original_length;
+    if (!mapped && old->original) {
+        memcpy(text, old->original, old->original_length);
+    }
+
+    table->taken = g_array_new(FALSE, FALSE, sizeof(PieceTaken));
+    for (i = 0; i < table->pieces->len; i++) {
+        Piece *piece = &g_array_index(table->pieces, Piece, i);
+        PieceTaken taken = { i, 0 };
+
+        if (storage_is_original(old, piece)) {
+            if (mapped) {
+                continue;
+            }
+            taken.offset = piece->data - old->original;
+        } else {
+            memcpy(text + position, piece->data, piece->bytes);
+            taken.offset = position;
+            position += piece->bytes;
+        }
+        piece->data = NULL;
+        g_array_append_val(table->taken, taken);
+    }
+
+    // Only a mapped original stays; its index is kept either way
+    storage = storage_new();
+    if (mapped) {
+        storage->original_bytes = g_bytes_ref(old->original_bytes);
+        storage->original = old->original;
+        storage->original_mapped = TRUE;
+    }
+    storage->original_length = old->original_length;
+    g_array_append_vals(storage->checkpoints, old->checkpoints->data, old->checkpoints->len);
+    storage->indexed_bytes = old->indexed_bytes;
+    storage->indexed_chars = old->indexed_chars;
+
+    table->storage = storage;
+    table->add_block = NULL;
+    table->add_used = 0;
+    table->add_size = 0;
+    storage_unref(old);
+
+    *length = size;
+    return text;
+}
+
+void piece_table_restore_text(PieceTable *table, gchar *text, gsize length) {
+    PieceStorage *storage = table->storage;
+
+    g_return_if_fail(table->taken);
+
+    if (storage->original_mapped || storage->original_length == 0) {
+        g_ptr_array_add(storage->blocks, text);
+        storage->add_allocated += length;
+    } else {
+        // Starts with the original text, which it becomes again
+        storage->original_bytes = g_bytes_new_take(text, length);
+        storage->original = text;
+    }
+
+    for (guint i = 0; i < table->taken->len; i++) {
+        const PieceTaken *taken = &g_array_index(table->taken, PieceTaken, i);
+
+        g_array_index(table->pieces, Piece, taken->index).data = text + taken->offset;
+    }
+    g_array_free(table->taken, TRUE);
+    table->taken = NULL;
+}
+
+gsize piece_table_get_memory(PieceTable *table) {
+    PieceStorage *storage = table->storage;
+
+    return storage->add_allocated + table->pieces->len * sizeof(Piece) +
+           (storage->original_mapped ? 0 : storage->original_length);
+}
+
+gsize piece_table_get_length(PieceTable *table) {
+    return table->length;
+}
+
+gsize piece_table_get_char_count(PieceTable *table) {
+    return table->char_count;
+}
+
+gsize piece_table_char_to_byte(PieceTable *table, gsize char_offset) {
+    gsize start;
+    guint i;
+
+    g_return_val_if_fail(!table->taken, 0);
+
+    if (char_offset >= table->char_count) {
+        return table->length;
+    }
+
+    i = piece_table_locate(table, char_offset, &start);
+    return table->hint_byte_start +
+           piece_char_to_byte(table->storage, &g_array_index(table->pieces, Piece, i),
+                              char_offset - start);
+}
+
+// ============================================
+// SNAPSHOTS
+// ============================================
+
+PieceSnapshot *piece_table_snapshot(PieceTable *table) {
+    PieceSnapshot *snapshot = g_new0(PieceSnapshot, 1);
+    guint n = table->pieces->len;
+    guint i;
+
+    snapshot->ref_count = 1;
+    snapshot->storage = storage_ref(table->storage);
+    snapshot->n_pieces = n;
+    snapshot->pieces = g_new(Piece, MAX(n, 1));
+    memcpy(snapshot->pieces, table->pieces->data, n * sizeof(Piece));
+    snapshot->byte_starts = g_new(gsize, n + 1);
+    snapshot->char_starts = g_new(gsize, n + 1);
+
+    snapshot->byte_starts[0] = 0;
+    snapshot->char_starts[0] = 0;
+    for (i = 0; i < n; i++) {
+        snapshot->byte_starts[i + 1] = snapshot->byte_starts[i] + snapshot->pieces[i].bytes;
+        snapshot->char_starts[i + 1] = snapshot->char_starts[i] + snapshot->pieces[i].chars;
+    }
+
+    return snapshot;
+}
+
+PieceSnapshot *piece_snapshot_ref(PieceSnapshot *snapshot) {
+    g_atomic_int_inc(&snapshot->ref_count);
+    return snapshot;
+}
+
+void piece_snapshot_unref(PieceSnapshot *snapshot) {
+    if (!snapshot || !g_atomic_int_dec_and_test(&snapshot->ref_count)) {
+        return;
+    }
+
+    storage_unref(snapshot->storage);
+    g_free(snapshot->pieces);
+    g_free(snapshot->byte_starts);
+    g_free(snapshot->char_starts);
+    g_free(snapshot);
+}
+
+const Piece *piece_snapshot_get_pieces(PieceSnapshot *snapshot, guint *n_pieces) {
+    *n_pieces = snapshot->n_pieces;
+    return snapshot->pieces;
+}
+
+gsize piece_snapshot_get_length(PieceSnapshot *snapshot) {
+    return snapshot->byte_starts[snapshot->n_pieces];
+}
+
+gsize piece_snapshot_get_char_count(PieceSnapshot *snapshot) {
+    return snapshot->char_starts[snapshot->n_pieces];
+}
+
+// Last piece whose start is at or before value (starts has n + 1 entries)
+static guint starts_search(const gsize *starts, guint n, gsize value) {
+    guint lo = 0, hi = n;
+
+    while (hi - lo > 1) {
+        guint mid = (lo + hi) / 2;
+        if (starts[mid] <= value) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void piece_snapshot_copy(PieceSnapshot *snapshot, gsize byte_offset, gsize length, gchar *dest) {
+    guint i = starts_search(snapshot->byte_starts, snapshot->n_pieces, byte_offset);
+
+    while (length > 0 && i < snapshot->n_pieces) {
+        const Piece *piece = &snapshot->pieces[i];
+        gsize within = byte_offset - snapshot->byte_starts[i];
+        gsize take = MIN(length, piece->bytes - within);
+
+        memcpy(dest, piece->data + within, take);
+        dest += take;
+        byte_offset += take;
+        length -= take;
+        i++;
+    }
+}
+
+const gchar *piece_snapshot_get_span(PieceSnapshot *snapshot, gsize byte_offset, gsize length) {
+    guint i = starts_search(snapshot->byte_starts, snapshot->n_pieces, byte_offset);
+    gsize within = byte_offset - snapshot->byte_starts[i];
+
+    if (i >= snapshot->n_pieces || within + length > snapshot->pieces[i].bytes) {
+        return NULL;
+    }
+    return snapshot->pieces[i].data + within;
+}
+
+gssize piece_snapshot_find(PieceSnapshot *snapshot, const gchar *needle, gsize needle_len,
+                           gsize from) {
+    gsize total = piece_snapshot_get_length(snapshot);
+    gchar *window = NULL;
+    gssize result = -1;
+    guint i;
+
+    if (needle_len == 0 || from >= total || needle_len > total - from) {
+        return -1;
+    }
+
+    // Scratch space for matches that straddle a piece boundary
+    if (needle_len > 1) {
+        window = g_malloc(2 * (needle_len - 1));
+    }
+
+    for (i = starts_search(snapshot->byte_starts, snapshot->n_pieces, from);
+         i < snapshot->n_pieces; i++) {
+        const Piece *piece = &snapshot->pieces[i];
+        gsize start = snapshot->byte_starts[i];
+        gsize begin = MAX(from, start);
+        gsize hit;
+
+        if (window && start > from) {
+            gsize window_start = (start - from > needle_len - 1) ? start - (needle_len - 1) : from;
+            gsize window_end = MIN(total, start + needle_len - 1);
+
+            piece_snapshot_copy(snapshot, window_start, window_end - window_start, window);
+            hit = text_scan_find(window, window_end - window_start, needle, needle_len);
+
+            if (hit < window_end - window_start && window_start + hit < start) {
+                result = window_start + hit;
+                break;
+            }
+        }
+
+        hit = text_scan_find(piece->data + (begin - start), piece->bytes - (begin - start),
+                             needle, needle_len);
+        if (hit < piece->bytes - (begin - start)) {
+            result = begin + hit;
+            break;
+        }
+    }
+
+    g_free(window);
+    return result;
+}
+
+gsize piece_snapshot_char_to_byte(PieceSnapshot *snapshot, gsize char_offset) {
+    guint i;
+
+    if (char_offset >= piece_snapshot_get_char_count(snapshot)) {
+        return piece_snapshot_get_length(snapshot);
+    }
+
+    i = starts_search(snapshot->char_starts, snapshot->n_pieces, char_offset);
+    return snapshot->byte_starts[i] +
+           piece_char_to_byte(snapshot->storage, &snapshot->pieces[i],
+                              char_offset - snapshot->char_starts[i]);
+}
+
+gsize piece_snapshot_byte_to_char(PieceSnapshot *snapshot, gsize byte_offset) {
+    guint i;
+
+    if (byte_offset >= piece_snapshot_get_length(snapshot)) {
+        return piece_snapshot_get_char_count(snapshot);
+    }
+
+    i = starts_search(snapshot->byte_starts, snapshot->n_pieces, byte_offset);
+    return snapshot->char_starts[i] +
+           piece_byte_to_char(snapshot->storage, &snapshot->pieces[i],
+                              byte_offset - snapshot->byte_starts[i]);
+}
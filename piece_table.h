@@ -0,0 +1,111 @@
+/*
+ * Piece-table document model
+ *
+ * The document is described by a list of pieces, each pointing into either
+ * the original file (memory-mapped, never copied) or an append-only add
+ * buffer that receives inserted text. Editing therefore costs memory in
+ * proportion to the edits, not to the size of the file. The GtkTextBuffer
+ * is a view that mirrors edits into the table.
+ *
+ * Edit positions are character offsets, matching gtk_text_iter_get_offset().
+ */
+
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include <glib.h>
+
+typedef struct {
+    const gchar *data;
+    gsize bytes;
+    gsize chars;
+} Piece;
+
+typedef struct _PieceTable PieceTable;
+typedef struct _PieceSnapshot PieceSnapshot;
+
+// Create an empty document
+PieceTable *piece_table_new(void);
+
+// Create a document backed by a read-only mapping of filename. Character
+// counts are unknown until the whole mapping has been passed, in order,
+// to piece_table_index_original().
+PieceTable *piece_table_new_from_file(const gchar *filename, GError **error);
+
+// Same for UTF-8 text already in memory, such as a slice of a mapping or a
+// file converted from another encoding. Takes its own reference to bytes.
+PieceTable *piece_table_new_from_bytes(GBytes *bytes);
+
+// Same for bytes that are (a slice of) a file mapping, which the kernel can
+// page out and read again, so it isn't counted as memory the document takes
+PieceTable *piece_table_new_from_mapping(GBytes *bytes);
+void piece_table_free(PieceTable *table);
+
+// The original text (NULL/0 for documents not backed by a file)
+const gchar *piece_table_get_original(PieceTable *table, gsize *length);
+
+// Count characters in the next length bytes of the original file. May be
+// called from a worker thread before the table is handed to the editor.
+void piece_table_index_original(PieceTable *table, const gchar *data, gsize length);
+
+// Append text at the end of the document, taking ownership of block (freed
+// with g_free()). Lets a worker build a document from decompressed text
+// without copying it again.
+void piece_table_append_block(PieceTable *table, gchar *block, gsize bytes);
+
+// Drop all content and release the mapping
+void piece_table_clear(PieceTable *table);
+
+void piece_table_insert(PieceTable *table, gsize char_offset, const gchar *text, gsize bytes);
+void piece_table_delete(PieceTable *table, gsize char_offset, gsize n_chars);
+
+// Release add-buffer memory that only holds deleted text, for documents
+// that keep growing at one end and shrinking at the other. Cheap when
+// there is little to release, in which case nothing is copied.
+void piece_table_compact(PieceTable *table);
+
+gsize piece_table_get_length(PieceTable *table);
+gsize piece_table_get_char_count(PieceTable *table);
+
+// Byte offset of a character, without taking a snapshot. The search starts
+// from the last edit or lookup, so it is cheap near where that was.
+gsize piece_table_char_to_byte(PieceTable *table, gsize char_offset);
+
+// Bytes of memory the document takes beyond a mapped file: its added text,
+// its original text unless mapped, and its pieces
+gsize piece_table_get_memory(PieceTable *table);
+
+// Move all the text of the document that isn't in a mapped file into one
+// buffer of *length bytes, which is returned (to be freed with g_free()),
+// and release the memory it took. Until piece_table_restore_text() gives
+// the same bytes back the document has only its lengths and can't be read.
+// For documents put away in a compact form.
+gchar *piece_table_take_text(PieceTable *table, gsize *length);
+void piece_table_restore_text(PieceTable *table, gchar *text, gsize length);
+
+// Immutable, thread-safe view of the current content. Later edits to the
+// table don't affect a snapshot, and the text it points to stays valid
+// until the last reference is dropped.
+PieceSnapshot *piece_table_snapshot(PieceTable *table);
+PieceSnapshot *piece_snapshot_ref(PieceSnapshot *snapshot);
+void piece_snapshot_unref(PieceSnapshot *snapshot);
+
+const Piece *piece_snapshot_get_pieces(PieceSnapshot *snapshot, guint *n_pieces);
+gsize piece_snapshot_get_length(PieceSnapshot *snapshot);
+gsize piece_snapshot_get_char_count(PieceSnapshot *snapshot);
+
+// Copy length bytes starting at byte_offset into dest
+void piece_snapshot_copy(PieceSnapshot *snapshot, gsize byte_offset, gsize length, gchar *dest);
+
+// The length bytes starting at byte_offset in place, if they lie in a
+// single piece, or NULL if they would have to be copied
+const gchar *piece_snapshot_get_span(PieceSnapshot *snapshot, gsize byte_offset, gsize length);
+
+// Byte offset of the first occurrence of needle at or after from, or -1
+gssize piece_snapshot_find(PieceSnapshot *snapshot, const gchar *needle, gsize needle_len,
+                           gsize from);
+
+gsize piece_snapshot_char_to_byte(PieceSnapshot *snapshot, gsize char_offset);
+gsize piece_snapshot_byte_to_char(PieceSnapshot *snapshot, gsize byte_offset);
+
+#endif // PIECE_TABLE_H
@@ -0,0 +1,342 @@
+/*
+ * Regular expression search over a document snapshot
+ *
+ * The snapshot is cut into chunks of about REGEX_CHUNK_SIZE bytes, ending
+ * after a newline where there is one nearby, and each chunk is matched by
+ * a thread of a shared pool. A chunk owns the matches that start inside
+ * it, but the text handed to PCRE reaches REGEX_CONTEXT bytes before it, so
+ * that ^, \b and lookbehind see the real preceding text, and up to
+ * REGEX_SEARCH_MAX_SPAN bytes after it, so that a match running past its
+ * end is found whole. Text that lies inside a single piece (the whole of an
+ * unedited file) is matched in place rather than copied.
+ *
+ * The calling thread collects the chunks in order, dropping a match that
+ * overlaps the last one of the chunk before, which only happens for
+ * matches that span a newline. At most twice as many chunks as there are
+ * processors are in flight, which bounds the memory held by results.
+ */
+
+#include "regex_search.h"
+#include "text_scan.h"
+
+#include <string.h>
+
+#define REGEX_CHUNK_SIZE  (1024 * 1024)  // Bytes matched per task
+#define REGEX_CONTEXT     256            // Bytes before a chunk visible to lookbehind
+#define REGEX_LINE_WINDOW 4096           // Bytes looked at for a newline to end a chunk at
+#define REGEX_CACHE_SIZE  16             // Compiled patterns kept
+
+typedef struct {
+    PieceSnapshot *snapshot;
+    GRegex *regex;
+    guint n_groups;         // Capture groups recorded per match, 0 without groups
+    const gint *cancelled;  // Atomic, the caller's
+    gint stopped;           // Atomic, set on an error or when func wants no more
+
+    GMutex lock;
+    GCond cond;
+} RegexRun;
+
+typedef struct {
+    RegexRun *run;
+    gsize start;            // Bytes whose matches belong to this chunk
+    gsize end;
+    GArray *matches;        // RegexMatch
+    GArray *groups;         // gssize pairs, run->n_groups per match
+    GError *error;
+    gboolean done;          // Protected by run->lock
+} RegexChunk;
+
+typedef struct {
+    gchar *pattern;
+    GRegexCompileFlags flags;
+    GRegex *regex;
+} RegexCacheEntry;
+
+// Most recently used first
+static GQueue regex_cache = G_QUEUE_INIT;
+
+// Counts characters through a chunk's text, from its last position
+typedef struct {
+    gsize position;
+    gsize chars;
+} RegexCursor;
+
+static void regex_cache_entry_free(gpointer data) {
+    RegexCacheEntry *entry = (RegexCacheEntry *)data;
+
+    g_regex_unref(entry->regex);
+    g_free(entry->pattern);
+    g_free(entry);
+}
+
+GRegex *regex_search_compile(const gchar *pattern, GRegexCompileFlags flags, GError **error) {
+    RegexCacheEntry *entry;
+    GRegex *regex;
+
+    for (GList *link = regex_cache.head; link; link = link->next) {
+        entry = (RegexCacheEntry *)link->data;
+
+        if (entry->flags == flags && strcmp(entry->pattern, pattern) == 0) {
+            g_queue_unlink(&regex_cache, link);
+            g_queue_push_head_link(&regex_cache, link);
+            return g_regex_ref(entry->regex);
+        }
+    }
+
+    // ^ and $ match at every line, and OPTIMIZE has PCRE2 JIT compile the
+    // pattern when it can
+    regex = g_regex_new(pattern, flags | G_REGEX_MULTILINE | G_REGEX_OPTIMIZE, 0, error);
+    if (!regex) {
+        return NULL;
+    }
+
+    entry = g_new0(RegexCacheEntry, 1);
+    entry->pattern = g_strdup(pattern);
+    entry->flags = flags;
+    entry->regex = regex;
+    g_queue_push_head(&regex_cache, entry);
+
+    if (regex_cache.length > REGEX_CACHE_SIZE) {
+        regex_cache_entry_free(g_queue_pop_tail(&regex_cache));
+    }
+
+    return g_regex_ref(regex);
+}
+
+void regex_search_clear_cache(void) {
+    g_queue_clear_full(&regex_cache, regex_cache_entry_free);
+}
+
+static gboolean regex_run_stopped(RegexRun *run) {
+    return g_atomic_int_get(&run->stopped) || (run->cancelled && g_atomic_int_get(run->cancelled));
+}
+
+// First character boundary at or after position
+static gsize regex_char_boundary(PieceSnapshot *snapshot, gsize position, gsize total) {
+    gchar bytes[3];
+    gsize n = MIN(sizeof(bytes), total - position), i = 0;
+
+    piece_snapshot_copy(snapshot, position, n, bytes);
+    while (i < n && ((guchar)bytes[i] & 0xC0) == 0x80) {
+        i++;
+    }
+    return position + i;
+}
+
+// Where the chunk starting at start ends: after the first newline past
+// REGEX_CHUNK_SIZE bytes, or right there in a very long line
+static gsize regex_chunk_end(PieceSnapshot *snapshot, gsize start, gsize total) {
+    gchar window[REGEX_LINE_WINDOW];
+    gsize target, length;
+    const gchar *newline;
+
+    if (total - start <= REGEX_CHUNK_SIZE) {
+        return total;
+    }
+
+    target = start + REGEX_CHUNK_SIZE;
+    length = MIN(sizeof(window), total - target);
+    piece_snapshot_copy(snapshot, target, length, window);
+
+    newline = memchr(window, '\n', length);
+    if (newline) {
+        return target + (newline - window) + 1;
+    }
+    return regex_char_boundary(snapshot, target, total);
+}
+
+// Character offset of position in the chunk's text
+static gsize regex_cursor_chars(RegexCursor *cursor, const gchar *text, gsize position) {
+    if (position < cursor->position) {
+        return cursor->chars - text_scan_count_chars(text + position, cursor->position - position);
+    }
+
+    cursor->chars += text_scan_count_chars(text + cursor->position, position - cursor->position);
+    cursor->position = position;
+    return cursor->chars;
+}
+
+// Pool thread: find the matches starting in one chunk
+static void regex_chunk_worker(gpointer data, gpointer user_data) {
+    RegexChunk *chunk = (RegexChunk *)data;
+    RegexRun *run = chunk->run;
+    gsize total = piece_snapshot_get_length(run->snapshot);
+    gsize from, to, length;
+    const gchar *text;
+    gchar *copy = NULL;
+    GMatchInfo *info = NULL;
+    RegexCursor cursor;
+
+    if (regex_run_stopped(run)) {
+        goto done;
+    }
+
+    from = regex_char_boundary(run->snapshot, chunk->start - MIN(chunk->start, REGEX_CONTEXT),
+                               total);
+    to = chunk->end + MIN(total - chunk->end, REGEX_SEARCH_MAX_SPAN);
+    if (to < total) {
+        to = regex_char_boundary(run->snapshot, to, total);
+    }
+    length = to - from;
+
+    text = length > 0 ? piece_snapshot_get_span(run->snapshot, from, length) : "";
+    if (!text) {
+        copy = g_malloc(length);
+        piece_snapshot_copy(run->snapshot, from, length, copy);
+        text = copy;
+    }
+
+    cursor.position = chunk->start - from;
+    cursor.chars = piece_snapshot_byte_to_char(run->snapshot, chunk->start);
+
+    // Where the text is cut short, its end isn't the end of a line
+    g_regex_match_full(run->regex, text, length, (gint)(chunk->start - from),
+                       to < total ? G_REGEX_MATCH_NOTEOL : 0, &info, &chunk->error);
+
+    while (!chunk->error && g_match_info_matches(info)) {
+        RegexMatch match;
+        gint start, end;
+
+        // The last chunk also owns an empty match at the end of the text
+        g_match_info_fetch_pos(info, 0, &start, &end);
+        if (from + start >= chunk->end && chunk->end < total) {
+            break;
+        }
+
+        match.start = regex_cursor_chars(&cursor, text, start);
+        for (guint g = 1; g <= run->n_groups; g++) {
+            gint group_start, group_end;
+            gssize pair[2] = { -1, -1 };
+
+            if (g_match_info_fetch_pos(info, (gint)g, &group_start, &group_end) &&
+                group_start >= 0) {
+                pair[0] = regex_cursor_chars(&cursor, text, group_start);
+                pair[1] = regex_cursor_chars(&cursor, text, group_end);
+            }
+            g_array_append_vals(chunk->groups, pair, 2);
+        }
+        match.end = regex_cursor_chars(&cursor, text, end);
+        g_array_append_val(chunk->matches, match);
+
+        if (chunk->matches->len % 1024 == 0 && regex_run_stopped(run)) {
+            break;
+        }
+        g_match_info_next(info, &chunk->error);
+    }
+
+    g_match_info_free(info);
+    g_free(copy);
+
+done:
+    g_mutex_lock(&run->lock);
+    chunk->done = TRUE;
+    g_cond_broadcast(&run->cond);
+    g_mutex_unlock(&run->lock);
+}
+
+// The pool shared by every search, one thread per processor
+static GThreadPool *regex_get_pool(void) {
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool)) {
+        g_once_init_leave(&pool, g_thread_pool_new(regex_chunk_worker, NULL,
+                                                   (gint)g_get_num_processors(), FALSE, NULL));
+    }
+    return pool;
+}
+
+static void regex_chunk_free(RegexChunk *chunk) {
+    g_array_free(chunk->matches, TRUE);
+    g_array_free(chunk->groups, TRUE);
+    g_clear_error(&chunk->error);
+    g_free(chunk);
+}
+
+gboolean regex_search_run(PieceSnapshot *snapshot, GRegex *regex, gboolean with_groups,
+                          const gint *cancelled, RegexMatchFunc func, gpointer data,
+                          GError **error) {
+    GThreadPool *pool = regex_get_pool();
+    guint max_pending = 2 * g_get_num_processors();
+    gsize total = piece_snapshot_get_length(snapshot);
+    gsize next = 0, last_end = 0;
+    GQueue pending = G_QUEUE_INIT;
+    gboolean started = FALSE;
+    gboolean ok = TRUE;
+    RegexChunk *chunk;
+    RegexRun run;
+
+    memset(&run, 0, sizeof(run));
+    run.snapshot = snapshot;
+    run.regex = regex;
+    run.n_groups = with_groups ? (guint)g_regex_get_capture_count(regex) : 0;
+    run.cancelled = cancelled;
+    g_mutex_init(&run.lock);
+    g_cond_init(&run.cond);
+
+    for (;;) {
+        const RegexMatch *matches;
+        guint skip = 0;
+
+        // Keep the pool busy ahead of the chunk being collected. An empty
+        // document is still one chunk, where ^ and $ match.
+        while ((next < total || !started) && pending.length < max_pending &&
+               !regex_run_stopped(&run)) {
+            started = TRUE;
+            chunk = g_new0(RegexChunk, 1);
+            chunk->run = &run;
+            chunk->start = next;
+            chunk->end = next = regex_chunk_end(snapshot, next, total);
+            chunk->matches = g_array_new(FALSE, FALSE, sizeof(RegexMatch));
+            chunk->groups = g_array_new(FALSE, FALSE, sizeof(gssize));
+            g_queue_push_tail(&pending, chunk);
+            g_thread_pool_push(pool, chunk, NULL);
+        }
+
+        // Chunks are collected in order, even if later ones finish first
+        chunk = (RegexChunk *)g_queue_pop_head(&pending);
+        if (!chunk) {
+            break;
+        }
+
+        g_mutex_lock(&run.lock);
+        while (!chunk->done) {
+            g_cond_wait(&run.cond, &run.lock);
+        }
+        g_mutex_unlock(&run.lock);
+
+        if (chunk->error) {
+            if (ok) {
+                g_propagate_error(error, chunk->error);
+                chunk->error = NULL;
+                ok = FALSE;
+            }
+            g_atomic_int_set(&run.stopped, 1);
+        }
+
+        matches = (const RegexMatch *)(void *)chunk->matches->data;
+        while (skip < chunk->matches->len && matches[skip].start < last_end) {
+            skip++;
+        }
+
+        if (!regex_run_stopped(&run) && skip < chunk->matches->len) {
+            const gssize *groups = (const gssize *)(void *)chunk->groups->data;
+
+            if (!func(matches + skip, chunk->matches->len - skip,
+                      with_groups ? groups + (gsize)skip * run.n_groups * 2 : NULL, data)) {
+                g_atomic_int_set(&run.stopped, 1);
+            }
+            last_end = matches[chunk->matches->len - 1].end;
+        }
+
+        regex_chunk_free(chunk);
+    }
+
+    if (cancelled && g_atomic_int_get(cancelled)) {
+        ok = FALSE;
+    }
+
+    g_mutex_clear(&run.lock);
+    g_cond_clear(&run.cond);
+    return ok;
+}
@@ -0,0 +1,47 @@
+/*
+ * Regular expression search over a document snapshot
+ *
+ * Patterns are compiled with GRegex (PCRE2, JIT compiled when GLib and the
+ * CPU support it) and kept in a small cache, so retyping or editing a
+ * pattern doesn't compile it again. The snapshot is split into chunks that
+ * are matched in parallel on a thread pool; the caller gets the matches in
+ * document order, as character offsets, with their capture groups if asked.
+ */
+
+#ifndef REGEX_SEARCH_H
+#define REGEX_SEARCH_H
+
+#include "piece_table.h"
+
+// Longest match found in full when it crosses the end of a chunk
+#define REGEX_SEARCH_MAX_SPAN (64 * 1024)
+
+typedef struct {
+    gsize start;            // Character offsets in the document
+    gsize end;
+} RegexMatch;
+
+// Called with the next matches in document order. groups holds, for each
+// match, the start and end character offsets of its capture groups (-1 for
+// a group that didn't take part), or is NULL if groups weren't asked for.
+// Returns FALSE if no more matches are wanted.
+typedef gboolean (*RegexMatchFunc)(const RegexMatch *matches, guint n_matches,
+                                   const gssize *groups, gpointer data);
+
+// Compile pattern, or take it from the cache of recently used patterns.
+// Returns a new reference, or NULL with error set if the pattern is
+// invalid. Main thread only.
+GRegex *regex_search_compile(const gchar *pattern, GRegexCompileFlags flags, GError **error);
+
+// Drop the cached patterns
+void regex_search_clear_cache(void);
+
+// Find the non-overlapping matches of regex in snapshot, passing them to
+// func from the calling thread. Returns FALSE if stopped by *cancelled
+// (optional) becoming non-zero, or with error set if matching ran into a
+// PCRE limit.
+gboolean regex_search_run(PieceSnapshot *snapshot, GRegex *regex, gboolean with_groups,
+                          const gint *cancelled, RegexMatchFunc func, gpointer data,
+                          GError **error);
+
+#endif // REGEX_SEARCH_H
@@ -0,0 +1,263 @@
+/*
+ * Replace All
+ *
+ * Matches come from regex_search_run() in document order, so the text is
+ * read once from the first match to the last: what lies between matches
+ * is copied, each match is replaced as it goes by. A literal search is
+ * the escaped string compiled as a pattern. The replacement is parsed
+ * once into text and group references before any matching starts.
+ */
+
+#include "replace.h"
+#include "regex_search.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    gint group;             // Capture group to insert, or -1 for text
+    gchar *text;
+} ReplacePart;
+
+// Walks the snapshot's pieces by character offset
+typedef struct {
+    const Piece *pieces;
+    guint n_pieces;
+    guint index;            // Current piece
+    gsize within;           // Bytes of it passed
+    gsize within_chars;     // The same in characters
+    gsize chars;            // Character offset in the document
+} ReplaceReader;
+
+typedef struct {
+    ReplaceReader reader;
+    GArray *parts;          // ReplacePart, NULL for an unexpanded replacement
+    const gchar *replacement;
+    guint n_groups;
+    GString *match;         // Text of the match being replaced
+    ReplaceResult *result;
+} ReplaceBuild;
+
+static void replace_parts_free(GArray *parts) {
+    for (guint i = 0; i < parts->len; i++) {
+        g_free(g_array_index(parts, ReplacePart, i).text);
+    }
+    g_array_free(parts, TRUE);
+}
+
+// Add the text collected so far and, if group isn't -1, a reference to it
+static void replace_parts_add(GArray *parts, GString *text, gint group) {
+    ReplacePart part;
+
+    if (text->len > 0) {
+        part.group = -1;
+        part.text = g_strndup(text->str, text->len);
+        g_array_append_val(parts, part);
+        g_string_truncate(text, 0);
+    }
+    if (group >= 0) {
+        part.group = group;
+        part.text = NULL;
+        g_array_append_val(parts, part);
+    }
+}
+
+// Split replacement into text and capture group references
+static GArray *replace_parse(const gchar *replacement, GRegex *regex, GError **error) {
+    GArray *parts = g_array_new(FALSE, FALSE, sizeof(ReplacePart));
+    GString *text = g_string_new(NULL);
+    gint n_groups = g_regex_get_capture_count(regex);
+    const gchar *p = replacement;
+
+    while (*p) {
+        gint group = -1;
+
+        if (*p != '\\') {
+            g_string_append_c(text, *p++);
+            continue;
+        }
+
+        p++;
+        switch (*p) {
+        case 'n':
+            g_string_append_c(text, '\n');
+            p++;
+            continue;
+        case 't':
+            g_string_append_c(text, '\t');
+            p++;
+            continue;
+        case 'r':
+            g_string_append_c(text, '\r');
+            p++;
+            continue;
+        case '\\':
+            g_string_append_c(text, '\\');
+            p++;
+            continue;
+        case 'g': {
+            const gchar *close = p[1] == '<' ? strchr(p + 2, '>') : NULL;
+            gchar *name;
+
+            if (!close || close == p + 2) {
+                break;
+            }
+            name = g_strndup(p + 2, close - (p + 2));
+            group = g_ascii_isdigit(*name) ? atoi(name) : g_regex_get_string_number(regex, name);
+            g_free(name);
+            p = close + 1;
+            break;
+        }
+        default:
+            if (g_ascii_isdigit(*p)) {
+                group = *p++ - '0';
+            }
+            break;
+        }
+
+        if (group < 0 || group > n_groups) {
+            g_set_error(error, G_REGEX_ERROR, G_REGEX_ERROR_REPLACE,
+                        group < 0 ? "Unknown escape in the replacement"
+                                  : "The replacement refers to a group the pattern doesn't have");
+            g_string_free(text, TRUE);
+            replace_parts_free(parts);
+            return NULL;
+        }
+        replace_parts_add(parts, text, group);
+    }
+
+    replace_parts_add(parts, text, -1);
+    g_string_free(text, TRUE);
+    return parts;
+}
+
+// Move the reader on to character offset to, appending the text passed
+// over to out unless it is NULL
+static void replace_reader_take(ReplaceReader *reader, gsize to, GString *out) {
+    while (reader->chars < to && reader->index < reader->n_pieces) {
+        const Piece *piece = &reader->pieces[reader->index];
+        const gchar *from = piece->data + reader->within;
+        gsize wanted = to - reader->chars;
+        gsize bytes;
+
+        if (wanted >= piece->chars - reader->within_chars) {
+            bytes = piece->bytes - reader->within;
+            reader->chars += piece->chars - reader->within_chars;
+            reader->index++;
+            reader->within = 0;
+            reader->within_chars = 0;
+        } else {
+            bytes = g_utf8_offset_to_pointer(from, (glong)wanted) - from;
+            reader->within += bytes;
+            reader->within_chars += wanted;
+            reader->chars += wanted;
+        }
+
+        if (out) {
+            g_string_append_len(out, from, bytes);
+        }
+    }
+}
+
+// Append the replacement of match, whose text is in build->match
+static void replace_expand(ReplaceBuild *build, const RegexMatch *match, const gssize *groups) {
+    GString *out = build->result->text;
+    const gchar *text = build->match->str;
+
+    for (guint i = 0; i < build->parts->len; i++) {
+        const ReplacePart *part = &g_array_index(build->parts, ReplacePart, i);
+        gssize start, end;
+        const gchar *first;
+
+        if (part->group < 0) {
+            g_string_append(out, part->text);
+            continue;
+        }
+        if (part->group == 0) {
+            g_string_append_len(out, text, build->match->len);
+            continue;
+        }
+
+        // Groups that didn't take part, or lie outside the match through
+        // lookaround, insert nothing
+        start = groups[(part->group - 1) * 2];
+        end = groups[(part->group - 1) * 2 + 1];
+        if (start < (gssize)match->start || end > (gssize)match->end || start > end) {
+            continue;
+        }
+
+        first = g_utf8_offset_to_pointer(text, start - (gssize)match->start);
+        g_string_append_len(out, first,
+                            g_utf8_offset_to_pointer(first, end - start) - first);
+    }
+}
+
+// Regex search callback: replace the next matches
+static gboolean replace_found(const RegexMatch *matches, guint n_matches, const gssize *groups,
+                              gpointer data) {
+    ReplaceBuild *build = (ReplaceBuild *)data;
+    ReplaceResult *result = build->result;
+
+    for (guint i = 0; i < n_matches; i++) {
+        const RegexMatch *match = &matches[i];
+
+        // The span starts at the first match
+        if (!result->text) {
+            result->text = g_string_new(NULL);
+            result->start = match->start;
+            replace_reader_take(&build->reader, match->start, NULL);
+        } else {
+            replace_reader_take(&build->reader, match->start, result->text);
+        }
+
+        if (build->parts) {
+            g_string_truncate(build->match, 0);
+            replace_reader_take(&build->reader, match->end, build->match);
+            replace_expand(build, match, groups + (gsize)i * build->n_groups * 2);
+        } else {
+            replace_reader_take(&build->reader, match->end, NULL);
+            g_string_append(result->text, build->replacement);
+        }
+
+        result->end = match->end;
+        result->count++;
+    }
+
+    return TRUE;
+}
+
+gboolean replace_all_build(PieceSnapshot *snapshot, GRegex *regex, const gchar *replacement,
+                           gboolean expand, ReplaceResult *result, GError **error) {
+    ReplaceBuild build;
+    gboolean ok;
+
+    memset(&build, 0, sizeof(build));
+    memset(result, 0, sizeof(*result));
+
+    if (expand) {
+        build.parts = replace_parse(replacement, regex, error);
+        if (!build.parts) {
+            return FALSE;
+        }
+        build.n_groups = (guint)g_regex_get_capture_count(regex);
+        build.match = g_string_new(NULL);
+    }
+
+    build.reader.pieces = piece_snapshot_get_pieces(snapshot, &build.reader.n_pieces);
+    build.replacement = replacement;
+    build.result = result;
+
+    ok = regex_search_run(snapshot, regex, expand, NULL, replace_found, &build, error);
+
+    if (build.parts) {
+        replace_parts_free(build.parts);
+        g_string_free(build.match, TRUE);
+    }
+
+    if (!ok && result->text) {
+        g_string_free(result->text, TRUE);
+        result->text = NULL;
+        result->count = 0;
+    }
+    return ok;
+}
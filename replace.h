@@ -0,0 +1,31 @@
+/*
+ * Replace All
+ *
+ * Every match is found from a snapshot of the document, and the text from
+ * the first match to the end of the last one is rebuilt with the
+ * replacements in a single pass. The caller swaps that span in as one
+ * edit, so the buffer, the piece table and the journal see one deletion
+ * and one insertion however many matches there are.
+ */
+
+#ifndef REPLACE_H
+#define REPLACE_H
+
+#include "piece_table.h"
+
+typedef struct {
+    gsize start;            // Character offsets of the span to replace
+    gsize end;
+    GString *text;          // What replaces it
+    gsize count;            // Matches replaced
+} ReplaceResult;
+
+// Build the replacement of every match of regex in snapshot. With expand
+// set, \0 to \9 and \g<name> in replacement insert capture groups, and \n,
+// \t, \r and \\ the characters they stand for; otherwise it is inserted as
+// is. Returns FALSE with error set if replacement is malformed. On success
+// result->text is NULL if nothing matched, else owned by the caller.
+gboolean replace_all_build(PieceSnapshot *snapshot, GRegex *regex, const gchar *replacement,
+                           gboolean expand, ReplaceResult *result, GError **error);
+
+#endif // REPLACE_H
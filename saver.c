@@ -0,0 +1,273 @@
+/*
+ * Background file saving
+ *
+ * The worker writes the snapshot with a FileWriter (see file_writer.c):
+ * into a temporary file created next to the target, fsync'd, renamed over
+ * the target and the directory synced, so a crash leaves either the old or
+ * the new file, never a truncated one. Documents read from another
+ * encoding are converted back to it on the way, and gzip/zstd files are
+ * compressed again on the fly.
+ *
+ * The main thread polls progress every SAVER_PROGRESS_INTERVAL ms to update
+ * the progress bar and throughput. After a successful save the new file is
+ * mapped into a fresh piece table; if nothing was typed meanwhile the
+ * document switches to it, releasing the add buffer and the old mapping.
+ * That is only possible when the file holds the text as it is, i.e.
+ * uncompressed UTF-8 without a byte order mark.
+ */
+
+#include "saver.h"
+#include "file_writer.h"
+#include "gutter.h"
+#include "journal.h"
+#include "status.h"
+#include "trace.h"
+
+#include <sys/stat.h>
+
+#define SAVER_PROGRESS_INTERVAL 100   // Milliseconds between progress updates
+
+// Permissions of a file saved under a new name
+static mode_t saver_create_mode = 0666;
+
+struct _FileSaver {
+    gint ref_count;
+    TextEditor *editor;         // Main thread only, NULL once detached
+    gchar *filename;
+    FileWriter writer;          // Run by the worker
+    gsize total;
+    guint64 edit_generation;    // Editor generation the snapshot was taken at
+    gint64 start_time;
+    gint64 trace_start;         // Start of the save.total span, main thread only
+
+    // Protected by lock
+    GMutex lock;
+    gsize bytes_written;
+    gboolean done;
+    GError *error;
+    PieceTable *rebased;
+};
+
+static FileSaver *saver_ref(FileSaver *saver) {
+    g_atomic_int_inc(&saver->ref_count);
+    return saver;
+}
+
+static void saver_unref(gpointer data) {
+    FileSaver *saver = (FileSaver *)data;
+
+    if (!g_atomic_int_dec_and_test(&saver->ref_count)) {
+        return;
+    }
+
+    piece_snapshot_unref(saver->writer.snapshot);
+    piece_table_free(saver->rebased);
+    g_clear_error(&saver->error);
+    g_mutex_clear(&saver->lock);
+    g_free(saver->filename);
+    g_free(saver);
+}
+
+// FileWriterFunc: count bytes of the snapshot as saved
+static void saver_add_progress(gsize length, gpointer user_data) {
+    FileSaver *saver = (FileSaver *)user_data;
+
+    g_mutex_lock(&saver->lock);
+    saver->bytes_written += length;
+    g_mutex_unlock(&saver->lock);
+}
+
+// Worker thread: write the file, then map and index the result
+static gpointer saver_worker(gpointer data) {
+    FileSaver *saver = (FileSaver *)data;
+    PieceTable *rebased = NULL;
+    GError *error = NULL;
+
+    file_writer_run(&saver->writer, &rebased, &error);
+
+    g_mutex_lock(&saver->lock);
+    saver->done = TRUE;
+    saver->error = error;
+    saver->rebased = rebased;
+    g_mutex_unlock(&saver->lock);
+
+    saver_unref(saver);
+    return NULL;
+}
+
+// Show percentage and throughput in the progress bar
+static void saver_update_progress(FileSaver *saver, gsize written) {
+    TextEditor *editor = saver->editor;
+    gdouble elapsed = (g_get_monotonic_time() - saver->start_time) / (gdouble)G_USEC_PER_SEC;
+    gdouble fraction = saver->total > 0 ? (gdouble)written / (gdouble)saver->total : 1.0;
+    gchar *rate = g_format_size(elapsed > 0.0 ? (guint64)(written / elapsed) : 0);
+    gchar *text = g_strdup_printf("%d%% (%s/s)", (gint)(fraction * 100.0), rate);
+
+    status_set_progress(editor, fraction, text);
+
+    g_free(text);
+    g_free(rate);
+}
+
+// Called on the main thread once the worker has finished
+static void saver_complete(FileSaver *saver) {
+    TRACE_SCOPE("save.complete");
+    TextEditor *editor = saver->editor;
+    PieceTable *rebased;
+    GError *error;
+
+    trace_end("save.total", saver->trace_start);
+
+    g_mutex_lock(&saver->lock);
+    error = saver->error;
+    saver->error = NULL;
+    rebased = saver->rebased;
+    saver->rebased = NULL;
+    g_mutex_unlock(&saver->lock);
+
+    editor->saver = NULL;
+    saver->editor = NULL;
+    gtk_widget_hide(editor->progress_bar);
+    gtk_widget_hide(editor->cancel_button);
+
+    if (error) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            editor_set_status(editor, "Save cancelled");
+        } else {
+            editor_set_status(editor, "");
+            editor_show_error(editor, "Failed to save file: %s\n%s",
+                              saver->filename, error->message);
+        }
+        journal_end_save(editor, FALSE);
+        g_error_free(error);
+    } else {
+        gdouble elapsed = (g_get_monotonic_time() - saver->start_time) / (gdouble)G_USEC_PER_SEC;
+        gchar *basename = g_path_get_basename(saver->filename);
+        gchar *size = g_format_size(saver->total);
+        gchar *rate = g_format_size(elapsed > 0.0 ? (guint64)(saver->total / elapsed) : 0);
+        gchar *status = g_strdup_printf("Saved %s (%s in %.1f s, %s/s)", basename, size, elapsed, rate);
+
+        g_free(editor->current_filename);
+        editor->current_filename = g_strdup(saver->filename);
+        editor->compression = saver->writer.compression;
+        // Any invalid bytes the file was read with are now U+FFFD on disk too,
+        // and the file holds what the buffer does even if follow mode had
+        // dropped the start of the one it was read from
+        editor->encoding.repaired = FALSE;
+        editor->follow_dropped = 0;
+        editor->follow_dropped_lines = 0;
+        editor_update_title(editor);
+        journal_end_save(editor, TRUE);
+
+        // Only if nothing was typed during the save does the file on disk
+        // match the buffer
+        if (editor->edit_generation == saver->edit_generation) {
+            editor->modified = FALSE;
+            gutter_clear_changes(editor);
+
+            if (rebased) {
+                piece_table_free(editor->document);
+                editor->document = rebased;
+                rebased = NULL;
+            }
+        }
+
+        editor_set_status(editor, status);
+        g_free(status);
+        g_free(rate);
+        g_free(size);
+        g_free(basename);
+    }
+
+    piece_table_free(rebased);
+    saver_unref(saver);
+}
+
+// Progress timer: update the UI and notice completion
+static gboolean saver_progress_tick(gpointer data) {
+    FileSaver *saver = (FileSaver *)data;
+    gsize written;
+    gboolean done;
+
+    g_mutex_lock(&saver->lock);
+    written = saver->bytes_written;
+    done = saver->done;
+    g_mutex_unlock(&saver->lock);
+
+    if (done) {
+        saver_complete(saver);
+        return G_SOURCE_REMOVE;
+    }
+
+    saver_update_progress(saver, written);
+    return G_SOURCE_CONTINUE;
+}
+
+void file_saver_init(void) {
+    // Only umask() can read it, by setting it, so it must not be done
+    // while other threads create files
+    mode_t mask = umask(0);
+
+    umask(mask);
+    saver_create_mode = 0666 & ~mask;
+}
+
+void file_saver_start(TextEditor *editor, const gchar *filename) {
+    FileSaver *saver;
+    gchar *basename, *status;
+
+    g_return_if_fail(editor->saver == NULL);
+
+    saver = g_new0(FileSaver, 1);
+    saver->ref_count = 1;
+    saver->editor = editor;
+    saver->filename = g_strdup(filename);
+    saver->writer.filename = saver->filename;
+    saver->writer.encoding = editor->encoding;
+
+    // Saving keeps the file's compression; Save As goes by the extension
+    if (g_strcmp0(filename, editor->current_filename) == 0) {
+        saver->writer.compression = editor->compression;
+    } else {
+        saver->writer.compression = compression_for_filename(filename);
+    }
+    saver->writer.compression_level = compression_get_level(saver->writer.compression);
+    saver->writer.create_mode = saver_create_mode;
+    saver->writer.func = saver_add_progress;
+    saver->writer.user_data = saver;
+    saver->trace_start = trace_begin();
+    saver->writer.snapshot = piece_table_snapshot(editor->document);
+    saver->total = piece_snapshot_get_length(saver->writer.snapshot);
+    saver->edit_generation = editor->edit_generation;
+    saver->start_time = g_get_monotonic_time();
+    g_mutex_init(&saver->lock);
+
+    editor->saver = saver;
+    journal_begin_save(editor);
+
+    status_set_progress(editor, 0.0, "0%");
+    gtk_widget_show(editor->progress_bar);
+    gtk_widget_show(editor->cancel_button);
+
+    basename = g_path_get_basename(filename);
+    status = g_strdup_printf("Saving %s...", basename);
+    editor_set_status(editor, status);
+    g_free(status);
+    g_free(basename);
+
+    g_timeout_add_full(G_PRIORITY_DEFAULT, SAVER_PROGRESS_INTERVAL, saver_progress_tick,
+                       saver_ref(saver), saver_unref);
+    g_thread_unref(g_thread_new("file-saver", saver_worker, saver_ref(saver)));
+}
+
+void file_saver_cancel(TextEditor *editor) {
+    if (editor->saver) {
+        g_atomic_int_set(&editor->saver->writer.cancelled, TRUE);
+    }
+}
+
+void file_saver_wait(TextEditor *editor) {
+    while (editor->saver) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
@@ -0,0 +1,29 @@
+/*
+ * Background file saving
+ *
+ * A snapshot of the piece table is streamed to a temporary file in the
+ * target's directory on a worker thread, which is then fsync'd and renamed
+ * over the target. The file on disk is never left half-written, and typing
+ * continues while a large document is being saved.
+ */
+
+#ifndef SAVER_H
+#define SAVER_H
+
+#include "editor.h"
+
+// Read the umask, which the permissions of new files come from. Called at
+// startup, before there are threads that could create files meanwhile.
+void file_saver_init(void);
+
+// Start saving the current document to filename. On success the editor's
+// filename and modified flag are updated when the save completes.
+void file_saver_start(TextEditor *editor, const gchar *filename);
+
+// Ask the running save, if any, to stop. The target file is left untouched.
+void file_saver_cancel(TextEditor *editor);
+
+// Run the main loop until the running save, if any, has completed
+void file_saver_wait(TextEditor *editor);
+
+#endif // SAVER_H
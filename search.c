@@ -0,0 +1,842 @@
+/*
+ * Incremental search bar
+ *
+ * The worker walks the snapshot's pieces with text_scan_find(), which
+ * filters candidates with vector compares of the needle's first and last
+ * byte. Matches that straddle a piece boundary are found in a small window
+ * copied around the boundary. Matches don't overlap, and their character
+ * offsets are counted on the way, so the main thread never has to convert
+ * byte offsets. Large pieces are searched SEARCH_SLICE bytes at a time so
+ * a superseded search stops quickly.
+ *
+ * In regex mode the matching is left to regex_search_run(), which scans
+ * chunks of the snapshot in parallel, and only the collecting is done here.
+ *
+ * Results are handed over in batches under the job's lock and picked up
+ * by a timeout on the main thread every SEARCH_POLL_INTERVAL ms. Only the
+ * matches in the visible part of the buffer are tagged, so highlighting
+ * costs the same however many matches there are.
+ */
+
+#include "search.h"
+#include "regex_search.h"
+#include "replace.h"
+#include "text_scan.h"
+#include "trace.h"
+
+#include <string.h>
+
+#define SEARCH_SLICE          (1024 * 1024)  // Bytes searched between cancellation checks
+#define SEARCH_BATCH          4096           // Matches handed over at once
+#define SEARCH_MAX_MATCHES    10000000       // Matches kept at most
+#define SEARCH_POLL_INTERVAL  100            // Milliseconds between result pickups
+#define SEARCH_RESTART_DELAY  250            // Milliseconds after an edit before searching again
+#define SEARCH_MAX_HIGHLIGHTS 2000           // Matches tagged at most in the visible area
+
+typedef struct {
+    gsize start;            // Character offsets
+    gsize end;
+} SearchMatch;
+
+typedef struct {
+    gint ref_count;
+    PieceSnapshot *snapshot;
+    gchar *needle;
+    gsize needle_length;
+    gsize match_chars;      // Length of the needle in characters
+    GRegex *regex;          // Compiled needle in regex mode, else NULL
+    gint cancelled;         // Atomic
+
+    // Protected by lock
+    GMutex lock;
+    GArray *found;          // SearchMatch, not picked up yet
+    gchar *error;           // Why the regex search failed
+    gboolean done;
+} SearchJob;
+
+// State of the regex worker's collecting callback
+typedef struct {
+    SearchJob *job;
+    GArray *batch;
+    gsize count;
+} SearchCollect;
+
+struct _Search {
+    TextEditor *editor;
+    GtkWidget *box;         // Where the bar goes, and in which place
+    gint position;
+    GtkWidget *bar;         // NULL until first shown
+    GtkWidget *entry;
+    GtkWidget *regex_button;
+    GtkWidget *count_label;
+    GtkWidget *replace_box;
+    GtkWidget *replace_entry;
+
+    SearchJob *job;         // Running search, NULL when none
+    GArray *matches;        // SearchMatch, the results so far, sorted
+    gboolean truncated;     // Stopped at SEARCH_MAX_MATCHES
+    gsize origin;           // Cursor offset when the search started
+    gboolean jump_pending;  // Select the first match after origin once found
+
+    gboolean tagged;        // Matches are highlighted in the buffer
+    guint poll_id;
+    guint restart_id;
+    guint highlight_id;
+};
+
+static SearchJob *search_job_ref(SearchJob *job) {
+    g_atomic_int_inc(&job->ref_count);
+    return job;
+}
+
+static void search_job_unref(SearchJob *job) {
+    if (!g_atomic_int_dec_and_test(&job->ref_count)) {
+        return;
+    }
+
+    piece_snapshot_unref(job->snapshot);
+    if (job->regex) {
+        g_regex_unref(job->regex);
+    }
+    g_array_free(job->found, TRUE);
+    g_mutex_clear(&job->lock);
+    g_free(job->error);
+    g_free(job->needle);
+    g_free(job);
+}
+
+// Hand the worker's batch of matches over to the main thread
+static void search_job_flush(SearchJob *job, GArray *batch) {
+    if (batch->len == 0) {
+        return;
+    }
+
+    g_mutex_lock(&job->lock);
+    g_array_append_vals(job->found, batch->data, batch->len);
+    g_mutex_unlock(&job->lock);
+    g_array_set_size(batch, 0);
+}
+
+// Record a match, returning FALSE once no more are wanted
+static gboolean search_job_add(SearchJob *job, GArray *batch, gsize *count,
+                               gsize start, gsize end) {
+    SearchMatch match = { start, end };
+
+    g_array_append_val(batch, match);
+    if (batch->len >= SEARCH_BATCH) {
+        search_job_flush(job, batch);
+    }
+    return ++*count < SEARCH_MAX_MATCHES;
+}
+
+// Find every occurrence of the needle in the snapshot
+static void search_literal(SearchJob *job, GArray *batch) {
+    const gchar *needle = job->needle;
+    gsize n = job->needle_length;
+    gsize total = piece_snapshot_get_length(job->snapshot);
+    gsize byte_start = 0, char_start = 0;   // Of the current piece
+    gsize next = 0;                         // Where the next match may start
+    gsize count = 0;
+    gboolean more = TRUE;
+    gchar *window = g_malloc(2 * n);
+    const Piece *pieces;
+    guint n_pieces;
+
+    pieces = piece_snapshot_get_pieces(job->snapshot, &n_pieces);
+
+    for (guint i = 0; i < n_pieces && more && !g_atomic_int_get(&job->cancelled); i++) {
+        const Piece *piece = &pieces[i];
+        gsize position, counted = 0, counted_chars = 0;
+
+        // Matches starting in earlier pieces and ending in this one. Their
+        // character offset is counted back from the start of the piece.
+        if (n > 1 && byte_start > 0) {
+            gsize window_start = MAX(next, byte_start > n - 1 ? byte_start - (n - 1) : 0);
+
+            if (window_start < byte_start) {
+                gsize length = MIN(total, byte_start + n - 1) - window_start;
+                gsize at = 0;
+
+                piece_snapshot_copy(job->snapshot, window_start, length, window);
+                while (more) {
+                    gsize hit = at + text_scan_find(window + at, length - at, needle, n);
+
+                    if (hit >= length || window_start + hit >= byte_start) {
+                        break;
+                    }
+                    gsize match_start = char_start -
+                        text_scan_count_chars(window + hit, byte_start - window_start - hit);
+
+                    more = search_job_add(job, batch, &count, match_start,
+                                          match_start + job->match_chars);
+                    at = hit + n;
+                    next = window_start + at;
+                }
+            }
+        }
+
+        // Matches inside the piece
+        position = MAX(next, byte_start) - byte_start;
+        while (more && position + n <= piece->bytes && !g_atomic_int_get(&job->cancelled)) {
+            gsize end = MIN(piece->bytes, position + SEARCH_SLICE + n - 1);
+            gsize hit = position + text_scan_find(piece->data + position, end - position,
+                                                  needle, n);
+
+            if (hit >= end) {
+                search_job_flush(job, batch);
+                position = end - (n - 1);
+                if (end == piece->bytes) {
+                    break;
+                }
+                continue;
+            }
+
+            counted_chars += text_scan_count_chars(piece->data + counted, hit - counted);
+            counted = hit;
+            more = search_job_add(job, batch, &count, char_start + counted_chars,
+                                  char_start + counted_chars + job->match_chars);
+            position = hit + n;
+            next = byte_start + position;
+        }
+
+        byte_start += piece->bytes;
+        char_start += piece->chars;
+    }
+
+    g_free(window);
+}
+
+// Regex search callback: record the matches of a chunk
+static gboolean search_regex_found(const RegexMatch *matches, guint n_matches,
+                                   const gssize *groups, gpointer data) {
+    SearchCollect *collect = (SearchCollect *)data;
+
+    for (guint i = 0; i < n_matches; i++) {
+        if (!search_job_add(collect->job, collect->batch, &collect->count,
+                            matches[i].start, matches[i].end)) {
+            return FALSE;
+        }
+    }
+
+    search_job_flush(collect->job, collect->batch);
+    return TRUE;
+}
+
+// Worker thread: find every match in the snapshot
+static gpointer search_worker(gpointer data) {
+    TRACE_SCOPE("search.scan");
+    SearchJob *job = (SearchJob *)data;
+    GArray *batch = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+    GError *error = NULL;
+
+    if (job->regex) {
+        SearchCollect collect = { job, batch, 0 };
+
+        regex_search_run(job->snapshot, job->regex, FALSE, &job->cancelled,
+                         search_regex_found, &collect, &error);
+    } else {
+        search_literal(job, batch);
+    }
+
+    search_job_flush(job, batch);
+    g_array_free(batch, TRUE);
+
+    g_mutex_lock(&job->lock);
+    if (error) {
+        job->error = g_strdup(error->message);
+    }
+    job->done = TRUE;
+    g_mutex_unlock(&job->lock);
+    g_clear_error(&error);
+
+    search_job_unref(job);
+    return NULL;
+}
+
+// Index of the first match at or after offset
+static guint search_lower_bound(GArray *matches, gsize offset) {
+    guint lo = 0, hi = matches->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index(matches, SearchMatch, mid).start < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Show the number of matches, and which one is selected
+static void search_update_label(Search *search, gint current) {
+    const gchar *more = search->truncated ? "+" : "";
+    const gchar *running = search->job ? "…" : "";
+    gchar *text;
+
+    if (gtk_entry_get_text_length(GTK_ENTRY(search->entry)) == 0) {
+        text = g_strdup("");
+    } else if (current >= 0) {
+        text = g_strdup_printf("%d of %u%s%s", current + 1, search->matches->len, more, running);
+    } else if (search->matches->len == 1 && !search->job) {
+        text = g_strdup("1 match");
+    } else {
+        text = g_strdup_printf("%u%s matches%s", search->matches->len, more, running);
+    }
+
+    gtk_label_set_text(GTK_LABEL(search->count_label), text);
+    g_free(text);
+}
+
+// Idle callback: tag the matches in the visible part of the buffer
+static gboolean search_highlight_idle(gpointer data) {
+    TRACE_SCOPE("search.highlight");
+    Search *search = (Search *)data;
+    TextEditor *editor = search->editor;
+    GtkTextView *view = GTK_TEXT_VIEW(editor->text_view);
+    GtkTextIter start, end;
+    GdkRectangle visible;
+    gsize first, last;
+    guint index;
+
+    search->highlight_id = 0;
+
+    if (search->tagged) {
+        gtk_text_buffer_get_bounds(editor->text_buffer, &start, &end);
+        gtk_text_buffer_remove_tag_by_name(editor->text_buffer, SEARCH_MATCH_TAG, &start, &end);
+        search->tagged = FALSE;
+    }
+
+    if (search->matches->len == 0 || !gtk_search_bar_get_search_mode(GTK_SEARCH_BAR(search->bar))) {
+        return G_SOURCE_REMOVE;
+    }
+
+    gtk_text_view_get_visible_rect(view, &visible);
+    gtk_text_view_get_line_at_y(view, &start, visible.y, NULL);
+    gtk_text_view_get_line_at_y(view, &end, visible.y + visible.height, NULL);
+    gtk_text_iter_forward_line(&end);
+
+    first = gtk_text_iter_get_offset(&start);
+    last = gtk_text_iter_get_offset(&end);
+
+    // Matches don't overlap, so only the one before the first visible line
+    // can reach into it
+    index = search_lower_bound(search->matches, first);
+    if (index > 0 && g_array_index(search->matches, SearchMatch, index - 1).end > first) {
+        index--;
+    }
+
+    for (guint tagged = 0; index < search->matches->len && tagged < SEARCH_MAX_HIGHLIGHTS;
+         index++, tagged++) {
+        const SearchMatch *match = &g_array_index(search->matches, SearchMatch, index);
+        GtkTextIter match_start, match_end;
+
+        if (match->start >= last) {
+            break;
+        }
+
+        gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &match_start, (gint)match->start);
+        gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &match_end, (gint)match->end);
+        gtk_text_buffer_apply_tag_by_name(editor->text_buffer, SEARCH_MATCH_TAG,
+                                          &match_start, &match_end);
+        search->tagged = TRUE;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void search_schedule_highlight(Search *search) {
+    if (search->highlight_id == 0) {
+        search->highlight_id = g_idle_add_full(G_PRIORITY_LOW, search_highlight_idle, search, NULL);
+    }
+}
+
+// Select match index and scroll it into view
+static void search_select(Search *search, guint index) {
+    TextEditor *editor = search->editor;
+    const SearchMatch *match = &g_array_index(search->matches, SearchMatch, index);
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &start, (gint)match->start);
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &end, (gint)match->end);
+    gtk_text_buffer_select_range(editor->text_buffer, &start, &end);
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view),
+                                 gtk_text_buffer_get_insert(editor->text_buffer),
+                                 0.1, FALSE, 0.0, 0.0);
+    search_update_label(search, (gint)index);
+}
+
+// Select the next or previous match from the cursor, wrapping around
+static void search_jump(Search *search, gboolean forward) {
+    GtkTextIter start, end;
+    gsize from;
+    guint index;
+
+    if (search->matches->len == 0) {
+        return;
+    }
+
+    gtk_text_buffer_get_selection_bounds(search->editor->text_buffer, &start, &end);
+    from = gtk_text_iter_get_offset(&start);
+
+    if (forward) {
+        // Past the selected match, but not past one starting at the cursor
+        index = search_lower_bound(search->matches,
+                                   gtk_text_iter_equal(&start, &end) ? from : from + 1);
+        // An empty regex match at the cursor is the one already selected
+        if (index < search->matches->len &&
+            g_array_index(search->matches, SearchMatch, index).end == from) {
+            index++;
+        }
+        if (index == search->matches->len) {
+            index = 0;
+        }
+    } else {
+        index = search_lower_bound(search->matches, from);
+        index = index > 0 ? index - 1 : search->matches->len - 1;
+    }
+
+    search->jump_pending = FALSE;
+    search_select(search, index);
+}
+
+// Stop the running search, keeping the matches found so far
+static void search_stop(Search *search) {
+    if (search->poll_id) {
+        g_source_remove(search->poll_id);
+        search->poll_id = 0;
+    }
+    if (search->job) {
+        g_atomic_int_set(&search->job->cancelled, 1);
+        search_job_unref(search->job);
+        search->job = NULL;
+    }
+}
+
+// Timeout callback: pick up the matches found since the last call
+static gboolean search_poll(gpointer data) {
+    Search *search = (Search *)data;
+    SearchJob *job = search->job;
+    gchar *error;
+    gboolean done;
+
+    g_mutex_lock(&job->lock);
+    g_array_append_vals(search->matches, job->found->data, job->found->len);
+    g_array_set_size(job->found, 0);
+    done = job->done;
+    error = g_steal_pointer(&job->error);
+    g_mutex_unlock(&job->lock);
+
+    if (done) {
+        search->truncated = search->matches->len >= SEARCH_MAX_MATCHES;
+        search_job_unref(job);
+        search->job = NULL;
+        search->poll_id = 0;
+    }
+
+    // Go to the first match after the cursor as soon as it is known, or
+    // around to the first one once there is none after it
+    if (search->jump_pending) {
+        guint index = search_lower_bound(search->matches, search->origin);
+
+        if (index < search->matches->len) {
+            search->jump_pending = FALSE;
+            search_select(search, index);
+        } else if (done && search->matches->len > 0) {
+            search->jump_pending = FALSE;
+            search_select(search, 0);
+        } else {
+            search_update_label(search, -1);
+        }
+    } else {
+        search_update_label(search, -1);
+    }
+
+    // A pattern can hit PCRE's backtracking limit on some text; the
+    // matches before that point are kept
+    if (error) {
+        gtk_label_set_text(GTK_LABEL(search->count_label), "Search stopped");
+        gtk_widget_set_tooltip_text(search->count_label, error);
+        g_free(error);
+    }
+
+    search_schedule_highlight(search);
+    return done ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+// Search for the entry's text, replacing any running search. With jump
+// set, the first match after the cursor is selected once it is found.
+static void search_start(Search *search, gboolean jump) {
+    TextEditor *editor = search->editor;
+    const gchar *needle = gtk_entry_get_text(GTK_ENTRY(search->entry));
+    GtkTextIter start, end;
+    GRegex *regex = NULL;
+    GError *error = NULL;
+    SearchJob *job;
+
+    search_stop(search);
+    g_array_set_size(search->matches, 0);
+    search->truncated = FALSE;
+    search_schedule_highlight(search);
+    gtk_widget_set_tooltip_text(search->count_label, NULL);
+
+    if (*needle == '\0') {
+        search_update_label(search, -1);
+        return;
+    }
+
+    if (editor->viewport) {
+        gtk_label_set_text(GTK_LABEL(search->count_label), "Not available in large-file mode");
+        return;
+    }
+
+    // Compiled patterns are cached, so typing back and forth is cheap
+    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search->regex_button))) {
+        regex = regex_search_compile(needle, 0, &error);
+        if (!regex) {
+            gtk_label_set_text(GTK_LABEL(search->count_label), "Invalid pattern");
+            gtk_widget_set_tooltip_text(search->count_label, error->message);
+            g_error_free(error);
+            return;
+        }
+    }
+
+    gtk_text_buffer_get_selection_bounds(editor->text_buffer, &start, &end);
+    search->origin = gtk_text_iter_get_offset(&start);
+    search->jump_pending = jump;
+
+    job = g_new0(SearchJob, 1);
+    job->ref_count = 1;
+    job->snapshot = piece_table_snapshot(editor->document);
+    job->needle = g_strdup(needle);
+    job->needle_length = strlen(needle);
+    job->match_chars = g_utf8_strlen(needle, -1);
+    job->regex = regex;
+    job->found = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+    g_mutex_init(&job->lock);
+
+    search->job = job;
+    g_thread_unref(g_thread_new("search", search_worker, search_job_ref(job)));
+    search->poll_id = g_timeout_add(SEARCH_POLL_INTERVAL, search_poll, search);
+    search_update_label(search, -1);
+}
+
+// Timeout callback: search again once the document has settled
+static gboolean search_restart(gpointer data) {
+    Search *search = (Search *)data;
+
+    // The document isn't complete until the loader is done
+    if (search->editor->loader) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    search->restart_id = 0;
+    search_start(search, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+// Buffer changed callback: the matches no longer fit the text
+static void on_search_buffer_changed(GtkTextBuffer *buffer, gpointer data) {
+    Search *search = (Search *)data;
+
+    if (!search->bar || !gtk_search_bar_get_search_mode(GTK_SEARCH_BAR(search->bar)) ||
+        gtk_entry_get_text_length(GTK_ENTRY(search->entry)) == 0) {
+        return;
+    }
+
+    search_stop(search);
+    g_array_set_size(search->matches, 0);
+    search_schedule_highlight(search);
+
+    // Not pushed back by further changes, so a file that keeps growing in
+    // follow mode still gets searched
+    if (search->restart_id == 0) {
+        search->restart_id = g_timeout_add(SEARCH_RESTART_DELAY, search_restart, search);
+    }
+}
+
+static void on_search_changed(GtkSearchEntry *entry, gpointer data) {
+    search_start((Search *)data, TRUE);
+}
+
+static void on_search_regex_toggled(GtkToggleButton *button, gpointer data) {
+    Search *search = (Search *)data;
+
+    search_start(search, TRUE);
+    gtk_widget_grab_focus(search->entry);
+}
+
+// Replace All button callback: replace every match as a single edit
+static void on_replace_all(GtkWidget *widget, gpointer data) {
+    TRACE_SCOPE("search.replace_all");
+    Search *search = (Search *)data;
+    TextEditor *editor = search->editor;
+    const gchar *needle = gtk_entry_get_text(GTK_ENTRY(search->entry));
+    gboolean use_regex = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search->regex_button));
+    PieceSnapshot *snapshot;
+    ReplaceResult result;
+    GError *error = NULL;
+    GtkTextIter start, end;
+    GRegex *regex;
+    gchar *status;
+    gboolean ok;
+
+    if (*needle == '\0') {
+        return;
+    }
+    if (editor->viewport || editor->loader ||
+        !gtk_text_view_get_editable(GTK_TEXT_VIEW(editor->text_view))) {
+        editor_set_status(editor, "The document can't be changed right now");
+        return;
+    }
+
+    // Plain text is searched as a pattern that matches only itself
+    if (use_regex) {
+        regex = regex_search_compile(needle, 0, &error);
+    } else {
+        gchar *escaped = g_regex_escape_string(needle, -1);
+
+        regex = regex_search_compile(escaped, 0, &error);
+        g_free(escaped);
+    }
+    if (!regex) {
+        editor_show_error(editor, "Invalid pattern: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    snapshot = piece_table_snapshot(editor->document);
+    ok = replace_all_build(snapshot, regex, gtk_entry_get_text(GTK_ENTRY(search->replace_entry)),
+                           use_regex, &result, &error);
+    piece_snapshot_unref(snapshot);
+    g_regex_unref(regex);
+
+    if (!ok) {
+        editor_show_error(editor, "Replace failed: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    if (!result.text) {
+        editor_set_status(editor, "Nothing to replace");
+        return;
+    }
+
+    // One deletion and one insertion, grouped as a single user action
+    gtk_text_buffer_begin_user_action(editor->text_buffer);
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &start, (gint)result.start);
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &end, (gint)result.end);
+    gtk_text_buffer_delete(editor->text_buffer, &start, &end);
+    if (result.text->len > 0) {
+        gtk_text_buffer_insert(editor->text_buffer, &start, result.text->str, result.text->len);
+    }
+    gtk_text_buffer_end_user_action(editor->text_buffer);
+
+    status = g_strdup_printf("Replaced %" G_GSIZE_FORMAT " occurrence%s", result.count,
+                             result.count == 1 ? "" : "s");
+    editor_set_status(editor, status);
+    g_free(status);
+    g_string_free(result.text, TRUE);
+}
+
+static void on_search_next(GtkWidget *widget, gpointer data) {
+    search_jump((Search *)data, TRUE);
+}
+
+static void on_search_previous(GtkWidget *widget, gpointer data) {
+    search_jump((Search *)data, FALSE);
+}
+
+// Scroll or resize callback: other matches are in view
+static void on_search_view_moved(GtkWidget *widget, gpointer data) {
+    search_schedule_highlight((Search *)data);
+}
+
+// Search bar shown or hidden
+static void on_search_mode_changed(GObject *bar, GParamSpec *pspec, gpointer data) {
+    Search *search = (Search *)data;
+
+    if (gtk_search_bar_get_search_mode(GTK_SEARCH_BAR(bar))) {
+        search_start(search, TRUE);
+        return;
+    }
+
+    if (search->restart_id) {
+        g_source_remove(search->restart_id);
+        search->restart_id = 0;
+    }
+    search_stop(search);
+    g_array_set_size(search->matches, 0);
+    search_schedule_highlight(search);
+    gtk_widget_grab_focus(search->editor->text_view);
+}
+
+// Create the bar the first time it is shown
+static void search_create_bar(Search *search) {
+    TextEditor *editor = search->editor;
+    GtkWidget *vbox, *hbox, *previous_button, *next_button, *replace_all_button;
+    GtkAdjustment *adjustment;
+
+    search->entry = gtk_search_entry_new();
+    gtk_entry_set_width_chars(GTK_ENTRY(search->entry), 30);
+    g_signal_connect(search->entry, "search-changed", G_CALLBACK(on_search_changed), search);
+    g_signal_connect(search->entry, "activate", G_CALLBACK(on_search_next), search);
+    g_signal_connect(search->entry, "next-match", G_CALLBACK(on_search_next), search);
+    g_signal_connect(search->entry, "previous-match", G_CALLBACK(on_search_previous), search);
+
+    previous_button = gtk_button_new_from_icon_name("go-up-symbolic", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(previous_button, "Previous match");
+    g_signal_connect(previous_button, "clicked", G_CALLBACK(on_search_previous), search);
+
+    next_button = gtk_button_new_from_icon_name("go-down-symbolic", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(next_button, "Next match");
+    g_signal_connect(next_button, "clicked", G_CALLBACK(on_search_next), search);
+
+    search->regex_button = gtk_toggle_button_new_with_label(".*");
+    gtk_widget_set_tooltip_text(search->regex_button, "Regular expression");
+    g_signal_connect(search->regex_button, "toggled", G_CALLBACK(on_search_regex_toggled), search);
+
+    search->count_label = gtk_label_new(NULL);
+    gtk_label_set_width_chars(GTK_LABEL(search->count_label), 18);
+    gtk_label_set_xalign(GTK_LABEL(search->count_label), 0.0);
+
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(hbox), search->entry, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), previous_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), next_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), search->regex_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), search->count_label, FALSE, FALSE, 0);
+
+    // Second row, only shown by search_show_replace()
+    search->replace_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(search->replace_entry), "Replace with");
+    replace_all_button = gtk_button_new_with_label("Replace All");
+    gtk_widget_set_tooltip_text(replace_all_button,
+                                "In regex mode, \\0 to \\9 and \\g<name> insert capture groups");
+    g_signal_connect(replace_all_button, "clicked", G_CALLBACK(on_replace_all), search);
+
+    search->replace_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(search->replace_box), search->replace_entry, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(search->replace_box), replace_all_button, FALSE, FALSE, 0);
+    gtk_widget_show_all(search->replace_box);
+    gtk_widget_set_no_show_all(search->replace_box, TRUE);
+    gtk_widget_hide(search->replace_box);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), search->replace_box, FALSE, FALSE, 0);
+
+    search->bar = gtk_search_bar_new();
+    gtk_search_bar_set_show_close_button(GTK_SEARCH_BAR(search->bar), TRUE);
+    gtk_container_add(GTK_CONTAINER(search->bar), vbox);
+    gtk_search_bar_connect_entry(GTK_SEARCH_BAR(search->bar), GTK_ENTRY(search->entry));
+    g_signal_connect(search->bar, "notify::search-mode-enabled",
+                     G_CALLBACK(on_search_mode_changed), search);
+    gtk_box_pack_start(GTK_BOX(search->box), search->bar, FALSE, FALSE, 0);
+    gtk_box_reorder_child(GTK_BOX(search->box), search->bar, search->position);
+    gtk_widget_show_all(search->bar);
+
+    g_signal_connect(editor->text_view, "size-allocate", G_CALLBACK(on_search_view_moved), search);
+    adjustment = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(editor->scrolled_window));
+    g_signal_connect(adjustment, "value-changed", G_CALLBACK(on_search_view_moved), search);
+}
+
+void search_init(TextEditor *editor, GtkWidget *box) {
+    Search *search = g_new0(Search, 1);
+    GList *children = gtk_container_get_children(GTK_CONTAINER(box));
+
+    search->editor = editor;
+    search->matches = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+
+    // The bar is only built when first needed, where it would be now
+    search->box = box;
+    search->position = g_list_length(children);
+    g_list_free(children);
+
+    editor->search = search;
+}
+
+void search_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer) {
+    gtk_text_buffer_create_tag(buffer, SEARCH_MATCH_TAG, "background", "#fce94f", NULL);
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_search_buffer_changed), editor->search);
+}
+
+void search_switch_document(TextEditor *editor) {
+    Search *search = editor->search;
+    GtkTextIter start, end;
+
+    // The highlights stay with the buffer, so they go now
+    if (search->tagged) {
+        gtk_text_buffer_get_bounds(editor->text_buffer, &start, &end);
+        gtk_text_buffer_remove_tag_by_name(editor->text_buffer, SEARCH_MATCH_TAG, &start, &end);
+        search->tagged = FALSE;
+    }
+
+    // Same as an edit: the matches are of the old text
+    on_search_buffer_changed(editor->text_buffer, search);
+}
+
+void search_show(TextEditor *editor) {
+    Search *search = editor->search;
+
+    if (!search->bar) {
+        search_create_bar(search);
+    }
+
+    gtk_widget_hide(search->replace_box);
+    gtk_search_bar_set_search_mode(GTK_SEARCH_BAR(search->bar), TRUE);
+    gtk_widget_grab_focus(search->entry);
+    gtk_editable_select_region(GTK_EDITABLE(search->entry), 0, -1);
+}
+
+void search_show_replace(TextEditor *editor) {
+    Search *search = editor->search;
+
+    if (!search->bar) {
+        search_create_bar(search);
+    }
+
+    gtk_widget_show(search->replace_box);
+    gtk_search_bar_set_search_mode(GTK_SEARCH_BAR(search->bar), TRUE);
+
+    // Start with what to find, unless that is already filled in
+    if (gtk_entry_get_text_length(GTK_ENTRY(search->entry)) == 0) {
+        gtk_widget_grab_focus(search->entry);
+    } else {
+        gtk_widget_grab_focus(search->replace_entry);
+    }
+}
+
+void search_cleanup(TextEditor *editor) {
+    Search *search = editor->search;
+    GtkAdjustment *adjustment;
+
+    if (!search) {
+        return;
+    }
+
+    search_stop(search);
+    if (search->restart_id) {
+        g_source_remove(search->restart_id);
+    }
+    if (search->highlight_id) {
+        g_source_remove(search->highlight_id);
+    }
+
+    // The widgets outlive this, so their handlers must not fire afterwards
+    g_signal_handlers_disconnect_by_data(editor->text_buffer, search);
+    if (search->bar) {
+        g_signal_handlers_disconnect_by_data(editor->text_view, search);
+        g_signal_handlers_disconnect_by_data(search->bar, search);
+        g_signal_handlers_disconnect_by_data(search->entry, search);
+        g_signal_handlers_disconnect_by_data(search->regex_button, search);
+        adjustment = gtk_scrolled_window_get_vadjustment(
+            GTK_SCROLLED_WINDOW(editor->scrolled_window));
+        g_signal_handlers_disconnect_by_data(adjustment, search);
+    }
+
+    g_array_free(search->matches, TRUE);
+    g_free(search);
+    editor->search = NULL;
+    regex_search_clear_cache();
+}
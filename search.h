@@ -0,0 +1,42 @@
+/*
+ * Incremental search bar
+ *
+ * A non-modal bar under the text view. Every change to the query starts a
+ * search of a snapshot of the document on a worker thread, cancelling the
+ * previous one, so typing never waits for a large document to be scanned.
+ * Matches are collected as sorted character offsets: the bar shows their
+ * count while they come in, every match in view is highlighted, and next
+ * and previous are a binary search away. The ".*" toggle switches from
+ * plain text to regular expressions, and a second row, shown for Replace,
+ * replaces every match at once (see replace.h).
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "editor.h"
+
+#define SEARCH_MATCH_TAG "search-match"  // Tag of the matches in view, in every document buffer
+
+// Set up searching. The bar is packed into box, at the place the next
+// child would take, the first time it is shown.
+void search_init(TextEditor *editor, GtkWidget *box);
+
+// Create the match tag in buffer and search again when it changes. Called
+// once for every document buffer, after search_init().
+void search_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer);
+
+// Another document is about to be shown: take the highlights off the
+// current one, and search the next one once it is in view
+void search_switch_document(TextEditor *editor);
+
+// Show the search bar and focus its entry
+void search_show(TextEditor *editor);
+
+// Show the search bar with its Replace All row
+void search_show_replace(TextEditor *editor);
+
+// Stop the running search and release the search state
+void search_cleanup(TextEditor *editor);
+
+#endif // SEARCH_H
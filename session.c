@@ -0,0 +1,705 @@
+/*
+ * Session snapshot
+ *
+ * The file is a header followed by one record per tab, in order:
+ *
+ *   "TES1", documents, current, 0, time written (g_get_real_time())
+ *   record: flags, path length, size, mtime, inode, line, column, top line,
+ *           edits length, index length, then the path, the edits and the
+ *           line index, each padded to 8 bytes
+ *
+ * with the fields in host byte order, like the journal's. The size, mtime
+ * and inode are all zero for an untitled document. Edits are the steps
+ * that turn the file's text into the document's:
+ *
+ *   original length, hash of the original, then ops of
+ *   'k' (keep n chars), 'd' (delete n chars) or 'i' (insert n bytes, given)
+ *
+ * read off its pieces (see piece_table.h), so they take as much room as the
+ * inserted text. They are checked against the file's text before being put
+ * back, and dropped when the journal was written to after the snapshot:
+ * the journal has every edit up to a crash, the snapshot only those up to
+ * its last write. A line index holds the size, mtime, inode and hash of
+ * the file, its line count and the checkpoint offsets.
+ *
+ * The mapping of the file is kept while there are edits or line indexes of
+ * it in use. Snapshots are written by a thread, one at a time, and the idle
+ * timer only writes one when what it would hold has changed.
+ */
+
+#include "session.h"
+#include "journal.h"
+#include "piece_table.h"
+#include "tabs.h"
+#include "text_scan.h"
+#include "viewport.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define SESSION_MAGIC      "TES1"
+#define SESSION_MAGIC_SIZE 4
+#define SESSION_HASH_SPAN  (64 * 1024)          // Bytes hashed at each end of a file
+#define SESSION_MAX_EDITS  (64 * 1024 * 1024)   // Edits of a document kept at most
+#define SESSION_OP_SIZE    (1 + 8)              // Op fields before the inserted bytes
+
+#define SESSION_PAD(length) (((length) + 7) & ~(gsize)7)
+
+typedef struct {
+    gchar magic[SESSION_MAGIC_SIZE];
+    guint32 n_documents;
+    guint32 current;
+    guint32 reserved;
+    gint64 saved;
+} SessionHeader;
+
+typedef struct {
+    guint64 size;
+    gint64 mtime;
+    guint64 inode;
+} SessionStat;
+
+typedef struct {
+    guint32 flags;          // Unused, 0
+    guint32 path_length;    // 0 for an untitled document
+    SessionStat stat;
+    guint64 line;
+    guint64 column;
+    guint64 top_line;
+    guint64 edits_length;
+    guint64 index_length;
+} SessionRecord;
+
+typedef struct {
+    guint64 original_length;
+    guint64 original_hash;
+} SessionEdits;
+
+typedef struct {
+    SessionStat stat;
+    guint64 hash;
+    guint64 n_lines;
+    // Followed by the checkpoints, as gsize
+} SessionIndex;
+
+struct _Session {
+    gchar *path;
+    gint64 saved;           // When the restored snapshot was written, 0 if none
+    GHashTable *indexes;    // File name -> GBytes holding a SessionIndex
+    guint save_id;
+    guint64 signature;      // Of the state last written
+    GThread *writer;        // Writing the last snapshot, joined before the next
+};
+
+typedef struct {
+    gchar *path;
+    GBytes *contents;
+} SessionWrite;
+
+// The state a snapshot is made of, collected from the tabs
+typedef struct {
+    Session *session;
+    gboolean with_edits;
+    GString *records;
+    guint32 n_documents;
+    guint32 current;
+    guint64 signature;
+} SessionState;
+
+static gchar *session_get_path(void) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_SESSION");
+
+    if (setting) {
+        return *setting && strcmp(setting, "0") != 0 ? g_strdup(setting) : NULL;
+    }
+    return g_build_filename(g_get_user_cache_dir(), "text_editor", "session", NULL);
+}
+
+// FNV-1a over the bytes, continuing from hash
+static guint64 session_hash_bytes(guint64 hash, const void *data, gsize length) {
+    const guchar *bytes = data;
+
+    for (gsize i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= G_GUINT64_CONSTANT(1099511628211);
+    }
+    return hash;
+}
+
+// Hash of a text, from its length and both ends only, so it costs the same
+// for any size. The size, mtime and inode tell most changes apart already.
+static guint64 session_hash_text(const gchar *data, gsize length) {
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+    guint64 length64 = length;
+    gsize head = MIN(length, SESSION_HASH_SPAN);
+    gsize tail = MIN(length - head, SESSION_HASH_SPAN);
+
+    hash = session_hash_bytes(hash, &length64, sizeof(length64));
+    hash = session_hash_bytes(hash, data, head);
+    return session_hash_bytes(hash, data + length - tail, tail);
+}
+
+static gboolean session_get_stat(const gchar *filename, SessionStat *stat_out) {
+    struct stat st;
+
+    memset(stat_out, 0, sizeof(*stat_out));
+    if (!filename) {
+        return TRUE;
+    }
+    if (stat(filename, &st) != 0) {
+        return FALSE;
+    }
+
+    stat_out->size = st.st_size;
+    stat_out->mtime = st.st_mtime;
+    stat_out->inode = st.st_ino;
+    return TRUE;
+}
+
+static void session_append_padded(GString *out, const void *data, gsize length) {
+    static const gchar zeros[8] = { 0 };
+
+    g_string_append_len(out, data, length);
+    g_string_append_len(out, zeros, SESSION_PAD(length) - length);
+}
+
+// Append an op, merged into the last one when of the same type
+static void session_append_op(GString *edits, gssize *last_op, gchar type, guint64 count,
+                              const gchar *text) {
+    if (count == 0) {
+        return;
+    }
+
+    if (*last_op >= 0 && edits->str[*last_op] == type && type != 'i') {
+        guint64 previous;
+
+        memcpy(&previous, edits->str + *last_op + 1, sizeof(previous));
+        previous += count;
+        memcpy(edits->str + *last_op + 1, &previous, sizeof(previous));
+        return;
+    }
+
+    *last_op = edits->len;
+    g_string_append_c(edits, type);
+    g_string_append_len(edits, (const gchar *)&count, sizeof(count));
+    if (text) {
+        g_string_append_len(edits, text, count);
+    }
+}
+
+// The edits turning the original text of document into its text. NULL if
+// there are none, or too many to keep.
+static GBytes *session_encode_edits(PieceTable *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document);
+    gsize original_length, position = 0;
+    const gchar *original = piece_table_get_original(document, &original_length);
+    SessionEdits header = { original_length, session_hash_text(original, original_length) };
+    GString *edits = g_string_new(NULL);
+    const Piece *pieces;
+    guint n_pieces;
+    gssize last_op = -1;
+    gboolean changed = FALSE;
+
+    g_string_append_len(edits, (const gchar *)&header, sizeof(header));
+
+    pieces = piece_snapshot_get_pieces(snapshot, &n_pieces);
+    for (guint i = 0; i < n_pieces && edits->len <= SESSION_MAX_EDITS; i++) {
+        const Piece *piece = &pieces[i];
+        gsize start = original ? (gsize)(piece->data - original) : 0;
+
+        if (original && piece->data >= original && start < original_length &&
+            start >= position) {
+            if (start > position) {
+                session_append_op(edits, &last_op, 'd',
+                                  text_scan_count_chars(original + position, start - position),
+                                  NULL);
+                changed = TRUE;
+            }
+            session_append_op(edits, &last_op, 'k', piece->chars, NULL);
+            position = start + piece->bytes;
+        } else {
+            // Added text, or text of the file moved back by an undo
+            session_append_op(edits, &last_op, 'i', piece->bytes, piece->data);
+            changed = TRUE;
+        }
+    }
+
+    if (position < original_length) {
+        session_append_op(edits, &last_op, 'd',
+                          text_scan_count_chars(original + position, original_length - position),
+                          NULL);
+        changed = TRUE;
+    }
+    piece_snapshot_unref(snapshot);
+
+    if (!changed || edits->len > SESSION_MAX_EDITS) {
+        g_string_free(edits, TRUE);
+        return NULL;
+    }
+    return g_string_free_to_bytes(edits);
+}
+
+// Check edits against the text in the buffer, which must be the file's
+static gboolean session_check_edits(TextEditor *editor, const gchar *data, gsize length) {
+    gsize original_length, pos = sizeof(SessionEdits);
+    const gchar *original = piece_table_get_original(editor->document, &original_length);
+    guint64 covered = 0;
+    SessionEdits header;
+
+    if (length < sizeof(header)) {
+        return FALSE;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.original_length != original_length ||
+        header.original_hash != session_hash_text(original, original_length)) {
+        return FALSE;
+    }
+
+    while (pos < length) {
+        guint64 count;
+
+        if (length - pos < SESSION_OP_SIZE) {
+            return FALSE;
+        }
+        memcpy(&count, data + pos + 1, sizeof(count));
+        if (data[pos] == 'i') {
+            if (count > length - pos - SESSION_OP_SIZE ||
+                !g_utf8_validate(data + pos + SESSION_OP_SIZE, count, NULL)) {
+                return FALSE;
+            }
+            pos += count;
+        } else if (data[pos] == 'k' || data[pos] == 'd') {
+            covered += count;
+        } else {
+            return FALSE;
+        }
+        pos += SESSION_OP_SIZE;
+    }
+
+    return covered == (guint64)gtk_text_buffer_get_char_count(editor->text_buffer);
+}
+
+// Put edits back through the buffer, so they are journalled and can be
+// undone like the user's own
+static gboolean session_apply_edits(TextEditor *editor, GBytes *edits) {
+    GtkTextBuffer *buffer = editor->text_buffer;
+    gsize length, pos = sizeof(SessionEdits);
+    const gchar *data = g_bytes_get_data(edits, &length);
+    gint offset = 0;
+
+    if (!session_check_edits(editor, data, length)) {
+        return FALSE;
+    }
+
+    while (pos < length) {
+        GtkTextIter start, end;
+        guint64 count;
+
+        memcpy(&count, data + pos + 1, sizeof(count));
+        gtk_text_buffer_get_iter_at_offset(buffer, &start, offset);
+        switch (data[pos]) {
+        case 'k':
+            offset += (gint)count;
+            break;
+        case 'd':
+            gtk_text_buffer_get_iter_at_offset(buffer, &end, offset + (gint)count);
+            gtk_text_buffer_delete(buffer, &start, &end);
+            break;
+        case 'i':
+            gtk_text_buffer_insert(buffer, &start, data + pos + SESSION_OP_SIZE, (gint)count);
+            offset += (gint)g_utf8_strlen(data + pos + SESSION_OP_SIZE, (gssize)count);
+            pos += count;
+            break;
+        }
+        pos += SESSION_OP_SIZE;
+    }
+
+    editor->modified = TRUE;
+    return TRUE;
+}
+
+// Keep the line index of the file in view, once it is complete
+static void session_keep_viewport_index(TextEditor *editor) {
+    Session *session = editor->session;
+    const gchar *contents;
+    gsize length, n_checkpoints;
+    const gsize *checkpoints;
+    LineIndex *index = viewport_get_line_index(editor, &contents, &length);
+    SessionIndex header;
+    GBytes *kept;
+    GString *blob;
+
+    if (!index || !editor->current_filename) {
+        return;
+    }
+
+    kept = g_hash_table_lookup(session->indexes, editor->current_filename);
+    if (kept && g_bytes_get_size(kept) >= sizeof(header) &&
+        session_get_stat(editor->current_filename, &header.stat) &&
+        memcmp(g_bytes_get_data(kept, NULL), &header.stat, sizeof(header.stat)) == 0) {
+        return;
+    }
+
+    if (!session_get_stat(editor->current_filename, &header.stat) ||
+        header.stat.size != length) {
+        return;
+    }
+    header.hash = session_hash_text(contents, length);
+    header.n_lines = line_index_get_line_count(index);
+    checkpoints = line_index_get_checkpoints(index, &n_checkpoints);
+
+    blob = g_string_sized_new(sizeof(header) + n_checkpoints * sizeof(gsize));
+    g_string_append_len(blob, (const gchar *)&header, sizeof(header));
+    g_string_append_len(blob, (const gchar *)checkpoints, n_checkpoints * sizeof(gsize));
+    g_hash_table_replace(session->indexes, g_strdup(editor->current_filename),
+                         g_string_free_to_bytes(blob));
+}
+
+// tabs_foreach() callback: add a record for the tab
+static void session_add_record(TextEditor *editor, const TabInfo *info, gpointer data) {
+    SessionState *state = (SessionState *)data;
+    SessionRecord record = { 0 };
+    GBytes *edits = NULL, *index = NULL;
+    gboolean untitled = !info->filename;
+
+    // The empty document of a new window
+    if (untitled && !info->modified && !info->pending_edits) {
+        return;
+    }
+
+    if (info->pending_edits) {
+        // Never shown, so never decided about
+        edits = g_bytes_ref(info->pending_edits);
+    } else if (state->with_edits && info->modified && info->document) {
+        edits = session_encode_edits(info->document);
+    }
+
+    // An untitled document put away by the tabs has its edits in its
+    // journal only, which is replayed when it comes back
+    if (untitled && !edits && !info->modified) {
+        return;
+    }
+    if (!session_get_stat(info->filename, &record.stat)) {
+        if (edits) {
+            g_bytes_unref(edits);
+        }
+        return;
+    }
+
+    if (!untitled) {
+        index = g_hash_table_lookup(state->session->indexes, info->filename);
+        if (index && (g_bytes_get_size(index) < sizeof(SessionIndex) ||
+                      memcmp(g_bytes_get_data(index, NULL), &record.stat,
+                             sizeof(record.stat)) != 0)) {
+            index = NULL;
+        }
+    }
+
+    if (info->current) {
+        state->current = state->n_documents;
+    }
+    state->n_documents++;
+
+    record.path_length = untitled ? 0 : strlen(info->filename);
+    record.line = info->line;
+    record.column = info->column;
+    record.top_line = info->top_line;
+    record.edits_length = edits ? g_bytes_get_size(edits) : 0;
+    record.index_length = index ? g_bytes_get_size(index) : 0;
+
+    g_string_append_len(state->records, (const gchar *)&record, sizeof(record));
+    if (!untitled) {
+        session_append_padded(state->records, info->filename, record.path_length);
+    }
+    if (edits) {
+        session_append_padded(state->records, g_bytes_get_data(edits, NULL), record.edits_length);
+        g_bytes_unref(edits);
+    }
+    if (index) {
+        session_append_padded(state->records, g_bytes_get_data(index, NULL), record.index_length);
+    }
+}
+
+// tabs_foreach() callback: hash what would go into a record
+static void session_sign(TextEditor *editor, const TabInfo *info, gpointer data) {
+    SessionState *state = (SessionState *)data;
+    guint64 fields[] = { info->current, info->modified, info->edit_generation,
+                         GPOINTER_TO_SIZE(info->pending_edits), info->line, info->column,
+                         info->top_line };
+
+    if (info->filename) {
+        state->signature = session_hash_bytes(state->signature, info->filename,
+                                              strlen(info->filename) + 1);
+    }
+    state->signature = session_hash_bytes(state->signature, fields, sizeof(fields));
+}
+
+static guint64 session_get_signature(TextEditor *editor) {
+    SessionState state = { editor->session, TRUE, NULL, 0, 0,
+                           G_GUINT64_CONSTANT(14695981039346656037) };
+    const gchar *contents;
+    gsize length;
+    guint64 indexed;
+
+    tabs_foreach(editor, session_sign, &state);
+
+    // A large file's index becomes worth saving once complete
+    indexed = viewport_get_line_index(editor, &contents, &length) != NULL;
+    return session_hash_bytes(state.signature, &indexed, sizeof(indexed));
+}
+
+static gpointer session_writer(gpointer data) {
+    SessionWrite *write = (SessionWrite *)data;
+    gchar *dir = g_path_get_dirname(write->path);
+    GError *error = NULL;
+    gsize length;
+    const gchar *contents = g_bytes_get_data(write->contents, &length);
+
+    g_mkdir_with_parents(dir, 0700);
+    if (!g_file_set_contents(write->path, contents, length, &error)) {
+        g_warning("Failed to write session to %s: %s", write->path, error->message);
+        g_error_free(error);
+    }
+
+    g_free(dir);
+    g_free(write->path);
+    g_bytes_unref(write->contents);
+    g_free(write);
+    return NULL;
+}
+
+void session_save(TextEditor *editor, gboolean with_edits) {
+    Session *session = editor->session;
+    SessionState state = { session, with_edits, NULL, 0, 0, 0 };
+    SessionHeader header = { SESSION_MAGIC, 0, 0, 0, 0 };
+    SessionWrite *write;
+    GString *contents;
+
+    if (!session) {
+        return;
+    }
+
+    session_keep_viewport_index(editor);
+    session->signature = session_get_signature(editor);
+
+    state.records = g_string_new(NULL);
+    tabs_foreach(editor, session_add_record, &state);
+
+    header.n_documents = state.n_documents;
+    header.current = state.current;
+    header.saved = g_get_real_time();
+    contents = g_string_sized_new(sizeof(header) + state.records->len);
+    g_string_append_len(contents, (const gchar *)&header, sizeof(header));
+    g_string_append_len(contents, state.records->str, state.records->len);
+    g_string_free(state.records, TRUE);
+
+    if (session->writer) {
+        g_thread_join(session->writer);
+    }
+
+    write = g_new0(SessionWrite, 1);
+    write->path = g_strdup(session->path);
+    write->contents = g_string_free_to_bytes(contents);
+    session->writer = g_thread_new("session-writer", session_writer, write);
+}
+
+// Idle timer: write the session if anything in it changed
+static gboolean session_save_tick(gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+
+    if (session_get_signature(editor) != editor->session->signature) {
+        session_save(editor, TRUE);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Add the tabs of the snapshot in bytes. Returns how many were added.
+static guint session_load(TextEditor *editor, GBytes *bytes) {
+    Session *session = editor->session;
+    gsize length, pos = sizeof(SessionHeader);
+    const gchar *data = g_bytes_get_data(bytes, &length);
+    guint added = 0, current = 0;
+    SessionHeader header;
+
+    if (length < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SESSION_MAGIC, SESSION_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    session->saved = header.saved;
+
+    for (guint32 i = 0; i < header.n_documents; i++) {
+        SessionRecord record;
+        SessionStat stat;
+        gsize path_size, edits_size, index_size;
+        gchar *filename = NULL;
+        GBytes *edits = NULL;
+
+        // Every record is checked to lie within the file before use
+        if (length - pos < sizeof(record)) {
+            break;
+        }
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+
+        path_size = SESSION_PAD((gsize)record.path_length);
+        edits_size = SESSION_PAD(record.edits_length);
+        index_size = SESSION_PAD(record.index_length);
+        if (record.edits_length > length || record.index_length > length ||
+            path_size + edits_size + index_size > length - pos) {
+            break;
+        }
+
+        if (record.path_length > 0) {
+            filename = g_strndup(data + pos, record.path_length);
+        }
+        pos += path_size;
+
+        // Files gone since are left out; changed ones lose their edits
+        if (!session_get_stat(filename, &stat)) {
+            g_free(filename);
+            pos += edits_size + index_size;
+            continue;
+        }
+        if (record.edits_length > 0 && memcmp(&stat, &record.stat, sizeof(stat)) == 0) {
+            edits = g_bytes_new_from_bytes(bytes, pos, record.edits_length);
+        }
+        pos += edits_size;
+
+        if (filename && record.index_length >= sizeof(SessionIndex)) {
+            g_hash_table_replace(session->indexes, g_strdup(filename),
+                                 g_bytes_new_from_bytes(bytes, pos, record.index_length));
+        }
+        pos += index_size;
+
+        if (i == header.current) {
+            current = added;
+        }
+        tabs_add_restored(editor, filename, record.line, record.column, record.top_line, edits);
+        added++;
+
+        if (edits) {
+            g_bytes_unref(edits);
+        }
+        g_free(filename);
+    }
+
+    if (added > 0) {
+        tabs_show_restored(editor, added, current);
+    }
+    return added;
+}
+
+gboolean session_restore(TextEditor *editor) {
+    gchar *path = session_get_path();
+    GMappedFile *mapping;
+    Session *session;
+    GBytes *bytes;
+    guint added;
+
+    if (!path) {
+        return FALSE;
+    }
+
+    session = g_new0(Session, 1);
+    session->path = path;
+    session->indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)g_bytes_unref);
+    session->save_id = g_timeout_add_full(G_PRIORITY_LOW, SESSION_SAVE_INTERVAL,
+                                          session_save_tick, editor, NULL);
+    editor->session = session;
+
+    mapping = g_mapped_file_new(path, FALSE, NULL);
+    if (!mapping) {
+        return FALSE;
+    }
+
+    // The edits and indexes taken from it keep the mapping
+    bytes = g_mapped_file_get_bytes(mapping);
+    g_mapped_file_unref(mapping);
+    added = session_load(editor, bytes);
+    g_bytes_unref(bytes);
+
+    // Unchanged until something is done
+    session->signature = session_get_signature(editor);
+    return added > 0;
+}
+
+void session_resume_document(TextEditor *editor) {
+    Session *session = editor->session;
+    GBytes *edits = editor->pending_edits;
+
+    editor->pending_edits = NULL;
+
+    // A journal written to after the snapshot has all its edits and more:
+    // it is offered for replay instead
+    if (edits && (!session || !journal_discard_older(editor->current_filename, session->saved))) {
+        g_bytes_unref(edits);
+        edits = NULL;
+    }
+
+    journal_start(editor);
+
+    if (edits) {
+        if (session_apply_edits(editor, edits)) {
+            editor_set_status(editor, "Restored unsaved changes");
+        } else {
+            editor_set_status(editor, "Unsaved changes of the last session no longer apply");
+        }
+        g_bytes_unref(edits);
+    }
+
+    editor_goto_pending(editor);
+}
+
+LineIndex *session_get_line_index(TextEditor *editor, const gchar *filename,
+                                  const gchar *data, gsize length) {
+    Session *session = editor->session;
+    SessionIndex header;
+    SessionStat stat;
+    const gchar *blob;
+    gsize size;
+    GBytes *kept;
+
+    if (!session || !(kept = g_hash_table_lookup(session->indexes, filename))) {
+        return NULL;
+    }
+
+    blob = g_bytes_get_data(kept, &size);
+    if (size < sizeof(header)) {
+        return NULL;
+    }
+    memcpy(&header, blob, sizeof(header));
+    if (!session_get_stat(filename, &stat) ||
+        memcmp(&stat, &header.stat, sizeof(stat)) != 0 ||
+        header.stat.size != length || header.hash != session_hash_text(data, length) ||
+        (size - sizeof(header)) % sizeof(gsize) != 0) {
+        return NULL;
+    }
+
+    // The blob is 8-byte aligned in the mapping and in memory
+    return line_index_new_complete(data, length, (const gsize *)(blob + sizeof(header)),
+                                   (size - sizeof(header)) / sizeof(gsize), header.n_lines);
+}
+
+void session_cleanup(TextEditor *editor) {
+    Session *session = editor->session;
+
+    if (!session) {
+        return;
+    }
+
+    if (session->save_id) {
+        g_source_remove(session->save_id);
+    }
+    if (session->writer) {
+        g_thread_join(session->writer);
+    }
+    g_hash_table_destroy(session->indexes);
+    g_free(session->path);
+    g_free(session);
+    editor->session = NULL;
+}
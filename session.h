@@ -0,0 +1,47 @@
+/*
+ * Session snapshot
+ *
+ * The open documents are written to a small binary file in the user's
+ * cache directory: their paths with the size, mtime and inode of each file,
+ * the cursor and scroll positions, the unsaved changes as edits against the
+ * file, and the line indexes of the files shown in large-file mode. It is
+ * written on quit and, when something changed, every SESSION_SAVE_INTERVAL
+ * ms while idle.
+ *
+ * On the next start the file is mapped and the documents come back as
+ * tabs, read only when shown; the current one is read right away. A saved
+ * line index spares the indexing scan of a large file that hasn't changed.
+ * The TEXT_EDITOR_SESSION environment variable names another session file,
+ * or turns sessions off when set to 0 or empty.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "editor.h"
+#include "line_index.h"
+
+#define SESSION_SAVE_INTERVAL 5000   // Milliseconds between checks for changes
+
+// At startup: bring back the documents of the last session. Returns FALSE
+// if there were none, the window then being left as it is.
+gboolean session_restore(TextEditor *editor);
+
+// The current document has been read: put back its unsaved changes from
+// the last session unless the journal has newer ones, start its journal,
+// and go to the pending position
+void session_resume_document(TextEditor *editor);
+
+// Write the session now. Without with_edits the changes of the documents
+// are left out, as on quit once the user has decided about them.
+void session_save(TextEditor *editor, gboolean with_edits);
+
+// A complete line index of filename, whose text is data, if one was saved
+// and the file hasn't changed since. NULL otherwise.
+LineIndex *session_get_line_index(TextEditor *editor, const gchar *filename,
+                                  const gchar *data, gsize length);
+
+// Wait for the session to be written and free it
+void session_cleanup(TextEditor *editor);
+
+#endif // SESSION_H
@@ -0,0 +1,166 @@
+/*
+ * Startup
+ *
+ * A phase is timed from the end of the one before, so the marks only need
+ * to be placed where a phase ends. The first frame is noticed from the
+ * frame clock's after-paint signal; while the loader is still to insert
+ * the first chunk of a file the frames go on being watched, and the first
+ * one painted with some text in the buffer is the first page. The loader
+ * makes that chunk small so it comes early. With --quit-after-load the
+ * startup goes on until the loader has inserted the whole file. Times are
+ * printed with g_ascii_formatd(), since GTK has switched to the user's
+ * locale by then and the output is meant to be parsed.
+ */
+
+#include "startup.h"
+#include "trace.h"
+
+#include <stdio.h>
+
+#define STARTUP_MAX_PHASES 16
+
+typedef struct {
+    const gchar *name;
+    gint64 end;             // trace_now() time
+} StartupPhase;
+
+static gint64 startup_start;
+static StartupPhase startup_phases[STARTUP_MAX_PHASES];
+static guint startup_n_phases;
+static gboolean startup_done;
+
+// The window being watched
+static TextEditor *startup_editor;
+static GSourceFunc startup_deferred;
+static gulong startup_paint_id;
+static gboolean startup_painted;
+
+static gboolean startup_profile;
+static gboolean startup_quit;
+static gboolean startup_quit_load;
+static gboolean startup_loading;   // Startup is over but for the file being read
+
+static GOptionEntry startup_options[] = {
+    { "startup-profile", 0, 0, G_OPTION_ARG_NONE, &startup_profile,
+      "Print how long each phase of startup took", NULL },
+    { "quit-after-startup", 0, 0, G_OPTION_ARG_NONE, &startup_quit,
+      "Quit once the first page is shown (for benchmarks)", NULL },
+    { "quit-after-load", 0, 0, G_OPTION_ARG_NONE, &startup_quit_load,
+      "Quit once the file is read in full (for benchmarks)", NULL },
+    { NULL }
+};
+
+// Print the phases on standard error
+static void startup_print(void) {
+    gchar phase[G_ASCII_DTOSTR_BUF_SIZE], total[G_ASCII_DTOSTR_BUF_SIZE];
+    gint64 previous = startup_start;
+
+    for (guint i = 0; i < startup_n_phases; i++) {
+        g_ascii_formatd(phase, sizeof(phase), "%.3f", (startup_phases[i].end - previous) / 1e6);
+        g_ascii_formatd(total, sizeof(total), "%.3f",
+                        (startup_phases[i].end - startup_start) / 1e6);
+        fprintf(stderr, "%-14s %10s %10s\n", startup_phases[i].name, phase, total);
+        previous = startup_phases[i].end;
+    }
+    fflush(stderr);
+}
+
+static gboolean startup_quit_idle(gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+
+    gtk_window_close(GTK_WINDOW(editor->window));
+    return G_SOURCE_REMOVE;
+}
+
+// The startup is over, or with --quit-after-load, all but the reading of
+// the file
+static void startup_finish(GdkFrameClock *clock) {
+    g_signal_handler_disconnect(clock, startup_paint_id);
+    startup_paint_id = 0;
+
+    if (startup_quit_load && startup_editor->loader) {
+        startup_loading = TRUE;
+        return;
+    }
+    startup_done = TRUE;
+
+    if (startup_profile) {
+        startup_print();
+    }
+    if (startup_quit || startup_quit_load) {
+        g_idle_add(startup_quit_idle, startup_editor);
+    }
+}
+
+// Frame clock after-paint: the first frame, or the first page of a file
+static void on_startup_after_paint(GdkFrameClock *clock, gpointer data) {
+    TextEditor *editor = startup_editor;
+
+    if (!startup_painted) {
+        startup_painted = TRUE;
+        startup_mark("first-frame");
+        if (startup_deferred) {
+            g_idle_add(startup_deferred, editor);
+        }
+    }
+
+    // Wait for a frame with the start of the file
+    if (editor->loader && gtk_text_buffer_get_char_count(editor->text_buffer) == 0) {
+        return;
+    }
+
+    if (editor->current_filename) {
+        startup_mark("first-page");
+    }
+    startup_finish(clock);
+}
+
+void startup_init(void) {
+    startup_start = trace_now();
+}
+
+void startup_add_options(GApplication *app) {
+    g_application_add_main_option_entries(app, startup_options);
+}
+
+void startup_mark(const gchar *phase) {
+    if (startup_done || startup_n_phases == STARTUP_MAX_PHASES) {
+        return;
+    }
+
+    startup_phases[startup_n_phases].name = phase;
+    startup_phases[startup_n_phases].end = trace_now();
+    startup_n_phases++;
+}
+
+void startup_loaded(void) {
+    startup_mark("loaded");
+
+    if (startup_loading) {
+        startup_loading = FALSE;
+        startup_done = TRUE;
+
+        if (startup_profile) {
+            startup_print();
+        }
+        g_idle_add(startup_quit_idle, startup_editor);
+    }
+}
+
+void startup_forwarded(void) {
+    startup_mark("forwarded");
+    startup_done = TRUE;
+
+    if (startup_profile) {
+        startup_print();
+    }
+}
+
+void startup_watch(TextEditor *editor, GSourceFunc deferred) {
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(editor->window);
+
+    startup_editor = editor;
+    startup_deferred = deferred;
+    startup_paint_id = g_signal_connect(clock, "after-paint",
+                                        G_CALLBACK(on_startup_after_paint), NULL);
+}
@@ -0,0 +1,46 @@
+/*
+ * Startup
+ *
+ * Startup is timed phase by phase, from main() to the first frame or, when
+ * a file is being read, to the first frame that shows its text. With
+ * --startup-profile the phases are printed on standard error as
+ *
+ *   <phase> <milliseconds in the phase> <milliseconds since main()>
+ *
+ * one per line. --quit-after-startup closes the editor right after, which
+ * is how the benchmarks time the first paint; --quit-after-load waits for
+ * the file to be read in full, the "loaded" phase, and then closes it.
+ * When the editor is running already, a second one only hands its files
+ * over and exits; its profile then ends with the "forwarded" phase.
+ *
+ * Only what the first frame shows is built before it: the menus are
+ * filled in once it is on screen, and the search bar when it is first
+ * opened.
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "editor.h"
+
+// Start the clock. Called first thing in main().
+void startup_init(void);
+
+// Add --startup-profile and --quit-after-startup to the application
+void startup_add_options(GApplication *app);
+
+// The phase named phase (a string literal) ends now
+void startup_mark(const gchar *phase);
+
+// The file being opened has been read in full, or failed to be read
+void startup_loaded(void);
+
+// The files were handed to the editor already running: the end of startup
+// for this instance
+void startup_forwarded(void);
+
+// Watch for the first frames of editor->window. Once the first one is
+// painted, deferred (if not NULL) is called from an idle callback.
+void startup_watch(TextEditor *editor, GSourceFunc deferred);
+
+#endif // STARTUP_H
@@ -0,0 +1,97 @@
+/*
+ * Document statistics
+ *
+ * A word starts at every character that isn't a separator and follows one
+ * (or the start of the document). An edit only changes which of its own
+ * characters start words and whether the character after it does, so the
+ * change in the count is the number of word starts in "before, text,
+ * after" less that in "before, after", where before and after are the
+ * characters on either side of the edit. Separators are ASCII, so the text
+ * is looked at byte by byte without decoding UTF-8.
+ */
+
+#include "stats.h"
+#include "status.h"
+#include "viewport.h"
+#include "text_scan.h"
+#include "trace.h"
+
+#include <string.h>
+
+static gboolean stats_is_separator(gunichar c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Change in the word count from putting text between before and after,
+// either of which is 0 at an end of the document
+static gssize stats_words_between(gunichar before, const gchar *text, gsize length,
+                                  gunichar after) {
+    gboolean in_word = before && !stats_is_separator(before);
+    gboolean after_word = after && !stats_is_separator(after);
+    gsize with, without;
+
+    without = after_word && !in_word;
+    with = text_scan_count_words(text, length, &in_word);
+    with += after_word && !in_word;
+
+    return (gssize)with - (gssize)without;
+}
+
+// Characters on either side of the range from start to end
+static void stats_neighbours(const GtkTextIter *start, const GtkTextIter *end,
+                             gunichar *before, gunichar *after) {
+    GtkTextIter previous = *start;
+
+    *before = gtk_text_iter_backward_char(&previous) ? gtk_text_iter_get_char(&previous) : 0;
+    *after = gtk_text_iter_is_end(end) ? 0 : gtk_text_iter_get_char(end);
+}
+
+void stats_record_insert(TextEditor *editor, const GtkTextIter *location,
+                         const gchar *text, gsize length) {
+    TRACE_SCOPE("stats.insert");
+    gunichar before, after;
+
+    stats_neighbours(location, location, &before, &after);
+    editor->n_words += stats_words_between(before, text, length, after);
+    status_update(editor, STATUS_COUNTS);
+}
+
+void stats_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end) {
+    TRACE_SCOPE("stats.delete");
+    gunichar before, after;
+    gchar *text = gtk_text_iter_get_slice(start, end);
+
+    stats_neighbours(start, end, &before, &after);
+    editor->n_words -= stats_words_between(before, text, strlen(text), after);
+    status_update(editor, STATUS_COUNTS);
+    g_free(text);
+}
+
+void stats_show(TextEditor *editor) {
+    GtkWidget *dialog;
+
+    if (editor->loader) {
+        editor_set_status(editor, "The file is still loading");
+        return;
+    }
+
+    dialog = gtk_message_dialog_new(GTK_WINDOW(editor->window),
+                                    GTK_DIALOG_DESTROY_WITH_PARENT,
+                                    GTK_MESSAGE_INFO,
+                                    GTK_BUTTONS_OK,
+                                    "Document Statistics");
+
+    if (editor->viewport) {
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+            "Lines: %" G_GSIZE_FORMAT "\nWords and characters aren't counted in large-file mode",
+            viewport_get_line_count(editor));
+    } else {
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+            "Characters: %" G_GSIZE_FORMAT "\nWords: %" G_GSIZE_FORMAT "\nLines: %" G_GSIZE_FORMAT,
+            line_table_get_char_count(editor->lines), editor->n_words,
+            line_table_get_line_count(editor->lines));
+    }
+
+    gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+}
@@ -0,0 +1,24 @@
+/*
+ * Document statistics
+ *
+ * Characters and lines come from the line table. Words, runs of characters
+ * other than space, tab, CR and LF, are counted once with the vectorized
+ * scanner when a file is read and then adjusted by every edit from the
+ * insert-text and delete-range handlers, so the counts shown in the status
+ * bar and by View > Word Count never need a pass over the document.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "editor.h"
+
+// Adjust the word count for an edit about to be made to the buffer
+void stats_record_insert(TextEditor *editor, const GtkTextIter *location,
+                         const gchar *text, gsize length);
+void stats_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end);
+
+// Show the counts in a dialog
+void stats_show(TextEditor *editor);
+
+#endif // STATS_H
@@ -0,0 +1,253 @@
+/*
+ * Status bar fields
+ *
+ * Each field keeps the text its label shows. A flush formats the marked
+ * fields into a buffer on the stack and compares it with that text, so
+ * nothing is allocated for a field that didn't change and its label isn't
+ * touched (which would queue a resize and a redraw).
+ */
+
+#include "status.h"
+#include "viewport.h"
+#include "trace.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#define STATUS_TEXT_MAX 128
+
+enum {
+    FIELD_POSITION,
+    FIELD_SELECTION,
+    FIELD_COUNTS,
+    FIELD_FILE,
+    N_FIELDS
+};
+
+struct _StatusFields {
+    GtkWidget *labels[N_FIELDS];
+    gchar shown[N_FIELDS][STATUS_TEXT_MAX];
+    guint dirty;            // Mask of StatusField
+    guint tick_id;
+
+    // Progress waiting to be shown, and what the progress bar shows
+    gdouble fraction;
+    gchar *progress_text;
+    gdouble shown_fraction;
+    gchar *shown_progress_text;
+};
+
+// Show text in a field unless it already does
+static void status_set_field(StatusFields *status, guint field, const gchar *text) {
+    if (strcmp(status->shown[field], text) != 0) {
+        g_strlcpy(status->shown[field], text, STATUS_TEXT_MAX);
+        gtk_label_set_text(GTK_LABEL(status->labels[field]), text);
+    }
+}
+
+// Whether the buffer mirrors the document (not while loading or in the
+// large-file mode, where the line table doesn't describe the buffer)
+static gboolean status_has_document(TextEditor *editor) {
+    return !editor->loader && !editor->viewport;
+}
+
+static void status_format_position(TextEditor *editor, gchar *text) {
+    GtkTextIter iter;
+    gsize offset, line, column, byte;
+
+    if (!status_has_document(editor)) {
+        text[0] = '\0';
+        return;
+    }
+
+    gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &iter,
+                                     gtk_text_buffer_get_insert(editor->text_buffer));
+    offset = gtk_text_iter_get_offset(&iter);
+    line_table_get_position(editor->lines, offset, &line, &column);
+
+    byte = piece_table_char_to_byte(editor->document, offset);
+
+    g_snprintf(text, STATUS_TEXT_MAX, "Ln %" G_GSIZE_FORMAT ", Col %" G_GSIZE_FORMAT
+               ", Byte %" G_GSIZE_FORMAT, line + 1, column + 1, byte);
+}
+
+static void status_format_selection(TextEditor *editor, gchar *text) {
+    GtkTextIter start, end;
+    gsize chars, lines;
+
+    if (!gtk_text_buffer_get_selection_bounds(editor->text_buffer, &start, &end)) {
+        text[0] = '\0';
+        return;
+    }
+
+    chars = gtk_text_iter_get_offset(&end) - gtk_text_iter_get_offset(&start);
+    lines = gtk_text_iter_get_line(&end) - gtk_text_iter_get_line(&start) + 1;
+
+    if (lines > 1) {
+        g_snprintf(text, STATUS_TEXT_MAX, "%" G_GSIZE_FORMAT " selected (%" G_GSIZE_FORMAT
+                   " lines)", chars, lines);
+    } else {
+        g_snprintf(text, STATUS_TEXT_MAX, "%" G_GSIZE_FORMAT " selected", chars);
+    }
+}
+
+static void status_format_counts(TextEditor *editor, gchar *text) {
+    if (editor->loader) {
+        text[0] = '\0';
+    } else if (editor->viewport) {
+        g_snprintf(text, STATUS_TEXT_MAX, "%" G_GSIZE_FORMAT " lines",
+                   viewport_get_line_count(editor));
+    } else {
+        g_snprintf(text, STATUS_TEXT_MAX, "%" G_GSIZE_FORMAT " lines, %" G_GSIZE_FORMAT
+                   " words, %" G_GSIZE_FORMAT " characters",
+                   line_table_get_line_count(editor->lines), editor->n_words,
+                   line_table_get_char_count(editor->lines));
+    }
+}
+
+// Size of the file on disk, then its encoding and compression
+static void status_format_file(TextEditor *editor, gchar *text) {
+    GString *details = g_string_new(NULL);
+    GStatBuf st;
+
+    if (editor->current_filename && g_stat(editor->current_filename, &st) == 0) {
+        gchar *size = g_format_size(st.st_size);
+
+        g_string_append_printf(details, "%s, ", size);
+        g_free(size);
+    }
+
+    g_string_append(details, encoding_get_charset(editor->encoding));
+    if (editor->encoding.bom) {
+        g_string_append(details, " with BOM");
+    }
+    if (editor->encoding.repaired) {
+        g_string_append(details, " (invalid bytes replaced)");
+    }
+    if (editor->compression != COMPRESSION_NONE) {
+        g_string_append_printf(details, ", %s", compression_get_name(editor->compression));
+    }
+
+    g_strlcpy(text, details->str, STATUS_TEXT_MAX);
+    g_string_free(details, TRUE);
+}
+
+static void status_flush_progress(TextEditor *editor) {
+    StatusFields *status = editor->status_fields;
+
+    if (status->fraction != status->shown_fraction) {
+        status->shown_fraction = status->fraction;
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(editor->progress_bar), status->fraction);
+    }
+    if (g_strcmp0(status->progress_text, status->shown_progress_text) != 0) {
+        g_free(status->shown_progress_text);
+        status->shown_progress_text = g_strdup(status->progress_text);
+        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(editor->progress_bar), status->progress_text);
+    }
+}
+
+// Frame clock tick: show the marked fields, once
+static gboolean status_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data) {
+    TRACE_SCOPE("status.update");
+    TextEditor *editor = (TextEditor *)data;
+    StatusFields *status = editor->status_fields;
+    guint dirty = status->dirty;
+    gchar text[STATUS_TEXT_MAX];
+
+    status->tick_id = 0;
+    status->dirty = 0;
+
+    if (dirty & STATUS_POSITION) {
+        status_format_position(editor, text);
+        status_set_field(status, FIELD_POSITION, text);
+    }
+    if (dirty & STATUS_SELECTION) {
+        status_format_selection(editor, text);
+        status_set_field(status, FIELD_SELECTION, text);
+    }
+    if (dirty & STATUS_COUNTS) {
+        status_format_counts(editor, text);
+        status_set_field(status, FIELD_COUNTS, text);
+    }
+    if (dirty & STATUS_FILE) {
+        status_format_file(editor, text);
+        status_set_field(status, FIELD_FILE, text);
+    }
+    if (dirty & STATUS_PROGRESS) {
+        status_flush_progress(editor);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+// Cursor moved or the selection changed
+static void on_cursor_moved(GObject *object, GParamSpec *pspec, gpointer data) {
+    status_update((TextEditor *)data, STATUS_POSITION | STATUS_SELECTION);
+}
+
+static void on_mark_set(GtkTextBuffer *buffer, GtkTextIter *location, GtkTextMark *mark,
+                        gpointer data) {
+    if (mark == gtk_text_buffer_get_insert(buffer) ||
+        mark == gtk_text_buffer_get_selection_bound(buffer)) {
+        status_update((TextEditor *)data, STATUS_POSITION | STATUS_SELECTION);
+    }
+}
+
+void status_init(TextEditor *editor) {
+    StatusFields *status = g_new0(StatusFields, 1);
+
+    editor->status_fields = status;
+    status->shown_fraction = -1.0;
+
+    // Packed from the right, so they read left to right in field order
+    for (gint i = N_FIELDS - 1; i >= 0; i--) {
+        status->labels[i] = gtk_label_new(NULL);
+        gtk_box_pack_end(GTK_BOX(editor->status_bar), status->labels[i], FALSE, FALSE, 6);
+    }
+
+    status_update(editor, STATUS_ALL);
+}
+
+void status_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer) {
+    g_signal_connect(buffer, "notify::cursor-position", G_CALLBACK(on_cursor_moved), editor);
+    g_signal_connect(buffer, "mark-set", G_CALLBACK(on_mark_set), editor);
+}
+
+void status_update(TextEditor *editor, guint fields) {
+    StatusFields *status = editor->status_fields;
+
+    status->dirty |= fields;
+    if (status->tick_id == 0) {
+        status->tick_id = gtk_widget_add_tick_callback(editor->status_bar, status_tick,
+                                                       editor, NULL);
+    }
+}
+
+void status_set_progress(TextEditor *editor, gdouble fraction, const gchar *text) {
+    StatusFields *status = editor->status_fields;
+
+    status->fraction = CLAMP(fraction, 0.0, 1.0);
+    if (g_strcmp0(status->progress_text, text) != 0) {
+        g_free(status->progress_text);
+        status->progress_text = g_strdup(text);
+    }
+    status_update(editor, STATUS_PROGRESS);
+}
+
+void status_cleanup(TextEditor *editor) {
+    StatusFields *status = editor->status_fields;
+
+    if (!status) {
+        return;
+    }
+
+    g_signal_handlers_disconnect_by_func(editor->text_buffer, on_cursor_moved, editor);
+    g_signal_handlers_disconnect_by_func(editor->text_buffer, on_mark_set, editor);
+    if (status->tick_id) {
+        gtk_widget_remove_tick_callback(editor->status_bar, status->tick_id);
+    }
+    g_free(status->progress_text);
+    g_free(status->shown_progress_text);
+    g_free(status);
+    editor->status_fields = NULL;
+}
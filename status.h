@@ -0,0 +1,43 @@
+/*
+ * Status bar fields
+ *
+ * Beside the message area, the status bar shows the cursor position (line,
+ * column and byte offset), the length of the selection, the line, word and
+ * character counts, the file's size and encoding, and the progress of a
+ * load or save. Changes only mark the fields they affect; the marked fields
+ * are worked out again at most once per frame, from the status bar's frame
+ * clock, and a label is only set when its text actually changed. Key repeat
+ * or dragging a selection therefore costs one update per frame however many
+ * signals it raises.
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include "editor.h"
+
+typedef enum {
+    STATUS_POSITION  = 1 << 0,  // Cursor line, column and byte offset
+    STATUS_SELECTION = 1 << 1,  // Length of the selection
+    STATUS_COUNTS    = 1 << 2,  // Lines, words and characters
+    STATUS_FILE      = 1 << 3,  // Size on disk, encoding and compression
+    STATUS_PROGRESS  = 1 << 4,  // Load or save progress bar
+    STATUS_ALL       = (1 << 5) - 1
+} StatusField;
+
+// Add the fields to editor->status_bar
+void status_init(TextEditor *editor);
+
+// Follow the cursor in buffer. Called once for every document buffer.
+void status_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer);
+
+// Show fields (a mask of StatusField) again on the next frame
+void status_update(TextEditor *editor, guint fields);
+
+// Set the progress bar on the next frame. The progress bar and the Cancel
+// button are still shown and hidden by whoever runs the operation.
+void status_set_progress(TextEditor *editor, gdouble fraction, const gchar *text);
+
+void status_cleanup(TextEditor *editor);
+
+#endif // STATUS_H
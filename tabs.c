@@ -0,0 +1,809 @@
+/*
+ * Tabs
+ *
+ * See tabs.h. The GtkNotebook is only used as a tab strip: its pages are
+ * empty, and the text view below it is given the buffer of whichever tab
+ * is current.
+ */
+
+#include "tabs.h"
+#include "loader.h"
+#include "saver.h"
+#include "journal.h"
+#include "viewport.h"
+#include "follow.h"
+#include "search.h"
+#include "status.h"
+#include "undo.h"
+#include "highlight.h"
+#include "session.h"
+#include "compression.h"
+
+#define TABS_LINE_OVERHEAD 64       // Bytes a buffer takes per line beyond the text, roughly
+#define TABS_TOP_MARK      "tab-top"
+
+typedef enum {
+    TAB_UNLOADED,                   // Only the file name; read when the tab is shown
+    TAB_EVICTED,                    // The document without a buffer or its text
+    TAB_RESIDENT                    // Buffer in memory
+} TabState;
+
+typedef struct {
+    Tabs *tabs;
+    TabState state;
+    GtkWidget *page;                // Empty, as the notebook is only a tab strip
+    GtkWidget *label;
+    gint64 last_shown;              // Monotonic time the tab was last left
+
+    // The editor's per-document fields, while the tab is not in view
+    GtkTextBuffer *text_buffer;
+    PieceTable *document;
+    LineTable *lines;
+    gchar *current_filename;
+    gsize pending_line;
+    gsize pending_column;
+    gsize pending_top;
+    GBytes *pending_edits;
+    Encoding encoding;
+    CompressionType compression;
+    guint64 follow_dropped;
+    gsize follow_dropped_lines;
+    gboolean modified;
+    gsize n_words;
+    guint64 edit_generation;
+    Journal *journal;
+    Undo *undo;
+    Highlight *highlight;
+
+    // Where the view was, as character offsets
+    gsize cursor;
+    gsize top;
+    gboolean following;             // Follow mode to resume when shown
+
+    // Text taken from the document of an evicted tab (see tab_drop_buffer())
+    GBytes *packed;                 // Compressed
+    gchar *taken;                   // Or as is, if it couldn't be
+    gsize taken_length;
+} Tab;
+
+struct _Tabs {
+    TextEditor *editor;
+    GtkWidget *notebook;
+    GPtrArray *tabs;                // Tab, in notebook order
+    Tab *active;                    // In view: its document is in the editor's fields
+    gsize budget;                   // Bytes kept for the tabs not in view
+};
+
+static void on_tab_close_clicked(GtkWidget *button, gpointer data);
+
+static gsize tabs_get_budget(void) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_TAB_BUDGET");
+
+    if (setting && *setting) {
+        return g_ascii_strtoull(setting, NULL, 10);
+    }
+    return TABS_DEFAULT_BUDGET;
+}
+
+#define TAB_SWAP(type, field) G_STMT_START {   \
+        type swap = editor->field;             \
+        editor->field = tab->field;            \
+        tab->field = swap;                     \
+    } G_STMT_END
+
+// Exchange the per-document fields of the editor with those kept in tab.
+// Also how the modules' per-document functions, which all work on the
+// editor's fields, are run on a tab not in view.
+static void tab_swap(TextEditor *editor, Tab *tab) {
+    TAB_SWAP(GtkTextBuffer *, text_buffer);
+    TAB_SWAP(PieceTable *, document);
+    TAB_SWAP(LineTable *, lines);
+    TAB_SWAP(gchar *, current_filename);
+    TAB_SWAP(gsize, pending_line);
+    TAB_SWAP(gsize, pending_column);
+    TAB_SWAP(gsize, pending_top);
+    TAB_SWAP(GBytes *, pending_edits);
+    TAB_SWAP(Encoding, encoding);
+    TAB_SWAP(CompressionType, compression);
+    TAB_SWAP(guint64, follow_dropped);
+    TAB_SWAP(gsize, follow_dropped_lines);
+    TAB_SWAP(gboolean, modified);
+    TAB_SWAP(gsize, n_words);
+    TAB_SWAP(guint64, edit_generation);
+    TAB_SWAP(Journal *, journal);
+    TAB_SWAP(Undo *, undo);
+    TAB_SWAP(Highlight *, highlight);
+}
+
+// Rough memory taken by a tab not in view: the buffer of a resident one,
+// or the compressed text of an evicted one, and the document and history
+// of either
+static gsize tab_get_size(Tab *tab) {
+    TextEditor *editor = tab->tabs->editor;
+    gsize size, lines = line_table_get_line_count(tab->lines);
+
+    if (tab->state == TAB_RESIDENT) {
+        size = piece_table_get_length(tab->document) + TABS_LINE_OVERHEAD * lines;
+    } else {
+        size = (tab->packed ? g_bytes_get_size(tab->packed) : tab->taken_length) +
+               sizeof(gsize) * lines;
+    }
+
+    tab_swap(editor, tab);
+    size += piece_table_get_memory(editor->document) + undo_get_memory(editor);
+    tab_swap(editor, tab);
+    return size;
+}
+
+static gboolean tab_is_modified(Tab *tab) {
+    return tab == tab->tabs->active ? tab->tabs->editor->modified : tab->modified;
+}
+
+static const gchar *tab_get_filename(Tab *tab) {
+    return tab == tab->tabs->active ? tab->tabs->editor->current_filename : tab->current_filename;
+}
+
+static void tab_set_label(Tab *tab, const gchar *filename) {
+    if (filename) {
+        gchar *basename = g_path_get_basename(filename);
+
+        gtk_label_set_text(GTK_LABEL(tab->label), basename);
+        gtk_widget_set_tooltip_text(tab->label, filename);
+        g_free(basename);
+    } else {
+        gtk_label_set_text(GTK_LABEL(tab->label), "Untitled");
+        gtk_widget_set_tooltip_text(tab->label, NULL);
+    }
+}
+
+// Create a tab for filename (NULL for an untitled document), to be read
+// when it is first shown
+static Tab *tab_new(Tabs *tabs, const gchar *filename, gsize line) {
+    Tab *tab = g_new0(Tab, 1);
+
+    tab->tabs = tabs;
+    tab->state = TAB_UNLOADED;
+    tab->current_filename = g_strdup(filename);
+    tab->pending_line = line + 1;
+    tab->encoding = (Encoding){ ENCODING_UTF8, FALSE, FALSE };
+
+    tab->page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_widget_show(tab->page);
+
+    tab->label = gtk_label_new(NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(tab->label), PANGO_ELLIPSIZE_MIDDLE);
+    gtk_label_set_max_width_chars(GTK_LABEL(tab->label), 24);
+    tab_set_label(tab, filename);
+    return tab;
+}
+
+// Add tab at the end of the strip, which is only shown with two tabs or more
+static void tabs_append(Tabs *tabs, Tab *tab) {
+    GtkWidget *box, *close_button;
+
+    close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
+    gtk_button_set_relief(GTK_BUTTON(close_button), GTK_RELIEF_NONE);
+    gtk_widget_set_focus_on_click(close_button, FALSE);
+    gtk_widget_set_tooltip_text(close_button, "Close Tab");
+    g_signal_connect(close_button, "clicked", G_CALLBACK(on_tab_close_clicked), tab);
+
+    box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    gtk_box_pack_start(GTK_BOX(box), tab->label, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(box), close_button, FALSE, FALSE, 0);
+    gtk_widget_show_all(box);
+
+    g_ptr_array_add(tabs->tabs, tab);
+    gtk_notebook_append_page(GTK_NOTEBOOK(tabs->notebook), tab->page, box);
+    gtk_notebook_set_show_tabs(GTK_NOTEBOOK(tabs->notebook), tabs->tabs->len > 1);
+}
+
+static Tab *tabs_find_page(Tabs *tabs, GtkWidget *page) {
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (tab->page == page) {
+            return tab;
+        }
+    }
+    return NULL;
+}
+
+static Tab *tabs_find_file(Tabs *tabs, const gchar *filename) {
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (g_strcmp0(tab_get_filename(tab), filename) == 0) {
+            return tab;
+        }
+    }
+    return NULL;
+}
+
+// Make tab current; the switch-page handler does the rest
+static void tabs_show(Tabs *tabs, Tab *tab) {
+    GtkNotebook *notebook = GTK_NOTEBOOK(tabs->notebook);
+
+    gtk_notebook_set_current_page(notebook, gtk_notebook_page_num(notebook, tab->page));
+}
+
+// Drop the buffer of a tab not in view, keeping its document, history and
+// journal. The highlighting goes with the buffer, since its tags are in it.
+// The text of the document that isn't in a file mapping is compressed, and
+// the texts of the history go to its spill file.
+static void tab_drop_buffer(Tabs *tabs, Tab *tab) {
+    GError *error = NULL;
+
+    tab_swap(tabs->editor, tab);
+    highlight_cleanup(tabs->editor);
+    undo_spill(tabs->editor);
+    tab_swap(tabs->editor, tab);
+
+    g_object_unref(tab->text_buffer);
+    tab->text_buffer = NULL;
+    tab->state = TAB_EVICTED;
+
+    tab->taken = piece_table_take_text(tab->document, &tab->taken_length);
+    if (tab->taken_length == 0) {
+        return;
+    }
+
+    tab->packed = compression_pack(tab->taken, tab->taken_length, &error);
+    if (tab->packed) {
+        g_clear_pointer(&tab->taken, g_free);
+    } else {
+        g_warning("Failed to compress the text of an evicted tab: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+// Give the document of an evicted tab its text back
+static void tab_restore_text(Tab *tab) {
+    GError *error = NULL;
+
+    g_return_if_fail(tab->state == TAB_EVICTED && tab->document);
+
+    if (tab->packed) {
+        tab->taken = g_malloc(tab->taken_length);
+        if (!compression_unpack(tab->packed, tab->taken, tab->taken_length, &error)) {
+            // Packed in memory moments ago, so only a bug gets here
+            g_error("Failed to decompress the text of an evicted tab: %s", error->message);
+        }
+        g_clear_pointer(&tab->packed, g_bytes_unref);
+    }
+
+    piece_table_restore_text(tab->document, g_steal_pointer(&tab->taken), tab->taken_length);
+    tab->taken_length = 0;
+}
+
+// Forget all of a tab not in view but its file name and pending position
+// (and edits), so the file is read again when the tab is next shown. With
+// discard the journal is deleted, otherwise left for recovery.
+static void tab_unload(Tabs *tabs, Tab *tab, gboolean discard) {
+    TextEditor *editor = tabs->editor;
+
+    tab_swap(editor, tab);
+    journal_close(editor, discard);
+    undo_cleanup(editor);
+    highlight_cleanup(editor);
+    tab_swap(editor, tab);
+
+    // Clearing the other history set the menu items from it
+    if (editor->undo) {
+        undo_update_items(editor);
+    }
+
+    if (tab->text_buffer) {
+        g_object_unref(tab->text_buffer);
+        tab->text_buffer = NULL;
+    }
+    piece_table_free(tab->document);
+    tab->document = NULL;
+    g_clear_pointer(&tab->packed, g_bytes_unref);
+    g_clear_pointer(&tab->taken, g_free);
+    tab->taken_length = 0;
+    line_table_free(tab->lines);
+    tab->lines = NULL;
+    tab->modified = FALSE;
+    tab->n_words = 0;
+    tab->following = FALSE;
+    tab->state = TAB_UNLOADED;
+}
+
+// Close a tab not in view for good
+static void tab_free(Tabs *tabs, Tab *tab, gboolean discard) {
+    GtkNotebook *notebook = GTK_NOTEBOOK(tabs->notebook);
+
+    tab_unload(tabs, tab, discard);
+    g_free(tab->current_filename);
+    if (tab->pending_edits) {
+        g_bytes_unref(tab->pending_edits);
+    }
+
+    g_ptr_array_remove(tabs->tabs, tab);
+    gtk_notebook_remove_page(notebook, gtk_notebook_page_num(notebook, tab->page));
+    gtk_notebook_set_show_tabs(notebook, tabs->tabs->len > 1);
+    g_free(tab);
+}
+
+// Put the text of document into an empty buffer, which mustn't be
+// connected yet: the document already has the text
+static void tab_fill_buffer(GtkTextBuffer *buffer, PieceTable *document) {
+    PieceSnapshot *snapshot = piece_table_snapshot(document);
+    const Piece *pieces;
+    guint n_pieces;
+    GtkTextIter end;
+
+    pieces = piece_snapshot_get_pieces(snapshot, &n_pieces);
+    for (guint i = 0; i < n_pieces; i++) {
+        gtk_text_buffer_get_end_iter(buffer, &end);
+        gtk_text_buffer_insert(buffer, &end, pieces[i].data, pieces[i].bytes);
+    }
+    piece_snapshot_unref(snapshot);
+}
+
+// Put the document in view away into its tab
+static void tabs_deactivate(Tabs *tabs) {
+    TextEditor *editor = tabs->editor;
+    GtkTextView *view = GTK_TEXT_VIEW(editor->text_view);
+    Tab *tab = tabs->active;
+    gchar *reopen = NULL;
+    GdkRectangle visible;
+    GtkTextIter iter;
+
+    // A save has to finish with the document it was started on
+    file_saver_wait(editor);
+
+    tab->following = editor->follow != NULL;
+    follow_stop(editor);
+
+    // A file still being read, or shown in large-file mode, is opened again
+    // when the tab is next shown
+    if (editor->loader || editor->viewport) {
+        reopen = g_strdup(editor->current_filename);
+        file_loader_cancel(editor);
+        viewport_close(editor);
+    }
+
+    gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &iter,
+                                     gtk_text_buffer_get_insert(editor->text_buffer));
+    tab->cursor = gtk_text_iter_get_offset(&iter);
+    gtk_text_view_get_visible_rect(view, &visible);
+    gtk_text_view_get_line_at_y(view, &iter, visible.y, NULL);
+    tab->top = gtk_text_iter_get_offset(&iter);
+
+    search_switch_document(editor);
+    tab_swap(editor, tab);
+    tab->last_shown = g_get_monotonic_time();
+    tabs->active = NULL;
+
+    if (reopen) {
+        tab_unload(tabs, tab, TRUE);
+        g_free(tab->current_filename);
+        tab->current_filename = reopen;
+        tab_set_label(tab, reopen);
+    }
+}
+
+// Bring the document of tab into view, reading the file or rebuilding the
+// buffer first if needed
+static void tabs_activate(Tabs *tabs, Tab *tab) {
+    TextEditor *editor = tabs->editor;
+    TabState state = tab->state;
+    GtkTextMark *top_mark;
+    GtkTextIter iter;
+
+    // Before the swap, which leaves the tab with the document of the one
+    // that was in view
+    if (state == TAB_EVICTED) {
+        tab_restore_text(tab);
+    }
+
+    tab_swap(editor, tab);
+    tabs->active = tab;
+
+    if (state != TAB_RESIDENT) {
+        editor->text_buffer = gtk_text_buffer_new(NULL);
+        if (state == TAB_EVICTED) {
+            tab_fill_buffer(editor->text_buffer, editor->document);
+            g_assert((gsize)gtk_text_buffer_get_char_count(editor->text_buffer) ==
+                     piece_table_get_char_count(editor->document));
+        } else {
+            editor->document = piece_table_new();
+            editor->lines = line_table_new();
+            undo_init(editor);
+        }
+        editor_connect_buffer(editor, editor->text_buffer);
+        highlight_init(editor);
+        tab->state = TAB_RESIDENT;
+    }
+
+    gtk_text_view_set_buffer(GTK_TEXT_VIEW(editor->text_view), editor->text_buffer);
+
+    if (state == TAB_UNLOADED && editor->current_filename) {
+        // Replaced by the loader's own copy
+        gchar *filename = g_steal_pointer(&editor->current_filename);
+
+        editor_open_file(editor, filename, editor->pending_line ? editor->pending_line - 1 : 0);
+        g_free(filename);
+    } else if (state == TAB_UNLOADED) {
+        session_resume_document(editor);
+    } else {
+        gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &iter, (gint)tab->cursor);
+        gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
+
+        // Scrolled once the view has been laid out for the buffer
+        gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &iter, (gint)tab->top);
+        top_mark = gtk_text_buffer_get_mark(editor->text_buffer, TABS_TOP_MARK);
+        if (top_mark) {
+            gtk_text_buffer_move_mark(editor->text_buffer, top_mark, &iter);
+        } else {
+            top_mark = gtk_text_buffer_create_mark(editor->text_buffer, TABS_TOP_MARK, &iter, TRUE);
+        }
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view), top_mark,
+                                     0.0, TRUE, 0.0, 0.0);
+    }
+
+    editor_update_title(editor);
+    status_update(editor, STATUS_ALL);
+    undo_update_items(editor);
+    highlight_show(editor);
+
+    if (tab->following) {
+        tab->following = FALSE;
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(editor->follow_item), TRUE);
+    }
+    gtk_widget_grab_focus(editor->text_view);
+}
+
+// Evict the tabs shown longest ago until the tabs not in view, evicted
+// ones included, fit the budget. What evicted tabs with changes still take
+// can't be given back, so that may not be reached.
+static void tabs_evict(Tabs *tabs) {
+    gsize total = 0;
+
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (tab != tabs->active && tab->state != TAB_UNLOADED) {
+            total += tab_get_size(tab);
+        }
+    }
+
+    while (total > tabs->budget) {
+        Tab *oldest = NULL;
+        gsize line, column, top_column;
+
+        for (guint i = 0; i < tabs->tabs->len; i++) {
+            Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+            if (tab != tabs->active && tab->state == TAB_RESIDENT &&
+                (!oldest || tab->last_shown < oldest->last_shown)) {
+                oldest = tab;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+
+        total -= tab_get_size(oldest);
+        if (oldest->modified) {
+            // The changes only exist in the document, which is kept
+            tab_drop_buffer(tabs, oldest);
+            total += tab_get_size(oldest);
+        } else {
+            // Same as the file: read it again, at the same place
+            line_table_get_position(oldest->lines, oldest->cursor, &line, &column);
+            oldest->pending_line = line + 1;
+            oldest->pending_column = column;
+            line_table_get_position(oldest->lines, oldest->top, &line, &top_column);
+            oldest->pending_top = line + 1;
+            tab_unload(tabs, oldest, TRUE);
+        }
+    }
+}
+
+// Notebook switch-page callback, run before the notebook shows page
+static void on_switch_page(GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer data) {
+    Tabs *tabs = (Tabs *)data;
+    Tab *tab = tabs_find_page(tabs, page);
+
+    if (!tab || tab == tabs->active) {
+        return;
+    }
+
+    if (tabs->active) {
+        tabs_deactivate(tabs);
+    }
+    tabs_activate(tabs, tab);
+    tabs_evict(tabs);
+}
+
+// Close button of a tab: one without changes can go without being shown
+static void on_tab_close_clicked(GtkWidget *button, gpointer data) {
+    Tab *tab = (Tab *)data;
+    Tabs *tabs = tab->tabs;
+
+    if (tab != tabs->active && !tab->modified) {
+        tab_free(tabs, tab, TRUE);
+        return;
+    }
+
+    tabs_show(tabs, tab);
+    tabs_close_current(tabs->editor);
+}
+
+void tabs_init(TextEditor *editor, GtkWidget *box) {
+    Tabs *tabs = g_new0(Tabs, 1);
+    Tab *tab;
+
+    tabs->editor = editor;
+    tabs->tabs = g_ptr_array_new();
+    tabs->budget = tabs_get_budget();
+
+    tabs->notebook = gtk_notebook_new();
+    gtk_notebook_set_scrollable(GTK_NOTEBOOK(tabs->notebook), TRUE);
+    gtk_notebook_set_show_border(GTK_NOTEBOOK(tabs->notebook), FALSE);
+    gtk_notebook_set_show_tabs(GTK_NOTEBOOK(tabs->notebook), FALSE);
+    gtk_widget_set_can_focus(tabs->notebook, FALSE);
+    g_signal_connect(tabs->notebook, "switch-page", G_CALLBACK(on_switch_page), tabs);
+    gtk_box_pack_start(GTK_BOX(box), tabs->notebook, FALSE, FALSE, 0);
+    editor->tabs = tabs;
+
+    // The editor's document is in view already
+    tab = tab_new(tabs, NULL, 0);
+    tab->state = TAB_RESIDENT;
+    tab->pending_line = 0;
+    tabs->active = tab;
+    tabs_append(tabs, tab);
+}
+
+void tabs_new(TextEditor *editor) {
+    Tab *tab = tab_new(editor->tabs, NULL, 0);
+
+    tabs_append(editor->tabs, tab);
+    tabs_show(editor->tabs, tab);
+}
+
+void tabs_open_file(TextEditor *editor, const gchar *filename, gsize line) {
+    Tabs *tabs = editor->tabs;
+    Tab *tab = tabs_find_file(tabs, filename);
+
+    if (tab) {
+        if (tab->state == TAB_UNLOADED) {
+            tab->pending_line = line + 1;
+        }
+        tabs_show(tabs, tab);
+
+        if (editor->loader) {
+            editor->pending_line = line + 1;
+        } else {
+            editor_goto_line(editor, line);
+        }
+        return;
+    }
+
+    // A new window's empty document is replaced rather than kept in a tab
+    if (!editor->current_filename && !editor->modified && !editor->loader && !editor->viewport &&
+        gtk_text_buffer_get_char_count(editor->text_buffer) == 0) {
+        editor_open_file(editor, filename, line);
+        return;
+    }
+
+    tab = tab_new(tabs, filename, line);
+    tabs_append(tabs, tab);
+    tabs_show(tabs, tab);
+}
+
+void tabs_add_file(TextEditor *editor, const gchar *filename, gsize line) {
+    Tabs *tabs = editor->tabs;
+
+    if (!tabs_find_file(tabs, filename)) {
+        tabs_append(tabs, tab_new(tabs, filename, line));
+    }
+}
+
+void tabs_add_restored(TextEditor *editor, const gchar *filename, gsize line, gsize column,
+                       gsize top_line, GBytes *edits) {
+    Tabs *tabs = editor->tabs;
+    Tab *tab = tab_new(tabs, filename, line);
+
+    tab->pending_column = column;
+    tab->pending_top = top_line + 1;
+    tab->pending_edits = edits ? g_bytes_ref(edits) : NULL;
+    tabs_append(tabs, tab);
+}
+
+void tabs_show_restored(TextEditor *editor, guint n_restored, guint current) {
+    Tabs *tabs = editor->tabs;
+    Tab *unused = NULL;
+    guint index = tabs->tabs->len - n_restored + current;
+
+    if (n_restored > tabs->tabs->len || current >= n_restored) {
+        return;
+    }
+
+    if (!editor->current_filename && !editor->modified && !editor->loader && !editor->viewport &&
+        gtk_text_buffer_get_char_count(editor->text_buffer) == 0) {
+        unused = tabs->active;
+    }
+
+    tabs_show(tabs, g_ptr_array_index(tabs->tabs, index));
+    if (unused && unused != tabs->active) {
+        tab_free(tabs, unused, TRUE);
+    }
+}
+
+// Where the view of the document in view is
+static void tabs_get_view_position(TextEditor *editor, TabInfo *info) {
+    GtkTextView *view = GTK_TEXT_VIEW(editor->text_view);
+    GdkRectangle visible;
+    GtkTextIter iter;
+
+    gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &iter,
+                                     gtk_text_buffer_get_insert(editor->text_buffer));
+    info->line = gtk_text_iter_get_line(&iter);
+    info->column = gtk_text_iter_get_line_offset(&iter);
+    gtk_text_view_get_visible_rect(view, &visible);
+    gtk_text_view_get_line_at_y(view, &iter, visible.y, NULL);
+    info->top_line = gtk_text_iter_get_line(&iter);
+}
+
+void tabs_foreach(TextEditor *editor, TabFunc func, gpointer data) {
+    Tabs *tabs = editor->tabs;
+
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+        TabInfo info = { 0 };
+
+        if (tab == tabs->active) {
+            info.filename = editor->current_filename;
+            info.current = TRUE;
+            info.modified = editor->modified;
+            info.edit_generation = editor->edit_generation;
+            info.pending_edits = editor->pending_edits;
+
+            if (editor->viewport) {
+                info.top_line = viewport_get_top_line(editor);
+                info.line = info.top_line;
+            } else if (editor->loader && editor->pending_line > 0) {
+                // Still to be gone to
+                info.line = editor->pending_line - 1;
+                info.column = editor->pending_column;
+                info.top_line = editor->pending_top > 0 ? editor->pending_top - 1 : info.line;
+            } else {
+                tabs_get_view_position(editor, &info);
+                info.document = editor->loader ? NULL : editor->document;
+            }
+        } else {
+            info.filename = tab->current_filename;
+            info.modified = tab->modified;
+            info.edit_generation = tab->edit_generation;
+            info.pending_edits = tab->pending_edits;
+
+            if (tab->state == TAB_UNLOADED) {
+                info.line = tab->pending_line > 0 ? tab->pending_line - 1 : 0;
+                info.column = tab->pending_column;
+                info.top_line = tab->pending_top > 0 ? tab->pending_top - 1 : info.line;
+            } else {
+                gsize top_column;
+
+                // An evicted document can't be read; its journal has the edits
+                info.document = tab->state == TAB_RESIDENT ? tab->document : NULL;
+                line_table_get_position(tab->lines, tab->cursor, &info.line, &info.column);
+                line_table_get_position(tab->lines, tab->top, &info.top_line, &top_column);
+            }
+        }
+
+        // Follow mode dropped the start of the file: the file is read whole
+        // next time, so the position is in it and there are no edits to it
+        if ((tab == tabs->active ? editor->follow_dropped : tab->follow_dropped) > 0) {
+            gsize dropped_lines = tab == tabs->active ? editor->follow_dropped_lines
+                                                      : tab->follow_dropped_lines;
+
+            info.line += dropped_lines;
+            info.top_line += dropped_lines;
+            info.modified = FALSE;
+            info.document = NULL;
+        }
+
+        func(editor, &info, data);
+    }
+}
+
+void tabs_close_current(TextEditor *editor) {
+    Tabs *tabs = editor->tabs;
+    Tab *tab = tabs->active;
+    guint index;
+
+    if (editor->modified && !editor_prompt_save_changes(editor)) {
+        return;
+    }
+
+    // Stopped while the document is still in view. The changes were saved
+    // or deliberately discarded, so the journal goes.
+    file_saver_wait(editor);
+    file_loader_cancel(editor);
+    viewport_close(editor);
+    follow_stop(editor);
+    journal_close(editor, TRUE);
+
+    // The last tab is replaced by an untitled one
+    if (tabs->tabs->len == 1) {
+        tabs_new(editor);
+    } else {
+        g_ptr_array_find(tabs->tabs, tab, &index);
+        tabs_show(tabs, g_ptr_array_index(tabs->tabs, index + 1 < tabs->tabs->len ? index + 1 : index - 1));
+    }
+
+    tab_free(tabs, tab, TRUE);
+}
+
+gboolean tabs_prompt_save_all(TextEditor *editor) {
+    Tabs *tabs = editor->tabs;
+
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (!tab_is_modified(tab)) {
+            continue;
+        }
+
+        tabs_show(tabs, tab);
+        if (!editor_prompt_save_changes(editor)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void tabs_discard_journals(TextEditor *editor) {
+    Tabs *tabs = editor->tabs;
+
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (tab == tabs->active) {
+            journal_close(editor, TRUE);
+        } else if (tab->journal) {
+            tab_swap(editor, tab);
+            journal_close(editor, TRUE);
+            tab_swap(editor, tab);
+        }
+    }
+}
+
+void tabs_update_label(TextEditor *editor) {
+    Tabs *tabs = editor->tabs;
+
+    if (tabs && tabs->active) {
+        tab_set_label(tabs->active, editor->current_filename);
+    }
+}
+
+void tabs_cleanup(TextEditor *editor) {
+    Tabs *tabs = editor->tabs;
+
+    if (!tabs) {
+        return;
+    }
+
+    // Pages are removed when the window goes, which mustn't switch tabs
+    g_signal_handlers_disconnect_by_data(tabs->notebook, tabs);
+
+    for (guint i = 0; i < tabs->tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs->tabs, i);
+
+        if (tab != tabs->active) {
+            tab_unload(tabs, tab, FALSE);
+            if (tab->pending_edits) {
+                g_bytes_unref(tab->pending_edits);
+            }
+        }
+        g_free(tab->current_filename);
+        g_free(tab);
+    }
+
+    g_ptr_array_free(tabs->tabs, TRUE);
+    g_free(tabs);
+    editor->tabs = NULL;
+}
@@ -0,0 +1,96 @@
+/*
+ * Tabs
+ *
+ * Every open document has a tab. There is one text view, and the editor's
+ * per-document fields (buffer, piece table, line table, file name, journal,
+ * undo history, highlighting, ...) always describe the tab in view;
+ * switching tabs swaps them with those kept in the tab being left, and
+ * gives the view the other tab's buffer. Anything running in the
+ * background on the document in view (a save, a load, follow mode) is
+ * finished or stopped first.
+ *
+ * A tab holds its document in one of three forms. A tab added for a file
+ * (from a session, say) only knows the file name until it is first shown,
+ * when the file is read. Tabs that have been shown keep their buffer, so
+ * going back to one is instant, until the buffers of the tabs not in view
+ * add up to more than a memory budget. The tabs shown longest ago are then
+ * evicted: one without changes is forgotten and read from its file again
+ * when next shown, one with changes keeps only its piece table, which
+ * references the file mapping, with the text not in the mapping
+ * compressed and the texts of its history in the undo spill file; the
+ * buffer is rebuilt from it. Evicted tabs count against the budget too.
+ * Opening many files therefore costs the memory of the few tabs actually
+ * looked at.
+ */
+
+#ifndef TABS_H
+#define TABS_H
+
+#include "editor.h"
+
+// Bytes of memory kept for the tabs not in view. Can be overridden with
+// the TEXT_EDITOR_TAB_BUDGET environment variable.
+#define TABS_DEFAULT_BUDGET (128 * 1024 * 1024)
+
+// What the session keeps of a tab (see session.h)
+typedef struct {
+    const gchar *filename;      // NULL for an untitled document
+    gboolean current;           // In view
+    gboolean modified;
+    guint64 edit_generation;
+    PieceTable *document;       // NULL until the file has been read, and while
+                                // evicted (the journal has the edits then)
+    GBytes *pending_edits;      // Edits of the last session not put back yet
+    gsize line;                 // Cursor line and column, from 0
+    gsize column;
+    gsize top_line;             // Line at the top of the view
+} TabInfo;
+
+typedef void (*TabFunc)(TextEditor *editor, const TabInfo *info, gpointer data);
+
+// Create the tab strip and pack it into box, with a tab for the document
+// the editor starts with
+void tabs_init(TextEditor *editor, GtkWidget *box);
+
+// Show an untitled document in a new tab
+void tabs_new(TextEditor *editor);
+
+// Show filename with the cursor on line (from 0): in the tab it is open in
+// already, in place of an unused untitled document, or in a new tab
+void tabs_open_file(TextEditor *editor, const gchar *filename, gsize line);
+
+// Add a tab for filename without reading it; that is done when the tab is
+// first shown
+void tabs_add_file(TextEditor *editor, const gchar *filename, gsize line);
+
+// Add a tab for filename (NULL for an untitled document) without reading
+// it. When first shown it goes to line and column with top_line at the top
+// of the view, and edits (if not NULL) are put back.
+void tabs_add_restored(TextEditor *editor, const gchar *filename, gsize line, gsize column,
+                       gsize top_line, GBytes *edits);
+
+// Show the current-th of the last n_restored tabs, once they have been
+// added. The untitled document a new window starts with goes if unused.
+void tabs_show_restored(TextEditor *editor, guint n_restored, guint current);
+
+// Call func for every tab, in order
+void tabs_foreach(TextEditor *editor, TabFunc func, gpointer data);
+
+// Close the tab in view, after asking to save its changes
+void tabs_close_current(TextEditor *editor);
+
+// Ask to save the changes of every tab that has any, showing each in turn.
+// Returns FALSE if the user cancelled.
+gboolean tabs_prompt_save_all(TextEditor *editor);
+
+// Delete the journals of all tabs, once their changes have been saved or
+// deliberately discarded
+void tabs_discard_journals(TextEditor *editor);
+
+// The file name of the document in view changed
+void tabs_update_label(TextEditor *editor);
+
+// Release the documents of the tabs not in view, leaving their journals
+void tabs_cleanup(TextEditor *editor);
+
+#endif // TABS_H
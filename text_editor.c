@@ -20,16 +20,24 @@
 #include <string.h>
 #include <signal.h>
 
-// Global application structure
-typedef struct {
-    GtkWidget *window;
-    GtkWidget *text_view;
-    GtkTextBuffer *text_buffer;
-    GtkWidget *scrolled_window;
-    gchar *current_filename;
-    gboolean modified;
-    GtkCssProvider *css_provider;
-} TextEditor;
+#include "editor.h"
+#include "loader.h"
+#include "saver.h"
+#include "journal.h"
+#include "viewport.h"
+#include "follow.h"
+#include "search.h"
+#include "find_files.h"
+#include "stats.h"
+#include "status.h"
+#include "undo.h"
+#include "highlight.h"
+#include "tabs.h"
+#include "trace.h"
+#include "timings.h"
+#include "startup.h"
+#include "session.h"
+#include "gutter.h"
 
 // Global pointer for signal handling
 static TextEditor *global_editor = NULL;
@@ -38,44 +46,104 @@ static TextEditor *global_editor = NULL;
 static void activate(GtkApplication *app, gpointer user_data);
 static void setup_ui(TextEditor *editor, GtkApplication *app);
 static void setup_menu_bar(TextEditor *editor, GtkWidget *vbox);
+static void on_menu_select(GtkMenuItem *item, gpointer data);
+static void fill_menus(TextEditor *editor);
+static gboolean on_first_frame(gpointer data);
+static void on_open(GApplication *app, GFile **files, gint n_files, const gchar *hint,
+                    gpointer user_data);
+static void on_startup(GApplication *app, gpointer user_data);
 static void on_new_file(GtkWidget *widget, gpointer data);
 static void on_open_file(GtkWidget *widget, gpointer data);
 static void on_save_file(GtkWidget *widget, gpointer data);
 static void on_save_as_file(GtkWidget *widget, gpointer data);
+static void on_close_tab(GtkWidget *widget, gpointer data);
 static void on_quit(GtkWidget *widget, gpointer data);
 static void on_font_selection(GtkWidget *widget, gpointer data);
 static void on_about(GtkWidget *widget, gpointer data);
+static void on_find(GtkWidget *widget, gpointer data);
+static void on_replace(GtkWidget *widget, gpointer data);
+static void on_find_in_files(GtkWidget *widget, gpointer data);
+static void on_word_count(GtkWidget *widget, gpointer data);
+static void on_undo(GtkWidget *widget, gpointer data);
+static void on_redo(GtkWidget *widget, gpointer data);
+static void on_goto_line(GtkWidget *widget, gpointer data);
+static void on_toggle_follow(GtkCheckMenuItem *item, gpointer data);
+static void on_toggle_trace(GtkCheckMenuItem *item, gpointer data);
+static void on_toggle_line_numbers(GtkCheckMenuItem *item, gpointer data);
+static void on_toggle_change_markers(GtkCheckMenuItem *item, gpointer data);
+static void on_toggle_match_markers(GtkCheckMenuItem *item, gpointer data);
+static void on_trace_timings(GtkWidget *widget, gpointer data);
 static void on_text_changed(GtkTextBuffer *buffer, gpointer data);
+static void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer data);
+static void on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start,
+                            GtkTextIter *end, gpointer data);
+static void on_cancel_operation(GtkWidget *widget, gpointer data);
 static gboolean on_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data);
 static void apply_css_styling(TextEditor *editor);
 static void cleanup_editor(TextEditor *editor);
 static void signal_handler(int signum);
 static gboolean save_file_internal(TextEditor *editor, const gchar *filename);
-static gboolean prompt_save_changes(TextEditor *editor);
+static void create_status_bar(TextEditor *editor, GtkWidget *vbox);
 
 // Main function
 int main(int argc, char *argv[]) {
     GtkApplication *app;
+    const gchar *trace_filename;
+    GError *error = NULL;
     int status;
 
+    startup_init();
+    file_saver_init();
+
+    // Trace from the very start if TEXT_EDITOR_TRACE asks for it
+    trace_filename = trace_init();
+
     // Set up signal handlers for clean exit
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    // Create GTK application
-    app = gtk_application_new("com.texteditor.advanced", G_APPLICATION_FLAGS_NONE);
+    // Create GTK application; files on the command line come to on_open.
+    // The application is unique on the session bus: when it is running
+    // already, this instance sends it the files over D-Bus and exits,
+    // without initializing GTK.
+    app = gtk_application_new("com.texteditor.advanced", G_APPLICATION_HANDLES_OPEN);
+    startup_add_options(G_APPLICATION(app));
+    g_signal_connect(app, "startup", G_CALLBACK(on_startup), NULL);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+    g_signal_connect(app, "open", G_CALLBACK(on_open), NULL);
     
     status = g_application_run(G_APPLICATION(app), argc, argv);
+
+    if (g_application_get_is_registered(G_APPLICATION(app)) &&
+        g_application_get_is_remote(G_APPLICATION(app))) {
+        startup_forwarded();
+    }
     
     g_object_unref(app);
+
+    if (trace_filename && !trace_write_json(trace_filename, &error)) {
+        g_warning("Failed to write trace to %s: %s", trace_filename, error->message);
+        g_error_free(error);
+    }
     return status;
 }
 
+// Application startup callback: GTK is initialized
+static void on_startup(GApplication *app, gpointer user_data) {
+    startup_mark("gtk-init");
+}
+
 // Application activation callback
 static void activate(GtkApplication *app, gpointer user_data) {
     TextEditor *editor;
 
+    // There is one window, whichever way the editor is started again
+    if (global_editor) {
+        gtk_window_present(GTK_WINDOW(global_editor->window));
+        return;
+    }
+
     // Allocate memory for editor structure
     editor = (TextEditor *)calloc(1, sizeof(TextEditor));
     if (!editor) {
@@ -86,20 +154,66 @@ static void activate(GtkApplication *app, gpointer user_data) {
     global_editor = editor;
     editor->current_filename = NULL;
     editor->modified = FALSE;
+    editor->document = piece_table_new();
+    editor->lines = line_table_new();
 
     // Set up the UI
     setup_ui(editor, app);
+    startup_mark("ui");
 
     // Apply CSS styling
     apply_css_styling(editor);
+    startup_mark("css");
 
     // Show the window
     gtk_widget_show_all(editor->window);
+    startup_mark("show");
+    startup_watch(editor, on_first_frame);
+
+    // Bring back the documents of the last session, or offer to recover
+    // edits left over from a crash. This decides what the first tab shows,
+    // so it isn't put off like the menus.
+    if (!session_restore(editor)) {
+        journal_recover_session(editor);
+    }
+    startup_mark("recover");
+}
+
+// Files given on the command line, of this instance or of a later one that
+// forwarded them. The first is shown, read by the loader; the others are
+// read when their tab is. A file open already just has its tab shown.
+static void on_open(GApplication *app, GFile **files, gint n_files, const gchar *hint,
+                    gpointer user_data) {
+    TextEditor *editor;
+    gboolean shown = FALSE;
+
+    activate(GTK_APPLICATION(app), NULL);
+    editor = global_editor;
+    if (!editor) {
+        return;
+    }
+
+    for (gint i = 0; i < n_files; i++) {
+        gchar *filename = g_file_get_path(files[i]);
+
+        if (!filename) {
+            continue;
+        }
+        if (!shown) {
+            tabs_open_file(editor, filename, 0);
+            shown = TRUE;
+        } else {
+            tabs_add_file(editor, filename, 0);
+        }
+        g_free(filename);
+    }
+    startup_mark("open");
 }
 
 // Set up the user interface
 static void setup_ui(TextEditor *editor, GtkApplication *app) {
     GtkWidget *vbox;
+    GtkWidget *hbox;
 
     // Create main window
     editor->window = gtk_application_window_new(app);
@@ -114,42 +228,121 @@ static void setup_ui(TextEditor *editor, GtkApplication *app) {
     // Set up menu bar
     setup_menu_bar(editor, vbox);
 
+    // Tab strip over the text, shown once there are two documents
+    tabs_init(editor, vbox);
+
     // Create scrolled window for text view
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), hbox, TRUE, TRUE, 0);
+
     editor->scrolled_window = gtk_scrolled_window_new(NULL, NULL);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(editor->scrolled_window),
                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-    gtk_box_pack_start(GTK_BOX(vbox), editor->scrolled_window, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), editor->scrolled_window, TRUE, TRUE, 0);
+
+    // Scrollbar over the whole file, only shown in large-file mode
+    editor->viewport_scrollbar = gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, NULL);
+    gtk_widget_set_no_show_all(editor->viewport_scrollbar, TRUE);
+    gtk_box_pack_start(GTK_BOX(hbox), editor->viewport_scrollbar, FALSE, FALSE, 0);
 
     // Create text view and buffer
     editor->text_buffer = gtk_text_buffer_new(NULL);
     editor->text_view = gtk_text_view_new_with_buffer(editor->text_buffer);
     gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(editor->text_view), GTK_WRAP_WORD_CHAR);
     gtk_widget_set_name(editor->text_view, "text-view");
-    
-    // Connect text changed signal
-    g_signal_connect(editor->text_buffer, "changed", G_CALLBACK(on_text_changed), editor);
+    undo_init(editor);
 
     // Add text view to scrolled window
     gtk_container_add(GTK_CONTAINER(editor->scrolled_window), editor->text_view);
+    highlight_init(editor);
+
+    // Line numbers in the view's left border
+    gutter_init(editor);
+
+    // Search bar under the text, hidden until Edit > Find
+    search_init(editor, vbox);
+
+    // Set up status bar
+    create_status_bar(editor, vbox);
+
+    // Once the modules connecting to it are set up
+    editor_connect_buffer(editor, editor->text_buffer);
+
+    // Frame phases and text drawing, for tracing
+    timings_init(editor);
+}
+
+// Create status bar with a progress indicator for background loads and saves
+static void create_status_bar(TextEditor *editor, GtkWidget *vbox) {
+    editor->status_bar = gtk_statusbar_new();
+    editor->status_context_id = gtk_statusbar_get_context_id(
+        GTK_STATUSBAR(editor->status_bar), "editor-status");
+
+    editor->cancel_button = gtk_button_new_with_label("Cancel");
+    g_signal_connect(editor->cancel_button, "clicked", G_CALLBACK(on_cancel_operation), editor);
+    gtk_widget_set_no_show_all(editor->cancel_button, TRUE);
+    gtk_box_pack_end(GTK_BOX(editor->status_bar), editor->cancel_button, FALSE, FALSE, 0);
+
+    editor->progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(editor->progress_bar), TRUE);
+    gtk_widget_set_valign(editor->progress_bar, GTK_ALIGN_CENTER);
+    gtk_widget_set_no_show_all(editor->progress_bar, TRUE);
+    gtk_box_pack_end(GTK_BOX(editor->status_bar), editor->progress_bar, FALSE, FALSE, 0);
+
+    status_init(editor);
+
+    gtk_box_pack_end(GTK_BOX(vbox), editor->status_bar, FALSE, FALSE, 0);
 }
 
-// Set up the menu bar
+// Set up the menu bar. Only the titles are there at first: the menus are
+// filled in by fill_menus() once the first frame is up, or when one is
+// opened before that.
 static void setup_menu_bar(TextEditor *editor, GtkWidget *vbox) {
-    GtkWidget *menu_bar;
-    GtkWidget *file_menu, *edit_menu, *view_menu, *help_menu;
-    GtkWidget *file_item, *edit_item, *view_item, *help_item;
-    GtkWidget *new_item, *open_item, *save_item, *save_as_item, *quit_item;
-    GtkWidget *font_item, *about_item;
+    static const gchar *titles[] = { "_File", "_Edit", "_View", "_Help" };
 
     // Create menu bar
-    menu_bar = gtk_menu_bar_new();
-    gtk_box_pack_start(GTK_BOX(vbox), menu_bar, FALSE, FALSE, 0);
+    editor->menu_bar = gtk_menu_bar_new();
+    gtk_box_pack_start(GTK_BOX(vbox), editor->menu_bar, FALSE, FALSE, 0);
+
+    editor->accel_group = gtk_accel_group_new();
+    gtk_window_add_accel_group(GTK_WINDOW(editor->window), editor->accel_group);
+
+    for (guint i = 0; i < G_N_ELEMENTS(titles); i++) {
+        GtkWidget *item = gtk_menu_item_new_with_mnemonic(titles[i]);
+
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), gtk_menu_new());
+        g_signal_connect(item, "select", G_CALLBACK(on_menu_select), editor);
+        gtk_menu_shell_append(GTK_MENU_SHELL(editor->menu_bar), item);
+    }
+}
+
+// A menu is opened (or its mnemonic pressed)
+static void on_menu_select(GtkMenuItem *item, gpointer data) {
+    fill_menus((TextEditor *)data);
+}
+
+// Fill in the menus, unless that is done already
+static void fill_menus(TextEditor *editor) {
+    GtkWidget *file_menu, *edit_menu, *view_menu, *help_menu;
+    GtkWidget *new_item, *open_item, *save_item, *save_as_item, *close_tab_item, *quit_item;
+    GtkWidget *find_item, *replace_item, *find_files_item, *goto_line_item, *font_item;
+    GtkWidget *word_count_item, *trace_item, *timings_item, *about_item;
+    GtkWidget *line_numbers_item, *change_markers_item, *match_markers_item;
+    GtkAccelGroup *accel_group = editor->accel_group;
+    GList *titles;
+
+    if (editor->undo_item) {
+        return;
+    }
+
+    titles = gtk_container_get_children(GTK_CONTAINER(editor->menu_bar));
+    file_menu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(g_list_nth_data(titles, 0)));
+    edit_menu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(g_list_nth_data(titles, 1)));
+    view_menu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(g_list_nth_data(titles, 2)));
+    help_menu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(g_list_nth_data(titles, 3)));
+    g_list_free(titles);
 
     // File menu
-    file_menu = gtk_menu_new();
-    file_item = gtk_menu_item_new_with_mnemonic("_File");
-    gtk_menu_item_set_submenu(GTK_MENU_ITEM(file_item), file_menu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), file_item);
 
     new_item = gtk_menu_item_new_with_mnemonic("_New");
     g_signal_connect(new_item, "activate", G_CALLBACK(on_new_file), editor);
@@ -169,54 +362,118 @@ static void setup_menu_bar(TextEditor *editor, GtkWidget *vbox) {
 
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), gtk_separator_menu_item_new());
 
+    close_tab_item = gtk_menu_item_new_with_mnemonic("_Close Tab");
+    g_signal_connect(close_tab_item, "activate", G_CALLBACK(on_close_tab), editor);
+    gtk_widget_add_accelerator(close_tab_item, "activate", accel_group, GDK_KEY_w,
+                               GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), close_tab_item);
+
     quit_item = gtk_menu_item_new_with_mnemonic("_Quit");
     g_signal_connect(quit_item, "activate", G_CALLBACK(on_quit), editor);
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), quit_item);
 
     // Edit menu
-    edit_menu = gtk_menu_new();
-    edit_item = gtk_menu_item_new_with_mnemonic("_Edit");
-    gtk_menu_item_set_submenu(GTK_MENU_ITEM(edit_item), edit_menu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), edit_item);
+
+    editor->undo_item = gtk_menu_item_new_with_mnemonic("_Undo");
+    g_signal_connect(editor->undo_item, "activate", G_CALLBACK(on_undo), editor);
+    gtk_widget_add_accelerator(editor->undo_item, "activate", accel_group, GDK_KEY_z,
+                               GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), editor->undo_item);
+
+    editor->redo_item = gtk_menu_item_new_with_mnemonic("_Redo");
+    g_signal_connect(editor->redo_item, "activate", G_CALLBACK(on_redo), editor);
+    gtk_widget_add_accelerator(editor->redo_item, "activate", accel_group, GDK_KEY_z,
+                               GDK_CONTROL_MASK | GDK_SHIFT_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), editor->redo_item);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), gtk_separator_menu_item_new());
+
+    find_item = gtk_menu_item_new_with_mnemonic("_Find...");
+    g_signal_connect(find_item, "activate", G_CALLBACK(on_find), editor);
+    gtk_widget_add_accelerator(find_item, "activate", accel_group, GDK_KEY_f,
+                               GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), find_item);
+
+    replace_item = gtk_menu_item_new_with_mnemonic("_Replace...");
+    g_signal_connect(replace_item, "activate", G_CALLBACK(on_replace), editor);
+    gtk_widget_add_accelerator(replace_item, "activate", accel_group, GDK_KEY_h,
+                               GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), replace_item);
+
+    find_files_item = gtk_menu_item_new_with_mnemonic("Find in F_iles...");
+    g_signal_connect(find_files_item, "activate", G_CALLBACK(on_find_in_files), editor);
+    gtk_widget_add_accelerator(find_files_item, "activate", accel_group, GDK_KEY_f,
+                               GDK_CONTROL_MASK | GDK_SHIFT_MASK, GTK_ACCEL_VISIBLE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), find_files_item);
+
+    goto_line_item = gtk_menu_item_new_with_mnemonic("Go to _Line...");
+    g_signal_connect(goto_line_item, "activate", G_CALLBACK(on_goto_line), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(edit_menu), goto_line_item);
 
     // View menu
-    view_menu = gtk_menu_new();
-    view_item = gtk_menu_item_new_with_mnemonic("_View");
-    gtk_menu_item_set_submenu(GTK_MENU_ITEM(view_item), view_menu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), view_item);
 
     font_item = gtk_menu_item_new_with_mnemonic("Select _Font");
     g_signal_connect(font_item, "activate", G_CALLBACK(on_font_selection), editor);
     gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), font_item);
 
-    // Help menu
-    help_menu = gtk_menu_new();
-    help_item = gtk_menu_item_new_with_mnemonic("_Help");
-    gtk_menu_item_set_submenu(GTK_MENU_ITEM(help_item), help_menu);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu_bar), help_item);
+    editor->follow_item = gtk_check_menu_item_new_with_mnemonic("_Follow File");
+    g_signal_connect(editor->follow_item, "toggled", G_CALLBACK(on_toggle_follow), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), editor->follow_item);
+
+    word_count_item = gtk_menu_item_new_with_mnemonic("_Word Count");
+    g_signal_connect(word_count_item, "activate", G_CALLBACK(on_word_count), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), word_count_item);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), gtk_separator_menu_item_new());
+
+    line_numbers_item = gtk_check_menu_item_new_with_mnemonic("_Line Numbers");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(line_numbers_item),
+                                   gutter_get_shown(editor, GUTTER_LINE_NUMBERS));
+    g_signal_connect(line_numbers_item, "toggled", G_CALLBACK(on_toggle_line_numbers), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), line_numbers_item);
+
+    change_markers_item = gtk_check_menu_item_new_with_mnemonic("Mark _Changed Lines");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(change_markers_item),
+                                   gutter_get_shown(editor, GUTTER_CHANGES));
+    g_signal_connect(change_markers_item, "toggled", G_CALLBACK(on_toggle_change_markers), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), change_markers_item);
 
+    match_markers_item = gtk_check_menu_item_new_with_mnemonic("Mark _Search Matches");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(match_markers_item),
+                                   gutter_get_shown(editor, GUTTER_MATCHES));
+    g_signal_connect(match_markers_item, "toggled", G_CALLBACK(on_toggle_match_markers), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), match_markers_item);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), gtk_separator_menu_item_new());
+
+    trace_item = gtk_check_menu_item_new_with_mnemonic("Record _Trace");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(trace_item), trace_is_enabled());
+    g_signal_connect(trace_item, "toggled", G_CALLBACK(on_toggle_trace), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), trace_item);
+
+    timings_item = gtk_menu_item_new_with_mnemonic("Trace T_imings");
+    g_signal_connect(timings_item, "activate", G_CALLBACK(on_trace_timings), editor);
+    gtk_menu_shell_append(GTK_MENU_SHELL(view_menu), timings_item);
+
+    // Help menu
     about_item = gtk_menu_item_new_with_mnemonic("_About");
     g_signal_connect(about_item, "activate", G_CALLBACK(on_about), editor);
     gtk_menu_shell_append(GTK_MENU_SHELL(help_menu), about_item);
-}
 
-// New file callback
-static void on_new_file(GtkWidget *widget, gpointer data) {
-    TextEditor *editor = (TextEditor *)data;
+    gtk_widget_show_all(editor->menu_bar);
+    undo_update_items(editor);
+    startup_mark("menus");
+}
 
-    if (editor->modified && !prompt_save_changes(editor)) {
-        return;
-    }
+// Idle callback once the first frame is on screen: what startup put off
+static gboolean on_first_frame(gpointer data) {
+    fill_menus((TextEditor *)data);
+    return G_SOURCE_REMOVE;
+}
 
-    gtk_text_buffer_set_text(editor->text_buffer, "", -1);
-    
-    if (editor->current_filename) {
-        g_free(editor->current_filename);
-        editor->current_filename = NULL;
-    }
-    
-    editor->modified = FALSE;
-    gtk_window_set_title(GTK_WINDOW(editor->window), "Advanced Text Editor - Untitled");
+// New file callback: an untitled document in a new tab
+static void on_new_file(GtkWidget *widget, gpointer data) {
+    tabs_new((TextEditor *)data);
 }
 
 // Open file callback
@@ -226,66 +483,26 @@ static void on_open_file(GtkWidget *widget, gpointer data) {
     GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
     gint res;
 
-    if (editor->modified && !prompt_save_changes(editor)) {
-        return;
-    }
-
     dialog = gtk_file_chooser_dialog_new("Open File",
                                         GTK_WINDOW(editor->window),
                                         action,
                                         "_Cancel", GTK_RESPONSE_CANCEL,
                                         "_Open", GTK_RESPONSE_ACCEPT,
                                         NULL);
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
 
     res = gtk_dialog_run(GTK_DIALOG(dialog));
     
     if (res == GTK_RESPONSE_ACCEPT) {
-        gchar *filename;
-        FILE *file;
-        gchar *content;
-        long file_size;
+        GSList *filenames = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog));
 
-        filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-        
-        file = fopen(filename, "r");
-        if (file) {
-            // Get file size
-            fseek(file, 0, SEEK_END);
-            file_size = ftell(file);
-            fseek(file, 0, SEEK_SET);
-
-            // Allocate memory and read file
-            content = (gchar *)malloc(file_size + 1);
-            if (content) {
-                fread(content, 1, file_size, file);
-                content[file_size] = '\0';
-
-                gtk_text_buffer_set_text(editor->text_buffer, content, -1);
-                free(content);
-
-                if (editor->current_filename) {
-                    g_free(editor->current_filename);
-                }
-                editor->current_filename = g_strdup(filename);
-                editor->modified = FALSE;
-
-                gchar *title = g_strdup_printf("Advanced Text Editor - %s", 
-                                              g_path_get_basename(filename));
-                gtk_window_set_title(GTK_WINDOW(editor->window), title);
-                g_free(title);
-            }
-            fclose(file);
-        } else {
-            GtkWidget *error_dialog = gtk_message_dialog_new(GTK_WINDOW(editor->window),
-                                                             GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                             GTK_MESSAGE_ERROR,
-                                                             GTK_BUTTONS_CLOSE,
-                                                             "Failed to open file: %s", filename);
-            gtk_dialog_run(GTK_DIALOG(error_dialog));
-            gtk_widget_destroy(error_dialog);
+        // The first file is shown, the others are read when their tab is
+        gtk_widget_hide(dialog);
+        tabs_open_file(editor, filenames->data, 0);
+        for (GSList *l = filenames->next; l; l = l->next) {
+            tabs_add_file(editor, l->data, 0);
         }
-        
-        g_free(filename);
+        g_slist_free_full(filenames, g_free);
     }
 
     gtk_widget_destroy(dialog);
@@ -295,6 +512,22 @@ static void on_open_file(GtkWidget *widget, gpointer data) {
 static void on_save_file(GtkWidget *widget, gpointer data) {
     TextEditor *editor = (TextEditor *)data;
 
+    if (editor->loader) {
+        editor_set_status(editor, "Cannot save while the file is still loading");
+        return;
+    }
+
+    if (editor->viewport) {
+        editor_set_status(editor, "Large files are opened read-only");
+        return;
+    }
+
+    // Would overwrite the file being followed with what is left of it
+    if (editor->follow) {
+        editor_set_status(editor, "Stop following the file before saving it");
+        return;
+    }
+
     if (editor->current_filename) {
         save_file_internal(editor, editor->current_filename);
     } else {
@@ -309,6 +542,16 @@ static void on_save_as_file(GtkWidget *widget, gpointer data) {
     GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_SAVE;
     gint res;
 
+    if (editor->loader) {
+        editor_set_status(editor, "Cannot save while the file is still loading");
+        return;
+    }
+
+    if (editor->viewport) {
+        editor_set_status(editor, "Large files are opened read-only");
+        return;
+    }
+
     dialog = gtk_file_chooser_dialog_new("Save File",
                                         GTK_WINDOW(editor->window),
                                         action,
@@ -327,17 +570,8 @@ static void on_save_as_file(GtkWidget *widget, gpointer data) {
     if (res == GTK_RESPONSE_ACCEPT) {
         gchar *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
         
-        if (save_file_internal(editor, filename)) {
-            if (editor->current_filename) {
-                g_free(editor->current_filename);
-            }
-            editor->current_filename = g_strdup(filename);
-            
-            gchar *title = g_strdup_printf("Advanced Text Editor - %s", 
-                                          g_path_get_basename(filename));
-            gtk_window_set_title(GTK_WINDOW(editor->window), title);
-            g_free(title);
-        }
+        // The filename and title are updated once the save succeeds
+        save_file_internal(editor, filename);
         
         g_free(filename);
     }
@@ -346,45 +580,42 @@ static void on_save_as_file(GtkWidget *widget, gpointer data) {
 }
 
 // Internal save file function
+//
+// Starts a background save; see saver.c. Returns FALSE if it couldn't start.
 static gboolean save_file_internal(TextEditor *editor, const gchar *filename) {
-    FILE *file;
-    GtkTextIter start, end;
-    gchar *text;
-    gboolean success = FALSE;
-
-    file = fopen(filename, "w");
-    if (file) {
-        gtk_text_buffer_get_bounds(editor->text_buffer, &start, &end);
-        text = gtk_text_buffer_get_text(editor->text_buffer, &start, &end, FALSE);
-        
-        if (fputs(text, file) != EOF) {
-            success = TRUE;
-            editor->modified = FALSE;
-        }
-        
-        g_free(text);
-        fclose(file);
-    } else {
-        GtkWidget *error_dialog = gtk_message_dialog_new(GTK_WINDOW(editor->window),
-                                                         GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                         GTK_MESSAGE_ERROR,
-                                                         GTK_BUTTONS_CLOSE,
-                                                         "Failed to save file: %s", filename);
-        gtk_dialog_run(GTK_DIALOG(error_dialog));
-        gtk_widget_destroy(error_dialog);
+    TRACE_SCOPE("save.start");
+
+    if (editor->saver) {
+        editor_set_status(editor, "A save is already in progress");
+        return FALSE;
     }
 
-    return success;
+    // Follow mode dropped the start of the file from the buffer
+    if (editor->follow_dropped > 0 && g_strcmp0(filename, editor->current_filename) == 0) {
+        editor_show_error(editor, "Only the end of %s is open, so saving would lose the rest.\n"
+                          "Save it under another name.", filename);
+        return FALSE;
+    }
+
+    file_saver_start(editor, filename);
+    return TRUE;
+}
+
+// Close Tab callback
+static void on_close_tab(GtkWidget *widget, gpointer data) {
+    tabs_close_current((TextEditor *)data);
 }
 
 // Quit callback
 static void on_quit(GtkWidget *widget, gpointer data) {
     TextEditor *editor = (TextEditor *)data;
 
-    if (editor->modified && !prompt_save_changes(editor)) {
+    if (!tabs_prompt_save_all(editor)) {
         return;
     }
 
+    session_save(editor, FALSE);
+    tabs_discard_journals(editor);
     cleanup_editor(editor);
     gtk_main_quit();
 }
@@ -438,26 +669,225 @@ static void on_about(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(dialog);
 }
 
+// Find callback: open the search bar
+static void on_find(GtkWidget *widget, gpointer data) {
+    search_show((TextEditor *)data);
+}
+
+// Replace callback: open the search bar with its replace row
+static void on_replace(GtkWidget *widget, gpointer data) {
+    search_show_replace((TextEditor *)data);
+}
+
+// Find in Files callback: open the Find in Files window
+static void on_find_in_files(GtkWidget *widget, gpointer data) {
+    find_files_show((TextEditor *)data);
+}
+
+// Undo callback
+static void on_undo(GtkWidget *widget, gpointer data) {
+    undo_undo((TextEditor *)data);
+}
+
+// Redo callback
+static void on_redo(GtkWidget *widget, gpointer data) {
+    undo_redo((TextEditor *)data);
+}
+
+// Word Count callback: show the document statistics
+static void on_word_count(GtkWidget *widget, gpointer data) {
+    stats_show((TextEditor *)data);
+}
+
+// Go to line callback
+static void on_goto_line(GtkWidget *widget, gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+    GtkWidget *dialog, *content_area, *hbox, *label, *spin_button;
+    gsize n_lines;
+
+    if (editor->loader) {
+        return;
+    }
+
+    n_lines = editor->viewport ? viewport_get_line_count(editor)
+                               : line_table_get_line_count(editor->lines);
+
+    dialog = gtk_dialog_new_with_buttons("Go to Line",
+                                         GTK_WINDOW(editor->window),
+                                         GTK_DIALOG_MODAL,
+                                         "_Cancel", GTK_RESPONSE_CANCEL,
+                                         "_Go", GTK_RESPONSE_OK,
+                                         NULL);
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_OK);
+    content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(hbox), 10);
+    label = gtk_label_new("Line:");
+    spin_button = gtk_spin_button_new_with_range(1, MAX(n_lines, 1), 1);
+    gtk_entry_set_activates_default(GTK_ENTRY(spin_button), TRUE);
+    gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), spin_button, TRUE, TRUE, 0);
+    gtk_container_add(GTK_CONTAINER(content_area), hbox);
+    gtk_widget_show_all(dialog);
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_OK) {
+        editor_goto_line(editor, gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spin_button)) - 1);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// Follow File menu callback: start or stop following the current file
+static void on_toggle_follow(GtkCheckMenuItem *item, gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+    GError *error = NULL;
+
+    if (!gtk_check_menu_item_get_active(item)) {
+        if (editor->follow) {
+            follow_stop(editor);
+            editor_set_status(editor, "Stopped following the file");
+
+            // Old lines were dropped: read the whole file again so that is
+            // what gets edited and saved, with the cursor on the same line
+            if (editor->follow_dropped > 0) {
+                gchar *filename = g_strdup(editor->current_filename);
+                GtkTextIter iter;
+
+                gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &iter,
+                                                 gtk_text_buffer_get_insert(editor->text_buffer));
+                editor_open_file(editor, filename,
+                                 editor->follow_dropped_lines + gtk_text_iter_get_line(&iter));
+                g_free(filename);
+            }
+        }
+        return;
+    }
+
+    // Unticking the item again comes back here with nothing to do
+    if (!editor->follow && !follow_start(editor, &error)) {
+        gtk_check_menu_item_set_active(item, FALSE);
+        editor_show_error(editor, "Cannot follow the file:\n%s", error->message);
+        g_error_free(error);
+    }
+}
+
+// Record Trace menu callback: turn tracing of the hot paths on or off
+static void on_toggle_trace(GtkCheckMenuItem *item, gpointer data) {
+    trace_set_enabled(gtk_check_menu_item_get_active(item));
+}
+
+// Line Numbers menu callback
+static void on_toggle_line_numbers(GtkCheckMenuItem *item, gpointer data) {
+    gutter_set_shown((TextEditor *)data, GUTTER_LINE_NUMBERS, gtk_check_menu_item_get_active(item));
+}
+
+// Mark Changed Lines menu callback
+static void on_toggle_change_markers(GtkCheckMenuItem *item, gpointer data) {
+    gutter_set_shown((TextEditor *)data, GUTTER_CHANGES, gtk_check_menu_item_get_active(item));
+}
+
+// Mark Search Matches menu callback
+static void on_toggle_match_markers(GtkCheckMenuItem *item, gpointer data) {
+    gutter_set_shown((TextEditor *)data, GUTTER_MATCHES, gtk_check_menu_item_get_active(item));
+}
+
+// Trace Timings callback: show the time spent per phase
+static void on_trace_timings(GtkWidget *widget, gpointer data) {
+    timings_show((TextEditor *)data);
+}
+
 // Text changed callback
 static void on_text_changed(GtkTextBuffer *buffer, gpointer data) {
     TextEditor *editor = (TextEditor *)data;
+
+    // Chunks inserted by the loader, viewport windows and follow mode are
+    // not user modifications
+    if (editor->loader || editor->viewport || editor->follow) {
+        return;
+    }
+
     editor->modified = TRUE;
 }
 
+// Insert text callback: record the insertion in the piece table
+static void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+    gint offset;
+
+    // Loaded chunks are already part of the loader's document
+    if (editor->loader || editor->viewport) {
+        return;
+    }
+
+    offset = gtk_text_iter_get_offset(location);
+    stats_record_insert(editor, location, text, len);
+    undo_record_insert(editor, location, text, len);
+    highlight_record_insert(editor, location, text, len);
+    piece_table_insert(editor->document, offset, text, len);
+    line_table_insert(editor->lines, offset, text, len);
+    journal_record_insert(editor, offset, text, len);
+    editor->edit_generation++;
+}
+
+// Delete range callback: record the deletion in the piece table
+static void on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start,
+                            GtkTextIter *end, gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+    gint from, to;
+
+    if (editor->loader || editor->viewport) {
+        return;
+    }
+
+    from = gtk_text_iter_get_offset(start);
+    to = gtk_text_iter_get_offset(end);
+    stats_record_delete(editor, start, end);
+    undo_record_delete(editor, start, end);
+    highlight_record_delete(editor, start, end);
+    piece_table_delete(editor->document, from, to - from);
+    line_table_delete(editor->lines, from, to - from);
+    journal_record_delete(editor, from, to - from);
+    editor->edit_generation++;
+}
+
+// Cancel button callback: stop the running load or save
+static void on_cancel_operation(GtkWidget *widget, gpointer data) {
+    TextEditor *editor = (TextEditor *)data;
+
+    if (editor->loader) {
+        // The edits of the last session went with the file
+        file_loader_cancel(editor);
+        g_clear_pointer(&editor->pending_edits, g_bytes_unref);
+        journal_start(editor);
+        editor_set_status(editor, "Loading cancelled");
+    } else if (editor->viewport) {
+        viewport_close(editor);
+        journal_start(editor);
+        editor_set_status(editor, "Loading cancelled");
+    } else {
+        file_saver_cancel(editor);
+    }
+}
+
 // Window delete event callback
 static gboolean on_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data) {
     TextEditor *editor = (TextEditor *)data;
 
-    if (editor->modified && !prompt_save_changes(editor)) {
+    if (!tabs_prompt_save_all(editor)) {
         return TRUE; // Don't close window
     }
 
+    // Changes were saved or deliberately discarded
+    session_save(editor, FALSE);
+    tabs_discard_journals(editor);
     cleanup_editor(editor);
     return FALSE; // Allow window to close
 }
 
 // Prompt to save changes
-static gboolean prompt_save_changes(TextEditor *editor) {
+gboolean editor_prompt_save_changes(TextEditor *editor) {
     GtkWidget *dialog;
     gint response;
 
@@ -478,7 +908,10 @@ static gboolean prompt_save_changes(TextEditor *editor) {
 
     if (response == GTK_RESPONSE_YES) {
         on_save_file(NULL, editor);
-        return TRUE;
+
+        // Closing has to wait for the background save to finish
+        file_saver_wait(editor);
+        return !editor->modified;
     } else if (response == GTK_RESPONSE_NO) {
         return TRUE;
     }
@@ -511,21 +944,192 @@ static void apply_css_styling(TextEditor *editor) {
 // Clean up editor resources
 static void cleanup_editor(TextEditor *editor) {
     if (editor) {
+        session_cleanup(editor);
+        find_files_cleanup(editor);
+        timings_cleanup(editor);
+        search_cleanup(editor);
+        file_saver_wait(editor);
+        file_loader_cancel(editor);
+        viewport_close(editor);
+        follow_stop(editor);
+        tabs_cleanup(editor);
+
+        // Kept on disk unless the user already dealt with the changes
+        journal_close(editor, FALSE);
+        undo_cleanup(editor);
+        highlight_cleanup(editor);
+        status_cleanup(editor);
+        gutter_cleanup(editor);
+
         if (editor->current_filename) {
             g_free(editor->current_filename);
             editor->current_filename = NULL;
         }
+        if (editor->pending_edits) {
+            g_bytes_unref(editor->pending_edits);
+            editor->pending_edits = NULL;
+        }
         
         if (editor->css_provider) {
             g_object_unref(editor->css_provider);
             editor->css_provider = NULL;
         }
+
+        piece_table_free(editor->document);
+        editor->document = NULL;
+        line_table_free(editor->lines);
+        editor->lines = NULL;
         
         free(editor);
         global_editor = NULL;
     }
 }
 
+// Update the window title from the current filename
+void editor_update_title(TextEditor *editor) {
+    gchar *title;
+
+    if (editor->current_filename) {
+        gchar *basename = g_path_get_basename(editor->current_filename);
+        title = g_strdup_printf("Advanced Text Editor - %s", basename);
+        g_free(basename);
+    } else {
+        title = g_strdup("Advanced Text Editor - Untitled");
+    }
+
+    gtk_window_set_title(GTK_WINDOW(editor->window), title);
+    g_free(title);
+
+    // The file details in the status bar describe the same file, and its
+    // name picks the highlighting and labels the tab
+    status_update(editor, STATUS_FILE);
+    highlight_update_grammar(editor);
+    tabs_update_label(editor);
+}
+
+// Open filename in place of the current document, with the cursor on line
+// (from 0). The file is read on a worker thread and streamed into the
+// buffer, or shown a window at a time if it is too large for that, so the
+// line is gone to once it has been read.
+void editor_open_file(TextEditor *editor, const gchar *filename, gsize line) {
+    TRACE_SCOPE("open.start");
+    GError *error = NULL;
+
+    // Let a save of the current document finish before replacing it
+    file_saver_wait(editor);
+    follow_stop(editor);
+    editor->pending_line = line + 1;
+
+    if (viewport_should_open(filename)) {
+        if (!viewport_open(editor, filename, &error)) {
+            editor_show_error(editor, "Failed to open file: %s\n%s", filename, error->message);
+            g_error_free(error);
+        }
+    } else if (!file_loader_start(editor, filename, &error)) {
+        editor_show_error(editor, "Failed to open file: %s\n%s", filename, error->message);
+        g_error_free(error);
+    }
+}
+
+// Connect the handlers a document buffer needs. Every tab has a buffer of
+// its own, but only the one in view is ever edited, so the handlers all
+// work on the editor's current document.
+void editor_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer) {
+    // Connect text changed signal
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), editor);
+
+    // Mirror edits into the piece table (before the default handler runs,
+    // while the iterators still describe the old text)
+    g_signal_connect(buffer, "insert-text", G_CALLBACK(on_insert_text), editor);
+    g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range), editor);
+
+    undo_connect_buffer(editor, buffer);
+    status_connect_buffer(editor, buffer);
+    search_connect_buffer(editor, buffer);
+    gutter_connect_buffer(editor, buffer);
+}
+
+// Put the cursor at the start of line (from 0) and scroll it into view
+void editor_goto_line(TextEditor *editor, gsize line) {
+    GtkTextIter iter;
+
+    if (editor->viewport) {
+        viewport_goto_line(editor, line);
+        return;
+    }
+
+    // The line table gives the offset without walking the buffer
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &iter,
+                                       line_table_get_line_start(editor->lines, line));
+    gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view),
+                                 gtk_text_buffer_get_insert(editor->text_buffer),
+                                 0.0, TRUE, 0.0, 0.5);
+}
+
+// Go to the position pending for the document being read, and forget it.
+// The buffer's own line lookup is used, since the line table is only
+// filled in once the file has been read.
+void editor_goto_pending(TextEditor *editor) {
+    GtkTextBuffer *buffer = editor->text_buffer;
+    GtkTextIter iter;
+
+    if (editor->pending_top > 0) {
+        GtkTextMark *mark;
+
+        // The view makes its own mark to scroll to once laid out
+        gtk_text_buffer_get_iter_at_line(buffer, &iter, (gint)editor->pending_top - 1);
+        mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view), mark, 0.0, TRUE, 0.0, 0.0);
+        gtk_text_buffer_delete_mark(buffer, mark);
+    }
+
+    if (editor->pending_line > 0) {
+        gtk_text_buffer_get_iter_at_line(buffer, &iter, (gint)editor->pending_line - 1);
+        if (editor->pending_column < (gsize)gtk_text_iter_get_chars_in_line(&iter)) {
+            gtk_text_iter_set_line_offset(&iter, (gint)editor->pending_column);
+        } else if (!gtk_text_iter_ends_line(&iter)) {
+            gtk_text_iter_forward_to_line_end(&iter);
+        }
+        gtk_text_buffer_place_cursor(buffer, &iter);
+
+        if (editor->pending_top == 0) {
+            gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view),
+                                         gtk_text_buffer_get_insert(buffer), 0.0, TRUE, 0.0, 0.5);
+        }
+    }
+
+    editor->pending_line = 0;
+    editor->pending_column = 0;
+    editor->pending_top = 0;
+}
+
+// Replace the message shown in the status bar
+void editor_set_status(TextEditor *editor, const gchar *message) {
+    gtk_statusbar_pop(GTK_STATUSBAR(editor->status_bar), editor->status_context_id);
+    gtk_statusbar_push(GTK_STATUSBAR(editor->status_bar), editor->status_context_id, message);
+}
+
+// Show a modal error message
+void editor_show_error(TextEditor *editor, const gchar *format, ...) {
+    GtkWidget *error_dialog;
+    gchar *message;
+    va_list args;
+
+    va_start(args, format);
+    message = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    error_dialog = gtk_message_dialog_new(GTK_WINDOW(editor->window),
+                                          GTK_DIALOG_DESTROY_WITH_PARENT,
+                                          GTK_MESSAGE_ERROR,
+                                          GTK_BUTTONS_CLOSE,
+                                          "%s", message);
+    gtk_dialog_run(GTK_DIALOG(error_dialog));
+    gtk_widget_destroy(error_dialog);
+    g_free(message);
+}
+
 // Signal handler for clean exit
 static void signal_handler(int signum) {
     g_print("\nReceived signal %d, cleaning up...\n", signum);
@@ -0,0 +1,526 @@
+/*
+ * Vectorized text scanning kernels
+ *
+ * Every kernel works on 64-byte blocks: a mask function turns a block into
+ * 64-bit masks with a bit per '\n' byte, per UTF-8 continuation byte
+ * (0x80-0xBF, which don't start a character) and per byte that is not
+ * plain ASCII text (NUL or 0x80 and above). The scanners below are written
+ * once against those masks and instantiated per instruction set with
+ * TEXT_SCAN_DEFINE_KERNEL, so each gets its mask function inlined. Bytes
+ * past the last whole block go through a scalar loop.
+ *
+ * Word counting uses a fourth mask, of separator bytes (space, tab, CR and
+ * LF). A word starts at every byte that isn't a separator and follows one,
+ * which is ~separators & (separators << 1 | the last bit of the previous
+ * block), so a block costs a shift and a popcount. Large inputs are split
+ * between threads; each slice starts out inside a word if the byte before
+ * it isn't a separator, so a word crossing a slice boundary is counted
+ * once, by the slice it starts in.
+ *
+ * Substring search compares the first and last byte of the needle against
+ * a vector of consecutive positions at once and only verifies positions
+ * where both match, which on text skips nearly every byte without a
+ * closer look. Inputs that keep producing candidates which then fail
+ * verification (long runs of the same byte) are handed to memmem(), whose
+ * Two-Way algorithm is linear in the worst case.
+ */
+
+#define _GNU_SOURCE
+#include "text_scan.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TEXT_SCAN_X86 1
+#endif
+
+#define TEXT_SCAN_BLOCK 64
+#define TEXT_SCAN_MAX_THREADS 16
+#define TEXT_SCAN_MIN_SLICE   (8 * 1024 * 1024)  // Smallest slice worth a thread
+
+typedef struct {
+    const gchar *name;
+    gsize (*count_newlines)(const gchar *data, gsize length);
+    gsize (*skip_newlines)(const gchar *data, gsize length, gsize n, gsize *found);
+    gsize (*line_lengths)(const gchar *data, gsize length, GArray *lengths);
+    gsize (*ascii_length)(const gchar *data, gsize length);
+    gsize (*count_chars)(const gchar *data, gsize length);
+    gsize (*count_words)(const gchar *data, gsize length, gboolean *in_word);
+    gsize (*find)(const gchar *data, gsize length, const gchar *needle, gsize needle_length);
+} TextScanKernel;
+
+#define TEXT_SCAN_INLINE static inline __attribute__((always_inline))
+
+// Scalar masks, used where no vector unit is available
+TEXT_SCAN_INLINE void masks_scalar(const gchar *p, guint64 *newlines, guint64 *continuation,
+                                   guint64 *special) {
+    guint64 n = 0, c = 0, s = 0;
+
+    for (guint i = 0; i < TEXT_SCAN_BLOCK; i++) {
+        guchar byte = (guchar)p[i];
+
+        n |= (guint64)(byte == '\n') << i;
+        c |= (guint64)((byte & 0xC0) == 0x80) << i;
+        s |= (guint64)(byte == 0 || byte >= 0x80) << i;
+    }
+
+    *newlines = n;
+    *continuation = c;
+    *special = s;
+}
+
+TEXT_SCAN_INLINE gboolean is_separator(guchar byte) {
+    return byte == ' ' || byte == '\t' || byte == '\n' || byte == '\r';
+}
+
+TEXT_SCAN_INLINE guint64 separators_scalar(const gchar *p) {
+    guint64 s = 0;
+
+    for (guint i = 0; i < TEXT_SCAN_BLOCK; i++) {
+        s |= (guint64)is_separator((guchar)p[i]) << i;
+    }
+    return s;
+}
+
+#ifdef TEXT_SCAN_X86
+
+#ifdef __SSE2__
+TEXT_SCAN_INLINE guint64 separators_sse2(const gchar *p) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    guint64 s = 0;
+
+    for (guint k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, newline),
+                                              _mm_cmpeq_epi8(v, carriage_return)));
+
+        s |= (guint64)(guint32)_mm_movemask_epi8(m) << (16 * k);
+    }
+    return s;
+}
+
+TEXT_SCAN_INLINE void masks_sse2(const gchar *p, guint64 *newlines, guint64 *continuation,
+                                 guint64 *special) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i limit = _mm_set1_epi8(-64);  // Continuation bytes are below it as signed
+    const __m128i zero = _mm_setzero_si128();
+    guint64 n = 0, c = 0, s = 0;
+
+    for (guint k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+
+        n |= (guint64)(guint32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * k);
+        c |= (guint64)(guint32)_mm_movemask_epi8(_mm_cmpgt_epi8(limit, v)) << (16 * k);
+        s |= (guint64)(guint32)_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))) << (16 * k);
+    }
+
+    *newlines = n;
+    *continuation = c;
+    *special = s;
+}
+#endif
+
+#define TEXT_SCAN_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+TEXT_SCAN_INLINE TEXT_SCAN_AVX2 void masks_avx2(const gchar *p, guint64 *newlines,
+                                                guint64 *continuation, guint64 *special) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i limit = _mm256_set1_epi8(-64);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+    *newlines = (guint64)(guint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                (guint64)(guint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+    *continuation = (guint64)(guint32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, lo)) |
+                    (guint64)(guint32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, hi)) << 32;
+    *special = (guint64)(guint32)_mm256_movemask_epi8(_mm256_or_si256(lo, _mm256_cmpeq_epi8(lo, zero))) |
+               (guint64)(guint32)_mm256_movemask_epi8(_mm256_or_si256(hi, _mm256_cmpeq_epi8(hi, zero))) << 32;
+}
+
+TEXT_SCAN_INLINE TEXT_SCAN_AVX2 guint32 separators_avx2_half(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+
+    return (guint32)_mm256_movemask_epi8(m);
+}
+
+TEXT_SCAN_INLINE TEXT_SCAN_AVX2 guint64 separators_avx2(const gchar *p) {
+    return (guint64)separators_avx2_half(_mm256_loadu_si256((const __m256i *)p)) |
+           (guint64)separators_avx2_half(_mm256_loadu_si256((const __m256i *)(p + 32))) << 32;
+}
+
+#endif // TEXT_SCAN_X86
+
+// The vector filter is given up on once more than one in 16 positions
+// scanned, after the first TEXT_SCAN_FIND_SLACK, failed verification
+#define TEXT_SCAN_FIND_SLACK 64
+
+// Search with memmem() from start on, returning length if there is no match
+static gsize find_memmem(const gchar *data, gsize length, gsize start, const gchar *needle,
+                         gsize needle_length) {
+    const gchar *hit = memmem(data + start, length - start, needle, needle_length);
+
+    return hit ? (gsize)(hit - data) : length;
+}
+
+static gsize find_scalar(const gchar *data, gsize length, const gchar *needle,
+                         gsize needle_length) {
+    return find_memmem(data, length, 0, needle, needle_length);
+}
+
+#ifdef TEXT_SCAN_X86
+
+#ifdef __SSE2__
+static gsize find_sse2(const gchar *data, gsize length, const gchar *needle,
+                       gsize needle_length) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    gsize misses = 0, i = 0;
+
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + needle_length - 1));
+        guint mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                     _mm_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            guint bit = __builtin_ctz(mask);
+
+            if (memcmp(data + i + bit, needle, needle_length) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+            misses++;
+        }
+
+        if (misses > TEXT_SCAN_FIND_SLACK + i / 16) {
+            break;
+        }
+    }
+
+    return find_memmem(data, length, i, needle, needle_length);
+}
+#endif
+
+static TEXT_SCAN_AVX2 gsize find_avx2(const gchar *data, gsize length, const gchar *needle,
+                                      gsize needle_length) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    gsize misses = 0, i = 0;
+
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + needle_length - 1));
+        guint32 mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                             _mm256_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            guint bit = __builtin_ctz(mask);
+
+            if (memcmp(data + i + bit, needle, needle_length) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+            misses++;
+        }
+
+        if (misses > TEXT_SCAN_FIND_SLACK + i / 16) {
+            break;
+        }
+    }
+
+    return find_memmem(data, length, i, needle, needle_length);
+}
+
+#endif // TEXT_SCAN_X86
+
+// Bits start..63 of a mask
+#define TEXT_SCAN_FROM(start) ((start) >= 64 ? 0 : ~G_GUINT64_CONSTANT(0) << (start))
+
+#define TEXT_SCAN_DEFINE_KERNEL(suffix, masks, separators, attributes)                       \
+    static attributes gsize count_newlines_##suffix(const gchar *data, gsize length) {       \
+        gsize count = 0, i = 0;                                                              \
+                                                                                             \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 newlines, continuation, special;                                         \
+            masks(data + i, &newlines, &continuation, &special);                             \
+            count += __builtin_popcountll(newlines);                                         \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            count += data[i] == '\n';                                                        \
+        }                                                                                    \
+        return count;                                                                        \
+    }                                                                                        \
+                                                                                             \
+    static attributes gsize skip_newlines_##suffix(const gchar *data, gsize length, gsize n, \
+                                                   gsize *found) {                           \
+        gsize seen = 0, i = 0;                                                               \
+                                                                                             \
+        if (n == 0) {                                                                        \
+            *found = 0;                                                                      \
+            return 0;                                                                        \
+        }                                                                                    \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 newlines, continuation, special;                                         \
+            gsize count;                                                                     \
+                                                                                             \
+            masks(data + i, &newlines, &continuation, &special);                             \
+            count = __builtin_popcountll(newlines);                                          \
+            if (seen + count >= n) {                                                         \
+                for (gsize k = n - seen - 1; k > 0; k--) {                                   \
+                    newlines &= newlines - 1;                                                \
+                }                                                                            \
+                *found = n;                                                                  \
+                return i + __builtin_ctzll(newlines) + 1;                                    \
+            }                                                                                \
+            seen += count;                                                                   \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            if (data[i] == '\n' && ++seen == n) {                                            \
+                *found = n;                                                                  \
+                return i + 1;                                                                \
+            }                                                                                \
+        }                                                                                    \
+        *found = seen;                                                                       \
+        return length;                                                                       \
+    }                                                                                        \
+                                                                                             \
+    static attributes gsize line_lengths_##suffix(const gchar *data, gsize length,           \
+                                                  GArray *lengths) {                         \
+        gsize line = 0, i = 0;                                                               \
+                                                                                             \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 newlines, continuation, special;                                         \
+            guint start = 0;                                                                 \
+                                                                                             \
+            masks(data + i, &newlines, &continuation, &special);                             \
+            while (newlines) {                                                               \
+                guint bit = __builtin_ctzll(newlines);                                       \
+                guint64 span = TEXT_SCAN_FROM(start) & ~TEXT_SCAN_FROM(bit + 1);             \
+                                                                                             \
+                line += (bit + 1 - start) - __builtin_popcountll(continuation & span);       \
+                g_array_append_val(lengths, line);                                           \
+                line = 0;                                                                    \
+                start = bit + 1;                                                             \
+                newlines &= newlines - 1;                                                    \
+            }                                                                                \
+            line += (TEXT_SCAN_BLOCK - start) -                                              \
+                    __builtin_popcountll(continuation & TEXT_SCAN_FROM(start));              \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            guchar byte = (guchar)data[i];                                                   \
+                                                                                             \
+            line += (byte & 0xC0) != 0x80;                                                   \
+            if (byte == '\n') {                                                              \
+                g_array_append_val(lengths, line);                                           \
+                line = 0;                                                                    \
+            }                                                                                \
+        }                                                                                    \
+        return line;                                                                         \
+    }                                                                                        \
+                                                                                             \
+    static attributes gsize ascii_length_##suffix(const gchar *data, gsize length) {         \
+        gsize i = 0;                                                                         \
+                                                                                             \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 newlines, continuation, special;                                         \
+                                                                                             \
+            masks(data + i, &newlines, &continuation, &special);                             \
+            if (special) {                                                                   \
+                return i + __builtin_ctzll(special);                                         \
+            }                                                                                \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            if (data[i] == 0 || (guchar)data[i] >= 0x80) {                                   \
+                break;                                                                       \
+            }                                                                                \
+        }                                                                                    \
+        return i;                                                                            \
+    }                                                                                        \
+                                                                                             \
+    static attributes gsize count_chars_##suffix(const gchar *data, gsize length) {          \
+        gsize count = 0, i = 0;                                                              \
+                                                                                             \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 newlines, continuation, special;                                         \
+                                                                                             \
+            masks(data + i, &newlines, &continuation, &special);                             \
+            count += TEXT_SCAN_BLOCK - __builtin_popcountll(continuation);                   \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            count += ((guchar)data[i] & 0xC0) != 0x80;                                       \
+        }                                                                                    \
+        return count;                                                                        \
+    }                                                                                        \
+                                                                                             \
+    static attributes gsize count_words_##suffix(const gchar *data, gsize length,            \
+                                                 gboolean *in_word) {                        \
+        guint64 after_separator = !*in_word;                                                 \
+        gsize count = 0, i = 0;                                                              \
+                                                                                             \
+        for (; i + TEXT_SCAN_BLOCK <= length; i += TEXT_SCAN_BLOCK) {                        \
+            guint64 blanks = separators(data + i);                                           \
+                                                                                             \
+            count += __builtin_popcountll(~blanks & (blanks << 1 | after_separator));        \
+            after_separator = blanks >> 63;                                                  \
+        }                                                                                    \
+        for (; i < length; i++) {                                                            \
+            guint64 blank = is_separator((guchar)data[i]);                                   \
+                                                                                             \
+            count += (blank ^ 1) & after_separator;                                          \
+            after_separator = blank;                                                         \
+        }                                                                                    \
+        *in_word = !after_separator;                                                         \
+        return count;                                                                        \
+    }                                                                                        \
+                                                                                             \
+    static const TextScanKernel kernel_##suffix = {                                          \
+        #suffix, count_newlines_##suffix, skip_newlines_##suffix, line_lengths_##suffix,     \
+        ascii_length_##suffix, count_chars_##suffix, count_words_##suffix, find_##suffix     \
+    };
+
+TEXT_SCAN_DEFINE_KERNEL(scalar, masks_scalar, separators_scalar, )
+
+#ifdef TEXT_SCAN_X86
+#ifdef __SSE2__
+TEXT_SCAN_DEFINE_KERNEL(sse2, masks_sse2, separators_sse2, )
+#endif
+TEXT_SCAN_DEFINE_KERNEL(avx2, masks_avx2, separators_avx2, TEXT_SCAN_AVX2)
+#endif
+
+// Pick the best kernel the CPU supports
+static const TextScanKernel *text_scan_kernel(void) {
+    static const TextScanKernel *kernel = NULL;
+
+    if (g_once_init_enter(&kernel)) {
+        const TextScanKernel *chosen = &kernel_scalar;
+
+#ifdef TEXT_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") &&
+            __builtin_cpu_supports("bmi")) {
+            chosen = &kernel_avx2;
+        }
+#ifdef __SSE2__
+        else {
+            chosen = &kernel_sse2;
+        }
+#endif
+#endif
+
+        g_once_init_leave(&kernel, chosen);
+    }
+
+    return kernel;
+}
+
+const gchar *text_scan_get_kernel(void) {
+    return text_scan_kernel()->name;
+}
+
+gsize text_scan_count_newlines(const gchar *data, gsize length) {
+    return text_scan_kernel()->count_newlines(data, length);
+}
+
+gsize text_scan_skip_newlines(const gchar *data, gsize length, gsize n, gsize *found) {
+    gsize passed;
+    gsize offset = text_scan_kernel()->skip_newlines(data, length, n, &passed);
+
+    if (found) {
+        *found = passed;
+    }
+    return offset;
+}
+
+gsize text_scan_line_lengths(const gchar *data, gsize length, GArray *lengths) {
+    return text_scan_kernel()->line_lengths(data, length, lengths);
+}
+
+gsize text_scan_ascii_length(const gchar *data, gsize length) {
+    return text_scan_kernel()->ascii_length(data, length);
+}
+
+gsize text_scan_count_chars(const gchar *data, gsize length) {
+    return text_scan_kernel()->count_chars(data, length);
+}
+
+typedef struct {
+    const gchar *data;
+    gsize length;
+    gboolean in_word;
+    gsize count;
+} WordScanJob;
+
+static gpointer word_scan_job_run(gpointer data) {
+    WordScanJob *job = (WordScanJob *)data;
+
+    job->count = text_scan_kernel()->count_words(job->data, job->length, &job->in_word);
+    return NULL;
+}
+
+gsize text_scan_count_words(const gchar *data, gsize length, gboolean *in_word) {
+    WordScanJob jobs[TEXT_SCAN_MAX_THREADS];
+    GThread *threads[TEXT_SCAN_MAX_THREADS];
+    guint n_jobs, i;
+    gsize slice, count = 0;
+
+    // Edits are counted on every keystroke, so small inputs skip the setup
+    if (length < 2 * TEXT_SCAN_MIN_SLICE) {
+        return text_scan_kernel()->count_words(data, length, in_word);
+    }
+
+    n_jobs = CLAMP(g_get_num_processors(), 1, TEXT_SCAN_MAX_THREADS);
+    n_jobs = MIN(n_jobs, length / TEXT_SCAN_MIN_SLICE);
+    if (n_jobs == 1) {
+        return text_scan_kernel()->count_words(data, length, in_word);
+    }
+
+    slice = length / n_jobs;
+    for (i = 0; i < n_jobs; i++) {
+        jobs[i].data = data + i * slice;
+        jobs[i].length = (i == n_jobs - 1) ? length - i * slice : slice;
+        jobs[i].in_word = i == 0 ? *in_word : !is_separator((guchar)data[i * slice - 1]);
+    }
+
+    // The calling thread takes the first slice
+    for (i = 1; i < n_jobs; i++) {
+        threads[i] = g_thread_new("word-scan", word_scan_job_run, &jobs[i]);
+    }
+    word_scan_job_run(&jobs[0]);
+    for (i = 1; i < n_jobs; i++) {
+        g_thread_join(threads[i]);
+    }
+
+    for (i = 0; i < n_jobs; i++) {
+        count += jobs[i].count;
+    }
+    *in_word = jobs[n_jobs - 1].in_word;
+    return count;
+}
+
+gsize text_scan_find(const gchar *data, gsize length, const gchar *needle, gsize needle_length) {
+    const gchar *hit;
+
+    if (needle_length == 0) {
+        return 0;
+    }
+    if (needle_length > length) {
+        return length;
+    }
+
+    // memchr() is already vectorized for a single byte
+    if (needle_length == 1) {
+        hit = memchr(data, needle[0], length);
+        return hit ? (gsize)(hit - data) : length;
+    }
+
+    return text_scan_kernel()->find(data, length, needle, needle_length);
+}
@@ -0,0 +1,46 @@
+/*
+ * Vectorized text scanning kernels
+ *
+ * Newline, UTF-8 character, word, ASCII run and substring scanning over raw
+ * bytes, using AVX2 or SSE2 when the CPU has them and a scalar loop
+ * otherwise. The implementation is picked once at runtime, so the binary
+ * runs on any x86-64 (or other) CPU.
+ */
+
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+#include <glib.h>
+
+// Name of the kernel in use ("avx2", "sse2" or "scalar")
+const gchar *text_scan_get_kernel(void);
+
+// Number of '\n' bytes in data
+gsize text_scan_count_newlines(const gchar *data, gsize length);
+
+// Offset just past the n-th newline in data. If there are fewer, returns
+// length; *found (optional) receives the number of newlines passed.
+gsize text_scan_skip_newlines(const gchar *data, gsize length, gsize n, gsize *found);
+
+// Append the length in characters of each newline-terminated line in data
+// (newline included) to lengths, an array of gsize. The first entry counts
+// from the start of data. Returns the characters after the last newline.
+gsize text_scan_line_lengths(const gchar *data, gsize length, GArray *lengths);
+
+// Length of the leading run of ASCII bytes other than NUL
+gsize text_scan_ascii_length(const gchar *data, gsize length);
+
+// Number of UTF-8 characters in data (bytes that aren't continuation bytes)
+gsize text_scan_count_chars(const gchar *data, gsize length);
+
+// Number of words in data, runs of bytes other than space, tab, CR and LF.
+// *in_word says whether the text just before data ends inside a word (so
+// a word continuing into data isn't counted again) and receives the same
+// for the end of data. Large inputs are counted on several threads.
+gsize text_scan_count_words(const gchar *data, gsize length, gboolean *in_word);
+
+// Offset of the first occurrence of needle in data, or length if there is
+// none. An empty needle matches at 0.
+gsize text_scan_find(const gchar *data, gsize length, const gchar *needle, gsize needle_length);
+
+#endif // TEXT_SCAN_H
@@ -0,0 +1,274 @@
+/*
+ * Trace timings window
+ *
+ * The list is rebuilt from trace_get_phases() every TIMINGS_REFRESH_INTERVAL
+ * ms while the window is mapped. The frame phases are timed from one frame
+ * clock signal to the next: before-paint starts the update phase, which
+ * runs the tick callbacks (the status bar's among them), layout and paint
+ * start theirs, and after-paint ends the frame.
+ */
+
+#include "timings.h"
+#include "trace.h"
+
+enum {
+    COLUMN_PHASE,
+    COLUMN_CALLS,
+    COLUMN_TOTAL,           // Milliseconds, formatted
+    COLUMN_MEAN,
+    COLUMN_MAX,
+    N_COLUMNS
+};
+
+struct _Timings {
+    TextEditor *editor;
+    GtkWidget *window;      // NULL until first shown
+    GtkWidget *status_label;
+    GtkListStore *store;
+    guint refresh_id;
+
+    // Frame phase under way, and when it started (0 when not tracing)
+    const gchar *phase;
+    gint64 phase_start;
+    gint64 draw_start;
+};
+
+// Show the spans recorded so far
+static void timings_refresh(Timings *timings) {
+    GArray *phases = trace_get_phases();
+    gchar total[32], mean[32], max[32];
+
+    gtk_label_set_text(GTK_LABEL(timings->status_label),
+                       trace_is_enabled() ? "Recording"
+                                          : "Not recording (turn on View > Record Trace)");
+
+    gtk_list_store_clear(timings->store);
+    for (guint i = 0; i < phases->len; i++) {
+        const TracePhase *phase = &g_array_index(phases, TracePhase, i);
+
+        g_snprintf(total, sizeof(total), "%.3f", phase->total / 1e6);
+        g_snprintf(mean, sizeof(mean), "%.3f", phase->total / 1e6 / phase->count);
+        g_snprintf(max, sizeof(max), "%.3f", phase->max / 1e6);
+        gtk_list_store_insert_with_values(timings->store, NULL, -1,
+                                          COLUMN_PHASE, phase->name,
+                                          COLUMN_CALLS, phase->count,
+                                          COLUMN_TOTAL, total,
+                                          COLUMN_MEAN, mean,
+                                          COLUMN_MAX, max, -1);
+    }
+
+    g_array_unref(phases);
+}
+
+static gboolean timings_refresh_tick(gpointer data) {
+    timings_refresh((Timings *)data);
+    return G_SOURCE_CONTINUE;
+}
+
+// Refresh only while the window is on screen
+static void on_timings_map(GtkWidget *widget, gpointer data) {
+    Timings *timings = (Timings *)data;
+
+    timings_refresh(timings);
+    if (timings->refresh_id == 0) {
+        timings->refresh_id = g_timeout_add(TIMINGS_REFRESH_INTERVAL, timings_refresh_tick,
+                                            timings);
+    }
+}
+
+static void on_timings_unmap(GtkWidget *widget, gpointer data) {
+    Timings *timings = (Timings *)data;
+
+    if (timings->refresh_id) {
+        g_source_remove(timings->refresh_id);
+        timings->refresh_id = 0;
+    }
+}
+
+static void on_timings_clear(GtkWidget *widget, gpointer data) {
+    trace_clear();
+    timings_refresh((Timings *)data);
+}
+
+// Save Trace button: write the spans as Chrome trace event JSON
+static void on_timings_save(GtkWidget *widget, gpointer data) {
+    Timings *timings = (Timings *)data;
+    TextEditor *editor = timings->editor;
+    GtkWidget *dialog;
+
+    dialog = gtk_file_chooser_dialog_new("Save Trace",
+                                         GTK_WINDOW(timings->window),
+                                         GTK_FILE_CHOOSER_ACTION_SAVE,
+                                         "_Cancel", GTK_RESPONSE_CANCEL,
+                                         "_Save", GTK_RESPONSE_ACCEPT,
+                                         NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "trace.json");
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        gchar *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        GError *error = NULL;
+
+        gtk_widget_hide(dialog);
+        if (trace_write_json(filename, &error)) {
+            gchar *basename = g_path_get_basename(filename);
+            gchar *status = g_strdup_printf("Trace saved to %s", basename);
+
+            editor_set_status(editor, status);
+            g_free(status);
+            g_free(basename);
+        } else {
+            editor_show_error(editor, "Failed to save trace: %s\n%s", filename, error->message);
+            g_error_free(error);
+        }
+        g_free(filename);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// Frame clock signals: end the phase under way and start the next one
+static void timings_start_phase(Timings *timings, const gchar *phase) {
+    trace_end(timings->phase, timings->phase_start);
+    timings->phase = phase;
+    timings->phase_start = phase ? trace_begin() : 0;
+}
+
+static void on_frame_before_paint(GdkFrameClock *clock, gpointer data) {
+    timings_start_phase((Timings *)data, "frame.update");
+}
+
+static void on_frame_layout(GdkFrameClock *clock, gpointer data) {
+    timings_start_phase((Timings *)data, "frame.layout");
+}
+
+static void on_frame_paint(GdkFrameClock *clock, gpointer data) {
+    timings_start_phase((Timings *)data, "frame.paint");
+}
+
+static void on_frame_after_paint(GdkFrameClock *clock, gpointer data) {
+    timings_start_phase((Timings *)data, NULL);
+}
+
+// The window has a frame clock once it is realized
+static void on_window_realize(GtkWidget *widget, gpointer data) {
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(widget);
+
+    g_signal_connect(clock, "before-paint", G_CALLBACK(on_frame_before_paint), data);
+    g_signal_connect(clock, "layout", G_CALLBACK(on_frame_layout), data);
+    g_signal_connect(clock, "paint", G_CALLBACK(on_frame_paint), data);
+    g_signal_connect(clock, "after-paint", G_CALLBACK(on_frame_after_paint), data);
+}
+
+// Text view drawing, nested in frame.paint
+static gboolean on_view_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+    ((Timings *)data)->draw_start = trace_begin();
+    return FALSE;
+}
+
+static gboolean on_view_drawn(GtkWidget *widget, cairo_t *cr, gpointer data) {
+    Timings *timings = (Timings *)data;
+
+    trace_end("frame.draw_text", timings->draw_start);
+    timings->draw_start = 0;
+    return FALSE;
+}
+
+// Create the window, hidden
+static void timings_create_window(Timings *timings) {
+    TextEditor *editor = timings->editor;
+    GtkWidget *vbox, *button_box, *clear_button, *save_button, *scrolled_window, *view;
+    const gchar *titles[N_COLUMNS] = { "Phase", "Calls", "Total (ms)", "Mean (ms)", "Max (ms)" };
+
+    timings->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(timings->window), "Trace Timings");
+    gtk_window_set_transient_for(GTK_WINDOW(timings->window), GTK_WINDOW(editor->window));
+    gtk_window_set_default_size(GTK_WINDOW(timings->window), 560, 400);
+    g_signal_connect(timings->window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+    g_signal_connect(timings->window, "map", G_CALLBACK(on_timings_map), timings);
+    g_signal_connect(timings->window, "unmap", G_CALLBACK(on_timings_unmap), timings);
+
+    timings->status_label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(timings->status_label), 0.0);
+
+    clear_button = gtk_button_new_with_mnemonic("_Clear");
+    g_signal_connect(clear_button, "clicked", G_CALLBACK(on_timings_clear), timings);
+
+    save_button = gtk_button_new_with_mnemonic("_Save Trace...");
+    g_signal_connect(save_button, "clicked", G_CALLBACK(on_timings_save), timings);
+
+    button_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(button_box), timings->status_label, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(button_box), clear_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(button_box), save_button, FALSE, FALSE, 0);
+
+    view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(timings->store));
+    for (gint i = 0; i < N_COLUMNS; i++) {
+        GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+
+        // Numbers line up on the right
+        if (i != COLUMN_PHASE) {
+            g_object_set(renderer, "xalign", 1.0, NULL);
+        }
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, titles[i],
+                                                    renderer, "text", i, NULL);
+    }
+
+    scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scrolled_window), view);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox), 10);
+    gtk_box_pack_start(GTK_BOX(vbox), button_box, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), scrolled_window, TRUE, TRUE, 0);
+    gtk_container_add(GTK_CONTAINER(timings->window), vbox);
+}
+
+void timings_init(TextEditor *editor) {
+    Timings *timings = g_new0(Timings, 1);
+
+    timings->editor = editor;
+    timings->store = gtk_list_store_new(N_COLUMNS, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING,
+                                        G_TYPE_STRING, G_TYPE_STRING);
+    editor->timings = timings;
+
+    g_signal_connect(editor->window, "realize", G_CALLBACK(on_window_realize), timings);
+    g_signal_connect(editor->text_view, "draw", G_CALLBACK(on_view_draw), timings);
+    g_signal_connect_after(editor->text_view, "draw", G_CALLBACK(on_view_drawn), timings);
+}
+
+void timings_show(TextEditor *editor) {
+    Timings *timings = editor->timings;
+
+    if (!timings->window) {
+        timings_create_window(timings);
+    }
+
+    gtk_widget_show_all(timings->window);
+    gtk_window_present(GTK_WINDOW(timings->window));
+}
+
+void timings_cleanup(TextEditor *editor) {
+    Timings *timings = editor->timings;
+
+    if (!timings) {
+        return;
+    }
+
+    // The frame clock outlives this when the window is destroyed after
+    if (gtk_widget_get_realized(editor->window)) {
+        g_signal_handlers_disconnect_by_data(gtk_widget_get_frame_clock(editor->window), timings);
+    }
+    g_signal_handlers_disconnect_by_data(editor->window, timings);
+    g_signal_handlers_disconnect_by_data(editor->text_view, timings);
+
+    if (timings->window) {
+        gtk_widget_destroy(timings->window);
+    }
+    if (timings->refresh_id) {
+        g_source_remove(timings->refresh_id);
+    }
+    g_object_unref(timings->store);
+    g_free(timings);
+    editor->timings = NULL;
+}
@@ -0,0 +1,28 @@
+/*
+ * Trace timings window
+ *
+ * A separate, non-modal window listing the traced phases (see trace.h)
+ * with how often they ran and how long they took, in total, on average and
+ * at most, refreshed while it is shown. It can clear the spans recorded so
+ * far and save them as a Chrome trace. This module also traces the frames
+ * of the main window: the update, layout and paint phases of the frame
+ * clock, and the drawing of the text view.
+ */
+
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include "editor.h"
+
+#define TIMINGS_REFRESH_INTERVAL 500    // Milliseconds between refreshes
+
+// Start tracing the frames of editor->window
+void timings_init(TextEditor *editor);
+
+// Show the window, creating it on first use
+void timings_show(TextEditor *editor);
+
+// Destroy the window
+void timings_cleanup(TextEditor *editor);
+
+#endif // TIMINGS_H
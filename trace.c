@@ -0,0 +1,296 @@
+/*
+ * Tracing of the hot paths
+ *
+ * Each thread gets a ring the first time it records a span, from a list
+ * of rings left behind by threads that have exited if there is one, so
+ * the short-lived loader, saver and search workers don't each cost a new
+ * ring. Only the owning thread writes to a ring: it fills the slot, then
+ * publishes it by bumping head. Readers copy a ring without stopping the
+ * writer and drop whatever it may have overwritten meanwhile. Spans carry
+ * the number of the thread that recorded them, so the spans of an exited
+ * thread keep their thread when its ring is reused.
+ */
+
+#include "trace.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+typedef struct {
+    const gchar *name;
+    gint64 start;           // Nanoseconds, see trace_now()
+    gint64 end;
+    guint thread;           // Index into trace_threads
+} TraceEvent;
+
+typedef struct {
+    gint head;              // Atomic, spans ever written (wrapping)
+    gint tail;              // Atomic, first span not cleared
+    guint thread;           // Number of the thread writing to it
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+gint trace_enabled;
+
+static void trace_release_ring(gpointer data);
+
+static GPrivate trace_ring_key = G_PRIVATE_INIT(trace_release_ring);
+
+// Protected by trace_lock. Rings are never freed.
+static GMutex trace_lock;
+static GPtrArray *trace_rings;      // TraceRing
+static GPtrArray *trace_free_rings; // Rings of threads that have exited
+static GPtrArray *trace_threads;    // Thread names, by thread number
+static gint64 trace_epoch;          // Time 0 of the written trace
+
+// Create the lists once. Called with trace_lock held.
+static void trace_setup_locked(void) {
+    if (trace_rings) {
+        return;
+    }
+
+    trace_rings = g_ptr_array_new();
+    trace_free_rings = g_ptr_array_new();
+    trace_threads = g_ptr_array_new_with_free_func(g_free);
+    trace_epoch = trace_now();
+}
+
+// Name of the calling thread, as the trace viewers show it
+static gchar *trace_get_thread_name(guint thread) {
+#ifdef __linux__
+    gchar name[17] = "";
+
+    // GLib names the threads it creates after their purpose
+    if (prctl(PR_GET_NAME, name, 0, 0, 0) == 0 && name[0]) {
+        return g_strdup(name);
+    }
+#endif
+    return g_strdup_printf("thread %u", thread);
+}
+
+// Give a ring back when its thread exits
+static void trace_release_ring(gpointer data) {
+    g_mutex_lock(&trace_lock);
+    g_ptr_array_add(trace_free_rings, data);
+    g_mutex_unlock(&trace_lock);
+}
+
+// The calling thread's ring, taken on first use
+static TraceRing *trace_get_ring(void) {
+    TraceRing *ring = g_private_get(&trace_ring_key);
+
+    if (G_LIKELY(ring)) {
+        return ring;
+    }
+
+    g_mutex_lock(&trace_lock);
+    trace_setup_locked();
+    if (trace_free_rings->len > 0) {
+        ring = g_ptr_array_remove_index_fast(trace_free_rings, trace_free_rings->len - 1);
+    } else {
+        ring = g_new0(TraceRing, 1);
+        g_ptr_array_add(trace_rings, ring);
+    }
+    ring->thread = trace_threads->len;
+    g_ptr_array_add(trace_threads, trace_get_thread_name(ring->thread));
+    g_mutex_unlock(&trace_lock);
+
+    g_private_set(&trace_ring_key, ring);
+    return ring;
+}
+
+const gchar *trace_init(void) {
+    const gchar *value = g_getenv("TEXT_EDITOR_TRACE");
+
+    if (!value || !value[0] || strcmp(value, "0") == 0) {
+        return NULL;
+    }
+
+    trace_set_enabled(TRUE);
+    return strcmp(value, "1") == 0 ? NULL : value;
+}
+
+void trace_set_enabled(gboolean enabled) {
+    g_mutex_lock(&trace_lock);
+    trace_setup_locked();
+    g_mutex_unlock(&trace_lock);
+
+    g_atomic_int_set(&trace_enabled, enabled ? 1 : 0);
+}
+
+gint64 trace_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (gint64)now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
+
+void trace_record(const gchar *name, gint64 start) {
+    TraceRing *ring = trace_get_ring();
+    TraceEvent *event;
+    guint head;
+
+    head = (guint)ring->head;
+    event = &ring->events[head % TRACE_RING_SIZE];
+    event->name = name;
+    event->start = start;
+    event->end = trace_now();
+    event->thread = ring->thread;
+
+    // Publishes the span to readers
+    g_atomic_int_set(&ring->head, (gint)(head + 1));
+}
+
+// Copy the spans of ring not cleared yet into events. Returns how many.
+static guint trace_copy_ring(TraceRing *ring, TraceEvent *events) {
+    guint head = (guint)g_atomic_int_get(&ring->head);
+    guint tail = (guint)g_atomic_int_get(&ring->tail);
+    guint first = head - tail > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : tail;
+    guint after, n = 0, dropped = 0;
+
+    for (guint i = first; i != head; i++) {
+        events[n++] = ring->events[i % TRACE_RING_SIZE];
+    }
+
+    // The writer went on meanwhile: the oldest slots (and the one it is
+    // filling) may hold newer spans or half-written ones
+    after = (guint)g_atomic_int_get(&ring->head);
+    if (after - first >= TRACE_RING_SIZE) {
+        dropped = MIN(n, after - first - TRACE_RING_SIZE + 1);
+        memmove(events, events + dropped, (n - dropped) * sizeof(TraceEvent));
+    }
+
+    return n - dropped;
+}
+
+// Call func for every recorded span
+static void trace_foreach(void (*func)(const TraceEvent *event, gpointer data), gpointer data) {
+    TraceEvent *events;
+    guint n_rings;
+
+    g_mutex_lock(&trace_lock);
+    n_rings = trace_rings ? trace_rings->len : 0;
+    g_mutex_unlock(&trace_lock);
+
+    events = g_new(TraceEvent, TRACE_RING_SIZE);
+    for (guint r = 0; r < n_rings; r++) {
+        TraceRing *ring;
+        guint n;
+
+        // Rings are only ever added, so the first n_rings stay put
+        g_mutex_lock(&trace_lock);
+        ring = g_ptr_array_index(trace_rings, r);
+        g_mutex_unlock(&trace_lock);
+
+        n = trace_copy_ring(ring, events);
+        for (guint i = 0; i < n; i++) {
+            func(&events[i], data);
+        }
+    }
+    g_free(events);
+}
+
+void trace_clear(void) {
+    g_mutex_lock(&trace_lock);
+    for (guint r = 0; trace_rings && r < trace_rings->len; r++) {
+        TraceRing *ring = g_ptr_array_index(trace_rings, r);
+
+        g_atomic_int_set(&ring->tail, g_atomic_int_get(&ring->head));
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+typedef struct {
+    GArray *phases;         // TracePhase
+    GHashTable *indexes;    // Name -> index + 1 in phases
+} TraceSum;
+
+static void trace_add_phase(const TraceEvent *event, gpointer data) {
+    TraceSum *sum = (TraceSum *)data;
+    guint index = GPOINTER_TO_UINT(g_hash_table_lookup(sum->indexes, event->name));
+    gint64 duration = event->end - event->start;
+    TracePhase *phase;
+
+    if (index == 0) {
+        TracePhase added = { event->name, 0, 0, 0 };
+
+        g_array_append_val(sum->phases, added);
+        index = sum->phases->len;
+        g_hash_table_insert(sum->indexes, (gpointer)event->name, GUINT_TO_POINTER(index));
+    }
+
+    phase = &g_array_index(sum->phases, TracePhase, index - 1);
+    phase->count++;
+    phase->total += duration;
+    phase->max = MAX(phase->max, duration);
+}
+
+static gint trace_compare_phases(gconstpointer a, gconstpointer b) {
+    const TracePhase *pa = a, *pb = b;
+
+    return pa->total < pb->total ? 1 : pa->total > pb->total ? -1 : strcmp(pa->name, pb->name);
+}
+
+GArray *trace_get_phases(void) {
+    // Span names are literals, but the same name may be two literals in
+    // two files, so they are told apart by their text
+    TraceSum sum = { g_array_new(FALSE, FALSE, sizeof(TracePhase)),
+                     g_hash_table_new(g_str_hash, g_str_equal) };
+
+    trace_foreach(trace_add_phase, &sum);
+    g_hash_table_destroy(sum.indexes);
+
+    g_array_sort(sum.phases, trace_compare_phases);
+    return sum.phases;
+}
+
+// Append nanoseconds as microseconds, the unit of the trace format.
+// Written by hand since printf would use the locale's decimal separator.
+static void trace_append_usec(GString *json, gint64 ns) {
+    g_string_append_printf(json, "%" G_GINT64_FORMAT ".%03d", ns / 1000, (gint)(ns % 1000));
+}
+
+static void trace_append_event(const TraceEvent *event, gpointer data) {
+    GString *json = (GString *)data;
+    const gchar *dot = strchr(event->name, '.');
+    gint category = dot ? (gint)(dot - event->name) : (gint)strlen(event->name);
+
+    g_string_append_printf(json, ",\n{\"name\":\"%s\",\"cat\":\"%.*s\",\"ph\":\"X\","
+                           "\"pid\":%d,\"tid\":%u,\"ts\":",
+                           event->name, category, event->name, (gint)getpid(),
+                           event->thread + 1);
+    trace_append_usec(json, MAX(event->start - trace_epoch, 0));
+    g_string_append(json, ",\"dur\":");
+    trace_append_usec(json, event->end - event->start);
+    g_string_append_c(json, '}');
+}
+
+gboolean trace_write_json(const gchar *filename, GError **error) {
+    GString *json = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    gboolean ok;
+
+    // Thread names first, then the spans
+    g_string_append_printf(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                           "\"args\":{\"name\":\"text_editor\"}}", (gint)getpid());
+    g_mutex_lock(&trace_lock);
+    for (guint t = 0; trace_threads && t < trace_threads->len; t++) {
+        gchar *name = g_strescape(g_ptr_array_index(trace_threads, t), NULL);
+
+        g_string_append_printf(json, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                               "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                               (gint)getpid(), t + 1, name);
+        g_free(name);
+    }
+    g_mutex_unlock(&trace_lock);
+
+    trace_foreach(trace_append_event, json);
+    g_string_append(json, "\n]}\n");
+
+    ok = g_file_set_contents(filename, json->str, json->len, error);
+    g_string_free(json, TRUE);
+    return ok;
+}
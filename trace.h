@@ -0,0 +1,92 @@
+/*
+ * Tracing of the hot paths
+ *
+ * A span is a named stretch of time on one thread: reading a file,
+ * inserting a chunk of it into the buffer, a search pass, a frame. Spans
+ * are recorded with monotonic nanosecond timestamps into a ring buffer of
+ * the thread's own, so recording takes no lock and never allocates; a ring
+ * keeps the last TRACE_RING_SIZE spans of its thread. The rings can be
+ * summed up per phase (the span name) for the timings window, or written
+ * out in the Chrome trace event format, which chrome://tracing and
+ * Perfetto (ui.perfetto.dev) open.
+ *
+ * Tracing is off unless the TEXT_EDITOR_TRACE environment variable is set
+ * or it is switched on from the View menu. TEXT_EDITOR_TRACE can also name
+ * the file the trace is written to when the editor exits. While it is off,
+ * a span costs a load and a branch at each end.
+ *
+ * Span names must be string literals (only the pointer is kept), named
+ * "phase.step"; the part before the dot is the trace category.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+#define TRACE_RING_SIZE 8192     // Spans kept per thread, a power of 2
+
+// Total time spent in spans of one name, see trace_get_phases()
+typedef struct {
+    const gchar *name;
+    guint count;
+    gint64 total;           // Nanoseconds
+    gint64 max;
+} TracePhase;
+
+// Whether spans are recorded. Read through trace_is_enabled().
+extern gint trace_enabled;
+
+static inline gboolean trace_is_enabled(void) {
+    return G_UNLIKELY(g_atomic_int_get(&trace_enabled));
+}
+
+// Turn tracing on from the environment. Returns the file to write the
+// trace to at exit, if TEXT_EDITOR_TRACE names one.
+const gchar *trace_init(void);
+
+void trace_set_enabled(gboolean enabled);
+
+// Monotonic time in nanoseconds
+gint64 trace_now(void);
+
+// Record a span that started at start and ends now
+void trace_record(const gchar *name, gint64 start);
+
+// Start of a span, or 0 when tracing is off. A span begun in one callback
+// can be ended in another, as long as both run on the same thread.
+static inline gint64 trace_begin(void) {
+    return trace_is_enabled() ? trace_now() : 0;
+}
+
+static inline void trace_end(const gchar *name, gint64 start) {
+    if (G_UNLIKELY(start != 0)) {
+        trace_record(name, start);
+    }
+}
+
+// A span from here to the end of the enclosing block
+typedef struct {
+    const gchar *name;
+    gint64 start;
+} TraceScope;
+
+static inline void trace_scope_end(TraceScope *scope) {
+    trace_end(scope->name, scope->start);
+}
+
+#define TRACE_SCOPE(name)                                                       \
+    TraceScope G_PASTE(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = \
+        { (name), trace_begin() }
+
+// Forget the spans recorded so far
+void trace_clear(void);
+
+// Sum up the recorded spans by name, most total time first. Free with
+// g_array_unref.
+GArray *trace_get_phases(void);
+
+// Write the recorded spans to filename as Chrome trace event JSON
+gboolean trace_write_json(const gchar *filename, GError **error);
+
+#endif // TRACE_H
@@ -0,0 +1,711 @@
+/*
+ * Undo and redo
+ *
+ * The history is an array of steps, oldest first, each an array of deltas
+ * applied in order. Steps before undo->current have been done and can be
+ * undone; the ones from it on were undone and can be redone until the next
+ * edit drops them. Undoing a step applies the inverse of its deltas in
+ * reverse order.
+ *
+ * Delta texts are carved out of UNDO_CHUNK_SIZE chunks; a chunk is freed
+ * once no delta refers to it any more. A keystroke next to the previous
+ * one extends the text of the last delta in place when that text is the
+ * newest thing in the newest chunk, so a typed run is one delta and one
+ * piece of text.
+ *
+ * Memory is counted as the bytes of chunks plus the delta records. Over
+ * budget, the texts of the oldest steps still in memory are appended to an
+ * unlinked spill file and their chunks released. Texts of UNDO_LARGE_TEXT
+ * bytes or more are written there when recorded; a large deletion is
+ * copied out of the piece table window by window rather than as one slice.
+ * When the live part of the spill file grows past UNDO_DISK_FACTOR times
+ * the budget, the oldest steps are dropped and their range of the file is
+ * punched out.
+ */
+
+#define _GNU_SOURCE
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define UNDO_CHUNK_SIZE    (64 * 1024)
+#define UNDO_LARGE_TEXT    (256 * 1024)            // Texts this big go straight to disk
+#define UNDO_SPILL_WINDOW  (1024 * 1024)           // Bytes copied to disk at a time
+#define UNDO_MERGE_TIMEOUT (G_USEC_PER_SEC)        // Pause that ends a run of keystrokes
+
+typedef enum {
+    UNDO_INSERT,
+    UNDO_DELETE
+} UndoType;
+
+typedef struct {
+    gchar *data;
+    gsize size;
+    gsize used;
+    guint live;                 // Deltas whose text is here
+} UndoChunk;
+
+typedef struct {
+    UndoType type;
+    gboolean spilled;           // Text is in the spill file at spill_offset
+    gsize offset;               // In characters
+    gsize chars;
+    gsize bytes;
+    UndoChunk *chunk;           // Holds text unless spilled
+    gchar *text;
+    guint64 spill_offset;
+} UndoDelta;
+
+typedef struct {
+    GArray *deltas;
+    gboolean typing;            // A run of keystrokes the next one may extend
+    gint64 time;                // Of the last edit added
+} UndoStep;
+
+struct _Undo {
+    GPtrArray *steps;           // Oldest first
+    guint current;              // Steps before it are done, from it on undone
+    guint n_spilled;            // Steps before it have their texts on disk
+    UndoChunk *tail;            // Chunk new text goes to
+    gsize memory;               // Bytes of chunks and deltas
+    gsize budget;
+
+    int spill_fd;               // -1 until first needed
+    guint64 spill_size;         // End of the spill file
+    guint64 spill_used;         // Bytes of it still referred to
+
+    guint depth;                // Nesting of begin-user-action
+    UndoStep *action_step;      // Step the current user action adds to
+    gboolean applying;          // The edits are an undo or redo
+};
+
+static gsize undo_get_budget(void) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_UNDO_BUDGET");
+
+    if (setting && *setting) {
+        return MAX(g_ascii_strtoull(setting, NULL, 10), 4 * UNDO_CHUNK_SIZE);
+    }
+    return UNDO_DEFAULT_BUDGET;
+}
+
+void undo_update_items(TextEditor *editor) {
+    Undo *undo = editor->undo;
+
+    // The menus are filled in after the first frame, see fill_menus()
+    if (!editor->undo_item) {
+        return;
+    }
+
+    gtk_widget_set_sensitive(editor->undo_item, undo->current > 0);
+    gtk_widget_set_sensitive(editor->redo_item, undo->current < undo->steps->len);
+}
+
+// ---- Spill file ----
+
+static gboolean undo_spill_open(Undo *undo) {
+    gchar *dir, *path;
+
+    if (undo->spill_fd >= 0) {
+        return TRUE;
+    }
+
+    dir = g_build_filename(g_get_user_cache_dir(), "text_editor", "undo", NULL);
+    path = g_build_filename(dir, "undo-XXXXXX", NULL);
+    if (g_mkdir_with_parents(dir, 0700) == 0) {
+        undo->spill_fd = g_mkstemp(path);
+    }
+
+    // Unlinked right away, so it goes when the editor does
+    if (undo->spill_fd >= 0) {
+        g_unlink(path);
+    } else {
+        g_warning("Failed to create undo spill file in %s: %s", dir, g_strerror(errno));
+    }
+    g_free(path);
+    g_free(dir);
+    return undo->spill_fd >= 0;
+}
+
+// Append data to the spill file, returning its offset in *offset
+static gboolean undo_spill_write(Undo *undo, const gchar *data, gsize length, guint64 *offset) {
+    guint64 at = undo->spill_size;
+
+    if (!undo_spill_open(undo)) {
+        return FALSE;
+    }
+
+    while (length > 0) {
+        gssize n = pwrite(undo->spill_fd, data, length, (off_t)at);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+        at += n;
+    }
+
+    *offset = undo->spill_size;
+    undo->spill_used += at - undo->spill_size;
+    undo->spill_size = at;
+    return TRUE;
+}
+
+static gboolean undo_spill_read(Undo *undo, guint64 offset, gchar *data, gsize length) {
+    while (length > 0) {
+        gssize n = pread(undo->spill_fd, data, length, (off_t)offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+// Give the disk space of a range no step refers to any more back
+static void undo_spill_release(Undo *undo, guint64 start, guint64 end) {
+    undo->spill_used -= end - start;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (end > start) {
+        fallocate(undo->spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)start, (off_t)(end - start));
+    }
+#endif
+}
+
+// ---- Arena ----
+
+static void undo_chunk_release(Undo *undo, UndoChunk *chunk) {
+    if (--chunk->live == 0 && chunk != undo->tail) {
+        undo->memory -= chunk->size;
+        g_free(chunk->data);
+        g_free(chunk);
+    }
+}
+
+// Room for length bytes of text, in the tail chunk or a new one
+static gchar *undo_arena_alloc(Undo *undo, gsize length, UndoChunk **chunk) {
+    UndoChunk *tail = undo->tail;
+
+    // Nothing refers to the tail any more, so it can start over
+    if (tail && tail->live == 0) {
+        tail->used = 0;
+    }
+
+    if (!tail || tail->size - tail->used < length) {
+        if (tail && tail->live == 0) {
+            undo->memory -= tail->size;
+            g_free(tail->data);
+            g_free(tail);
+        }
+
+        tail = g_new0(UndoChunk, 1);
+        tail->size = MAX(UNDO_CHUNK_SIZE, length);
+        tail->data = g_malloc(tail->size);
+        undo->tail = tail;
+        undo->memory += tail->size;
+    }
+
+    *chunk = tail;
+    tail->live++;
+    tail->used += length;
+    return tail->data + tail->used - length;
+}
+
+// Whether delta's text ends the tail chunk with room for length more bytes
+static gboolean undo_can_extend(Undo *undo, const UndoDelta *delta, gsize length) {
+    UndoChunk *tail = undo->tail;
+
+    return !delta->spilled && delta->chunk == tail &&
+           delta->text + delta->bytes == tail->data + tail->used &&
+           tail->size - tail->used >= length;
+}
+
+// ---- Steps ----
+
+static void undo_step_free(Undo *undo, UndoStep *step) {
+    guint64 start = 0, end = 0;
+
+    // The spilled texts of a step are mostly next to each other in the
+    // file, so they are released as a few ranges
+    for (guint i = 0; i < step->deltas->len; i++) {
+        UndoDelta *delta = &g_array_index(step->deltas, UndoDelta, i);
+
+        if (!delta->spilled) {
+            undo_chunk_release(undo, delta->chunk);
+            continue;
+        }
+        if (delta->spill_offset != end) {
+            undo_spill_release(undo, start, end);
+            start = delta->spill_offset;
+        }
+        end = delta->spill_offset + delta->bytes;
+    }
+    undo_spill_release(undo, start, end);
+
+    undo->memory -= sizeof(UndoStep) + step->deltas->len * sizeof(UndoDelta);
+    g_array_free(step->deltas, TRUE);
+    g_free(step);
+}
+
+// Move the texts of step to the spill file
+static gboolean undo_step_spill(Undo *undo, UndoStep *step) {
+    for (guint i = 0; i < step->deltas->len; i++) {
+        UndoDelta *delta = &g_array_index(step->deltas, UndoDelta, i);
+
+        if (delta->spilled) {
+            continue;
+        }
+        if (!undo_spill_write(undo, delta->text, delta->bytes, &delta->spill_offset)) {
+            return FALSE;
+        }
+        delta->spilled = TRUE;
+        delta->text = NULL;
+        undo_chunk_release(undo, delta->chunk);
+        delta->chunk = NULL;
+    }
+    return TRUE;
+}
+
+// Drop the oldest step, or the newest undone one if nothing is done
+static void undo_drop_step(Undo *undo) {
+    if (undo->current > 0) {
+        undo_step_free(undo, g_ptr_array_index(undo->steps, 0));
+        g_ptr_array_remove_index(undo->steps, 0);
+        undo->current--;
+        if (undo->n_spilled > 0) {
+            undo->n_spilled--;
+        }
+    } else {
+        undo_step_free(undo, g_ptr_array_index(undo->steps, undo->steps->len - 1));
+        g_ptr_array_set_size(undo->steps, undo->steps->len - 1);
+        undo->n_spilled = MIN(undo->n_spilled, undo->steps->len);
+    }
+}
+
+// Keep memory within the budget and the spill file within its share
+static void undo_enforce_budget(Undo *undo) {
+    // The newest step may still be extended, so it stays in memory
+    while (undo->memory > undo->budget && undo->steps->len > 1) {
+        if (undo->n_spilled < undo->steps->len - 1 &&
+            undo_step_spill(undo, g_ptr_array_index(undo->steps, undo->n_spilled))) {
+            undo->n_spilled++;
+        } else {
+            undo_drop_step(undo);
+        }
+    }
+
+    while (undo->spill_used > (guint64)undo->budget * UNDO_DISK_FACTOR && undo->steps->len > 1) {
+        undo_drop_step(undo);
+    }
+}
+
+// Forget the steps that were undone, once something new is done
+static void undo_truncate_redo(Undo *undo) {
+    while (undo->steps->len > undo->current) {
+        undo_step_free(undo, g_ptr_array_index(undo->steps, undo->steps->len - 1));
+        g_ptr_array_set_size(undo->steps, undo->steps->len - 1);
+    }
+    undo->n_spilled = MIN(undo->n_spilled, undo->steps->len);
+}
+
+// A single character typed or removed, which may extend a run
+static gboolean undo_is_keystroke(UndoType type, gsize chars, const gchar *text) {
+    return chars == 1 && (type == UNDO_DELETE || (text && *text != '\n'));
+}
+
+// Try to add a keystroke to the last delta of step, without a new delta
+static gboolean undo_merge(Undo *undo, UndoStep *step, UndoType type, gsize offset,
+                           const gchar *text, gsize bytes) {
+    UndoDelta *last = &g_array_index(step->deltas, UndoDelta, step->deltas->len - 1);
+
+    if (last->type != type || !undo_can_extend(undo, last, bytes)) {
+        return FALSE;
+    }
+
+    if (type == UNDO_INSERT && offset == last->offset + last->chars) {
+        // Typed after the run
+        memcpy(last->text + last->bytes, text, bytes);
+    } else if (type == UNDO_DELETE && offset == last->offset) {
+        // Delete key: the text followed what was deleted before
+        memcpy(last->text + last->bytes, text, bytes);
+    } else if (type == UNDO_DELETE && offset + 1 == last->offset) {
+        // Backspace: the text came before it
+        memmove(last->text + bytes, last->text, last->bytes);
+        memcpy(last->text, text, bytes);
+        last->offset = offset;
+    } else {
+        return FALSE;
+    }
+
+    undo->tail->used += bytes;
+    last->chars++;
+    last->bytes += bytes;
+    return TRUE;
+}
+
+// The step a new delta goes to: the current user action's, the run of
+// keystrokes it continues, or a new one
+static UndoStep *undo_pick_step(Undo *undo, UndoType type, gsize offset, gsize chars,
+                                const gchar *text, gsize bytes, gboolean *merged) {
+    gboolean keystroke = text && undo_is_keystroke(type, chars, text);
+    gint64 now = g_get_monotonic_time();
+    UndoStep *step = NULL;
+
+    *merged = FALSE;
+
+    if (undo->depth > 0 && undo->action_step) {
+        step = undo->action_step;
+        *merged = keystroke && undo_merge(undo, step, type, offset, text, bytes);
+        step->typing = step->typing && *merged;
+    } else if (undo->current > 0 && keystroke) {
+        UndoStep *last = g_ptr_array_index(undo->steps, undo->current - 1);
+
+        if (last->typing && undo->n_spilled < undo->current &&
+            now - last->time < UNDO_MERGE_TIMEOUT &&
+            undo_merge(undo, last, type, offset, text, bytes)) {
+            step = last;
+            *merged = TRUE;
+        }
+    }
+
+    if (!step) {
+        step = g_new0(UndoStep, 1);
+        step->deltas = g_array_new(FALSE, FALSE, sizeof(UndoDelta));
+        step->typing = keystroke;
+        g_ptr_array_add(undo->steps, step);
+        undo->current = undo->steps->len;
+        undo->memory += sizeof(UndoStep);
+    }
+
+    if (undo->depth > 0) {
+        undo->action_step = step;
+    }
+    step->time = now;
+    return step;
+}
+
+// Record a delta. text is NULL for a large deletion, whose text is copied
+// from snapshot starting at byte_offset instead.
+static void undo_record(TextEditor *editor, UndoType type, gsize offset, gsize chars,
+                        const gchar *text, gsize bytes, PieceSnapshot *snapshot,
+                        gsize byte_offset) {
+    Undo *undo = editor->undo;
+    UndoDelta delta = { 0 };
+    UndoStep *step;
+    gboolean merged;
+
+    if (!undo || undo->applying || editor->follow || chars == 0) {
+        return;
+    }
+
+    undo_truncate_redo(undo);
+    step = undo_pick_step(undo, type, offset, chars, text, bytes, &merged);
+    if (merged) {
+        undo_enforce_budget(undo);
+        undo_update_items(editor);
+        return;
+    }
+
+    delta.type = type;
+    delta.offset = offset;
+    delta.chars = chars;
+    delta.bytes = bytes;
+
+    if (bytes >= UNDO_LARGE_TEXT) {
+        gboolean ok = TRUE;
+        gchar *window = NULL;
+
+        delta.spilled = TRUE;
+        if (text) {
+            ok = undo_spill_write(undo, text, bytes, &delta.spill_offset);
+        } else {
+            for (gsize done = 0; ok && done < bytes; done += UNDO_SPILL_WINDOW) {
+                gsize length = MIN(UNDO_SPILL_WINDOW, bytes - done);
+                const gchar *span = piece_snapshot_get_span(snapshot, byte_offset + done, length);
+                guint64 at;
+
+                if (!span) {
+                    window = window ? window : g_malloc(UNDO_SPILL_WINDOW);
+                    piece_snapshot_copy(snapshot, byte_offset + done, length, window);
+                    span = window;
+                }
+                ok = undo_spill_write(undo, span, length, &at);
+                if (done == 0) {
+                    delta.spill_offset = at;
+                }
+            }
+            g_free(window);
+        }
+
+        if (!ok) {
+            undo_clear(editor);
+            editor_set_status(editor, "The edit is too large to be undone");
+            return;
+        }
+    } else {
+        delta.text = undo_arena_alloc(undo, bytes, &delta.chunk);
+        if (text) {
+            memcpy(delta.text, text, bytes);
+        } else {
+            piece_snapshot_copy(snapshot, byte_offset, bytes, delta.text);
+        }
+    }
+
+    g_array_append_val(step->deltas, delta);
+    undo->memory += sizeof(UndoDelta);
+    undo_enforce_budget(undo);
+    undo_update_items(editor);
+}
+
+void undo_record_insert(TextEditor *editor, const GtkTextIter *location,
+                        const gchar *text, gsize length) {
+    undo_record(editor, UNDO_INSERT, gtk_text_iter_get_offset(location),
+                g_utf8_strlen(text, length), text, length, NULL, 0);
+}
+
+void undo_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end) {
+    gsize from = gtk_text_iter_get_offset(start);
+    gsize to = gtk_text_iter_get_offset(end);
+    PieceSnapshot *snapshot;
+    gsize first, last;
+
+    if (!editor->undo || editor->undo->applying || editor->follow || to == from) {
+        return;
+    }
+
+    // A small deletion is copied from the buffer, a large one is read from
+    // the document in windows instead of as one slice
+    if (to - from < UNDO_LARGE_TEXT / 4) {
+        gchar *text = gtk_text_iter_get_slice(start, end);
+
+        undo_record(editor, UNDO_DELETE, from, to - from, text, strlen(text), NULL, 0);
+        g_free(text);
+        return;
+    }
+
+    snapshot = piece_table_snapshot(editor->document);
+    first = piece_snapshot_char_to_byte(snapshot, from);
+    last = piece_snapshot_char_to_byte(snapshot, to);
+    undo_record(editor, UNDO_DELETE, from, to - from, NULL, last - first, snapshot, first);
+    piece_snapshot_unref(snapshot);
+}
+
+// ---- Undo and redo ----
+
+// Insert the text of delta at its offset
+static gboolean undo_insert_text(TextEditor *editor, const UndoDelta *delta) {
+    Undo *undo = editor->undo;
+    gchar *copy = NULL;
+    const gchar *text = delta->text;
+    GtkTextIter iter;
+
+    if (delta->spilled) {
+        copy = g_malloc(delta->bytes);
+        if (!undo_spill_read(undo, delta->spill_offset, copy, delta->bytes)) {
+            g_free(copy);
+            return FALSE;
+        }
+        text = copy;
+    }
+
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &iter, (gint)delta->offset);
+    gtk_text_buffer_insert(editor->text_buffer, &iter, text, delta->bytes);
+    g_free(copy);
+    return TRUE;
+}
+
+static void undo_delete_text(TextEditor *editor, const UndoDelta *delta) {
+    GtkTextIter start, end;
+
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &start, (gint)delta->offset);
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &end,
+                                       (gint)(delta->offset + delta->chars));
+    gtk_text_buffer_delete(editor->text_buffer, &start, &end);
+}
+
+// Apply step forwards (redo) or its inverse backwards (undo), leaving the
+// cursor where the last change was made
+static void undo_apply(TextEditor *editor, UndoStep *step, gboolean forward) {
+    Undo *undo = editor->undo;
+    gsize cursor = 0;
+    GtkTextIter iter;
+    gboolean ok = TRUE;
+
+    undo->applying = TRUE;
+    for (guint k = 0; ok && k < step->deltas->len; k++) {
+        guint i = forward ? k : step->deltas->len - 1 - k;
+        const UndoDelta *delta = &g_array_index(step->deltas, UndoDelta, i);
+
+        if ((delta->type == UNDO_INSERT) == forward) {
+            ok = undo_insert_text(editor, delta);
+            cursor = delta->offset + delta->chars;
+        } else {
+            undo_delete_text(editor, delta);
+            cursor = delta->offset;
+        }
+    }
+    undo->applying = FALSE;
+
+    if (!ok) {
+        undo_clear(editor);
+        editor_show_error(editor, "Failed to read the undo history back from disk");
+        return;
+    }
+
+    gtk_text_buffer_get_iter_at_offset(editor->text_buffer, &iter, (gint)cursor);
+    gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
+    gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(editor->text_view),
+                                       gtk_text_buffer_get_insert(editor->text_buffer));
+}
+
+// Whether the document can be changed at all
+static gboolean undo_is_available(TextEditor *editor) {
+    return editor->undo && !editor->loader && !editor->viewport && !editor->follow &&
+           editor->undo->depth == 0;
+}
+
+void undo_undo(TextEditor *editor) {
+    Undo *undo = editor->undo;
+    UndoStep *step;
+
+    if (!undo_is_available(editor) || undo->current == 0) {
+        return;
+    }
+
+    step = g_ptr_array_index(undo->steps, --undo->current);
+    step->typing = FALSE;
+    undo_apply(editor, step, FALSE);
+    undo_update_items(editor);
+}
+
+void undo_redo(TextEditor *editor) {
+    Undo *undo = editor->undo;
+    UndoStep *step;
+
+    if (!undo_is_available(editor) || undo->current == undo->steps->len) {
+        return;
+    }
+
+    step = g_ptr_array_index(undo->steps, undo->current++);
+    undo_apply(editor, step, TRUE);
+    undo_update_items(editor);
+}
+
+// ---- User actions ----
+
+static void on_begin_user_action(GtkTextBuffer *buffer, gpointer data) {
+    Undo *undo = ((TextEditor *)data)->undo;
+
+    if (undo->depth++ == 0) {
+        undo->action_step = NULL;
+    }
+}
+
+static void on_end_user_action(GtkTextBuffer *buffer, gpointer data) {
+    Undo *undo = ((TextEditor *)data)->undo;
+
+    if (undo->depth > 0 && --undo->depth == 0) {
+        undo->action_step = NULL;
+    }
+}
+
+// ---- Setup ----
+
+void undo_init(TextEditor *editor) {
+    Undo *undo = g_new0(Undo, 1);
+
+    undo->steps = g_ptr_array_new();
+    undo->budget = undo_get_budget();
+    undo->spill_fd = -1;
+    editor->undo = undo;
+    undo_update_items(editor);
+}
+
+void undo_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer) {
+    g_signal_connect(buffer, "begin-user-action", G_CALLBACK(on_begin_user_action), editor);
+    g_signal_connect(buffer, "end-user-action", G_CALLBACK(on_end_user_action), editor);
+}
+
+void undo_clear(TextEditor *editor) {
+    Undo *undo = editor->undo;
+
+    if (!undo) {
+        return;
+    }
+
+    // Dropped oldest first, as they were all done
+    undo->current = undo->steps->len;
+    while (undo->steps->len > 0) {
+        undo_drop_step(undo);
+    }
+    undo->n_spilled = 0;
+    undo->action_step = NULL;
+
+    if (undo->tail && undo->tail->live == 0) {
+        undo->memory -= undo->tail->size;
+        g_free(undo->tail->data);
+        g_free(undo->tail);
+        undo->tail = NULL;
+    }
+    if (undo->spill_fd >= 0 && ftruncate(undo->spill_fd, 0) == 0) {
+        undo->spill_size = 0;
+    }
+
+    undo_update_items(editor);
+}
+
+void undo_spill(TextEditor *editor) {
+    Undo *undo = editor->undo;
+
+    if (!undo) {
+        return;
+    }
+
+    // Spilled steps can't be extended, so the next edit starts a new one
+    while (undo->n_spilled < undo->steps->len &&
+           undo_step_spill(undo, g_ptr_array_index(undo->steps, undo->n_spilled))) {
+        undo->n_spilled++;
+    }
+
+    if (undo->tail && undo->tail->live == 0) {
+        undo->memory -= undo->tail->size;
+        g_free(undo->tail->data);
+        g_free(undo->tail);
+        undo->tail = NULL;
+    }
+}
+
+gsize undo_get_memory(TextEditor *editor) {
+    return editor->undo ? editor->undo->memory : 0;
+}
+
+void undo_cleanup(TextEditor *editor) {
+    Undo *undo = editor->undo;
+
+    if (!undo) {
+        return;
+    }
+
+    undo_clear(editor);
+    if (undo->spill_fd >= 0) {
+        close(undo->spill_fd);
+    }
+    g_ptr_array_free(undo->steps, TRUE);
+    g_free(undo);
+    editor->undo = NULL;
+}
@@ -0,0 +1,61 @@
+/*
+ * Undo and redo
+ *
+ * Every insertion and deletion made to the document is recorded as a
+ * delta (where, how many characters and the text involved), and the
+ * deltas are grouped into steps: everything done inside one user action,
+ * such as a paste or a Replace All, is a single step, and consecutive
+ * keystrokes at adjacent positions are merged into one run. The texts
+ * live in an arena of large chunks, not one allocation per edit.
+ *
+ * History is bounded by a memory budget in bytes rather than a number of
+ * levels. Once over it, the texts of the oldest steps are moved to a spill
+ * file in the user's cache directory, and large texts go there straight
+ * away, so pasting or replacing a big document doesn't double the memory
+ * it takes. The spill file is in turn bounded, by dropping the oldest
+ * steps for good.
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "editor.h"
+
+// Memory budget for the history in bytes. Can be overridden with the
+// TEXT_EDITOR_UNDO_BUDGET environment variable; up to UNDO_DISK_FACTOR
+// times as much is kept on disk.
+#define UNDO_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define UNDO_DISK_FACTOR    16
+
+// Start an empty history for the current document. Every document (tab)
+// has a history of its own.
+void undo_init(TextEditor *editor);
+
+// Group the edits made in a user action on buffer into one step. Called
+// once for every document buffer.
+void undo_connect_buffer(TextEditor *editor, GtkTextBuffer *buffer);
+
+// Record edits about to be made to the buffer, from the insert-text and
+// delete-range handlers, before the document is changed
+void undo_record_insert(TextEditor *editor, const GtkTextIter *location,
+                        const gchar *text, gsize length);
+void undo_record_delete(TextEditor *editor, const GtkTextIter *start, const GtkTextIter *end);
+
+// Undo the last step, or redo the last one undone
+void undo_undo(TextEditor *editor);
+void undo_redo(TextEditor *editor);
+
+// Make Edit > Undo and Redo sensitive according to the current history
+void undo_update_items(TextEditor *editor);
+
+// Forget the history, when another document replaces the current one
+void undo_clear(TextEditor *editor);
+
+// Move all the texts of the history to the spill file, for a document put
+// away, and report the memory the history takes
+void undo_spill(TextEditor *editor);
+gsize undo_get_memory(TextEditor *editor);
+
+void undo_cleanup(TextEditor *editor);
+
+#endif // UNDO_H
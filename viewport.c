@@ -0,0 +1,497 @@
+/*
+ * Large-file viewport mode
+ *
+ * The buffer holds a window of lines, starting at first_line, made of the
+ * visible lines plus VIEWPORT_MARGIN_LINES on either side. Scrolling within
+ * the window is plain text view scrolling; once the top of the view comes
+ * within half a margin of either edge the window is rebuilt around it.
+ * Jumps with the external scrollbar rebuild the window directly. Memory
+ * use is the line index (one offset per LINE_INDEX_STRIDE lines) plus the
+ * window, whatever the file size.
+ */
+
+#include "viewport.h"
+#include "line_index.h"
+#include "loader.h"
+#include "journal.h"
+#include "status.h"
+#include "undo.h"
+#include "highlight.h"
+#include "session.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define VIEWPORT_MARGIN_LINES     200                // Lines kept above and below the view
+#define VIEWPORT_MAX_WINDOW_BYTES (4 * 1024 * 1024)  // Cap for windows of very long lines
+#define VIEWPORT_INDEX_STEP       (8 * 1024 * 1024)  // Bytes indexed between progress updates
+#define VIEWPORT_PROGRESS_INTERVAL 100               // Milliseconds between progress updates
+
+struct _Viewport {
+    gint ref_count;
+    TextEditor *editor;         // Main thread only, NULL once closed
+    gchar *filename;
+    GMappedFile *mapping;
+    const gchar *contents;
+    gsize length;
+    LineIndex *index;
+    gint cancelled;             // Atomic
+
+    // Protected by lock while indexing
+    GMutex lock;
+    gsize bytes_indexed;
+    gboolean indexed;
+
+    // Main thread only, once indexed
+    guint progress_id;
+    guint rebuild_id;
+    gsize first_line;           // File line at the top of the buffer
+    gsize n_window_lines;       // Lines in the buffer
+    gboolean updating;          // Set while the view is moved programmatically
+    GtkTextMark *top_mark;
+    GtkAdjustment *adjustment;  // External scrollbar, in lines
+    GtkAdjustment *view_adjustment;
+    gulong adjustment_handler;
+    gulong view_adjustment_handler;
+};
+
+static Viewport *viewport_ref(Viewport *viewport) {
+    g_atomic_int_inc(&viewport->ref_count);
+    return viewport;
+}
+
+static void viewport_unref(gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+
+    if (!g_atomic_int_dec_and_test(&viewport->ref_count)) {
+        return;
+    }
+
+    line_index_free(viewport->index);
+    g_mapped_file_unref(viewport->mapping);
+    g_mutex_clear(&viewport->lock);
+    g_free(viewport->filename);
+    g_free(viewport);
+}
+
+gboolean viewport_should_open(const gchar *filename) {
+    const gchar *setting = g_getenv("TEXT_EDITOR_LARGE_FILE_THRESHOLD");
+    guint64 threshold = VIEWPORT_DEFAULT_THRESHOLD;
+    struct stat st;
+
+    if (setting && *setting) {
+        threshold = g_ascii_strtoull(setting, NULL, 10);
+    }
+
+    // Compressed files can't be shown from a mapping; they are streamed in
+    return stat(filename, &st) == 0 && S_ISREG(st.st_mode) && (guint64)st.st_size >= threshold &&
+           compression_detect_file(filename) == COMPRESSION_NONE;
+}
+
+// Worker thread: build the line index
+static gpointer viewport_worker(gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+    gsize indexed = 0;
+
+    while (!line_index_is_complete(viewport->index) && !g_atomic_int_get(&viewport->cancelled)) {
+        indexed = line_index_scan(viewport->index, VIEWPORT_INDEX_STEP);
+
+        g_mutex_lock(&viewport->lock);
+        viewport->bytes_indexed = indexed;
+        g_mutex_unlock(&viewport->lock);
+    }
+
+    g_mutex_lock(&viewport->lock);
+    viewport->indexed = TRUE;
+    g_mutex_unlock(&viewport->lock);
+
+    viewport_unref(viewport);
+    return NULL;
+}
+
+// Number of buffer lines that fit in the text view
+static gsize viewport_visible_lines(Viewport *viewport) {
+    GtkTextView *view = GTK_TEXT_VIEW(viewport->editor->text_view);
+    GtkTextIter start;
+    gint y, line_height;
+    gint height = gtk_widget_get_allocated_height(viewport->editor->text_view);
+
+    gtk_text_buffer_get_start_iter(viewport->editor->text_buffer, &start);
+    gtk_text_view_get_line_yrange(view, &start, &y, &line_height);
+    if (line_height <= 0) {
+        line_height = 16;
+    }
+
+    return MAX(1, height / line_height);
+}
+
+// Put the lines around top_line in the buffer and show top_line at the top
+static void viewport_show_line(Viewport *viewport, gsize top_line) {
+    TextEditor *editor = viewport->editor;
+    gsize n_lines = line_index_get_line_count(viewport->index);
+    gsize visible = viewport_visible_lines(viewport);
+    gsize first, last, start, end;
+    GtkTextIter iter;
+    gchar *valid = NULL;
+
+    top_line = MIN(top_line, n_lines - 1);
+    first = top_line > VIEWPORT_MARGIN_LINES ? top_line - VIEWPORT_MARGIN_LINES : 0;
+    last = MIN(n_lines, top_line + visible + VIEWPORT_MARGIN_LINES);
+
+    start = line_index_get_line_offset(viewport->index, first);
+    end = line_index_get_line_offset(viewport->index, last);
+
+    // Leave out the newline ending the window, it would add an empty line
+    if (last < n_lines && end > start) {
+        end--;
+    }
+
+    // A window of a few enormous lines is cut short on a character boundary
+    if (end - start > VIEWPORT_MAX_WINDOW_BYTES) {
+        const gchar *cut = g_utf8_find_prev_char(viewport->contents + start,
+                                                 viewport->contents + start + VIEWPORT_MAX_WINDOW_BYTES + 1);
+        end = cut ? (gsize)(cut - viewport->contents) : start;
+    }
+
+    if (!g_utf8_validate(viewport->contents + start, end - start, NULL)) {
+        valid = g_utf8_make_valid(viewport->contents + start, end - start);
+    }
+
+    viewport->updating = TRUE;
+
+    if (valid) {
+        gtk_text_buffer_set_text(editor->text_buffer, valid, -1);
+    } else {
+        gtk_text_buffer_set_text(editor->text_buffer, viewport->contents + start, end - start);
+    }
+    viewport->first_line = first;
+    viewport->n_window_lines = gtk_text_buffer_get_line_count(editor->text_buffer);
+
+    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &iter, top_line - first);
+    gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
+    gtk_text_buffer_move_mark(editor->text_buffer, viewport->top_mark, &iter);
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(editor->text_view), viewport->top_mark, 0.0, TRUE, 0.0, 0.0);
+
+    gtk_adjustment_set_page_size(viewport->adjustment, visible);
+    gtk_adjustment_set_page_increment(viewport->adjustment, visible);
+    gtk_adjustment_set_value(viewport->adjustment, top_line);
+
+    viewport->updating = FALSE;
+    g_free(valid);
+}
+
+// Whether top_line can be shown without rebuilding the window
+static gboolean viewport_in_window(Viewport *viewport, gsize top_line) {
+    gsize n_lines = line_index_get_line_count(viewport->index);
+    gsize window_end = viewport->first_line + viewport->n_window_lines;
+    gsize visible = viewport_visible_lines(viewport);
+    gsize slack = VIEWPORT_MARGIN_LINES / 2;
+
+    if (top_line < viewport->first_line || top_line + visible > window_end) {
+        return FALSE;
+    }
+    if (viewport->first_line > 0 && top_line - viewport->first_line < slack) {
+        return FALSE;
+    }
+    if (window_end < n_lines && window_end - (top_line + visible) < slack) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Rebuild the window around the line at the top of the view
+static gboolean viewport_rebuild_idle(gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+
+    viewport->rebuild_id = 0;
+    if (viewport->editor) {
+        viewport_show_line(viewport, (gsize)gtk_adjustment_get_value(viewport->adjustment));
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// External scrollbar moved: scroll within the window or rebuild it
+static void on_viewport_scrolled(GtkAdjustment *adjustment, gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+    gsize top_line = (gsize)gtk_adjustment_get_value(adjustment);
+
+    if (viewport->updating) {
+        return;
+    }
+
+    if (viewport_in_window(viewport, top_line)) {
+        GtkTextIter iter;
+
+        viewport->updating = TRUE;
+        gtk_text_buffer_get_iter_at_line(viewport->editor->text_buffer, &iter,
+                                         top_line - viewport->first_line);
+        gtk_text_buffer_move_mark(viewport->editor->text_buffer, viewport->top_mark, &iter);
+        gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(viewport->editor->text_view),
+                                     viewport->top_mark, 0.0, TRUE, 0.0, 0.0);
+        viewport->updating = FALSE;
+    } else {
+        viewport_show_line(viewport, top_line);
+    }
+}
+
+// Text view scrolled (wheel, keyboard): follow with the external scrollbar
+// and rebuild the window when getting close to its edges
+static void on_view_scrolled(GtkAdjustment *adjustment, gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+    GtkTextIter iter;
+    gsize top_line;
+
+    if (viewport->updating) {
+        return;
+    }
+
+    gtk_text_view_get_line_at_y(GTK_TEXT_VIEW(viewport->editor->text_view), &iter,
+                                (gint)gtk_adjustment_get_value(adjustment), NULL);
+    top_line = viewport->first_line + gtk_text_iter_get_line(&iter);
+
+    viewport->updating = TRUE;
+    gtk_adjustment_set_value(viewport->adjustment, top_line);
+    viewport->updating = FALSE;
+
+    if (!viewport_in_window(viewport, top_line) && viewport->rebuild_id == 0) {
+        viewport->rebuild_id = g_idle_add(viewport_rebuild_idle, viewport);
+    }
+}
+
+// Indexing finished: switch the view over to the window
+static void viewport_index_done(Viewport *viewport) {
+    TextEditor *editor = viewport->editor;
+    gsize n_lines = line_index_get_line_count(viewport->index);
+    gchar *basename = g_path_get_basename(viewport->filename);
+    gchar *status = g_strdup_printf("Opened %s read-only (%" G_GSIZE_FORMAT " lines, large-file mode)",
+                                    basename, n_lines);
+
+    gtk_widget_hide(editor->progress_bar);
+    gtk_widget_hide(editor->cancel_button);
+    status_update(editor, STATUS_COUNTS);
+
+    viewport->top_mark = gtk_text_buffer_create_mark(editor->text_buffer, NULL, NULL, TRUE);
+    viewport->adjustment = gtk_range_get_adjustment(GTK_RANGE(editor->viewport_scrollbar));
+    gtk_adjustment_configure(viewport->adjustment, 0.0, 0.0, n_lines, 1.0, 1.0, 1.0);
+    viewport->adjustment_handler = g_signal_connect(viewport->adjustment, "value-changed",
+                                                    G_CALLBACK(on_viewport_scrolled), viewport);
+
+    viewport->view_adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(editor->text_view));
+    viewport->view_adjustment_handler = g_signal_connect(viewport->view_adjustment, "value-changed",
+                                                         G_CALLBACK(on_view_scrolled), viewport);
+
+    // The text view still scrolls, but only the external scrollbar is shown
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(editor->scrolled_window),
+                                   GTK_POLICY_AUTOMATIC, GTK_POLICY_EXTERNAL);
+    gtk_widget_show(editor->viewport_scrollbar);
+
+    // The line asked for goes at the top, unless a position from the last
+    // session says which line was there
+    if (editor->pending_top > 0) {
+        viewport_show_line(viewport, editor->pending_top - 1);
+    } else {
+        viewport_show_line(viewport, editor->pending_line > 0 ? editor->pending_line - 1 : 0);
+    }
+    editor->pending_line = 0;
+    editor->pending_column = 0;
+    editor->pending_top = 0;
+    editor_set_status(editor, status);
+
+    g_free(status);
+    g_free(basename);
+}
+
+// Progress timer while the worker indexes the file
+static gboolean viewport_progress_tick(gpointer data) {
+    Viewport *viewport = (Viewport *)data;
+    TextEditor *editor = viewport->editor;
+    gsize indexed;
+    gboolean done;
+    gdouble fraction;
+    gchar *text;
+
+    g_mutex_lock(&viewport->lock);
+    indexed = viewport->bytes_indexed;
+    done = viewport->indexed;
+    g_mutex_unlock(&viewport->lock);
+
+    if (done) {
+        viewport->progress_id = 0;
+        viewport_index_done(viewport);
+        return G_SOURCE_REMOVE;
+    }
+
+    fraction = viewport->length > 0 ? (gdouble)indexed / (gdouble)viewport->length : 1.0;
+    text = g_strdup_printf("%d%%", (gint)(fraction * 100.0));
+    status_set_progress(editor, fraction, text);
+    g_free(text);
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean viewport_open(TextEditor *editor, const gchar *filename, GError **error) {
+    GMappedFile *mapping;
+    Viewport *viewport;
+    gchar *basename, *status;
+
+    mapping = g_mapped_file_new(filename, FALSE, error);
+    if (!mapping) {
+        return FALSE;
+    }
+
+    file_loader_cancel(editor);
+    viewport_close(editor);
+    journal_close(editor, TRUE);
+
+    viewport = g_new0(Viewport, 1);
+    viewport->ref_count = 1;
+    viewport->editor = editor;
+    viewport->filename = g_strdup(filename);
+    viewport->mapping = mapping;
+    viewport->contents = g_mapped_file_get_contents(mapping);
+    viewport->length = g_mapped_file_get_length(mapping);
+    g_mutex_init(&viewport->lock);
+
+    // An index saved with the last session spares the scan
+    viewport->index = session_get_line_index(editor, filename, viewport->contents,
+                                             viewport->length);
+    if (viewport->index) {
+        viewport->bytes_indexed = viewport->length;
+        viewport->indexed = TRUE;
+    } else {
+        viewport->index = line_index_new(viewport->contents, viewport->length);
+    }
+
+    // Attached first, so clearing the buffer isn't mirrored as an edit
+    editor->viewport = viewport;
+    gtk_text_buffer_set_text(editor->text_buffer, "", -1);
+    piece_table_clear(editor->document);
+    line_table_clear(editor->lines);
+    undo_clear(editor);
+    highlight_reset(editor);
+    editor->n_words = 0;
+    status_update(editor, STATUS_POSITION | STATUS_COUNTS);
+
+    g_free(editor->current_filename);
+    editor->current_filename = g_strdup(filename);
+    editor->follow_dropped = 0;
+    editor->follow_dropped_lines = 0;
+    editor->modified = FALSE;
+    editor_update_title(editor);
+
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+    status_set_progress(editor, 0.0, "0%");
+    gtk_widget_show(editor->progress_bar);
+    gtk_widget_show(editor->cancel_button);
+
+    basename = g_path_get_basename(filename);
+    status = g_strdup_printf("Indexing %s...", basename);
+    editor_set_status(editor, status);
+    g_free(status);
+    g_free(basename);
+
+    if (viewport->indexed) {
+        viewport->progress_id = g_idle_add(viewport_progress_tick, viewport);
+    } else {
+        viewport->progress_id = g_timeout_add(VIEWPORT_PROGRESS_INTERVAL, viewport_progress_tick,
+                                              viewport);
+        g_thread_unref(g_thread_new("viewport-index", viewport_worker, viewport_ref(viewport)));
+    }
+
+    return TRUE;
+}
+
+void viewport_close(TextEditor *editor) {
+    Viewport *viewport = editor->viewport;
+
+    if (!viewport) {
+        return;
+    }
+
+    g_atomic_int_set(&viewport->cancelled, TRUE);
+
+    if (viewport->progress_id) {
+        g_source_remove(viewport->progress_id);
+    }
+    if (viewport->rebuild_id) {
+        g_source_remove(viewport->rebuild_id);
+    }
+    if (viewport->adjustment_handler) {
+        g_signal_handler_disconnect(viewport->adjustment, viewport->adjustment_handler);
+    }
+    if (viewport->view_adjustment_handler) {
+        g_signal_handler_disconnect(viewport->view_adjustment, viewport->view_adjustment_handler);
+    }
+
+    // Cleared while still attached so the change isn't mirrored
+    gtk_text_buffer_set_text(editor->text_buffer, "", -1);
+    if (viewport->top_mark) {
+        gtk_text_buffer_delete_mark(editor->text_buffer, viewport->top_mark);
+    }
+
+    gtk_widget_hide(editor->viewport_scrollbar);
+    gtk_widget_hide(editor->progress_bar);
+    gtk_widget_hide(editor->cancel_button);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(editor->scrolled_window),
+                                   GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), TRUE);
+
+    g_free(editor->current_filename);
+    editor->current_filename = NULL;
+    editor->encoding = (Encoding){ ENCODING_UTF8, FALSE, FALSE };
+    editor->compression = COMPRESSION_NONE;
+    editor->follow_dropped = 0;
+    editor->follow_dropped_lines = 0;
+    editor->modified = FALSE;
+    editor_update_title(editor);
+    status_update(editor, STATUS_POSITION | STATUS_COUNTS);
+
+    editor->viewport = NULL;
+    viewport->editor = NULL;
+    viewport_unref(viewport);
+    highlight_reset(editor);
+}
+
+gsize viewport_get_line_count(TextEditor *editor) {
+    Viewport *viewport = editor->viewport;
+
+    if (!viewport || !viewport->adjustment) {
+        return 0;
+    }
+    return line_index_get_line_count(viewport->index);
+}
+
+void viewport_goto_line(TextEditor *editor, gsize line) {
+    Viewport *viewport = editor->viewport;
+
+    if (viewport && viewport->adjustment) {
+        viewport_show_line(viewport, line);
+    }
+}
+
+gsize viewport_get_top_line(TextEditor *editor) {
+    Viewport *viewport = editor->viewport;
+
+    if (!viewport || !viewport->adjustment) {
+        return 0;
+    }
+    return (gsize)gtk_adjustment_get_value(viewport->adjustment);
+}
+
+gsize viewport_get_first_line(TextEditor *editor) {
+    return editor->viewport ? editor->viewport->first_line : 0;
+}
+
+LineIndex *viewport_get_line_index(TextEditor *editor, const gchar **contents, gsize *length) {
+    Viewport *viewport = editor->viewport;
+
+    // Complete once the view has switched over to the window
+    if (!viewport || !viewport->adjustment) {
+        return NULL;
+    }
+
+    *contents = viewport->contents;
+    *length = viewport->length;
+    return viewport->index;
+}
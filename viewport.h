@@ -0,0 +1,46 @@
+/*
+ * Large-file viewport mode
+ *
+ * Files above a size threshold are not copied into the GtkTextBuffer.
+ * Instead the file is memory-mapped, a sparse line index is built on a
+ * worker thread, and only the lines around the visible area are placed in
+ * the buffer. A separate scrollbar spans the whole file and maps its
+ * position to a line. The document is read-only in this mode.
+ */
+
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include "editor.h"
+#include "line_index.h"
+
+// Files at least this large open in viewport mode. Can be overridden in
+// bytes with the TEXT_EDITOR_LARGE_FILE_THRESHOLD environment variable.
+#define VIEWPORT_DEFAULT_THRESHOLD (256 * 1024 * 1024)
+
+// Whether filename is large enough to be opened in viewport mode
+gboolean viewport_should_open(const gchar *filename);
+
+// Show filename in viewport mode, replacing the current document
+gboolean viewport_open(TextEditor *editor, const gchar *filename, GError **error);
+
+// Number of lines in the file, 0 until it has been indexed
+gsize viewport_get_line_count(TextEditor *editor);
+
+// Scroll so that line (from 0) is at the top of the view
+void viewport_goto_line(TextEditor *editor, gsize line);
+
+// Line (from 0) at the top of the view, 0 until the file has been indexed
+gsize viewport_get_top_line(TextEditor *editor);
+
+// File line (from 0) of the first line in the buffer
+gsize viewport_get_first_line(TextEditor *editor);
+
+// The complete line index of the file, and the mapped file it indexes, or
+// NULL while it is being built
+LineIndex *viewport_get_line_index(TextEditor *editor, const gchar **contents, gsize *length);
+
+// Leave viewport mode, or stop indexing, and clear the buffer
+void viewport_close(TextEditor *editor);
+
+#endif // VIEWPORT_H